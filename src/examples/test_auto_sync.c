@@ -0,0 +1,300 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test automatic reads and writes with the auto_sync_read_ms and
+ * auto_sync_write_ms attributes.
+ *
+ * A tag that is read every READ_PERIOD_MS must get about the right
+ * number of read callbacks in RUN_TIME_MS without the application
+ * calling plc_tag_read(), and a value written through another handle
+ * must show up in its data.
+ *
+ * Several sets on a tag with auto_sync_write_ms must be written with a
+ * single write, and an explicit write must cancel the pending one.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=TestBigArray&allow_packing=0"
+#define DATA_TIMEOUT 5000
+
+#define READ_PERIOD_MS (50)
+#define RUN_TIME_MS (1000)
+#define WRITE_DELAY_MS (50)
+#define NUM_SETS (5)
+
+
+static pthread_mutex_t counts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int reads_completed = 0;
+static int reads_failed = 0;
+static int writes_completed = 0;
+static int writes_failed = 0;
+
+
+static int test_auto_read(void);
+static int test_auto_write(void);
+static void tag_callback(int32_t tag_id, int event, int status);
+static int get_count(int *count);
+
+
+
+int main()
+{
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    if(test_auto_read() != PLCTAG_STATUS_OK || test_auto_write() != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+/* the library reads the tag on its own and picks up new values. */
+int test_auto_read(void)
+{
+    char tag_path[256];
+    int32_t reader = 0;
+    int32_t writer = 0;
+    int32_t val = 0;
+    int reads = 0;
+    int64_t timeout_time = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing automatic reads every %dms.\n", READ_PERIOD_MS);
+
+    snprintf_platform(tag_path, sizeof(tag_path), "%s&auto_sync_read_ms=%d", TAG_PATH, READ_PERIOD_MS);
+
+    writer = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+    if(writer < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(writer));
+        return writer;
+    }
+
+    reader = plc_tag_create(tag_path, DATA_TIMEOUT);
+    if(reader < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(reader));
+        plc_tag_destroy(writer);
+        return reader;
+    }
+
+    plc_tag_register_callback(reader, tag_callback);
+
+    util_sleep_ms(RUN_TIME_MS);
+
+    reads = get_count(&reads_completed);
+
+    /* allow for scheduling jitter, but not for missing most of the reads. */
+    if(reads < (RUN_TIME_MS / READ_PERIOD_MS) / 2 || reads > (RUN_TIME_MS / READ_PERIOD_MS) + 2 || get_count(&reads_failed)) {
+        printf("ERROR: Got %d reads with %d failures in %dms, expected about %d!\n", reads, get_count(&reads_failed), RUN_TIME_MS, RUN_TIME_MS / READ_PERIOD_MS);
+        rc = PLCTAG_ERR_BAD_STATUS;
+    } else {
+        printf("\t%d automatic reads in %dms.\n", reads, RUN_TIME_MS);
+    }
+
+    /* change the value through the other handle and wait for it to be read. */
+    if(rc == PLCTAG_STATUS_OK) {
+        val = plc_tag_get_int32(reader, 0) + 1;
+
+        plc_tag_set_int32(writer, 0, val);
+        rc = plc_tag_write(writer, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to write the new value! Got error %s.\n", plc_tag_decode_error(rc));
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        timeout_time = util_time_ms() + (READ_PERIOD_MS * 10);
+
+        while(plc_tag_get_int32(reader, 0) != val && util_time_ms() < timeout_time) {
+            util_sleep_ms(1);
+        }
+
+        if(plc_tag_get_int32(reader, 0) != val) {
+            printf("ERROR: The new value %d was not read automatically!\n", val);
+            rc = PLCTAG_ERR_BAD_DATA;
+        } else {
+            printf("\tNew value %d was read automatically.\n", val);
+        }
+    }
+
+    plc_tag_destroy(reader);
+    plc_tag_destroy(writer);
+
+    return rc;
+}
+
+
+
+/* sets are collected into one write without calling plc_tag_write(). */
+int test_auto_write(void)
+{
+    char tag_path[256];
+    int32_t writer = 0;
+    int32_t reader = 0;
+    int32_t val = 0;
+    int writes = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing automatic writes %dms after a change.\n", WRITE_DELAY_MS);
+
+    snprintf_platform(tag_path, sizeof(tag_path), "%s&auto_sync_write_ms=%d", TAG_PATH, WRITE_DELAY_MS);
+
+    reader = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+    if(reader < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(reader));
+        return reader;
+    }
+
+    writer = plc_tag_create(tag_path, DATA_TIMEOUT);
+    if(writer < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(writer));
+        plc_tag_destroy(reader);
+        return writer;
+    }
+
+    plc_tag_register_callback(writer, tag_callback);
+
+    /* several quick changes go out in one write. */
+    val = plc_tag_get_int32(writer, 0);
+    for(int i=0; i < NUM_SETS; i++) {
+        plc_tag_set_int32(writer, 0, ++val);
+    }
+
+    util_sleep_ms(WRITE_DELAY_MS * 4);
+
+    writes = get_count(&writes_completed);
+    if(writes != 1 || get_count(&writes_failed)) {
+        printf("ERROR: Got %d writes with %d failures after %d sets, expected one!\n", writes, get_count(&writes_failed), NUM_SETS);
+        rc = PLCTAG_ERR_BAD_STATUS;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = plc_tag_read(reader, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to read the value back! Got error %s.\n", plc_tag_decode_error(rc));
+        } else if(plc_tag_get_int32(reader, 0) != val) {
+            printf("ERROR: Read back %d, expected %d!\n", plc_tag_get_int32(reader, 0), val);
+            rc = PLCTAG_ERR_BAD_DATA;
+        } else {
+            printf("\t%d sets were written as one write of %d.\n", NUM_SETS, val);
+        }
+    }
+
+    /* an explicit write takes the place of the automatic one. */
+    if(rc == PLCTAG_STATUS_OK) {
+        plc_tag_set_int32(writer, 0, ++val);
+
+        rc = plc_tag_write(writer, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to write the tag! Got error %s.\n", plc_tag_decode_error(rc));
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        util_sleep_ms(WRITE_DELAY_MS * 4);
+
+        writes = get_count(&writes_completed);
+        if(writes != 2) {
+            printf("ERROR: Got %d writes in total, expected two!\n", writes);
+            rc = PLCTAG_ERR_BAD_STATUS;
+        } else {
+            printf("\tExplicit write cancelled the automatic write.\n");
+        }
+    }
+
+    plc_tag_destroy(writer);
+    plc_tag_destroy(reader);
+
+    return rc;
+}
+
+
+
+void tag_callback(int32_t tag_id, int event, int status)
+{
+    (void)tag_id;
+
+    pthread_mutex_lock(&counts_mutex);
+
+    if(event == PLCTAG_EVENT_READ_COMPLETED) {
+        reads_completed++;
+
+        if(status != PLCTAG_STATUS_OK) {
+            reads_failed++;
+        }
+    } else if(event == PLCTAG_EVENT_WRITE_COMPLETED) {
+        writes_completed++;
+
+        if(status != PLCTAG_STATUS_OK) {
+            writes_failed++;
+        }
+    }
+
+    pthread_mutex_unlock(&counts_mutex);
+}
+
+
+
+int get_count(int *count)
+{
+    int val = 0;
+
+    pthread_mutex_lock(&counts_mutex);
+    val = *count;
+    pthread_mutex_unlock(&counts_mutex);
+
+    return val;
+}
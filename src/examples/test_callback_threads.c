@@ -0,0 +1,222 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test the callback thread pool.
+ *
+ * NUM_TAGS tags are read NUM_ROUNDS times with a callback that takes
+ * CALLBACK_MS to run.  This is done once with the callbacks called
+ * inline and once with callback_threads set.  Both run times are printed.
+ *
+ * Every read must complete and the callbacks for one tag must never run
+ * at the same time.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=TestBigArray&allow_packing=0"
+#define DATA_TIMEOUT 5000
+
+#define NUM_TAGS (20)
+#define NUM_ROUNDS (5)
+#define CALLBACK_MS (10)
+#define CALLBACK_THREADS (8)
+
+
+static pthread_mutex_t counts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int32_t tags[NUM_TAGS];
+static int in_callback[NUM_TAGS];
+static int completed = 0;
+static int failed = 0;
+static int overlapped = 0;
+
+
+static int run_reads(const char *extra, int64_t *run_time);
+static void tag_callback(int32_t tag_id, int event, int status);
+static int get_completed(void);
+
+
+
+int main()
+{
+    int64_t inline_time = 0;
+    int64_t pool_time = 0;
+    char extra[64];
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    printf("Testing callbacks called inline.\n");
+    if(run_reads("", &inline_time) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("Testing callbacks called by %d threads.\n", CALLBACK_THREADS);
+    snprintf_platform(extra, sizeof(extra), "&callback_threads=%d", CALLBACK_THREADS);
+    if(run_reads(extra, &pool_time) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("%d completions with a %dms callback took %dms inline and %dms with %d threads.\n",
+           NUM_TAGS * NUM_ROUNDS, CALLBACK_MS, (int)inline_time, (int)pool_time, CALLBACK_THREADS);
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+/* read all the tags a few times and wait for the callbacks. */
+int run_reads(const char *extra, int64_t *run_time)
+{
+    char tag_path[256];
+    int64_t start = 0;
+    int64_t timeout_time = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    snprintf_platform(tag_path, sizeof(tag_path), "%s%s", TAG_PATH, extra);
+
+    completed = 0;
+    failed = 0;
+    overlapped = 0;
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        tags[i] = plc_tag_create(tag_path, DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(tags[i]));
+            return tags[i];
+        }
+
+        plc_tag_register_callback(tags[i], tag_callback);
+    }
+
+    start = util_time_ms();
+    timeout_time = start + (NUM_ROUNDS * DATA_TIMEOUT);
+
+    for(int round=1; round <= NUM_ROUNDS && rc == PLCTAG_STATUS_OK; round++) {
+        for(int i=0; i < NUM_TAGS; i++) {
+            plc_tag_read(tags[i], 0);
+        }
+
+        while(get_completed() < round * NUM_TAGS && util_time_ms() < timeout_time) {
+            util_sleep_ms(1);
+        }
+
+        if(get_completed() < round * NUM_TAGS) {
+            printf("ERROR: Only %d of %d reads completed!\n", get_completed(), round * NUM_TAGS);
+            rc = PLCTAG_ERR_TIMEOUT;
+        }
+    }
+
+    *run_time = util_time_ms() - start;
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    if(rc == PLCTAG_STATUS_OK && (failed || overlapped)) {
+        printf("ERROR: %d reads failed and %d callbacks overlapped another for the same tag!\n", failed, overlapped);
+        rc = PLCTAG_ERR_BAD_STATUS;
+    }
+
+    return rc;
+}
+
+
+
+void tag_callback(int32_t tag_id, int event, int status)
+{
+    int index = -1;
+
+    if(event != PLCTAG_EVENT_READ_COMPLETED) {
+        return;
+    }
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(tags[i] == tag_id) {
+            index = i;
+        }
+    }
+
+    if(index < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&counts_mutex);
+    if(in_callback[index]) {
+        overlapped++;
+    }
+    in_callback[index] = 1;
+    pthread_mutex_unlock(&counts_mutex);
+
+    /* pretend to do some work. */
+    util_sleep_ms(CALLBACK_MS);
+
+    pthread_mutex_lock(&counts_mutex);
+    in_callback[index] = 0;
+    completed++;
+    if(status != PLCTAG_STATUS_OK) {
+        failed++;
+    }
+    pthread_mutex_unlock(&counts_mutex);
+}
+
+
+
+int get_completed(void)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&counts_mutex);
+    count = completed;
+    pthread_mutex_unlock(&counts_mutex);
+
+    return count;
+}
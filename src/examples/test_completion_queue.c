@@ -0,0 +1,315 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test the completion queue with plc_tag_read_async(),
+ * plc_tag_write_async(), plc_tag_poll_completions() and the handle from
+ * plc_tag_get_completion_fd().
+ *
+ * NUM_ROUNDS rounds of NUM_TAGS async reads are started and collected by
+ * waiting on the completion handle with poll().  Every completion must
+ * have the right tag ID, event, status and cookie.  A second operation on
+ * a busy tag must be refused, a write must come back with its cookie and
+ * destroying a tag with a read in flight must still queue a completion.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <poll.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&allow_packing=0&name=TestBigArray[%d]"
+#define DATA_TIMEOUT 5000
+
+#define NUM_TAGS (200)
+#define NUM_ROUNDS (5)
+#define MAX_COMPLETIONS (64)
+
+
+static int32_t tags[NUM_TAGS];
+static int completion_fd = -1;
+
+
+static int test_reads(void);
+static int test_write(void);
+static int test_destroy(void);
+static int wait_for_completions(plc_tag_completion_t *completions, int max_completions);
+static void destroy_tags(void);
+
+
+
+int main()
+{
+    char tag_path[256];
+    intptr_t fd = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        snprintf_platform(tag_path, sizeof(tag_path), TAG_PATH, i);
+
+        tags[i] = plc_tag_create(tag_path, DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            printf("ERROR %s: Could not create tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            destroy_tags();
+            return 1;
+        }
+    }
+
+    fd = plc_tag_get_completion_fd();
+    if(fd < 0) {
+        printf("ERROR %s: Could not get the completion handle!\n", plc_tag_decode_error((int)fd));
+        destroy_tags();
+        return 1;
+    }
+
+    completion_fd = (int)fd;
+
+    if((rc = test_reads()) == PLCTAG_STATUS_OK && (rc = test_write()) == PLCTAG_STATUS_OK) {
+        rc = test_destroy();
+    }
+
+    destroy_tags();
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+/* start all the reads and collect the completions from the queue. */
+int test_reads(void)
+{
+    plc_tag_completion_t completions[MAX_COMPLETIONS];
+    int seen[NUM_TAGS];
+    int64_t start = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing %d rounds of %d async reads.\n", NUM_ROUNDS, NUM_TAGS);
+
+    start = util_time_ms();
+
+    for(int round=0; round < NUM_ROUNDS; round++) {
+        int received = 0;
+        int expected = NUM_TAGS;
+
+        for(int i=0; i < NUM_TAGS; i++) {
+            seen[i] = 0;
+
+            rc = plc_tag_read_async(tags[i], (void *)(intptr_t)(i + 1));
+            if(rc != PLCTAG_STATUS_PENDING) {
+                printf("ERROR: Unable to start read on tag %d! Got %s.\n", i, plc_tag_decode_error(rc));
+                return PLCTAG_ERR_BAD_STATUS;
+            }
+        }
+
+        /* only one async operation at a time on a tag. */
+        rc = plc_tag_read_async(tags[0], NULL);
+        if(rc != PLCTAG_ERR_BUSY && rc != PLCTAG_STATUS_PENDING) {
+            printf("ERROR: Expected PLCTAG_ERR_BUSY for a second read, got %s!\n", plc_tag_decode_error(rc));
+            return PLCTAG_ERR_BAD_STATUS;
+        }
+
+        /* the first read might have finished already, then this is a real read. */
+        if(rc == PLCTAG_STATUS_PENDING) {
+            expected++;
+        }
+
+        while(received < expected) {
+            int num = wait_for_completions(completions, MAX_COMPLETIONS);
+
+            if(num < 0) {
+                printf("ERROR: Only got %d of %d completions in round %d!\n", received, expected, round);
+                return num;
+            }
+
+            for(int i=0; i < num; i++) {
+                intptr_t index = (intptr_t)completions[i].cookie - 1;
+
+                /* the extra read from the busy check. */
+                if(index < 0 && expected > NUM_TAGS && completions[i].tag_id == tags[0]) {
+                    received++;
+                    continue;
+                }
+
+                if(index < 0 || index >= NUM_TAGS || completions[i].tag_id != tags[index]
+                   || completions[i].event != PLCTAG_EVENT_READ_COMPLETED || completions[i].status != PLCTAG_STATUS_OK) {
+                    printf("ERROR: Bad completion for tag %d, event %d, status %s and cookie %p!\n",
+                           completions[i].tag_id, completions[i].event, plc_tag_decode_error(completions[i].status), completions[i].cookie);
+                    return PLCTAG_ERR_BAD_DATA;
+                }
+
+                seen[index]++;
+                received++;
+            }
+        }
+
+        for(int i=0; i < NUM_TAGS; i++) {
+            if(seen[i] != 1) {
+                printf("ERROR: Tag %d got %d completions in round %d!\n", i, seen[i], round);
+                return PLCTAG_ERR_BAD_DATA;
+            }
+        }
+    }
+
+    printf("\t%d rounds of %d async reads completed in %dms.\n", NUM_ROUNDS, NUM_TAGS, (int)(util_time_ms() - start));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* a write comes back with its own event and cookie. */
+int test_write(void)
+{
+    plc_tag_completion_t completions[MAX_COMPLETIONS];
+    int num = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing an async write.\n");
+
+    plc_tag_set_int32(tags[3], 0, 1234);
+
+    rc = plc_tag_write_async(tags[3], (void *)(intptr_t)7);
+    if(rc != PLCTAG_STATUS_PENDING) {
+        printf("ERROR: Unable to start the write! Got %s.\n", plc_tag_decode_error(rc));
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    num = wait_for_completions(completions, MAX_COMPLETIONS);
+    if(num != 1 || completions[0].tag_id != tags[3] || completions[0].event != PLCTAG_EVENT_WRITE_COMPLETED
+       || completions[0].status != PLCTAG_STATUS_OK || completions[0].cookie != (void *)(intptr_t)7) {
+        printf("ERROR: Did not get the write completion!\n");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* destroying a tag with a read in flight still hands the cookie back. */
+int test_destroy(void)
+{
+    plc_tag_completion_t completions[MAX_COMPLETIONS];
+    int num = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing destroying a tag with a read in flight.\n");
+
+    rc = plc_tag_read_async(tags[5], (void *)(intptr_t)99);
+    if(rc != PLCTAG_STATUS_PENDING) {
+        printf("ERROR: Unable to start the read! Got %s.\n", plc_tag_decode_error(rc));
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    plc_tag_destroy(tags[5]);
+
+    num = wait_for_completions(completions, MAX_COMPLETIONS);
+
+    /* the read may have finished before the tag was destroyed. */
+    if(num != 1 || completions[0].cookie != (void *)(intptr_t)99
+       || (completions[0].status != PLCTAG_ERR_ABORT && completions[0].status != PLCTAG_STATUS_OK)) {
+        printf("ERROR: Did not get one completion for the destroyed tag!\n");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    printf("\tGot the completion with status %s.\n", plc_tag_decode_error(completions[0].status));
+
+    tags[5] = 0;
+
+    /* the queue is empty so the handle must not be ready. */
+    if(plc_tag_poll_completions(completions, MAX_COMPLETIONS) != 0) {
+        printf("ERROR: Got extra completions!\n");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* wait until the completion handle is ready and take what is queued. */
+int wait_for_completions(plc_tag_completion_t *completions, int max_completions)
+{
+    struct pollfd pfd;
+    int num = 0;
+
+    pfd.fd = completion_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if(poll(&pfd, 1, DATA_TIMEOUT) <= 0) {
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    num = plc_tag_poll_completions(completions, max_completions);
+    if(num == 0) {
+        printf("ERROR: The completion handle was ready with nothing queued!\n");
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    return num;
+}
+
+
+
+void destroy_tags(void)
+{
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(tags[i] > 0) {
+            plc_tag_destroy(tags[i]);
+        }
+    }
+}
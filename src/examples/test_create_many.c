@@ -0,0 +1,242 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test plc_tag_create_many().
+ *
+ * NUM_TAGS tags are created one at a time and then another NUM_TAGS
+ * with one call, and the run times are printed.  Each tag is for a
+ * different element so none of them can use type information found by
+ * an earlier tag.  Attribute strings that fail must only fail their own
+ * entry.
+ *
+ * Packing is turned off because ab_server does not handle packed
+ * requests.  Take allow_packing out of the path to test against a PLC.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_count=1&allow_packing=0&name=TestBigArray[%d]"
+#define BAD_TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_count=1&allow_packing=0&name=NoSuchTag"
+#define DATA_TIMEOUT 5000
+
+#define NUM_TAGS (1000)
+
+
+static char *attrib_strs[NUM_TAGS];
+static int32_t tags[NUM_TAGS];
+
+
+static int make_attrib_strs(int first_elem);
+static void free_attrib_strs(void);
+static void destroy_tags(void);
+static int test_create_times(void);
+static int test_bad_tags(void);
+
+
+
+int main()
+{
+    int rc = PLCTAG_STATUS_OK;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    if((rc = test_create_times()) == PLCTAG_STATUS_OK) {
+        rc = test_bad_tags();
+    }
+
+    free_attrib_strs();
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+/* create tags one at a time and then all at once. */
+int test_create_times(void)
+{
+    int64_t start = 0;
+    int64_t one_at_a_time = 0;
+    int64_t all_at_once = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing creation times.\n");
+
+    if(make_attrib_strs(0) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    start = util_time_ms();
+    for(int i=0; i < NUM_TAGS; i++) {
+        tags[i] = plc_tag_create(attrib_strs[i], DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            printf("ERROR %s: Could not create tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            destroy_tags();
+            return tags[i];
+        }
+    }
+    one_at_a_time = util_time_ms() - start;
+
+    destroy_tags();
+
+    /* use other elements so that nothing is known about the tags yet. */
+    if(make_attrib_strs(NUM_TAGS) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    start = util_time_ms();
+    rc = plc_tag_create_many((const char **)attrib_strs, NUM_TAGS, tags, DATA_TIMEOUT);
+    all_at_once = util_time_ms() - start;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR %s: Could not create the tags!\n", plc_tag_decode_error(rc));
+        destroy_tags();
+        return rc;
+    }
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(tags[i] < 0 || plc_tag_status(tags[i]) != PLCTAG_STATUS_OK) {
+            printf("ERROR: Tag %d was not created correctly!\n", i);
+            destroy_tags();
+            return PLCTAG_ERR_BAD_STATUS;
+        }
+    }
+
+    destroy_tags();
+
+    printf("\tCreated %d tags in %dms one at a time and %dms with plc_tag_create_many().\n", NUM_TAGS, (int)one_at_a_time, (int)all_at_once);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* tags that cannot be created get an error in their own entry. */
+int test_bad_tags(void)
+{
+    const char *strs[4];
+    int32_t ids[4];
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing bad tags in the list.\n");
+
+    strs[0] = attrib_strs[0];
+    strs[1] = BAD_TAG_PATH;
+    strs[2] = "this is not a tag";
+    strs[3] = attrib_strs[1];
+
+    rc = plc_tag_create_many(strs, 4, ids, DATA_TIMEOUT);
+
+    if(rc == PLCTAG_STATUS_OK || ids[0] < 0 || ids[1] >= 0 || ids[2] >= 0 || ids[3] < 0) {
+        printf("ERROR: Expected two tags and two errors, got %d, %d, %d and %d with status %s!\n",
+               ids[0], ids[1], ids[2], ids[3], plc_tag_decode_error(rc));
+        rc = PLCTAG_ERR_BAD_STATUS;
+    } else {
+        printf("\tBad tags got errors %s and %s.\n", plc_tag_decode_error(ids[1]), plc_tag_decode_error(ids[2]));
+        rc = PLCTAG_STATUS_OK;
+    }
+
+    for(int i=0; i < 4; i++) {
+        if(ids[i] > 0) {
+            plc_tag_destroy(ids[i]);
+        }
+    }
+
+    return rc;
+}
+
+
+
+int make_attrib_strs(int first_elem)
+{
+    free_attrib_strs();
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        attrib_strs[i] = (char *)malloc(256);
+        if(!attrib_strs[i]) {
+            printf("ERROR: Unable to allocate memory for the attribute strings!\n");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        snprintf_platform(attrib_strs[i], 256, TAG_PATH, first_elem + i);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void free_attrib_strs(void)
+{
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(attrib_strs[i]) {
+            free(attrib_strs[i]);
+            attrib_strs[i] = NULL;
+        }
+    }
+}
+
+
+
+void destroy_tags(void)
+{
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(tags[i] > 0) {
+            plc_tag_destroy(tags[i]);
+        }
+
+        tags[i] = 0;
+    }
+}
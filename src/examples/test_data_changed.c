@@ -0,0 +1,234 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test PLCTAG_EVENT_DATA_CHANGED and deadband filtering.
+ *
+ * A plain tag must get a data changed event only when a read returns
+ * different data.  A tag with an absolute deadband of DEADBAND must not
+ * get one for a smaller change, but must get one once small changes add
+ * up to more than the deadband.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=TestBigArray&allow_packing=0"
+#define DATA_TIMEOUT 5000
+
+#define DEADBAND (5)
+
+
+static pthread_mutex_t counts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int changes = 0;
+static int32_t writer = 0;
+
+
+static int test_changes(void);
+static int test_deadband(void);
+static int write_value(int32_t val);
+static int expect_change(int32_t tag, int expected, const char *what);
+static void tag_callback(int32_t tag_id, int event, int status);
+
+
+
+int main()
+{
+    int rc = PLCTAG_STATUS_OK;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    writer = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+    if(writer < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(writer));
+        return 1;
+    }
+
+    if((rc = write_value(0)) == PLCTAG_STATUS_OK && (rc = test_changes()) == PLCTAG_STATUS_OK) {
+        rc = test_deadband();
+    }
+
+    plc_tag_destroy(writer);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+/* only reads that return different data are changes. */
+int test_changes(void)
+{
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing data changed events.\n");
+
+    tag = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+    if(tag < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        return tag;
+    }
+
+    plc_tag_register_callback(tag, tag_callback);
+
+    /* the first read is always a change. */
+    if((rc = expect_change(tag, 1, "first read")) == PLCTAG_STATUS_OK
+       && (rc = expect_change(tag, 0, "same data")) == PLCTAG_STATUS_OK
+       && (rc = write_value(1)) == PLCTAG_STATUS_OK) {
+        rc = expect_change(tag, 1, "new data");
+    }
+
+    plc_tag_destroy(tag);
+
+    return rc;
+}
+
+
+
+/* changes inside the deadband are filtered out until they add up. */
+int test_deadband(void)
+{
+    char tag_path[256];
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing data changed events with a deadband of %d.\n", DEADBAND);
+
+    snprintf_platform(tag_path, sizeof(tag_path), "%s&deadband_type=int32&deadband=%d", TAG_PATH, DEADBAND);
+
+    tag = plc_tag_create(tag_path, DATA_TIMEOUT);
+    if(tag < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        return tag;
+    }
+
+    plc_tag_register_callback(tag, tag_callback);
+
+    if((rc = write_value(100)) == PLCTAG_STATUS_OK
+       && (rc = expect_change(tag, 1, "first read")) == PLCTAG_STATUS_OK
+       && (rc = write_value(100 + DEADBAND - 2)) == PLCTAG_STATUS_OK
+       && (rc = expect_change(tag, 0, "change inside the deadband")) == PLCTAG_STATUS_OK
+       && (rc = write_value(100 + DEADBAND + 1)) == PLCTAG_STATUS_OK
+       && (rc = expect_change(tag, 1, "drift past the deadband")) == PLCTAG_STATUS_OK
+       && (rc = write_value(100 - DEADBAND)) == PLCTAG_STATUS_OK) {
+        rc = expect_change(tag, 1, "change down past the deadband");
+    }
+
+    plc_tag_destroy(tag);
+
+    return rc;
+}
+
+
+
+int write_value(int32_t val)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    plc_tag_set_int32(writer, 0, val);
+
+    rc = plc_tag_write(writer, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to write %d! Got error %s.\n", val, plc_tag_decode_error(rc));
+    }
+
+    return rc;
+}
+
+
+
+/* read the tag and check the number of data changed events. */
+int expect_change(int32_t tag, int expected, const char *what)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int count = 0;
+
+    pthread_mutex_lock(&counts_mutex);
+    changes = 0;
+    pthread_mutex_unlock(&counts_mutex);
+
+    rc = plc_tag_read(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to read the tag! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    pthread_mutex_lock(&counts_mutex);
+    count = changes;
+    pthread_mutex_unlock(&counts_mutex);
+
+    if(count != expected) {
+        printf("ERROR: Got %d data changed events after %s with value %d, expected %d!\n", count, what, plc_tag_get_int32(tag, 0), expected);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    printf("\t%s with value %d: %d events.\n", what, plc_tag_get_int32(tag, 0), count);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void tag_callback(int32_t tag_id, int event, int status)
+{
+    (void)tag_id;
+    (void)status;
+
+    if(event == PLCTAG_EVENT_DATA_CHANGED) {
+        pthread_mutex_lock(&counts_mutex);
+        changes++;
+        pthread_mutex_unlock(&counts_mutex);
+    }
+}
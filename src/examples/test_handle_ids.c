@@ -0,0 +1,224 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test that tag IDs stay unique and that stale IDs are rejected.
+ *
+ * Tags are created and destroyed over and over so that the library has
+ * to reuse its internal slots.  No ID may be handed out twice, and every
+ * destroyed ID must get PLCTAG_ERR_NOT_FOUND.
+ *
+ * Then NUM_THREADS threads look up random tags from a pool while the
+ * main thread keeps replacing tags in the pool.  The number of lookups
+ * per second is printed.
+ */
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=TestBigArray"
+#define DATA_TIMEOUT 5000
+
+#define NUM_CYCLES (200)
+#define NUM_THREADS (16)
+#define POOL_SIZE (64)
+#define RUN_TIME_MS (3000)
+
+
+static volatile int32_t pool[POOL_SIZE];
+static volatile int done = 0;
+static int64_t lookups[NUM_THREADS];
+
+
+static int test_stale_ids(void);
+static int test_lookup_stress(void);
+static void *lookup_thread(void *arg);
+
+
+
+int main()
+{
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    if(test_stale_ids() != PLCTAG_STATUS_OK || test_lookup_stress() != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+/* create and destroy tags, old IDs must never come back or find a tag. */
+int test_stale_ids(void)
+{
+    int32_t ids[NUM_CYCLES];
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing IDs of destroyed tags.\n");
+
+    for(int i=0; i < NUM_CYCLES; i++) {
+        ids[i] = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+        if(ids[i] < 0) {
+            printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(ids[i]));
+            return ids[i];
+        }
+
+        for(int j=0; j < i; j++) {
+            if(ids[j] == ids[i]) {
+                printf("ERROR: Tag ID %d was handed out twice!\n", ids[i]);
+                plc_tag_destroy(ids[i]);
+                return PLCTAG_ERR_DUPLICATE;
+            }
+        }
+
+        plc_tag_destroy(ids[i]);
+
+        for(int j=0; j <= i; j++) {
+            rc = plc_tag_status(ids[j]);
+            if(rc != PLCTAG_ERR_NOT_FOUND) {
+                printf("ERROR: Destroyed tag ID %d got status %s instead of PLCTAG_ERR_NOT_FOUND!\n", ids[j], plc_tag_decode_error(rc));
+                return PLCTAG_ERR_BAD_STATUS;
+            }
+        }
+    }
+
+    printf("\t%d tags created and destroyed with unique IDs.\n", NUM_CYCLES);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* look up tags from many threads while tags are replaced. */
+int test_lookup_stress(void)
+{
+    pthread_t threads[NUM_THREADS];
+    int64_t start = 0;
+    int64_t total = 0;
+    int replaced = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing lookups from %d threads while replacing tags.\n", NUM_THREADS);
+
+    for(int i=0; i < POOL_SIZE; i++) {
+        pool[i] = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+        if(pool[i] < 0) {
+            printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(pool[i]));
+            return pool[i];
+        }
+    }
+
+    for(int i=0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, lookup_thread, (void *)(intptr_t)i);
+    }
+
+    start = util_time_ms();
+
+    while(util_time_ms() - start < RUN_TIME_MS && rc == PLCTAG_STATUS_OK) {
+        int index = replaced % POOL_SIZE;
+        int32_t old_id = pool[index];
+        int32_t new_id = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+
+        if(new_id < 0) {
+            printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(new_id));
+            rc = new_id;
+            break;
+        }
+
+        pool[index] = new_id;
+        plc_tag_destroy(old_id);
+
+        if(plc_tag_status(old_id) != PLCTAG_ERR_NOT_FOUND) {
+            printf("ERROR: Destroyed tag ID %d is still found!\n", old_id);
+            rc = PLCTAG_ERR_BAD_STATUS;
+        }
+
+        replaced++;
+    }
+
+    done = 1;
+
+    for(int i=0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        total += lookups[i];
+    }
+
+    for(int i=0; i < POOL_SIZE; i++) {
+        plc_tag_destroy(pool[i]);
+    }
+
+    printf("\t%d tags replaced, %" PRId64 " lookups in %dms (%.1f M/s).\n", replaced, total, RUN_TIME_MS, (double)total / (RUN_TIME_MS * 1000.0));
+
+    return rc;
+}
+
+
+
+void *lookup_thread(void *arg)
+{
+    int tid = (int)(intptr_t)arg;
+    unsigned int seed = (unsigned int)tid;
+    int64_t count = 0;
+
+    while(!done) {
+        seed = (seed * 1103515245) + 12345;
+        plc_tag_get_int32(pool[(seed >> 8) % POOL_SIZE], 0);
+        count++;
+    }
+
+    lookups[tid] = count;
+
+    return NULL;
+}
@@ -0,0 +1,320 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test addressing a tag by symbol instance ID together with the metadata
+ * cache file.
+ *
+ * A tag listing finds the instance IDs, then a tag is created with
+ * use_instance_id and metadata_cache_file.  Instance IDs change when a
+ * project is downloaded, so the file must only hold the symbolic tag
+ * name.  A new session must then get the right element size from the
+ * file for both a symbolic tag and an instance-addressed tag.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define METADATA_FILE "test_instance_metadata.cache"
+#define BASE_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&allow_packing=0&metadata_cache_file=" METADATA_FILE
+#define LIST_PATH BASE_PATH "&name=@tags"
+#define TAG_PATH BASE_PATH "&elem_count=2000&name=TestBigArray"
+#define INSTANCE_TAG_PATH TAG_PATH "&use_instance_id=1"
+#define TAG_NAME "TestBigArray"
+#define ELEM_COUNT (2000)
+#define ELEM_SIZE (4)
+#define DATA_TIMEOUT 5000
+
+#define MARKER (4343)
+
+
+static int test_instance_tag(int32_t *value);
+static int test_cached_tag(const char *path, const char *label, int use_listing);
+static int wait_for_metadata_file(void);
+static int check_metadata_file(void);
+
+
+
+int main()
+{
+    int32_t value = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    remove(METADATA_FILE);
+
+    printf("Testing a tag addressed by instance ID.\n");
+    if(test_instance_tag(&value) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    /* the session writes the metadata when it goes away. */
+    if(wait_for_metadata_file() != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("Checking the metadata file.\n");
+    if(check_metadata_file() != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("Testing a symbolic tag with the loaded metadata.\n");
+    if(test_cached_tag(TAG_PATH, "symbolic", 0) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("Testing an instance-addressed tag with the loaded metadata.\n");
+    if(test_cached_tag(INSTANCE_TAG_PATH, "instance-addressed", 1) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    remove(METADATA_FILE);
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+int test_instance_tag(int32_t *value)
+{
+    int32_t list_tag = 0;
+    int32_t instance_tag = 0;
+    int32_t symbolic_tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    /* the listing finds the instance IDs for the session. */
+    list_tag = plc_tag_create(LIST_PATH, DATA_TIMEOUT);
+    if(list_tag < 0) {
+        printf("ERROR %s: Could not create the tag listing tag!\n", plc_tag_decode_error(list_tag));
+        return list_tag;
+    }
+
+    rc = plc_tag_read(list_tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to read the tag listing! Got error %s.\n", plc_tag_decode_error(rc));
+        plc_tag_destroy(list_tag);
+        return rc;
+    }
+
+    do {
+        instance_tag = plc_tag_create(INSTANCE_TAG_PATH, DATA_TIMEOUT);
+        if(instance_tag < 0) {
+            printf("ERROR %s: Could not create the instance-addressed tag!\n", plc_tag_decode_error(instance_tag));
+            rc = instance_tag;
+            break;
+        }
+
+        if(plc_tag_get_int_attribute(instance_tag, "elem_size", 0) != ELEM_SIZE) {
+            printf("ERROR: Expected element size %d but got %d!\n", ELEM_SIZE, plc_tag_get_int_attribute(instance_tag, "elem_size", 0));
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        plc_tag_set_int32(instance_tag, (ELEM_COUNT - 1) * ELEM_SIZE, MARKER);
+
+        rc = plc_tag_write(instance_tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to write the instance-addressed tag! Got error %s.\n", plc_tag_decode_error(rc));
+            break;
+        }
+
+        /* the write must have reached the right tag. */
+        symbolic_tag = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+        if(symbolic_tag < 0) {
+            printf("ERROR %s: Could not create the symbolic tag!\n", plc_tag_decode_error(symbolic_tag));
+            rc = symbolic_tag;
+            break;
+        }
+
+        rc = plc_tag_read(symbolic_tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to read the symbolic tag! Got error %s.\n", plc_tag_decode_error(rc));
+            break;
+        }
+
+        *value = plc_tag_get_int32(symbolic_tag, (ELEM_COUNT - 1) * ELEM_SIZE);
+        if(*value != MARKER) {
+            printf("ERROR: Expected %d but read %d!\n", MARKER, (int)*value);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+    } while(0);
+
+    if(symbolic_tag > 0) {
+        plc_tag_destroy(symbolic_tag);
+    }
+
+    if(instance_tag > 0) {
+        plc_tag_destroy(instance_tag);
+    }
+
+    plc_tag_destroy(list_tag);
+
+    return rc;
+}
+
+
+
+int test_cached_tag(const char *path, const char *label, int use_listing)
+{
+    int32_t list_tag = 0;
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(use_listing) {
+        list_tag = plc_tag_create(LIST_PATH, DATA_TIMEOUT);
+        if(list_tag < 0) {
+            printf("ERROR %s: Could not create the tag listing tag!\n", plc_tag_decode_error(list_tag));
+            return list_tag;
+        }
+
+        rc = plc_tag_read(list_tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to read the tag listing! Got error %s.\n", plc_tag_decode_error(rc));
+            plc_tag_destroy(list_tag);
+            return rc;
+        }
+    }
+
+    tag = plc_tag_create(path, DATA_TIMEOUT);
+    if(tag < 0) {
+        printf("ERROR %s: Could not create the %s tag!\n", plc_tag_decode_error(tag), label);
+
+        if(list_tag > 0) {
+            plc_tag_destroy(list_tag);
+        }
+
+        return tag;
+    }
+
+    do {
+        if(plc_tag_get_int_attribute(tag, "elem_size", 0) != ELEM_SIZE) {
+            printf("ERROR: Expected element size %d for the %s tag but got %d!\n", ELEM_SIZE, label, plc_tag_get_int_attribute(tag, "elem_size", 0));
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        rc = plc_tag_read(tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to read the %s tag! Got error %s.\n", label, plc_tag_decode_error(rc));
+            break;
+        }
+
+        if(plc_tag_get_int32(tag, (ELEM_COUNT - 1) * ELEM_SIZE) != MARKER) {
+            printf("ERROR: Expected %d but the %s tag read %d!\n", MARKER, label, (int)plc_tag_get_int32(tag, (ELEM_COUNT - 1) * ELEM_SIZE));
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+    } while(0);
+
+    plc_tag_destroy(tag);
+
+    if(list_tag > 0) {
+        plc_tag_destroy(list_tag);
+    }
+
+    return rc;
+}
+
+
+
+int wait_for_metadata_file(void)
+{
+    int64_t timeout = util_time_ms() + DATA_TIMEOUT;
+
+    while(util_time_ms() < timeout) {
+        int rc = check_metadata_file();
+
+        if(rc != PLCTAG_ERR_NOT_FOUND) {
+            return rc;
+        }
+
+        util_sleep_ms(10);
+    }
+
+    printf("ERROR: The metadata file was not written!\n");
+
+    return PLCTAG_ERR_TIMEOUT;
+}
+
+
+
+/* the file must hold the symbolic name and no instance segment. */
+int check_metadata_file(void)
+{
+    const unsigned char instance_segment[] = { 0x20, 0x6B, 0x24, 0x01 };
+    FILE *file = NULL;
+    char data[1024];
+    size_t size = 0;
+    int found_name = 0;
+
+    file = fopen(METADATA_FILE, "rb");
+    if(!file) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+
+    for(size_t i=0; i + strlen(TAG_NAME) <= size; i++) {
+        if(memcmp(&data[i], TAG_NAME, strlen(TAG_NAME)) == 0) {
+            found_name = 1;
+        }
+
+        /* TestBigArray is the first Symbol Object instance on the simulator. */
+        if(i + sizeof(instance_segment) <= size && memcmp(&data[i], instance_segment, sizeof(instance_segment)) == 0) {
+            printf("ERROR: The metadata file holds an instance-addressed tag name!\n");
+            return PLCTAG_ERR_BAD_DATA;
+        }
+    }
+
+    return (found_name ? PLCTAG_STATUS_OK : PLCTAG_ERR_NOT_FOUND);
+}
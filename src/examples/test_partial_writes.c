@@ -0,0 +1,206 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test writing only the changed data with the partial_writes attribute.
+ *
+ * A second handle changes the first element behind the back of the
+ * partial write handle.  A partial write of the last element must not
+ * overwrite it.  Then a partial write is aborted and the second handle
+ * changes the last element.  The next partial write must send the
+ * aborted change again.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=2000&name=TestBigArray&allow_packing=0"
+#define PARTIAL_TAG_PATH TAG_PATH "&partial_writes=1"
+#define ELEM_COUNT (2000)
+#define ELEM_SIZE (4)
+#define LAST_OFFSET ((ELEM_COUNT - 1) * ELEM_SIZE)
+#define DATA_TIMEOUT 5000
+
+#define FIRST_MARKER (1111)
+#define LAST_MARKER (2222)
+#define ABORTED_MARKER (3333)
+#define OTHER_MARKER (4444)
+
+
+static int write_value(int32_t tag, int offset, int32_t value);
+static int check_value(int32_t tag, int offset, int32_t value);
+
+
+
+int main()
+{
+    int32_t partial_tag = 0;
+    int32_t other_tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    partial_tag = plc_tag_create(PARTIAL_TAG_PATH, DATA_TIMEOUT);
+    if(partial_tag < 0) {
+        printf("ERROR %s: Could not create the partial write tag!\n", plc_tag_decode_error(partial_tag));
+        return 1;
+    }
+
+    other_tag = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+    if(other_tag < 0) {
+        printf("ERROR %s: Could not create the second tag!\n", plc_tag_decode_error(other_tag));
+        plc_tag_destroy(partial_tag);
+        return 1;
+    }
+
+    do {
+        rc = plc_tag_read(partial_tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to read the partial write tag! Got error %s.\n", plc_tag_decode_error(rc));
+            break;
+        }
+
+        printf("Testing that a partial write leaves other data alone.\n");
+
+        rc = write_value(other_tag, 0, FIRST_MARKER);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        rc = write_value(partial_tag, LAST_OFFSET, LAST_MARKER);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        rc = check_value(other_tag, 0, FIRST_MARKER);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        rc = check_value(other_tag, LAST_OFFSET, LAST_MARKER);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        printf("Testing that an aborted partial write is sent again.\n");
+
+        plc_tag_set_int32(partial_tag, LAST_OFFSET, ABORTED_MARKER);
+
+        rc = plc_tag_write(partial_tag, 0);
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+            printf("ERROR: Unable to start the write! Got error %s.\n", plc_tag_decode_error(rc));
+            break;
+        }
+
+        plc_tag_abort(partial_tag);
+
+        /* whether or not the aborted write got there, change the data under it. */
+        rc = write_value(other_tag, LAST_OFFSET, OTHER_MARKER);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        rc = plc_tag_write(partial_tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to write the partial write tag! Got error %s.\n", plc_tag_decode_error(rc));
+            break;
+        }
+
+        rc = check_value(other_tag, LAST_OFFSET, ABORTED_MARKER);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+    } while(0);
+
+    plc_tag_destroy(other_tag);
+    plc_tag_destroy(partial_tag);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+int write_value(int32_t tag, int offset, int32_t value)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    plc_tag_set_int32(tag, offset, value);
+
+    rc = plc_tag_write(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to write %d at offset %d! Got error %s.\n", (int)value, offset, plc_tag_decode_error(rc));
+    }
+
+    return rc;
+}
+
+
+
+int check_value(int32_t tag, int offset, int32_t value)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = plc_tag_read(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to read the tag! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if(plc_tag_get_int32(tag, offset) != value) {
+        printf("ERROR: Expected %d at offset %d but read %d!\n", (int)value, offset, (int)plc_tag_get_int32(tag, offset));
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
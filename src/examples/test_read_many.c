@@ -0,0 +1,284 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test plc_tag_read_many() and plc_tag_write_many().
+ *
+ * A set of handles to the same array is read one at a time and then all
+ * at once, and the run times are printed.  New values are written with
+ * one call and read back through other handles.  An invalid tag ID must
+ * only fail its own entry, and reads can be started without waiting.
+ *
+ * Packing is turned off because ab_server does not handle packed
+ * requests.  Take allow_packing out of the path to test against a PLC.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_count=10&name=TestBigArray&allow_packing=0"
+#define ELEM_COUNT (10)
+#define ELEM_SIZE (4)
+#define NUM_TAGS (20)
+#define DATA_TIMEOUT 5000
+
+
+static int32_t tags[NUM_TAGS];
+static int statuses[NUM_TAGS];
+
+
+static int test_read_times(void);
+static int test_write_read_back(int base);
+static int test_bad_tag(void);
+static int test_no_wait(void);
+static void destroy_tags(void);
+
+
+
+
+int main()
+{
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        tags[i] = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            printf("ERROR %s: Could not create tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            destroy_tags();
+            return 1;
+        }
+    }
+
+    if(test_read_times() != PLCTAG_STATUS_OK
+       || test_write_read_back(100) != PLCTAG_STATUS_OK
+       || test_write_read_back(200) != PLCTAG_STATUS_OK
+       || test_bad_tag() != PLCTAG_STATUS_OK
+       || test_no_wait() != PLCTAG_STATUS_OK) {
+        destroy_tags();
+        return 1;
+    }
+
+    destroy_tags();
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+/* read all the tags one at a time and then with one call. */
+int test_read_times(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t start = 0;
+    int64_t one_at_a_time = 0;
+    int64_t all_at_once = 0;
+
+    printf("Testing read times.\n");
+
+    start = util_time_ms();
+    for(int i=0; i < NUM_TAGS; i++) {
+        rc = plc_tag_read(tags[i], DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            printf("ERROR: Unable to read tag %d! Got error %s.\n", i, plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+    one_at_a_time = util_time_ms() - start;
+
+    start = util_time_ms();
+    rc = plc_tag_read_many(tags, NUM_TAGS, statuses, DATA_TIMEOUT);
+    all_at_once = util_time_ms() - start;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to read the tags! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(statuses[i] != PLCTAG_STATUS_OK) {
+            printf("ERROR: Read of tag %d returned status %s!\n", i, plc_tag_decode_error(statuses[i]));
+            return PLCTAG_ERR_BAD_STATUS;
+        }
+    }
+
+    printf("\tRead %d tags in %dms one at a time and %dms with plc_tag_read_many().\n", NUM_TAGS, (int)one_at_a_time, (int)all_at_once);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * write new values with the first half of the handles and read them
+ * back with the second half.  All of the handles are for the same
+ * elements so the first half all write the same values.
+ */
+int test_write_read_back(int base)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int half = NUM_TAGS / 2;
+
+    printf("Testing write and read back of values starting at %d.\n", base);
+
+    for(int i=0; i < half; i++) {
+        for(int elem=0; elem < ELEM_COUNT; elem++) {
+            plc_tag_set_int32(tags[i], elem * ELEM_SIZE, base + elem);
+        }
+    }
+
+    rc = plc_tag_write_many(tags, half, statuses, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to write the tags! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    rc = plc_tag_read_many(&tags[half], NUM_TAGS - half, statuses, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to read the tags back! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    for(int i=half; i < NUM_TAGS; i++) {
+        for(int elem=0; elem < ELEM_COUNT; elem++) {
+            int32_t val = plc_tag_get_int32(tags[i], elem * ELEM_SIZE);
+
+            if(val != base + elem) {
+                printf("ERROR: Tag %d element %d is %d, expected %d!\n", i, elem, val, base + elem);
+                return PLCTAG_ERR_BAD_DATA;
+            }
+        }
+    }
+
+    printf("\tRead back the values through %d other handles.\n", NUM_TAGS - half);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* an invalid tag ID in the middle of the list only fails that entry. */
+int test_bad_tag(void)
+{
+    int32_t ids[3];
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing an invalid tag ID in the list.\n");
+
+    ids[0] = tags[0];
+    ids[1] = 0x7FFFFFF0;
+    ids[2] = tags[1];
+
+    rc = plc_tag_read_many(ids, 3, statuses, DATA_TIMEOUT);
+
+    if(rc != PLCTAG_ERR_NOT_FOUND || statuses[0] != PLCTAG_STATUS_OK || statuses[1] != PLCTAG_ERR_NOT_FOUND || statuses[2] != PLCTAG_STATUS_OK) {
+        printf("ERROR: Expected OK, NOT_FOUND, OK and NOT_FOUND overall, got %s, %s, %s and %s!\n",
+                plc_tag_decode_error(statuses[0]), plc_tag_decode_error(statuses[1]),
+                plc_tag_decode_error(statuses[2]), plc_tag_decode_error(rc));
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* with a zero timeout the reads are started and the call returns. */
+int test_no_wait(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t timeout_time = util_time_ms() + DATA_TIMEOUT;
+    int pending = 0;
+
+    printf("Testing reads without waiting.\n");
+
+    rc = plc_tag_read_many(tags, NUM_TAGS, statuses, 0);
+    if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to start the reads! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < NUM_TAGS; i++) {
+            rc = plc_tag_status(tags[i]);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                pending++;
+            } else if(rc != PLCTAG_STATUS_OK) {
+                printf("ERROR: Read of tag %d failed with status %s!\n", i, plc_tag_decode_error(rc));
+                return rc;
+            }
+        }
+
+        if(pending) {
+            util_sleep_ms(1);
+        }
+    } while(pending && util_time_ms() < timeout_time);
+
+    if(pending) {
+        printf("ERROR: %d reads did not finish in time!\n", pending);
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void destroy_tags(void)
+{
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(tags[i] > 0) {
+            plc_tag_destroy(tags[i]);
+        }
+    }
+}
@@ -0,0 +1,231 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test plc_tag_read_range().
+ *
+ * Known values are written to the whole array.  Then a few elements are
+ * changed through the same handle that wrote them, and a second handle
+ * reads just that range.  The range must have the new values and the
+ * rest of the second handle's data must be left as it was.  Reading a
+ * range is timed against reading the whole tag.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=2000&name=TestBigArray"
+#define ELEM_COUNT (2000)
+#define ELEM_SIZE (4)
+#define DATA_TIMEOUT 5000
+
+#define RANGE_START (500)
+#define RANGE_COUNT (10)
+#define NUM_READS (100)
+
+
+static int32_t writer = 0;
+static int32_t reader = 0;
+
+
+static int test_range(void);
+static int test_times(void);
+static int test_bounds(void);
+
+
+
+int main()
+{
+    int rc = PLCTAG_STATUS_OK;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    writer = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+    reader = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+    if(writer < 0 || reader < 0) {
+        printf("ERROR %s: Could not create tags!\n", plc_tag_decode_error(writer < 0 ? writer : reader));
+        return 1;
+    }
+
+    if((rc = test_range()) == PLCTAG_STATUS_OK && (rc = test_times()) == PLCTAG_STATUS_OK) {
+        rc = test_bounds();
+    }
+
+    plc_tag_destroy(writer);
+    plc_tag_destroy(reader);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+/* only the range is refreshed. */
+int test_range(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing a read of elements %d to %d.\n", RANGE_START, RANGE_START + RANGE_COUNT - 1);
+
+    for(int i=0; i < ELEM_COUNT; i++) {
+        plc_tag_set_int32(writer, i * ELEM_SIZE, i);
+    }
+
+    rc = plc_tag_write(writer, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to write the tag! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    rc = plc_tag_read(reader, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to read the tag! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* change every element, only the range should be seen. */
+    for(int i=0; i < ELEM_COUNT; i++) {
+        plc_tag_set_int32(writer, i * ELEM_SIZE, -i);
+    }
+
+    rc = plc_tag_write(writer, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to write the tag! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    rc = plc_tag_read_range(reader, RANGE_START, RANGE_COUNT, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to read the range! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    for(int i=0; i < ELEM_COUNT; i++) {
+        int32_t expected = (i >= RANGE_START && i < RANGE_START + RANGE_COUNT) ? -i : i;
+        int32_t val = plc_tag_get_int32(reader, i * ELEM_SIZE);
+
+        if(val != expected) {
+            printf("ERROR: Element %d is %d, expected %d!\n", i, val, expected);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+    }
+
+    printf("\tOnly the range was refreshed.\n");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* reading a few elements is cheaper than reading all of them. */
+int test_times(void)
+{
+    int64_t start = 0;
+    int64_t full_time = 0;
+    int64_t range_time = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing read times.\n");
+
+    start = util_time_ms();
+    for(int i=0; i < NUM_READS && rc == PLCTAG_STATUS_OK; i++) {
+        rc = plc_tag_read(reader, DATA_TIMEOUT);
+    }
+    full_time = util_time_ms() - start;
+
+    start = util_time_ms();
+    for(int i=0; i < NUM_READS && rc == PLCTAG_STATUS_OK; i++) {
+        rc = plc_tag_read_range(reader, RANGE_START, RANGE_COUNT, DATA_TIMEOUT);
+    }
+    range_time = util_time_ms() - start;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Read failed with error %s!\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    printf("\t%d reads took %dms for all %d elements and %dms for %d elements.\n", NUM_READS, (int)full_time, ELEM_COUNT, (int)range_time, RANGE_COUNT);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* ranges outside the tag are refused. */
+int test_bounds(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    printf("Testing ranges outside the tag.\n");
+
+    rc = plc_tag_read_range(reader, ELEM_COUNT - 5, RANGE_COUNT, DATA_TIMEOUT);
+    if(rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
+        printf("ERROR: Expected PLCTAG_ERR_OUT_OF_BOUNDS for a range past the end, got %s!\n", plc_tag_decode_error(rc));
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    rc = plc_tag_read_range(reader, -1, RANGE_COUNT, DATA_TIMEOUT);
+    if(rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
+        printf("ERROR: Expected PLCTAG_ERR_OUT_OF_BOUNDS for a negative start, got %s!\n", plc_tag_decode_error(rc));
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    /* the tag still works. */
+    rc = plc_tag_read_range(reader, 0, 1, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to read a range after an error! Got error %s.\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
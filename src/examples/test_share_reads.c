@@ -0,0 +1,189 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Test sharing reads between handles with the share_reads attribute.
+ *
+ * NUM_THREADS threads each make their own handle to a large array and
+ * read it NUM_READS times.  This is done without and with share_reads
+ * and both run times are printed.  Every read must succeed and must see
+ * the value written to the last element before the threads started.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,8
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=2000&name=TestBigArray&allow_packing=0"
+#define ELEM_COUNT (2000)
+#define ELEM_SIZE (4)
+#define DATA_TIMEOUT 5000
+
+#define NUM_THREADS (10)
+#define NUM_READS (100)
+#define MARKER (4242)
+
+
+static const char *tag_path = NULL;
+static pthread_mutex_t counts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int errors = 0;
+
+
+static int run_threads(const char *path, int64_t *run_time);
+static void *reader_thread(void *arg);
+
+
+
+int main()
+{
+    int32_t writer = 0;
+    int64_t unshared_time = 0;
+    int64_t shared_time = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        printf("Required compatible library version %d.%d.%d not available, found %d.%d.%d!\n", REQUIRED_VERSION, version_major, version_minor, version_patch);
+        return 1;
+    }
+
+    printf("Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    /* put a known value at the end of the array. */
+    writer = plc_tag_create(TAG_PATH, DATA_TIMEOUT);
+    if(writer < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(writer));
+        return 1;
+    }
+
+    plc_tag_set_int32(writer, (ELEM_COUNT - 1) * ELEM_SIZE, MARKER);
+
+    rc = plc_tag_write(writer, DATA_TIMEOUT);
+    plc_tag_destroy(writer);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        printf("ERROR: Unable to write the marker value! Got error %s.\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    printf("Testing reads without sharing.\n");
+    if(run_threads(TAG_PATH, &unshared_time) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("Testing reads with sharing.\n");
+    if(run_threads(TAG_PATH "&share_reads=1", &shared_time) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    printf("%d threads each reading %d elements %d times took %dms without sharing and %dms with sharing.\n",
+           NUM_THREADS, ELEM_COUNT, NUM_READS, (int)unshared_time, (int)shared_time);
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
+
+
+
+int run_threads(const char *path, int64_t *run_time)
+{
+    pthread_t threads[NUM_THREADS];
+    int64_t start = 0;
+
+    tag_path = path;
+    errors = 0;
+
+    start = util_time_ms();
+
+    for(int i=0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, reader_thread, NULL);
+    }
+
+    for(int i=0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    *run_time = util_time_ms() - start;
+
+    if(errors) {
+        printf("ERROR: %d reads failed or returned the wrong data!\n", errors);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void *reader_thread(void *arg)
+{
+    int32_t tag = 0;
+    int bad = 0;
+
+    (void)arg;
+
+    tag = plc_tag_create(tag_path, DATA_TIMEOUT);
+    if(tag < 0) {
+        printf("ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        bad = NUM_READS;
+    } else {
+        for(int i=0; i < NUM_READS; i++) {
+            int rc = plc_tag_read(tag, DATA_TIMEOUT);
+
+            if(rc != PLCTAG_STATUS_OK) {
+                printf("ERROR: Read failed with error %s!\n", plc_tag_decode_error(rc));
+                bad++;
+            } else if(plc_tag_get_int32(tag, (ELEM_COUNT - 1) * ELEM_SIZE) != MARKER) {
+                bad++;
+            }
+        }
+
+        plc_tag_destroy(tag);
+    }
+
+    pthread_mutex_lock(&counts_mutex);
+    errors += bad;
+    pthread_mutex_unlock(&counts_mutex);
+
+    return NULL;
+}
@@ -35,6 +35,7 @@
 
 #include <limits.h>
 #include <float.h>
+#include <stdlib.h>
 #include <lib/libplctag.h>
 #include <lib/tag.h>
 #include <lib/init.h>
@@ -43,27 +44,118 @@
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/hash.h>
-#include <util/hashtable.h>
 #include <util/rc.h>
 #include <util/vector.h>
 #include <ab/ab.h>
 
 
-#define INITIAL_TAG_TABLE_SIZE (201)
-
 #define TAG_ID_MASK (0xFFFFFFF)
 
-#define MAX_TAG_MAP_ATTEMPTS (50)
+/*
+ * Tag IDs are made of a slot index in the low bits and a generation
+ * count in the high bits.  The generation changes each time a slot is
+ * reused so that stale IDs do not find the new tag.
+ */
+#define TAG_INDEX_BITS (18)
+#define TAG_INDEX_MASK ((1 << TAG_INDEX_BITS) - 1)
+#define TAG_GENERATION_MASK (TAG_ID_MASK >> TAG_INDEX_BITS)
+
+/* slots are allocated in chunks that never move or go away until teardown. */
+#define TAG_CHUNK_BITS (10)
+#define TAG_CHUNK_SIZE (1 << TAG_CHUNK_BITS)
+#define TAG_MAX_CHUNKS (1 << (TAG_INDEX_BITS - TAG_CHUNK_BITS))
+
+/*
+ * A tag table slot.  Readers bump the readers count before they look at
+ * the tag ID and tag pointer.  Removing a tag clears the ID and then waits
+ * for the readers count to drop to zero before releasing the table's
+ * reference to the tag.  That way lookups never take a lock.
+ */
+struct tag_slot_t {
+    volatile int32_t tag_id;
+    volatile int32_t readers;
+    int32_t generation;
+    plc_tag_p tag;
+};
+
+typedef struct tag_slot_t *tag_slot_p;
 
 /* these are only internal to the file */
 
-static volatile int32_t next_tag_id = 10; /* MAGIC */
-static volatile hashtable_p tags = NULL;
-static mutex_p tag_lookup_mutex = NULL;
+static tag_slot_p volatile tag_chunks[TAG_MAX_CHUNKS] = {0};
+static volatile int32_t tag_slot_count = 0;
+static int next_tag_slot = 0;
+static mutex_p tag_table_mutex = NULL;
 
 static volatile int library_terminating = 0;
 static thread_p tag_tickler_thread = NULL;
 
+/*
+ * The tickler only visits tags that have something going on.  Tags are
+ * put on this list when an operation starts and when the protocol layer
+ * signals that a response came in.
+ */
+static mutex_p tickler_mutex = NULL;
+static cond_p tickler_cond = NULL;
+static int32_t *tickler_tags = NULL;
+static int tickler_tag_count = 0;
+static int tickler_tag_capacity = 0;
+
+/*
+ * Tags with auto_sync_read_ms set are read by the tickler thread.  Read
+ * times are aligned to multiples of the period so that tags with the same
+ * period are started in the same pass and can be packed together.  The
+ * list and next time are protected by the tickler mutex.
+ */
+static int32_t *auto_sync_tags = NULL;
+static int auto_sync_tag_count = 0;
+static int auto_sync_tag_capacity = 0;
+static int64_t auto_sync_next_time = INT64_MAX;
+
+/*
+ * Optional callback thread pool.  Tags created with callback_threads set
+ * have their completion callbacks queued here instead of being run on the
+ * tickler thread.  The pool is started by the first tag that asks for it.
+ */
+#define CALLBACK_POOL_MAX_THREADS (64)
+
+static mutex_p callback_pool_mutex = NULL;
+static cond_p callback_pool_cond = NULL;
+static vector_p callback_pool_tags = NULL;
+static thread_p callback_pool_threads[CALLBACK_POOL_MAX_THREADS];
+static int callback_pool_num_threads = 0;
+static volatile int callback_pool_terminating = 0;
+static THREAD_LOCAL plc_tag_p callback_pool_current_tag = NULL;
+
+/*
+ * Completions of plc_tag_read_async() and plc_tag_write_async() wait in
+ * a ring buffer until the application polls for them.  The notifier is
+ * signaled while the queue is not empty.  All protected by the
+ * completion mutex.
+ */
+static mutex_p completion_mutex = NULL;
+static notifier_p completion_notifier = NULL;
+static plc_tag_completion_t *completion_queue = NULL;
+static int completion_head = 0;
+static int completion_count = 0;
+static int completion_capacity = 0;
+
+/*
+ * Element types for the data changed deadband.  The tag data is treated
+ * as an array of elements of the given type.
+ */
+#define DEADBAND_TYPE_NONE      (0)
+#define DEADBAND_TYPE_INT8      (1)
+#define DEADBAND_TYPE_UINT8     (2)
+#define DEADBAND_TYPE_INT16     (3)
+#define DEADBAND_TYPE_UINT16    (4)
+#define DEADBAND_TYPE_INT32     (5)
+#define DEADBAND_TYPE_UINT32    (6)
+#define DEADBAND_TYPE_INT64     (7)
+#define DEADBAND_TYPE_UINT64    (8)
+#define DEADBAND_TYPE_FLOAT32   (9)
+#define DEADBAND_TYPE_FLOAT64   (10)
+
 //static mutex_p global_library_mutex = NULL;
 
 
@@ -71,8 +163,40 @@ static thread_p tag_tickler_thread = NULL;
 /* helper functions. */
 static plc_tag_p lookup_tag(int32_t id);
 static int add_tag_lookup(plc_tag_p tag);
-static int tag_id_inc(int id);
+static plc_tag_p remove_tag_lookup(int32_t id);
+static tag_slot_p get_tag_slot(int index);
+static plc_tag_p tag_slot_get_tag(tag_slot_p slot, int32_t id);
 static THREAD_FUNC(tag_tickler_func);
+static void tickler_schedule(plc_tag_p tag);
+static int tickler_take_tags(int32_t **tag_ids, int *capacity);
+static int auto_sync_add(plc_tag_p tag);
+static void auto_sync_mark_dirty(plc_tag_p tag);
+static void auto_sync_rearm(plc_tag_p tag);
+static void mark_dirty(plc_tag_p tag, int offset, int length);
+static int64_t auto_sync_scan(int32_t **tag_ids, int *capacity);
+static int64_t auto_sync_next_aligned(int64_t now, int period_ms);
+static int dispatch_callback(plc_tag_p tag, int event, int status);
+static int callback_pool_start(int num_threads);
+static void callback_pool_stop(void);
+static void callback_pool_flush(plc_tag_p tag);
+static THREAD_FUNC(callback_pool_handler);
+static int wait_for_completion(plc_tag_p tag, int64_t timeout_time);
+static int compare_tag_ptrs(const void *a, const void *b);
+static int do_many(int32_t *ids, int num_tags, int *statuses, int timeout, int is_write);
+static int create_tag_unmapped(const char *attrib_str, plc_tag_p *tag_out);
+static int wait_for_tag_setup(plc_tag_p tag, int64_t timeout_time);
+static int32_t map_tag(plc_tag_p tag);
+static int host_is_big_endian(void);
+static void copy_elements(uint8_t *dest, uint8_t *src, int elem_size, int count, int swap);
+static int get_array(int32_t id, int offset, uint8_t *buffer, int elem_size, int count);
+static int set_array(int32_t id, int offset, uint8_t *buffer, int elem_size, int count);
+static int parse_deadband_type(const char *type_str, int *elem_size);
+static double get_deadband_value(plc_tag_p tag, uint8_t *data);
+static int check_data_changed(plc_tag_p tag);
+static int start_async(int32_t id, void *cookie, int is_write);
+static int read_tag(int32_t id, int start_elem, int elem_count, int timeout);
+static int completion_push(int32_t tag_id, int event, int status, void *cookie);
+static void async_abort(plc_tag_p tag, int32_t tag_id);
 //static int to_tag_index(int id);
 
 
@@ -119,16 +243,49 @@ int lib_init(void)
 
     pdebug(DEBUG_INFO,"Setting up global library data.");
 
-    pdebug(DEBUG_INFO,"Creating tag hashtable.");
-    if((tags = hashtable_create(INITIAL_TAG_TABLE_SIZE)) == NULL) { /* MAGIC */
-        pdebug(DEBUG_ERROR, "Unable to create tag hashtable!");
-        return PLCTAG_ERR_NO_MEM;
+    pdebug(DEBUG_INFO,"Creating tag table mutex.");
+    rc = mutex_create((mutex_p *)&tag_table_mutex);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create tag table mutex!");
+    }
+
+    pdebug(DEBUG_INFO,"Creating tag tickler mutex.");
+    rc = mutex_create(&tickler_mutex);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create tag tickler mutex!");
+        return rc;
+    }
+
+    rc = cond_create(&tickler_cond);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create tag tickler condition variable!");
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO,"Creating callback pool mutex.");
+    rc = mutex_create(&callback_pool_mutex);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create callback pool mutex!");
+        return rc;
+    }
+
+    rc = cond_create(&callback_pool_cond);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create callback pool condition variable!");
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO,"Creating completion queue mutex.");
+    rc = mutex_create(&completion_mutex);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create completion queue mutex!");
+        return rc;
     }
 
-    pdebug(DEBUG_INFO,"Creating tag hashtable mutex.");
-    rc = mutex_create((mutex_p *)&tag_lookup_mutex);
+    rc = notifier_create(&completion_notifier);
     if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to create tag hashtable mutex!");
+        pdebug(DEBUG_ERROR, "Unable to create completion queue notifier!");
+        return rc;
     }
 
     pdebug(DEBUG_INFO,"Creating tag tickler thread.");
@@ -153,23 +310,88 @@ void lib_teardown(void)
 
     if(tag_tickler_thread) {
         pdebug(DEBUG_INFO,"Tearing down tag tickler thread.");
+        cond_signal(tickler_cond);
         thread_join(tag_tickler_thread);
         thread_destroy(&tag_tickler_thread);
         tag_tickler_thread = NULL;
     }
 
-    if(tag_lookup_mutex) {
-        pdebug(DEBUG_INFO,"Tearing down tag lookup mutex.");
-        mutex_destroy(&tag_lookup_mutex);
-        tag_lookup_mutex = NULL;
+    /* the tickler feeds the callback pool, so stop it second. */
+    callback_pool_stop();
+
+    if(callback_pool_cond) {
+        cond_destroy(&callback_pool_cond);
+        callback_pool_cond = NULL;
+    }
+
+    if(callback_pool_mutex) {
+        mutex_destroy(&callback_pool_mutex);
+        callback_pool_mutex = NULL;
+    }
+
+    if(completion_notifier) {
+        notifier_destroy(&completion_notifier);
+        completion_notifier = NULL;
+    }
+
+    if(completion_mutex) {
+        mutex_destroy(&completion_mutex);
+        completion_mutex = NULL;
+    }
+
+    if(completion_queue) {
+        mem_free(completion_queue);
+        completion_queue = NULL;
+    }
+
+    completion_head = 0;
+    completion_count = 0;
+    completion_capacity = 0;
+
+    if(tickler_cond) {
+        cond_destroy(&tickler_cond);
+        tickler_cond = NULL;
+    }
+
+    if(tickler_mutex) {
+        mutex_destroy(&tickler_mutex);
+        tickler_mutex = NULL;
+    }
+
+    if(tickler_tags) {
+        mem_free(tickler_tags);
+        tickler_tags = NULL;
+    }
+
+    if(auto_sync_tags) {
+        mem_free(auto_sync_tags);
+        auto_sync_tags = NULL;
+    }
+
+    auto_sync_tag_count = 0;
+    auto_sync_tag_capacity = 0;
+    auto_sync_next_time = INT64_MAX;
+
+    tickler_tag_count = 0;
+    tickler_tag_capacity = 0;
+
+    if(tag_table_mutex) {
+        pdebug(DEBUG_INFO,"Tearing down tag table mutex.");
+        mutex_destroy(&tag_table_mutex);
+        tag_table_mutex = NULL;
     }
 
-    if(tags) {
-        pdebug(DEBUG_INFO, "Destroying tag hashtable.");
-        hashtable_destroy(tags);
-        tags = NULL;
+    pdebug(DEBUG_INFO, "Destroying tag table.");
+    for(int i=0; i < TAG_MAX_CHUNKS; i++) {
+        if(tag_chunks[i]) {
+            mem_free(tag_chunks[i]);
+            tag_chunks[i] = NULL;
+        }
     }
 
+    tag_slot_count = 0;
+    next_tag_slot = 0;
+
     library_terminating = 0;
 
     pdebug(DEBUG_INFO,"Done.");
@@ -180,6 +402,11 @@ void lib_teardown(void)
 
 THREAD_FUNC(tag_tickler_func)
 {
+    int32_t *tag_ids = NULL;
+    int capacity = 0;
+    int32_t *auto_sync_ids = NULL;
+    int auto_sync_capacity = 0;
+
     (void)arg;
 
     debug_set_tag_id(0);
@@ -187,67 +414,173 @@ THREAD_FUNC(tag_tickler_func)
     pdebug(DEBUG_INFO,"Starting.");
 
     while(!library_terminating) {
-        int max_index = 0;
+        int num_tags = 0;
+        int deferred = 0;
+        int64_t next_time = INT64_MAX;
+        int64_t now = time_ms();
+
+        /* start any auto sync reads and writes that are due. */
+        critical_block(tickler_mutex) {
+            next_time = auto_sync_next_time;
+        }
 
-        critical_block(tag_lookup_mutex) {
-            max_index = hashtable_capacity(tags);
+        if(next_time <= now) {
+            next_time = auto_sync_scan(&auto_sync_ids, &auto_sync_capacity);
         }
 
-        for(int i=0; i < max_index; i++) {
-            plc_tag_p tag = NULL;
+        num_tags = tickler_take_tags(&tag_ids, &capacity);
 
-            critical_block(tag_lookup_mutex) {
-                /* look up the max index again. it may have changed. */
-                max_index = hashtable_capacity(tags);
+        /* nothing is active, wait until something is or an auto sync operation is due. */
+        if(num_tags == 0) {
+            int64_t wait_ms = 100; /* MAGIC */
 
-                if(i < max_index) {
-                    tag = hashtable_get_index(tags, i);
+            if(next_time - now < wait_ms) {
+                wait_ms = (next_time > now ? next_time - now : 1);
+            }
 
-                    if(tag) {
-                        debug_set_tag_id(tag->tag_id);
-                        tag = rc_inc(tag);
-                    }
-                } else {
-                    debug_set_tag_id(0);
-                    tag = NULL;
-                }
+            cond_wait(tickler_cond, (int)wait_ms);
+            continue;
+        }
+
+        for(int i=0; i < num_tags && !library_terminating; i++) {
+            plc_tag_p tag = tag_slot_get_tag(get_tag_slot(tag_ids[i] & TAG_INDEX_MASK), tag_ids[i]);
+
+            /* the tag may have been destroyed since it was scheduled. */
+            if(!tag) {
+                continue;
             }
 
-            if(tag && tag->vtable->tickler) {
+            debug_set_tag_id(tag->tag_id);
+
+            /* clear this first so that a completion during the tickle puts the tag back. */
+            atomic_int32_set(&tag->tickler_scheduled, 0);
+
+            if(tag->vtable->tickler) {
                 if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
-                    tag->vtable->tickler(tag);
+                    /* a synchronous read or write drives the tag itself. */
+                    int sync_op = tag->sync_op_in_progress;
+
+                    int poll = 0;
+                    int async_event = 0;
+                    int async_status = PLCTAG_STATUS_OK;
+                    void *async_cookie = NULL;
+
+                    if(!sync_op) {
+                        tag->vtable->tickler(tag);
+                    }
+
+                    /*
+                     * requests made while the tag was being created do not have
+                     * the tag ID, so nothing will signal us when they finish.
+                     */
+                    if(tag->tickler_poll) {
+                        if(tag->vtable->status(tag) == PLCTAG_STATUS_PENDING) {
+                            poll = 1;
+                        } else {
+                            tag->tickler_poll = 0;
+                        }
+                    }
+
+                    /* compare the new data once, when the read is first seen. */
+                    if(!sync_op && !poll && tag->read_complete && !tag->data_change_checked) {
+                        tag->data_change_checked = 1;
+
+                        if(tag->vtable->status(tag) == PLCTAG_STATUS_OK && check_data_changed(tag)) {
+                            tag->data_changed = 1;
+                        }
+                    }
+
+                    /* an automatic write was held back while the tag was busy. */
+                    if(!sync_op && tag->auto_sync_waiting && tag->vtable->status(tag) != PLCTAG_STATUS_PENDING) {
+                        tag->auto_sync_waiting = 0;
+                        auto_sync_rearm(tag);
+                    }
+
+                    /* take any finished async operation for the completion queue. */
+                    if(!sync_op && tag->async_event) {
+                        async_status = tag->vtable->status(tag);
+
+                        if(async_status != PLCTAG_STATUS_PENDING) {
+                            async_event = tag->async_event;
+                            async_cookie = tag->async_cookie;
+                            tag->async_event = 0;
+                            tag->async_cookie = NULL;
+                        }
+                    }
 
                     mutex_unlock(tag->api_mutex);
 
-                    if(tag->read_complete) {
-                        if(tag->callback) {
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_READ_COMPLETED, plc_tag_status(tag->tag_id));
+                    if(poll) {
+                        tickler_schedule(tag);
+                        deferred = 1;
+                    }
+
+                    /* if the queue cannot take it, put it back and try again later. */
+                    if(async_event && completion_push(tag->tag_id, async_event, async_status, async_cookie) != PLCTAG_STATUS_OK) {
+                        critical_block(tag->api_mutex) {
+                            tag->async_event = async_event;
+                            tag->async_cookie = async_cookie;
                         }
 
-                        tag->read_complete = 0;
+                        tickler_schedule(tag);
+                        deferred = 1;
+                    }
+
+                    /* if the callback queue is full, leave the flag set and try again later. */
+                    if(sync_op) {
+                        /* nothing to do. */
+                    } else if(tag->read_complete) {
+                        if(!tag->callback || dispatch_callback(tag, PLCTAG_EVENT_READ_COMPLETED, plc_tag_status(tag->tag_id)) == PLCTAG_STATUS_OK) {
+                            tag->read_complete = 0;
+                            tag->data_change_checked = 0;
+                        } else {
+                            tickler_schedule(tag);
+                            deferred = 1;
+                        }
                     }
 
-                    if(tag->write_complete) {
-                        if(tag->callback) {
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_WRITE_COMPLETED, plc_tag_status(tag->tag_id));
+                    if(!sync_op && tag->data_changed) {
+                        if(!tag->callback || dispatch_callback(tag, PLCTAG_EVENT_DATA_CHANGED, PLCTAG_STATUS_OK) == PLCTAG_STATUS_OK) {
+                            tag->data_changed = 0;
+                        } else {
+                            tickler_schedule(tag);
+                            deferred = 1;
                         }
+                    }
 
-                        tag->write_complete = 0;
+                    if(!sync_op && tag->write_complete) {
+                        if(!tag->callback || dispatch_callback(tag, PLCTAG_EVENT_WRITE_COMPLETED, plc_tag_status(tag->tag_id)) == PLCTAG_STATUS_OK) {
+                            tag->write_complete = 0;
+                        } else {
+                            tickler_schedule(tag);
+                            deferred = 1;
+                        }
                     }
+                } else {
+                    /* someone else has the tag, try again later. */
+                    tickler_schedule(tag);
+                    deferred = 1;
                 }
             }
 
-            if(tag) {
-                debug_set_tag_id(0);
-                rc_dec(tag);
-            }
+            debug_set_tag_id(0);
+            rc_dec(tag);
         }
 
-        if(!library_terminating) {
+        /* do not spin on tags that are locked by other threads. */
+        if(deferred && !library_terminating) {
             sleep_ms(1);
         }
     }
 
+    if(tag_ids) {
+        mem_free(tag_ids);
+    }
+
+    if(auto_sync_ids) {
+        mem_free(auto_sync_ids);
+    }
+
     debug_set_tag_id(0);
 
     pdebug(DEBUG_INFO,"Terminating.");
@@ -257,420 +590,2408 @@ THREAD_FUNC(tag_tickler_func)
 
 
 
-/**************************************************************************
- ***************************  API Functions  ******************************
- **************************************************************************/
-
-
 /*
- * plc_tag_decode_error()
- *
- * This takes an integer error value and turns it into a printable string.
+ * tickler_schedule
  *
- * FIXME - this should produce better errors than this!
+ * Put the tag on the list for the tickler thread.  A tag is only put
+ * on the list once until the tickler gets to it.
  */
+void tickler_schedule(plc_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
 
+    if(!tag || !tickler_mutex || !atomic_int32_cas(&tag->tickler_scheduled, 0, 1)) {
+        return;
+    }
 
+    critical_block(tickler_mutex) {
+        if(tickler_tag_count >= tickler_tag_capacity) {
+            int new_capacity = (tickler_tag_capacity ? tickler_tag_capacity * 2 : 64); /* MAGIC */
+            int32_t *new_tags = (int32_t *)mem_realloc(tickler_tags, (int)(sizeof(int32_t) * (size_t)new_capacity));
 
-LIB_EXPORT const char *plc_tag_decode_error(int rc)
-{
-    switch(rc) {
-    case PLCTAG_STATUS_PENDING:
-        return "PLCTAG_STATUS_PENDING";
-    case PLCTAG_STATUS_OK:
-        return "PLCTAG_STATUS_OK";
-    case PLCTAG_ERR_ABORT:
-        return "PLCTAG_ERR_ABORT";
-    case PLCTAG_ERR_BAD_CONFIG:
-        return "PLCTAG_ERR_BAD_CONFIG";
-    case PLCTAG_ERR_BAD_CONNECTION:
-        return "PLCTAG_ERR_BAD_CONNECTION";
-    case PLCTAG_ERR_BAD_DATA:
-        return "PLCTAG_ERR_BAD_DATA";
-    case PLCTAG_ERR_BAD_DEVICE:
-        return "PLCTAG_ERR_BAD_DEVICE";
-    case PLCTAG_ERR_BAD_GATEWAY:
-        return "PLCTAG_ERR_BAD_GATEWAY";
-    case PLCTAG_ERR_BAD_PARAM:
-        return "PLCTAG_ERR_BAD_PARAM";
-    case PLCTAG_ERR_BAD_REPLY:
-        return "PLCTAG_ERR_BAD_REPLY";
-    case PLCTAG_ERR_BAD_STATUS:
-        return "PLCTAG_ERR_BAD_STATUS";
-    case PLCTAG_ERR_CLOSE:
-        return "PLCTAG_ERR_CLOSE";
-    case PLCTAG_ERR_CREATE:
-        return "PLCTAG_ERR_CREATE";
-    case PLCTAG_ERR_DUPLICATE:
-        return "PLCTAG_ERR_DUPLICATE";
-    case PLCTAG_ERR_ENCODE:
-        return "PLCTAG_ERR_ENCODE";
-    case PLCTAG_ERR_MUTEX_DESTROY:
-        return "PLCTAG_ERR_MUTEX_DESTROY";
-    case PLCTAG_ERR_MUTEX_INIT:
-        return "PLCTAG_ERR_MUTEX_INIT";
-    case PLCTAG_ERR_MUTEX_LOCK:
-        return "PLCTAG_ERR_MUTEX_LOCK";
-    case PLCTAG_ERR_MUTEX_UNLOCK:
-        return "PLCTAG_ERR_MUTEX_UNLOCK";
-    case PLCTAG_ERR_NOT_ALLOWED:
-        return "PLCTAG_ERR_NOT_ALLOWED";
-    case PLCTAG_ERR_NOT_FOUND:
-        return "PLCTAG_ERR_NOT_FOUND";
-    case PLCTAG_ERR_NOT_IMPLEMENTED:
-        return "PLCTAG_ERR_NOT_IMPLEMENTED";
-    case PLCTAG_ERR_NO_DATA:
-        return "PLCTAG_ERR_NO_DATA";
-    case PLCTAG_ERR_NO_MATCH:
-        return "PLCTAG_ERR_NO_MATCH";
-    case PLCTAG_ERR_NO_MEM:
-        return "PLCTAG_ERR_NO_MEM";
-    case PLCTAG_ERR_NO_RESOURCES:
-        return "PLCTAG_ERR_NO_RESOURCES";
-    case PLCTAG_ERR_NULL_PTR:
-        return "PLCTAG_ERR_NULL_PTR";
-    case PLCTAG_ERR_OPEN:
-        return "PLCTAG_ERR_OPEN";
-    case PLCTAG_ERR_OUT_OF_BOUNDS:
-        return "PLCTAG_ERR_OUT_OF_BOUNDS";
-    case PLCTAG_ERR_READ:
-        return "PLCTAG_ERR_READ";
-    case PLCTAG_ERR_REMOTE_ERR:
-        return "PLCTAG_ERR_REMOTE_ERR";
-    case PLCTAG_ERR_THREAD_CREATE:
-        return "PLCTAG_ERR_THREAD_CREATE";
-    case PLCTAG_ERR_THREAD_JOIN:
-        return "PLCTAG_ERR_THREAD_JOIN";
-    case PLCTAG_ERR_TIMEOUT:
-        return "PLCTAG_ERR_TIMEOUT";
-    case PLCTAG_ERR_TOO_LARGE:
-        return "PLCTAG_ERR_TOO_LARGE";
-    case PLCTAG_ERR_TOO_SMALL:
-        return "PLCTAG_ERR_TOO_SMALL";
-    case PLCTAG_ERR_UNSUPPORTED:
-        return "PLCTAG_ERR_UNSUPPORTED";
-    case PLCTAG_ERR_WINSOCK:
-        return "PLCTAG_ERR_WINSOCK";
-    case PLCTAG_ERR_WRITE:
-        return "PLCTAG_ERR_WRITE";
-    case PLCTAG_ERR_PARTIAL:
-        return "PLCTAG_ERR_PARTIAL";
-    case PLCTAG_ERR_BUSY:
-        return "PLCTAG_ERR_BUSY";
+            if(!new_tags) {
+                pdebug(DEBUG_ERROR, "Unable to grow the tickler tag list!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
 
-    default:
-        return "Unknown error.";
-        break;
+            tickler_tags = new_tags;
+            tickler_tag_capacity = new_capacity;
+        }
+
+        tickler_tags[tickler_tag_count] = tag->tag_id;
+        tickler_tag_count++;
     }
 
-    return "Unknown error.";
+    if(rc != PLCTAG_STATUS_OK) {
+        atomic_int32_set(&tag->tickler_scheduled, 0);
+        return;
+    }
+
+    cond_signal(tickler_cond);
 }
 
 
 
+/*
+ * tickler_take_tags
+ *
+ * Move the scheduled tag IDs into the passed array, growing it if needed.
+ * Returns the number of tag IDs.
+ */
+int tickler_take_tags(int32_t **tag_ids, int *capacity)
+{
+    int num_tags = 0;
+
+    critical_block(tickler_mutex) {
+        if(tickler_tag_count > *capacity) {
+            int32_t *new_ids = (int32_t *)mem_realloc(*tag_ids, (int)(sizeof(int32_t) * (size_t)tickler_tag_capacity));
+
+            if(!new_ids) {
+                pdebug(DEBUG_ERROR, "Unable to grow the tickler work list!");
+                break;
+            }
+
+            *tag_ids = new_ids;
+            *capacity = tickler_tag_capacity;
+        }
+
+        num_tags = tickler_tag_count;
+        if(num_tags > 0) {
+            mem_copy(*tag_ids, tickler_tags, (int)(sizeof(int32_t) * (size_t)num_tags));
+        }
+        tickler_tag_count = 0;
+    }
+
+    return num_tags;
+}
+
 
 
 /*
- * Set the debug level.
+ * auto_sync_next_aligned
  *
- * This function takes values from the defined debug levels.  It sets
- * the debug level to the passed value.  Higher numbers output increasing amounts
- * of information.   Input values not defined will be ignored.
+ * Find the next multiple of the period after now.  All tags with the same
+ * period come due at the same time.
  */
-
-LIB_EXPORT void plc_tag_set_debug_level(int debug_level)
+int64_t auto_sync_next_aligned(int64_t now, int period_ms)
 {
-	if (debug_level >= PLCTAG_DEBUG_NONE && debug_level <= PLCTAG_DEBUG_SPEW) {
-		set_debug_level(debug_level);
-	}
+    return ((now / period_ms) + 1) * period_ms;
 }
 
 
 
-
 /*
- * Check that the library supports the required API version.
+ * auto_sync_add
  *
- * PLCTAG_STATUS_OK is returned if the version matches.  If it does not,
- * PLCTAG_ERR_UNSUPPORTED is returned.
+ * Put the tag on the auto sync list and wake up the tickler so that it
+ * picks up the new read time.
  */
-
-LIB_EXPORT int plc_tag_check_lib_version(int req_major, int req_minor, int req_patch)
+int auto_sync_add(plc_tag_p tag)
 {
-    /* encode these with 16-bits per version part. */
-    uint64_t lib_encoded_version = (((uint64_t)version_major) << 32u)
-                                 + (((uint64_t)version_minor) << 16u)
-                                   + (uint64_t)version_patch;
+    int rc = PLCTAG_STATUS_OK;
 
-    uint64_t req_encoded_version = (((uint64_t)req_major) << 32u)
-                                 + (((uint64_t)req_minor) << 16u)
-                                   + (uint64_t)req_patch;
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-    if(version_major == (uint64_t)req_major && lib_encoded_version >= req_encoded_version) {
-        return PLCTAG_STATUS_OK;
+    if(tag->auto_sync_read_ms > 0) {
+        tag->auto_sync_next_read = auto_sync_next_aligned(time_ms(), tag->auto_sync_read_ms);
     } else {
-        return PLCTAG_ERR_UNSUPPORTED;
+        tag->auto_sync_next_read = INT64_MAX;
     }
-}
 
+    critical_block(tickler_mutex) {
+        if(auto_sync_tag_count >= auto_sync_tag_capacity) {
+            int new_capacity = (auto_sync_tag_capacity ? auto_sync_tag_capacity * 2 : 64); /* MAGIC */
+            int32_t *new_tags = (int32_t *)mem_realloc(auto_sync_tags, (int)(sizeof(int32_t) * (size_t)new_capacity));
+
+            if(!new_tags) {
+                pdebug(DEBUG_ERROR, "Unable to grow the auto sync tag list!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            auto_sync_tags = new_tags;
+            auto_sync_tag_capacity = new_capacity;
+        }
+
+        auto_sync_tags[auto_sync_tag_count] = tag->tag_id;
+        auto_sync_tag_count++;
+
+        if(tag->auto_sync_next_read < auto_sync_next_time) {
+            auto_sync_next_time = tag->auto_sync_next_read;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        cond_signal(tickler_cond);
+    }
 
+    pdebug(DEBUG_DETAIL, "Done.");
 
+    return rc;
+}
 
 
 
 /*
- * plc_tag_create()
+ * auto_sync_mark_dirty
  *
- * Just pass through to the plc_tag_create_sync() function.
+ * Called with the tag API mutex held after the tag data was changed.  The
+ * first change starts the write delay.  Later changes before the write
+ * starts go out in the same write.
+ */
+void auto_sync_mark_dirty(plc_tag_p tag)
+{
+    if(tag->auto_sync_write_ms <= 0 || tag->auto_sync_write_dirty) {
+        return;
+    }
+
+    tag->auto_sync_write_dirty = 1;
+    tag->auto_sync_next_write = time_ms() + tag->auto_sync_write_ms;
+
+    critical_block(tickler_mutex) {
+        if(tag->auto_sync_next_write < auto_sync_next_time) {
+            auto_sync_next_time = tag->auto_sync_next_write;
+        }
+    }
+
+    cond_signal(tickler_cond);
+}
+
+
+
+/*
+ * auto_sync_rearm
  *
- * This is where the dispatch occurs to the protocol specific implementation.
+ * Called by the tickler with the tag API mutex held once the operation
+ * that held back an automatic write is done.  The write is due now.
  */
+void auto_sync_rearm(plc_tag_p tag)
+{
+    if(!tag->auto_sync_write_dirty) {
+        return;
+    }
 
-LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
+    tag->auto_sync_next_write = time_ms();
+
+    critical_block(tickler_mutex) {
+        if(tag->auto_sync_next_write < auto_sync_next_time) {
+            auto_sync_next_time = tag->auto_sync_next_write;
+        }
+    }
+}
+
+
+
+/*
+ * mark_dirty
+ *
+ * Called with the tag API mutex held after length bytes at offset were
+ * changed.  The changed range is only kept if the tag writes just what
+ * changed.
+ */
+void mark_dirty(plc_tag_p tag, int offset, int length)
 {
-    plc_tag_p tag = PLC_TAG_P_NULL;
-    int id = PLCTAG_ERR_OUT_OF_BOUNDS;
-    attr attribs = NULL;
-    int rc = PLCTAG_STATUS_OK;
-    int read_cache_ms = 0;
-    tag_create_function tag_constructor;
-	int debug_level = -1;
+    auto_sync_mark_dirty(tag);
 
-    pdebug(DEBUG_INFO,"Starting");
+    if(tag->partial_writes) {
+        plc_tag_mark_dirty_range(tag, offset, length);
+    }
+}
 
-    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
-        return rc;
+
+
+/*
+ * plc_tag_mark_dirty_range
+ *
+ * Called with the tag API mutex held to add a changed range, either from
+ * a setter or from a write that did not finish.  Ranges that touch are
+ * merged.  If all the range slots are in use, the two closest ranges are
+ * merged, so the unchanged bytes between them are written too.
+ */
+void plc_tag_mark_dirty_range(plc_tag_p tag, int offset, int length)
+{
+    int start = offset;
+    int end = offset + length;
+    int i = 0;
+
+    if(length <= 0) {
+        return;
     }
 
-    if(!attrib_str || str_length(attrib_str) == 0) {
-        pdebug(DEBUG_WARN,"Tag attribute string is null or zero length!");
-        return PLCTAG_ERR_TOO_SMALL;
+    do {
+        /* take in all the ranges that touch this one. */
+        i = 0;
+        while(i < tag->num_dirty_ranges) {
+            struct tag_range_t *range = &(tag->dirty_ranges[i]);
+
+            if(range->start <= end && start <= range->end) {
+                start = (range->start < start ? range->start : start);
+                end = (range->end > end ? range->end : end);
+
+                /* the order does not matter, fill the hole with the last one. */
+                tag->num_dirty_ranges--;
+                tag->dirty_ranges[i] = tag->dirty_ranges[tag->num_dirty_ranges];
+            } else {
+                i++;
+            }
+        }
+
+        /* out of room?  Merge with the closest range and check again. */
+        if(tag->num_dirty_ranges >= TAG_MAX_DIRTY_RANGES) {
+            int closest = 0;
+            int closest_gap = INT_MAX;
+
+            for(i=0; i < tag->num_dirty_ranges; i++) {
+                struct tag_range_t *range = &(tag->dirty_ranges[i]);
+                int gap = (range->start > end ? range->start - end : start - range->end);
+
+                if(gap < closest_gap) {
+                    closest = i;
+                    closest_gap = gap;
+                }
+            }
+
+            start = (tag->dirty_ranges[closest].start < start ? tag->dirty_ranges[closest].start : start);
+            end = (tag->dirty_ranges[closest].end > end ? tag->dirty_ranges[closest].end : end);
+
+            tag->num_dirty_ranges--;
+            tag->dirty_ranges[closest] = tag->dirty_ranges[tag->num_dirty_ranges];
+        } else {
+            break;
+        }
+    } while(1);
+
+    tag->dirty_ranges[tag->num_dirty_ranges].start = start;
+    tag->dirty_ranges[tag->num_dirty_ranges].end = end;
+    tag->num_dirty_ranges++;
+}
+
+
+
+/*
+ * auto_sync_scan
+ *
+ * Start writes and reads on all the auto sync tags that are due.  They
+ * are all started in this one pass so the requests reach the session
+ * together.  If a tag is still busy with the last operation, that read
+ * scan is skipped.  A pending write waits for the tag instead and is not
+ * scanned again until the tickler sees the tag finish.  Tags that have
+ * been destroyed are dropped from the list.
+ *
+ * Returns the time the next tag comes due.
+ */
+int64_t auto_sync_scan(int32_t **tag_ids, int *capacity)
+{
+    int num_tags = 0;
+    int num_dead = 0;
+    int64_t now = time_ms();
+    int64_t next_time = INT64_MAX;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    critical_block(tickler_mutex) {
+        if(auto_sync_tag_count > *capacity) {
+            int32_t *new_ids = (int32_t *)mem_realloc(*tag_ids, (int)(sizeof(int32_t) * (size_t)auto_sync_tag_capacity));
+
+            if(!new_ids) {
+                pdebug(DEBUG_ERROR, "Unable to grow the auto sync work list!");
+                break;
+            }
+
+            *tag_ids = new_ids;
+            *capacity = auto_sync_tag_capacity;
+        }
+
+        num_tags = auto_sync_tag_count;
+        if(num_tags > 0) {
+            mem_copy(*tag_ids, auto_sync_tags, (int)(sizeof(int32_t) * (size_t)num_tags));
+        }
+
+        /* tags added while we scan will lower this again. */
+        auto_sync_next_time = INT64_MAX;
     }
 
-    attribs = attr_create_from_str(attrib_str);
-    if(!attribs) {
-        pdebug(DEBUG_WARN,"Unable to parse attribute string!");
-        return PLCTAG_ERR_BAD_DATA;
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_p tag = tag_slot_get_tag(get_tag_slot((*tag_ids)[i] & TAG_INDEX_MASK), (*tag_ids)[i]);
+        int started = 0;
+        int started_write = 0;
+
+        if(!tag) {
+            num_dead++;
+            continue;
+        }
+
+        /* dirty data goes out first, a read would overwrite it. */
+        if(tag->auto_sync_write_dirty && !tag->auto_sync_waiting && tag->auto_sync_next_write <= now) {
+            if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
+                if(!tag->sync_op_in_progress && tag->vtable->status(tag) != PLCTAG_STATUS_PENDING) {
+                    int rc = tag->vtable->write(tag);
+
+                    if(rc == PLCTAG_STATUS_OK || rc == PLCTAG_STATUS_PENDING) {
+                        started_write = 1;
+                        tickler_schedule(tag);
+                    } else {
+                        pdebug(DEBUG_WARN, "Unable to start automatic write of tag %d, error %s!", tag->tag_id, plc_tag_decode_error(rc));
+                    }
+
+                    /* all the sets up to now are in this write. */
+                    tag->auto_sync_write_dirty = 0;
+                } else {
+                    /* the tickler re-arms the write when the current operation is done. */
+                    tag->auto_sync_waiting = 1;
+                }
+
+                mutex_unlock(tag->api_mutex);
+            } else {
+                /* someone else has the tag, let the tickler look at it when it is free. */
+                tag->auto_sync_waiting = 1;
+                tickler_schedule(tag);
+            }
+        } else if(tag->auto_sync_read_ms > 0 && tag->auto_sync_next_read <= now) {
+            if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
+                /* do not read over data that has not been written yet. */
+                if(!tag->sync_op_in_progress && !tag->auto_sync_write_dirty && tag->vtable->status(tag) != PLCTAG_STATUS_PENDING) {
+                    int rc = tag->vtable->read(tag);
+
+                    if(rc == PLCTAG_STATUS_OK || rc == PLCTAG_STATUS_PENDING) {
+                        started = 1;
+                        tickler_schedule(tag);
+                    } else {
+                        pdebug(DEBUG_WARN, "Unable to start automatic read of tag %d, error %s!", tag->tag_id, plc_tag_decode_error(rc));
+                    }
+                } else {
+                    pdebug(DEBUG_DETAIL, "Tag %d is busy, skipping this scan.", tag->tag_id);
+                }
+
+                mutex_unlock(tag->api_mutex);
+            } else {
+                pdebug(DEBUG_DETAIL, "Tag %d is locked, skipping this scan.", tag->tag_id);
+            }
+
+            tag->auto_sync_next_read = auto_sync_next_aligned(now, tag->auto_sync_read_ms);
+        }
+
+        if(started && tag->callback) {
+            dispatch_callback(tag, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
+        }
+
+        if(started_write && tag->callback) {
+            dispatch_callback(tag, PLCTAG_EVENT_WRITE_STARTED, PLCTAG_STATUS_OK);
+        }
+
+        if(tag->auto_sync_read_ms > 0 && tag->auto_sync_next_read < next_time) {
+            next_time = tag->auto_sync_next_read;
+        }
+
+        if(tag->auto_sync_write_dirty && !tag->auto_sync_waiting && tag->auto_sync_next_write < next_time) {
+            next_time = tag->auto_sync_next_write;
+        }
+
+        rc_dec(tag);
     }
 
-    /* set debug level */
-	debug_level = attr_get_int(attribs, "debug", -1);
-	if (debug_level > DEBUG_NONE) {
-		set_debug_level(debug_level);
-	}
+    critical_block(tickler_mutex) {
+        /* drop destroyed tags from the list. */
+        if(num_dead > 0) {
+            int new_count = 0;
 
-    /*
-     * create the tag, this is protocol specific.
-     *
-     * If this routine wants to keep the attributes around, it needs
-     * to clone them.
-     */
-    tag_constructor = find_tag_create_func(attribs);
+            for(int i=0; i < auto_sync_tag_count; i++) {
+                int32_t id = auto_sync_tags[i];
+                tag_slot_p slot = get_tag_slot(id & TAG_INDEX_MASK);
 
-    if(!tag_constructor) {
-        pdebug(DEBUG_WARN,"Tag creation failed, no tag constructor found for tag type!");
-        attr_destroy(attribs);
-        return PLCTAG_ERR_BAD_PARAM;
+                /* only check the ID, we do not want to release a tag while holding the mutex. */
+                if(slot && atomic_int32_get(&slot->tag_id) == id) {
+                    auto_sync_tags[new_count] = id;
+                    new_count++;
+                }
+            }
+
+            auto_sync_tag_count = new_count;
+        }
+
+        if(next_time < auto_sync_next_time) {
+            auto_sync_next_time = next_time;
+        }
+
+        next_time = auto_sync_next_time;
     }
 
-    tag = tag_constructor(attribs);
+    pdebug(DEBUG_SPEW, "Done.");
 
-    /*
-     * FIXME - this really should be here???  Maybe not?  But, this is
-     * the only place it can be without making every protocol type do this automatically.
-     */
-    if(!tag) {
-        pdebug(DEBUG_WARN, "Tag creation failed, skipping mutex creation and other generic setup.");
-        attr_destroy(attribs);
-        return PLCTAG_ERR_CREATE;
+    return next_time;
+}
+
+
+
+/*
+ * dispatch_callback
+ *
+ * Run the tag's callback now or, if the tag uses the callback pool, queue
+ * it for a pool thread.  Returns PLCTAG_ERR_BUSY if the tag's queue is
+ * full.
+ */
+int dispatch_callback(plc_tag_p tag, int event, int status)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!tag->callback_queue.use_pool) {
+        tag->callback(tag->tag_id, event, status);
+        return PLCTAG_STATUS_OK;
     }
 
-    rc = mutex_create(&(tag->ext_mutex));
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN,"Unable to create tag external mutex!");
-        rc_dec(tag);
-        return PLCTAG_ERR_CREATE;
+    critical_block(callback_pool_mutex) {
+        struct tag_callback_queue_t *queue = &(tag->callback_queue);
+        int index = 0;
+
+        if(queue->count >= TAG_CALLBACK_QUEUE_SIZE) {
+            pdebug(DEBUG_DETAIL, "Callback queue for tag %d is full.", tag->tag_id);
+            rc = PLCTAG_ERR_BUSY;
+            break;
+        }
+
+        index = (queue->head + queue->count) % TAG_CALLBACK_QUEUE_SIZE;
+        queue->events[index] = event;
+        queue->statuses[index] = status;
+        queue->count++;
+
+        /* only one pool thread at a time works on a tag's queue. */
+        if(!queue->scheduled) {
+            rc = vector_put(callback_pool_tags, vector_length(callback_pool_tags), rc_inc(tag));
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to queue tag %d for the callback pool!", tag->tag_id);
+                queue->count--;
+                rc_dec(tag);
+                break;
+            }
+
+            queue->scheduled = 1;
+        }
     }
 
-    rc = mutex_create(&(tag->api_mutex));
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN,"Unable to create tag API mutex!");
-        rc_dec(tag);
-        return PLCTAG_ERR_CREATE;
+    if(rc == PLCTAG_STATUS_OK) {
+        cond_signal(callback_pool_cond);
     }
 
-    /* set up the read cache config. */
-    read_cache_ms = attr_get_int(attribs,"read_cache_ms",0);
-    if(read_cache_ms < 0) {
-        pdebug(DEBUG_WARN, "read_cache_ms value must be positive, using zero.");
-        read_cache_ms = 0;
+    return rc;
+}
+
+
+
+/*
+ * callback_pool_start
+ *
+ * Start the callback pool threads if they are not already running.  The
+ * first tag to use the pool sets the number of threads.  Later tags that
+ * ask for a different number share the running pool.
+ */
+int callback_pool_start(int num_threads)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(callback_pool_mutex) {
+        if(callback_pool_num_threads > 0) {
+            if(num_threads != callback_pool_num_threads) {
+                pdebug(DEBUG_WARN, "Callback pool is already running with %d threads, ignoring callback_threads=%d.", callback_pool_num_threads, num_threads);
+            } else {
+                pdebug(DEBUG_DETAIL, "Callback pool already running.");
+            }
+
+            break;
+        }
+
+        pdebug(DEBUG_INFO, "Starting callback pool with %d threads.", num_threads);
+
+        if(!callback_pool_tags) {
+            callback_pool_tags = vector_create(50, 50); /* MAGIC */
+            if(!callback_pool_tags) {
+                pdebug(DEBUG_ERROR, "Unable to create callback pool tag vector!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+        }
+
+        callback_pool_terminating = 0;
+
+        for(callback_pool_num_threads = 0; callback_pool_num_threads < num_threads; callback_pool_num_threads++) {
+            rc = thread_create(&(callback_pool_threads[callback_pool_num_threads]), callback_pool_handler, 32*1024, NULL);
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to create callback pool thread %d, %s!", callback_pool_num_threads, plc_tag_decode_error(rc));
+                break;
+            }
+        }
+
+        /* as long as we have one thread, we can keep going. */
+        if(callback_pool_num_threads > 0) {
+            rc = PLCTAG_STATUS_OK;
+        }
     }
 
-    tag->read_cache_expire = (int64_t)0;
-    tag->read_cache_ms = (int64_t)read_cache_ms;
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    /*
-     * Release memory for attributes
-     *
-     * some code is commented out that would have kept a pointer
-     * to the attributes in the tag and released the memory upon
+    return rc;
+}
+
+
+
+/*
+ * callback_pool_stop
+ *
+ * Stop the pool threads and drop any tags still queued.
+ */
+void callback_pool_stop(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    callback_pool_terminating = 1;
+
+    for(int i=0; i < callback_pool_num_threads; i++) {
+        cond_signal(callback_pool_cond);
+        thread_join(callback_pool_threads[i]);
+        thread_destroy(&(callback_pool_threads[i]));
+    }
+
+    callback_pool_num_threads = 0;
+
+    if(callback_pool_tags) {
+        while(vector_length(callback_pool_tags) > 0) {
+            plc_tag_p tag = vector_remove(callback_pool_tags, 0);
+
+            tag->callback_queue.scheduled = 0;
+            tag->callback_queue.count = 0;
+            cond_signal(tag->callback_queue.idle_cond);
+            rc_dec(tag);
+        }
+
+        vector_destroy(callback_pool_tags);
+        callback_pool_tags = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * callback_pool_flush
+ *
+ * Wait until all the queued callbacks for the tag have run.  If we are
+ * called from one of the tag's own callbacks, do not wait for ourselves.
+ */
+void callback_pool_flush(plc_tag_p tag)
+{
+    int busy = 1;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(callback_pool_current_tag == tag) {
+        pdebug(DEBUG_DETAIL, "Called from the tag's own callback.");
+        return;
+    }
+
+    while(busy && !callback_pool_terminating) {
+        critical_block(callback_pool_mutex) {
+            busy = tag->callback_queue.scheduled;
+        }
+
+        /* the pool thread signals when it finishes the queue. */
+        if(busy) {
+            cond_wait(tag->callback_queue.idle_cond, 100); /* MAGIC */
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/*
+ * callback_pool_handler
+ *
+ * Pool thread.  Take a tag off the queue and run all of its queued
+ * callbacks.  The tag stays marked as scheduled while we work on it, so no
+ * other thread can run its callbacks out of order.
+ */
+THREAD_FUNC(callback_pool_handler)
+{
+    (void)arg;
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    while(!callback_pool_terminating) {
+        plc_tag_p tag = NULL;
+        int more_tags = 0;
+
+        critical_block(callback_pool_mutex) {
+            if(vector_length(callback_pool_tags) > 0) {
+                tag = vector_remove(callback_pool_tags, 0);
+                more_tags = (vector_length(callback_pool_tags) > 0);
+            }
+        }
+
+        if(!tag) {
+            cond_wait(callback_pool_cond, 100); /* MAGIC */
+            continue;
+        }
+
+        /* get another thread going on the rest of the queue. */
+        if(more_tags) {
+            cond_signal(callback_pool_cond);
+        }
+
+        debug_set_tag_id(tag->tag_id);
+        callback_pool_current_tag = tag;
+
+        do {
+            int have_event = 0;
+            int event = 0;
+            int status = PLCTAG_STATUS_OK;
+
+            critical_block(callback_pool_mutex) {
+                struct tag_callback_queue_t *queue = &(tag->callback_queue);
+
+                if(queue->count > 0) {
+                    event = queue->events[queue->head];
+                    status = queue->statuses[queue->head];
+                    queue->head = (queue->head + 1) % TAG_CALLBACK_QUEUE_SIZE;
+                    queue->count--;
+                    have_event = 1;
+                } else {
+                    /* done with this tag for now. */
+                    queue->scheduled = 0;
+                }
+            }
+
+            if(!have_event) {
+                cond_signal(tag->callback_queue.idle_cond);
+                break;
+            }
+
+            if(tag->callback) {
+                tag->callback(tag->tag_id, event, status);
+            }
+        } while(!callback_pool_terminating);
+
+        callback_pool_current_tag = NULL;
+        debug_set_tag_id(0);
+
+        rc_dec(tag);
+    }
+
+    pdebug(DEBUG_INFO, "Terminating.");
+
+    THREAD_RETURN(0);
+}
+
+
+
+/**************************************************************************
+ ***************************  API Functions  ******************************
+ **************************************************************************/
+
+
+/*
+ * plc_tag_decode_error()
+ *
+ * This takes an integer error value and turns it into a printable string.
+ *
+ * FIXME - this should produce better errors than this!
+ */
+
+
+
+LIB_EXPORT const char *plc_tag_decode_error(int rc)
+{
+    switch(rc) {
+    case PLCTAG_STATUS_PENDING:
+        return "PLCTAG_STATUS_PENDING";
+    case PLCTAG_STATUS_OK:
+        return "PLCTAG_STATUS_OK";
+    case PLCTAG_ERR_ABORT:
+        return "PLCTAG_ERR_ABORT";
+    case PLCTAG_ERR_BAD_CONFIG:
+        return "PLCTAG_ERR_BAD_CONFIG";
+    case PLCTAG_ERR_BAD_CONNECTION:
+        return "PLCTAG_ERR_BAD_CONNECTION";
+    case PLCTAG_ERR_BAD_DATA:
+        return "PLCTAG_ERR_BAD_DATA";
+    case PLCTAG_ERR_BAD_DEVICE:
+        return "PLCTAG_ERR_BAD_DEVICE";
+    case PLCTAG_ERR_BAD_GATEWAY:
+        return "PLCTAG_ERR_BAD_GATEWAY";
+    case PLCTAG_ERR_BAD_PARAM:
+        return "PLCTAG_ERR_BAD_PARAM";
+    case PLCTAG_ERR_BAD_REPLY:
+        return "PLCTAG_ERR_BAD_REPLY";
+    case PLCTAG_ERR_BAD_STATUS:
+        return "PLCTAG_ERR_BAD_STATUS";
+    case PLCTAG_ERR_CLOSE:
+        return "PLCTAG_ERR_CLOSE";
+    case PLCTAG_ERR_CREATE:
+        return "PLCTAG_ERR_CREATE";
+    case PLCTAG_ERR_DUPLICATE:
+        return "PLCTAG_ERR_DUPLICATE";
+    case PLCTAG_ERR_ENCODE:
+        return "PLCTAG_ERR_ENCODE";
+    case PLCTAG_ERR_MUTEX_DESTROY:
+        return "PLCTAG_ERR_MUTEX_DESTROY";
+    case PLCTAG_ERR_MUTEX_INIT:
+        return "PLCTAG_ERR_MUTEX_INIT";
+    case PLCTAG_ERR_MUTEX_LOCK:
+        return "PLCTAG_ERR_MUTEX_LOCK";
+    case PLCTAG_ERR_MUTEX_UNLOCK:
+        return "PLCTAG_ERR_MUTEX_UNLOCK";
+    case PLCTAG_ERR_NOT_ALLOWED:
+        return "PLCTAG_ERR_NOT_ALLOWED";
+    case PLCTAG_ERR_NOT_FOUND:
+        return "PLCTAG_ERR_NOT_FOUND";
+    case PLCTAG_ERR_NOT_IMPLEMENTED:
+        return "PLCTAG_ERR_NOT_IMPLEMENTED";
+    case PLCTAG_ERR_NO_DATA:
+        return "PLCTAG_ERR_NO_DATA";
+    case PLCTAG_ERR_NO_MATCH:
+        return "PLCTAG_ERR_NO_MATCH";
+    case PLCTAG_ERR_NO_MEM:
+        return "PLCTAG_ERR_NO_MEM";
+    case PLCTAG_ERR_NO_RESOURCES:
+        return "PLCTAG_ERR_NO_RESOURCES";
+    case PLCTAG_ERR_NULL_PTR:
+        return "PLCTAG_ERR_NULL_PTR";
+    case PLCTAG_ERR_OPEN:
+        return "PLCTAG_ERR_OPEN";
+    case PLCTAG_ERR_OUT_OF_BOUNDS:
+        return "PLCTAG_ERR_OUT_OF_BOUNDS";
+    case PLCTAG_ERR_READ:
+        return "PLCTAG_ERR_READ";
+    case PLCTAG_ERR_REMOTE_ERR:
+        return "PLCTAG_ERR_REMOTE_ERR";
+    case PLCTAG_ERR_THREAD_CREATE:
+        return "PLCTAG_ERR_THREAD_CREATE";
+    case PLCTAG_ERR_THREAD_JOIN:
+        return "PLCTAG_ERR_THREAD_JOIN";
+    case PLCTAG_ERR_TIMEOUT:
+        return "PLCTAG_ERR_TIMEOUT";
+    case PLCTAG_ERR_TOO_LARGE:
+        return "PLCTAG_ERR_TOO_LARGE";
+    case PLCTAG_ERR_TOO_SMALL:
+        return "PLCTAG_ERR_TOO_SMALL";
+    case PLCTAG_ERR_UNSUPPORTED:
+        return "PLCTAG_ERR_UNSUPPORTED";
+    case PLCTAG_ERR_WINSOCK:
+        return "PLCTAG_ERR_WINSOCK";
+    case PLCTAG_ERR_WRITE:
+        return "PLCTAG_ERR_WRITE";
+    case PLCTAG_ERR_PARTIAL:
+        return "PLCTAG_ERR_PARTIAL";
+    case PLCTAG_ERR_BUSY:
+        return "PLCTAG_ERR_BUSY";
+
+    default:
+        return "Unknown error.";
+        break;
+    }
+
+    return "Unknown error.";
+}
+
+
+
+
+
+/*
+ * Set the debug level.
+ *
+ * This function takes values from the defined debug levels.  It sets
+ * the debug level to the passed value.  Higher numbers output increasing amounts
+ * of information.   Input values not defined will be ignored.
+ */
+
+LIB_EXPORT void plc_tag_set_debug_level(int debug_level)
+{
+	if (debug_level >= PLCTAG_DEBUG_NONE && debug_level <= PLCTAG_DEBUG_SPEW) {
+		set_debug_level(debug_level);
+	}
+}
+
+
+
+
+/*
+ * Check that the library supports the required API version.
+ *
+ * PLCTAG_STATUS_OK is returned if the version matches.  If it does not,
+ * PLCTAG_ERR_UNSUPPORTED is returned.
+ */
+
+LIB_EXPORT int plc_tag_check_lib_version(int req_major, int req_minor, int req_patch)
+{
+    /* encode these with 16-bits per version part. */
+    uint64_t lib_encoded_version = (((uint64_t)version_major) << 32u)
+                                 + (((uint64_t)version_minor) << 16u)
+                                   + (uint64_t)version_patch;
+
+    uint64_t req_encoded_version = (((uint64_t)req_major) << 32u)
+                                 + (((uint64_t)req_minor) << 16u)
+                                   + (uint64_t)req_patch;
+
+    if(version_major == (uint64_t)req_major && lib_encoded_version >= req_encoded_version) {
+        return PLCTAG_STATUS_OK;
+    } else {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+}
+
+
+
+
+
+
+/*
+ * create_tag_unmapped
+ *
+ * Create the tag and do the generic set up, but do not wait for it or give
+ * it an ID yet.
+ *
+ * This is where the dispatch occurs to the protocol specific implementation.
+ */
+
+int create_tag_unmapped(const char *attrib_str, plc_tag_p *tag_out)
+{
+    plc_tag_p tag = PLC_TAG_P_NULL;
+    attr attribs = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    int read_cache_ms = 0;
+    int callback_threads = 0;
+    int auto_sync_read_ms = 0;
+    int auto_sync_write_ms = 0;
+    const char *deadband_type = NULL;
+    tag_create_function tag_constructor;
+	int debug_level = -1;
+
+    pdebug(DEBUG_INFO,"Starting");
+
+    *tag_out = NULL;
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    if(!attrib_str || str_length(attrib_str) == 0) {
+        pdebug(DEBUG_WARN,"Tag attribute string is null or zero length!");
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    attribs = attr_create_from_str(attrib_str);
+    if(!attribs) {
+        pdebug(DEBUG_WARN,"Unable to parse attribute string!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    /* set debug level */
+	debug_level = attr_get_int(attribs, "debug", -1);
+	if (debug_level > DEBUG_NONE) {
+		set_debug_level(debug_level);
+	}
+
+    /*
+     * create the tag, this is protocol specific.
+     *
+     * If this routine wants to keep the attributes around, it needs
+     * to clone them.
+     */
+    tag_constructor = find_tag_create_func(attribs);
+
+    if(!tag_constructor) {
+        pdebug(DEBUG_WARN,"Tag creation failed, no tag constructor found for tag type!");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag = tag_constructor(attribs);
+
+    /*
+     * FIXME - this really should be here???  Maybe not?  But, this is
+     * the only place it can be without making every protocol type do this automatically.
+     */
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Tag creation failed, skipping mutex creation and other generic setup.");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    rc = mutex_create(&(tag->ext_mutex));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to create tag external mutex!");
+        rc_dec(tag);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    rc = mutex_create(&(tag->api_mutex));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to create tag API mutex!");
+        rc_dec(tag);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    rc = mutex_create(&(tag->sync_op_mutex));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to create tag synchronous operation mutex!");
+        rc_dec(tag);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    rc = cond_create(&(tag->tag_cond_wait));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to create tag condition variable!");
+        rc_dec(tag);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* set up the read cache config. */
+    read_cache_ms = attr_get_int(attribs,"read_cache_ms",0);
+    if(read_cache_ms < 0) {
+        pdebug(DEBUG_WARN, "read_cache_ms value must be positive, using zero.");
+        read_cache_ms = 0;
+    }
+
+    tag->read_cache_expire = (int64_t)0;
+    tag->read_cache_ms = (int64_t)read_cache_ms;
+
+    /* set up automatic periodic reads. */
+    auto_sync_read_ms = attr_get_int(attribs, "auto_sync_read_ms", 0);
+    if(auto_sync_read_ms < 0) {
+        pdebug(DEBUG_WARN, "auto_sync_read_ms value must be positive, not %d!", auto_sync_read_ms);
+        attr_destroy(attribs);
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag->auto_sync_read_ms = auto_sync_read_ms;
+
+    /* set up automatic writes of changed data. */
+    auto_sync_write_ms = attr_get_int(attribs, "auto_sync_write_ms", 0);
+    if(auto_sync_write_ms < 0) {
+        pdebug(DEBUG_WARN, "auto_sync_write_ms value must be positive, not %d!", auto_sync_write_ms);
+        attr_destroy(attribs);
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag->auto_sync_write_ms = auto_sync_write_ms;
+
+    /* set up deadband filtering of data changed events. */
+    deadband_type = attr_get_str(attribs, "deadband_type", NULL);
+    if(deadband_type) {
+        tag->deadband_type = parse_deadband_type(deadband_type, &(tag->deadband_elem_size));
+        if(tag->deadband_type == DEADBAND_TYPE_NONE) {
+            pdebug(DEBUG_WARN, "Unsupported deadband type %s!", deadband_type);
+            attr_destroy(attribs);
+            rc_dec(tag);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        tag->deadband = (double)attr_get_float(attribs, "deadband", 0.0f);
+        tag->deadband_percent = (double)attr_get_float(attribs, "deadband_percent", 0.0f);
+
+        if(tag->deadband < 0.0 || tag->deadband_percent < 0.0) {
+            pdebug(DEBUG_WARN, "Deadband values must not be negative!");
+            attr_destroy(attribs);
+            rc_dec(tag);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    /* run callbacks in the callback thread pool? */
+    callback_threads = attr_get_int(attribs, "callback_threads", 0);
+    if(callback_threads < 0 || callback_threads > CALLBACK_POOL_MAX_THREADS) {
+        pdebug(DEBUG_WARN, "Number of callback threads must be between 0 and %d, not %d!", CALLBACK_POOL_MAX_THREADS, callback_threads);
+        attr_destroy(attribs);
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(callback_threads > 0) {
+        rc = cond_create(&(tag->callback_queue.idle_cond));
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create callback queue condition variable!");
+            attr_destroy(attribs);
+            rc_dec(tag);
+            return PLCTAG_ERR_CREATE;
+        }
+
+        rc = callback_pool_start(callback_threads);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to start callback thread pool!");
+            attr_destroy(attribs);
+            rc_dec(tag);
+            return rc;
+        }
+
+        tag->callback_queue.use_pool = 1;
+    }
+
+    /*
+     * Release memory for attributes
+     *
+     * some code is commented out that would have kept a pointer
+     * to the attributes in the tag and released the memory upon
      * tag destruction. To prevent a memory leak without maintaining
      * that pointer, the memory needs to be released here.
      */
-    attr_destroy(attribs);
+    attr_destroy(attribs);
+
+    *tag_out = tag;
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * wait_for_tag_setup
+ *
+ * Wait until the set up started by the tag constructor is done.  The
+ * requests made during set up do not have a tag ID, so nothing signals
+ * us and we poll the tag instead.  On timeout the set up is aborted.
+ */
+int wait_for_tag_setup(plc_tag_p tag, int64_t timeout_time)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    /* get the tag status. */
+    rc = tag->vtable->status(tag);
+
+    while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
+        /* give some time to the tickler function. */
+        if(tag->vtable->tickler) {
+            tag->vtable->tickler(tag);
+        }
+
+        rc = tag->vtable->status(tag);
+
+        /*
+         * terminate early and do not wait again if the
+         * IO is done.
+         */
+        if(rc != PLCTAG_STATUS_PENDING) {
+            break;
+        }
+
+        sleep_ms(1); /* MAGIC */
+    }
+
+    /*
+     * if we dropped out of the while loop but the status is
+     * still pending, then we timed out.
+     *
+     * Abort the operation and set the status to show the timeout.
+     */
+    if(rc == PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_WARN,"Timeout waiting for tag to be ready!");
+        tag->vtable->abort(tag);
+        rc = PLCTAG_ERR_TIMEOUT;
+    }
+
+    /* any read done during set up is not something the user asked for. */
+    if(rc == PLCTAG_STATUS_OK) {
+        tag->read_complete = 0;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * map_tag
+ *
+ * Give the tag an ID and hand it to the tickler.  The reference passed in
+ * is owned by the tag table after this, even on failure.
+ */
+int32_t map_tag(plc_tag_p tag)
+{
+    int32_t id = PLCTAG_ERR_OUT_OF_BOUNDS;
+    int rc = PLCTAG_STATUS_OK;
+
+    /* map the tag to a tag ID */
+    id = add_tag_lookup(tag);
+
+    /* if the mapping failed, then punt */
+    if(id < 0) {
+        pdebug(DEBUG_ERROR, "Unable to map tag %p to lookup table entry, rc=%s", tag, plc_tag_decode_error(id));
+        rc_dec(tag);
+        return id;
+    }
+
+    /* save this for later. */
+    tag->tag_id = id;
+
+    debug_set_tag_id(id);
+
+    /* let the tickler finish anything started while the tag was created. */
+    tag->tickler_poll = 1;
+    tickler_schedule(tag);
+
+    /* the tickler needs the ID to find the tag. */
+    if(tag->auto_sync_read_ms > 0 || tag->auto_sync_write_ms > 0) {
+        rc = auto_sync_add(tag);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to set up automatic reads and writes, error %s!", plc_tag_decode_error(rc));
+            plc_tag_destroy(id);
+            return rc;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Returning mapped tag ID %d", id);
+
+    return id;
+}
+
+
+
+/*
+ * plc_tag_create()
+ *
+ * Create one tag and, if there is a timeout, wait for it to be ready.
+ */
+
+LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
+{
+    plc_tag_p tag = PLC_TAG_P_NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO,"Starting");
+
+    rc = create_tag_unmapped(attrib_str, &tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /*
+    * if there is a timeout, then loop until we get
+    * an error or we timeout.
+    */
+    if(timeout) {
+        int64_t start_time = time_ms();
+
+        rc = wait_for_tag_setup(tag, start_time + timeout);
+
+        /* check to see if there was an error during tag creation. */
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s while trying to create tag!", plc_tag_decode_error(rc));
+            rc_dec(tag);
+            return rc;
+        }
+
+        pdebug(DEBUG_INFO,"tag set up elapsed time %ldms",(time_ms()-start_time));
+    }
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return map_tag(tag);
+}
+
+
+
+/*
+ * plc_tag_create_many
+ *
+ * Create all the tags before waiting on any of them.  The set up reads of
+ * all the tags are queued together so that the sessions can pack them.
+ */
+LIB_EXPORT int plc_tag_create_many(const char **attrib_strs, int num_tags, int32_t *tag_ids, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p *tags = NULL;
+    int *pending = NULL;
+    int num_pending = 0;
+    int64_t timeout_time = time_ms() + timeout;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!attrib_strs || !tag_ids || num_tags <= 0 || timeout < 0) {
+        pdebug(DEBUG_WARN, "Called with bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tags = (plc_tag_p *)mem_alloc((int)(sizeof(plc_tag_p) * (size_t)num_tags));
+    pending = (int *)mem_alloc((int)(sizeof(int) * (size_t)num_tags));
+
+    if(!tags || !pending) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag list!");
+
+        if(tags) {
+            mem_free(tags);
+        }
+
+        if(pending) {
+            mem_free(pending);
+        }
+
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* set up all the tags, this starts their first reads. */
+    for(int i=0; i < num_tags; i++) {
+        tag_ids[i] = create_tag_unmapped(attrib_strs[i], &tags[i]);
+
+        if(tags[i]) {
+            pending[num_pending] = i;
+            num_pending++;
+        }
+    }
+
+    /* poll the tags still being set up until they are all done. */
+    while(timeout && num_pending > 0) {
+        int still_pending = 0;
+        int timed_out = (timeout_time <= time_ms());
+
+        for(int i=0; i < num_pending; i++) {
+            plc_tag_p tag = tags[pending[i]];
+            int status = PLCTAG_STATUS_PENDING;
+
+            if(tag->vtable->tickler) {
+                tag->vtable->tickler(tag);
+            }
+
+            status = tag->vtable->status(tag);
+
+            if(status == PLCTAG_STATUS_PENDING && timed_out) {
+                pdebug(DEBUG_WARN,"Timeout waiting for tag to be ready!");
+                tag->vtable->abort(tag);
+                status = PLCTAG_ERR_TIMEOUT;
+            }
+
+            if(status == PLCTAG_STATUS_PENDING) {
+                pending[still_pending] = pending[i];
+                still_pending++;
+            } else if(status != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Error %s while trying to create tag %d!", plc_tag_decode_error(status), pending[i]);
+                tag_ids[pending[i]] = status;
+                tags[pending[i]] = rc_dec(tag);
+            } else {
+                /* any read done during set up is not something the user asked for. */
+                tag->read_complete = 0;
+            }
+        }
+
+        num_pending = still_pending;
+
+        if(num_pending > 0) {
+            sleep_ms(1); /* MAGIC */
+        }
+    }
+
+    /* hand out the IDs. */
+    for(int i=0; i < num_tags; i++) {
+        if(tags[i]) {
+            tag_ids[i] = map_tag(tags[i]);
+        }
+
+        if(rc == PLCTAG_STATUS_OK && tag_ids[i] < 0) {
+            rc = tag_ids[i];
+        }
+    }
+
+    mem_free(tags);
+    mem_free(pending);
+
+    pdebug(DEBUG_INFO, "Done with status %s.", plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_shutdown
+ *
+ * Some systems may not be able to call atexit() handlers.  In those cases, wrappers should
+ * call this function before unloading the library or terminating.   Most OSes will cleanly
+ * recover all system resources when a process is terminated and this will not be necessary.
+ */
+
+LIB_EXPORT void plc_tag_shutdown(void)
+{
+    destroy_modules();
+}
+
+
+/*
+ * plc_tag_register_callback
+ *
+ * This function registers the passed callback function with the tag.  Only one callback function
+ * may be registered on a tag at a time!
+ *
+ * Once registered, any of the following operations on or in the tag will result in the callback
+ * being called:
+ *
+ *      * starting a tag read operation.
+ *      * a tag read operation ending.
+ *      * a tag read being aborted.
+ *      * starting a tag write operation.
+ *      * a tag write operation ending.
+ *      * a tag write being aborted.
+ *      * a tag being destroyed
+ *
+ * The callback is called outside of the internal tag mutex so it can call any tag functions safely.   However,
+ * the callback is called in the context of the internal tag helper thread and not the client library thread(s).
+ * This means that YOU are responsible for making sure that all client application data structures the callback
+ * function touches are safe to access by the callback!
+ *
+ * Do not do any operations in the callback that block for any significant time.   This will cause library
+ * performance to be poor or even to start failing!
+ *
+ * When the callback is called with the PLCTAG_EVENT_DESTROY_STARTED, do not call any tag functions.  It is
+ * not guaranteed that they will work and they will possibly hang or fail.
+ *
+ * Return values:
+ *void (*tag_callback_func)(int32_t tag_id, uint32_t event, int status)
+ * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
+ * function may be registered at a time on each tag.
+ *
+ * If all is successful, the function will return PLCTAG_STATUS_OK.
+ */
+
+LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_func)(int32_t tag_id, int event, int status))
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(tag_id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        if(tag->callback) {
+            rc = PLCTAG_ERR_DUPLICATE;
+        } else {
+            rc = PLCTAG_STATUS_OK;
+            tag->callback = tag_callback_func;
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_unregister_callback
+ *
+ * This function removes the callback already registered on the tag.
+ *
+ * Return values:
+ *
+ * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
+ * An error of PLCTAG_ERR_NOT_FOUND is returned if there was no registered callback.
+ */
+
+LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(tag_id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        if(tag->callback) {
+            rc = PLCTAG_STATUS_OK;
+            tag->callback = NULL;
+        } else {
+            rc = PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_register_logger
+ *
+ * This function registers the passed callback function with the library.  Only one callback function
+ * may be registered with the library at a time!
+ *
+ * Once registered, the function will be called with any logging message that is normally printed due 
+ * to the current log level setting.
+ *
+ * WARNING: the callback will usually be called when the internal tag API mutex is held.   You cannot
+ * call any tag functions within the callback!
+ *
+ * Return values:
+ *
+ * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
+ * function may be registered at a time on each tag.
+ *
+ * If all is successful, the function will return PLCTAG_STATUS_OK.
+ */
+
+LIB_EXPORT int plc_tag_register_logger(void (*log_callback_func)(int32_t tag_id, int debug_level, const char *message))
+{
+    pdebug(DEBUG_DETAIL, "Starting");
+    return debug_register_logger(log_callback_func);
+}
+
+
+
+/*
+ * plc_tag_unregister_logger
+ *
+ * This function removes the logger callback already registered for the library.
+ *
+ * Return values:
+ *
+ * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
+ * An error of PLCTAG_ERR_NOT_FOUND is returned if there was no registered callback.
+ */
+
+LIB_EXPORT int plc_tag_unregister_logger(void)
+{
+    pdebug(DEBUG_DETAIL, "Starting");
+    return debug_unregister_logger();
+}
+
+
+
+/*
+ * plc_tag_lock
+ *
+ * Lock the tag against use by other threads.  Because operations on a tag are
+ * very much asynchronous, actions like getting and extracting the data from
+ * a tag take more than one API call.  If more than one thread is using the same tag,
+ * then the internal state of the tag will get broken and you will probably experience
+ * a crash.
+ *
+ * This should be used to initially lock a tag when starting operations with it
+ * followed by a call to plc_tag_unlock when you have everything you need from the tag.
+ */
+
+LIB_EXPORT int plc_tag_lock(int32_t id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        rc = mutex_lock(tag->ext_mutex);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_unlock
+ *
+ * The opposite action of plc_tag_unlock.  This allows other threads to access the
+ * tag.
+ */
+
+LIB_EXPORT int plc_tag_unlock(int32_t id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        rc = mutex_unlock(tag->ext_mutex);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_abort()
+ *
+ * This function calls through the vtable in the passed tag to call
+ * the protocol-specific implementation.
+ *
+ * The implementation must do whatever is necessary to abort any
+ * ongoing IO.
+ *
+ * The status of the operation is returned.
+ */
+
+int plc_tag_abort(int32_t id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        /* who knows what state the tag data is in.  */
+        tag->read_cache_expire = (uint64_t)0;
+
+        if(!tag->vtable || !tag->vtable->abort) {
+            pdebug(DEBUG_WARN,"Tag does not have a abort function!");
+            rc = PLCTAG_ERR_NOT_IMPLEMENTED;
+        }
+
+        /* this may be synchronous. */
+        rc = tag->vtable->abort(tag);
+    }
+
+    async_abort(tag, id);
+
+    if(tag->callback) {
+        tag->callback(id, PLCTAG_EVENT_ABORTED, PLCTAG_STATUS_OK);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_destroy()
+ *
+ * Remove all implementation specific details about a tag and clear its
+ * memory.
+ */
+
+
+LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
+{
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(tag_id <= 0 || tag_id > TAG_ID_MASK) {
+        pdebug(DEBUG_WARN, "Called with zero or invalid tag!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    tag = remove_tag_lookup(tag_id);
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Called with non-existent tag!");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* abort anything in flight */
+    pdebug(DEBUG_DETAIL, "Aborting any in-flight operations.");
+
+    critical_block(tag->api_mutex) {
+        if(!tag->vtable || !tag->vtable->abort) {
+            pdebug(DEBUG_WARN,"Tag does not have a abort function!");
+        }
+
+        /* Force a clean up. */
+        tag->vtable->abort(tag);
+    }
+
+    /* the application still gets its cookie back. */
+    async_abort(tag, tag_id);
+
+    /* make sure queued callbacks run before the destroy callback. */
+    if(tag->callback_queue.use_pool) {
+        callback_pool_flush(tag);
+    }
+
+    if(tag->callback) {
+        tag->callback(tag_id, PLCTAG_EVENT_DESTROYED, PLCTAG_STATUS_OK);
+    }
+
+    /* release the reference outside the mutex. */
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    debug_set_tag_id(0);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+/*
+ * plc_tag_read()
+ *
+ * This function calls through the vtable in the passed tag to call
+ * the protocol-specific implementation.  That starts the read operation.
+ * If there is a timeout passed, then this routine waits for either
+ * a timeout or an error.
+ *
+ * The status of the operation is returned.
+ */
+
+LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
+{
+    return read_tag(id, 0, 0, timeout);
+}
+
+
+
+
+/*
+ * plc_tag_read_range
+ *
+ * Read some of the elements of the tag.  The protocol does the work, this
+ * only checks the arguments.
+ */
+
+LIB_EXPORT int plc_tag_read_range(int32_t id, int start_elem, int elem_count, int timeout)
+{
+    if(start_elem < 0 || elem_count <= 0) {
+        pdebug(DEBUG_WARN, "Element range %d to %d is not valid!", start_elem, start_elem + elem_count - 1);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    return read_tag(id, start_elem, elem_count, timeout);
+}
+
+
+
+
+/*
+ * read_tag
+ *
+ * Start a read of all of the tag or, if elem_count is not zero, of some of
+ * its elements.  The range is only set on the tag while the protocol starts
+ * the read, the protocol keeps what it needs of it.
+ */
+
+int read_tag(int32_t id, int start_elem, int elem_count, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int sync_op = 0;
+    int data_changed = 0;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(tag->callback) {
+        tag->callback(id, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
+    }
+
+    /* only one synchronous operation at a time waits on the tag. */
+    if(timeout) {
+        mutex_lock(tag->sync_op_mutex);
+    }
+
+    critical_block(tag->api_mutex) {
+        /* check read cache, if not expired, return existing data. */
+        if(!elem_count && tag->read_cache_expire > time_ms()) {
+            pdebug(DEBUG_INFO, "Returning cached data.");
+            rc = PLCTAG_STATUS_OK;
+            break;
+        }
+
+        /* if we are going to wait, get rid of any old signal first. */
+        if(timeout) {
+            cond_clear(tag->tag_cond_wait);
+            tag->sync_op_in_progress = 1;
+            sync_op = 1;
+        }
+
+        /* the protocol implementation does not do the timeout. */
+        tag->read_range_start = start_elem;
+        tag->read_range_count = elem_count;
+
+        rc = tag->vtable->read(tag);
+
+        tag->read_range_start = 0;
+        tag->read_range_count = 0;
+
+        /* if error, return now */
+        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+            if(sync_op) {
+                tag->sync_op_in_progress = 0;
+                sync_op = 0;
+            }
+
+            break;
+        }
+
+        /* set up the cache time.  This works when read_cache_ms is zero as it is already expired. */
+        if(!elem_count) {
+            tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+        }
+
+        /* let the tickler know there is something to do. */
+        tickler_schedule(tag);
+    } /* end of api mutex block */
+
+    /*
+     * if there is a timeout, then wait until we get
+     * an error or we timeout.
+     */
+    if(sync_op) {
+        int64_t start_time = time_ms();
+        int64_t timeout_time = timeout + start_time;
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            rc = wait_for_completion(tag, timeout_time);
+        }
+
+        critical_block(tag->api_mutex) {
+            /*
+             * if we dropped out of the wait but the status is
+             * still pending, then we timed out.
+             *
+             * Abort the operation and set the status to show the timeout.
+             */
+            if(rc != PLCTAG_STATUS_OK) {
+                /* abort the request. */
+                if(tag->vtable->abort) {
+                    tag->vtable->abort(tag);
+                }
+
+                /* translate error if we are still pending. */
+                if(rc == PLCTAG_STATUS_PENDING) {
+                    pdebug(DEBUG_WARN, "Read operation timed out.");
+                    rc = PLCTAG_ERR_TIMEOUT;
+                }
+            }
+
+            /* don't trigger the callback twice. */
+            if(tag->read_complete) {
+                tag->read_complete = 0;
+            }
+
+            tag->data_change_checked = 0;
+
+            if(rc == PLCTAG_STATUS_OK) {
+                data_changed = check_data_changed(tag);
+            }
+
+            tag->sync_op_in_progress = 0;
+
+            /* let the tickler start an automatic write that waited for us. */
+            if(tag->auto_sync_write_dirty) {
+                tickler_schedule(tag);
+            }
+        }
+
+        pdebug(DEBUG_INFO,"elapsed time %ldms",(time_ms()-start_time));
+    }
+
+    if(timeout) {
+        mutex_unlock(tag->sync_op_mutex);
+    }
+
+    if(tag->callback) {
+        if(timeout) {
+            tag->callback(id, PLCTAG_EVENT_READ_COMPLETED, rc);
+        }
+
+        if(data_changed) {
+            tag->callback(id, PLCTAG_EVENT_DATA_CHANGED, PLCTAG_STATUS_OK);
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return rc;
+}
+
+
+
+
+
+
+/*
+ * plc_tag_status
+ *
+ * Return the current status of the tag.  This will be PLCTAG_STATUS_PENDING if there is
+ * an uncompleted IO operation.  It will be PLCTAG_STATUS_OK if everything is fine.  Other
+ * errors will be returned as appropriate.
+ *
+ * This is a function provided by the underlying protocol implementation.
+ */
+
+
+int plc_tag_status(int32_t id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        if(tag && tag->vtable->tickler) {
+            tag->vtable->tickler(tag);
+        }
+
+        rc = tag->vtable->status(tag);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done with rc=%s.", plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+
+
+
+/*
+ * plc_tag_write()
+ *
+ * This function calls through the vtable in the passed tag to call
+ * the protocol-specific implementation.  That starts the write operation.
+ * If there is a timeout passed, then this routine waits for either
+ * a timeout or an error.
+ *
+ * The status of the operation is returned.
+ */
+
+LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int sync_op = 0;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(tag->callback) {
+        tag->callback(id, PLCTAG_EVENT_WRITE_STARTED, PLCTAG_STATUS_OK);
+    }
+
+    /* only one synchronous operation at a time waits on the tag. */
+    if(timeout) {
+        mutex_lock(tag->sync_op_mutex);
+    }
+
+    critical_block(tag->api_mutex) {
+        /* if we are going to wait, get rid of any old signal first. */
+        if(timeout) {
+            cond_clear(tag->tag_cond_wait);
+            tag->sync_op_in_progress = 1;
+            sync_op = 1;
+        }
+
+        /* the protocol implementation does not do the timeout. */
+        rc = tag->vtable->write(tag);
+
+        /* this write takes care of any pending automatic write. */
+        if(rc == PLCTAG_STATUS_OK || rc == PLCTAG_STATUS_PENDING) {
+            tag->auto_sync_write_dirty = 0;
+        }
+
+        /* if error, return now */
+        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN,"Response from write command is not OK!");
+
+            if(sync_op) {
+                tag->sync_op_in_progress = 0;
+                sync_op = 0;
+            }
+
+            break;
+        }
+
+        /* let the tickler know there is something to do. */
+        tickler_schedule(tag);
+    } /* end of api mutex block */
+
+    /*
+     * if there is a timeout, then wait until we get
+     * an error or we timeout.
+     */
+    if(sync_op) {
+        int64_t start_time = time_ms();
+        int64_t timeout_time = timeout + start_time;
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            rc = wait_for_completion(tag, timeout_time);
+        }
+
+        critical_block(tag->api_mutex) {
+            /*
+             * if we dropped out of the wait but the status is
+             * still pending, then we timed out.
+             *
+             * Abort the operation and set the status to show the timeout.
+             */
+            if(rc != PLCTAG_STATUS_OK) {
+                /* abort the request. */
+                if(tag->vtable->abort) {
+                    tag->vtable->abort(tag);
+                }
+
+                /* translate error if we are still pending. */
+                if(rc == PLCTAG_STATUS_PENDING) {
+                    pdebug(DEBUG_WARN, "Write operation timed out.");
+                    rc = PLCTAG_ERR_TIMEOUT;
+                }
+            }
+
+            /* don't trigger the callback twice. */
+            if(tag->write_complete) {
+                tag->write_complete = 0;
+            }
+
+            tag->sync_op_in_progress = 0;
+
+            /* let the tickler start an automatic write that waited for us. */
+            if(tag->auto_sync_write_dirty) {
+                tickler_schedule(tag);
+            }
+        }
+
+        pdebug(DEBUG_INFO,"elapsed time %lldms",(time_ms()-start_time));
+    }
+
+    if(timeout) {
+        mutex_unlock(tag->sync_op_mutex);
+    }
+
+    if(tag->callback) {
+        if(timeout) {
+            tag->callback(id, PLCTAG_EVENT_WRITE_COMPLETED, rc);
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_read_many()
+ *
+ * Start a read on each of the passed tags before waiting on any of them.
+ * All the requests are queued at once, so the protocol layer can pack
+ * them together.  If there is a timeout, wait once for all of them using
+ * the timeout as the overall limit.
+ *
+ * The status of each tag is returned in the statuses array.  The return
+ * value is PLCTAG_STATUS_OK if all tags succeeded, otherwise the first
+ * status that was not OK.
+ */
+
+LIB_EXPORT int plc_tag_read_many(int32_t *ids, int num_tags, int *statuses, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = do_many(ids, num_tags, statuses, timeout, 0);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_write_many()
+ *
+ * Start a write on each of the passed tags before waiting on any of them.
+ * This works the same way as plc_tag_read_many() above.
+ */
+
+LIB_EXPORT int plc_tag_write_many(int32_t *ids, int num_tags, int *statuses, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = do_many(ids, num_tags, statuses, timeout, 1);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_read_async()
+ *
+ * Start a read without waiting.  When it finishes, a completion with the
+ * cookie is put on the completion queue.  Only one async operation may be
+ * outstanding on a tag at a time.
+ */
+
+LIB_EXPORT int plc_tag_read_async(int32_t id, void *cookie)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = start_async(id, cookie, 0);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_write_async()
+ *
+ * Start a write without waiting.  This works the same way as
+ * plc_tag_read_async() above.
+ */
+
+LIB_EXPORT int plc_tag_write_async(int32_t id, void *cookie)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = start_async(id, cookie, 1);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_poll_completions()
+ *
+ * Copy up to max_completions finished async operations out of the
+ * completion queue, oldest first.  Returns the number copied.  The
+ * completion notifier is cleared when the queue is emptied.
+ */
+
+LIB_EXPORT int plc_tag_poll_completions(plc_tag_completion_t *completions, int max_completions)
+{
+    int num = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!completions || max_completions <= 0) {
+        pdebug(DEBUG_WARN, "Called with bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* nothing can be queued before the library is set up. */
+    if(!completion_mutex) {
+        return 0;
+    }
+
+    critical_block(completion_mutex) {
+        while(num < max_completions && completion_count > 0) {
+            completions[num] = completion_queue[completion_head];
+            num++;
+
+            completion_head = (completion_head + 1) % completion_capacity;
+            completion_count--;
+        }
+
+        if(completion_count == 0) {
+            completion_head = 0;
+            notifier_clear(completion_notifier);
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return num;
+}
+
+
+
+
+/*
+ * plc_tag_get_completion_fd()
+ *
+ * Return the handle that is signaled while there are completions in the
+ * queue.  This is a file descriptor on POSIX systems and an event handle
+ * on Windows.
+ */
+
+LIB_EXPORT intptr_t plc_tag_get_completion_fd(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return (intptr_t)rc;
+    }
+
+    if(!completion_notifier) {
+        pdebug(DEBUG_WARN, "No completion notifier!");
+        return (intptr_t)PLCTAG_ERR_CREATE;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return notifier_get_handle(completion_notifier);
+}
+
+
+
+
+
+/*
+ * Tag data accessors.
+ */
+
+
+
+
+LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, int default_value)
+{
+    int res = default_value;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* get library attributes */
+    if(id == 0) {
+        if(str_cmp_i(attrib_name, "version_major") == 0) {
+            res = (int)version_major;
+        } else if(str_cmp_i(attrib_name, "version_minor") == 0) {
+            res = (int)version_minor;
+        } else if(str_cmp_i(attrib_name, "version_patch") == 0) {
+            res = (int)version_patch;
+        } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
+            res = (int)get_debug_level();
+        }
+    } else {
+        tag = lookup_tag(id);
+
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            return default_value;
+        }
+
+        critical_block(tag->api_mutex) {
+            /* match the generic ones first. */
+            if(str_cmp_i(attrib_name, "size") == 0) {
+                res = (int)tag->size;
+            } else if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
+                /* FIXME - what happens if this overflows? */
+                res = (int)tag->read_cache_ms;
+            } else  {
+                if(tag->vtable->get_int_attrib) {
+                    res = tag->vtable->get_int_attrib(tag, attrib_name, default_value);
+                }
+            }
+
+        }
+
+        rc_dec(tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
 
-    /*
-    * if there is a timeout, then loop until we get
-    * an error or we timeout.
-    */
-    if(timeout) {
-        int64_t timeout_time = timeout + time_ms();
-        int64_t start_time = time_ms();
+    return res;
+}
 
-        /* get the tag status. */
-        rc = tag->vtable->status(tag);
 
-        while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
-            /* give some time to the tickler function. */
-            if(tag->vtable->tickler) {
-                tag->vtable->tickler(tag);
-            }
 
-            rc = tag->vtable->status(tag);
+LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, int new_value)
+{
+    int res = PLCTAG_ERR_NOT_FOUND;
+    plc_tag_p tag = NULL;
 
-            /*
-             * terminate early and do not wait again if the
-             * IO is done.
-             */
-            if(rc != PLCTAG_STATUS_PENDING) {
-                break;
-            }
+    pdebug(DEBUG_SPEW, "Starting.");
 
-            sleep_ms(1); /* MAGIC */
+    /* get library attributes */
+    if(id == 0) {
+        if(str_cmp_i(attrib_name, "debug_level") == 0) {
+            if(new_value >= DEBUG_ERROR && new_value < DEBUG_SPEW) {
+                set_debug_level(new_value);
+                res = PLCTAG_STATUS_OK;
+            } else {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
         }
+    } else {
+        tag = lookup_tag(id);
 
-        /*
-         * if we dropped out of the while loop but the status is
-         * still pending, then we timed out.
-         *
-         * Abort the operation and set the status to show the timeout.
-         */
-        if(rc == PLCTAG_STATUS_PENDING) {
-            pdebug(DEBUG_WARN,"Timeout waiting for tag to be ready!");
-            tag->vtable->abort(tag);
-            rc = PLCTAG_ERR_TIMEOUT;
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            return PLCTAG_ERR_NOT_FOUND;
         }
 
-        /* check to see if there was an error during tag creation. */
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Error %s while trying to create tag!", plc_tag_decode_error(rc));
-            rc_dec(tag);
-            return rc;
+        critical_block(tag->api_mutex) {
+            /* match the generic ones first. */
+            if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
+                if(new_value >= 0) {
+                    /* expire the cache. */
+                    tag->read_cache_expire = (int64_t)0;
+                    tag->read_cache_ms = (int64_t)new_value;
+                    res = PLCTAG_STATUS_OK;
+                } else {
+                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+            } else {
+                if(tag->vtable->set_int_attrib) {
+                    res = tag->vtable->set_int_attrib(tag, attrib_name, new_value);
+                }
+            }
         }
 
-        pdebug(DEBUG_INFO,"tag set up elapsed time %ldms",(time_ms()-start_time));
     }
 
-    /* map the tag to a tag ID */
-    id = add_tag_lookup(tag);
+    rc_dec(tag);
 
-    /* if the mapping failed, then punt */
-    if(id < 0) {
-        pdebug(DEBUG_ERROR, "Unable to map tag %p to lookup table entry, rc=%s", tag, plc_tag_decode_error(id));
-        rc_dec(tag);
-        return id;
-    }
+    pdebug(DEBUG_SPEW, "Done.");
 
-    /* save this for later. */
-    tag->tag_id = id;
+    return res;
+}
 
-    debug_set_tag_id(id);
 
-    pdebug(DEBUG_INFO, "Returning mapped tag ID %d", id);
 
-    pdebug(DEBUG_INFO,"Done.");
 
-    return id;
-}
+LIB_EXPORT int plc_tag_get_size(int32_t id)
+{
+    int result = 0;
+    plc_tag_p tag = lookup_tag(id);
 
+    pdebug(DEBUG_SPEW, "Starting.");
 
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
 
+    critical_block(tag->api_mutex) {
+        result = tag->size;
+    }
 
-/*
- * plc_tag_shutdown
- *
- * Some systems may not be able to call atexit() handlers.  In those cases, wrappers should
- * call this function before unloading the library or terminating.   Most OSes will cleanly
- * recover all system resources when a process is terminated and this will not be necessary.
- */
+    rc_dec(tag);
 
-LIB_EXPORT void plc_tag_shutdown(void)
-{
-    destroy_modules();
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return result;
 }
 
 
+
+
 /*
- * plc_tag_register_callback
- *
- * This function registers the passed callback function with the tag.  Only one callback function
- * may be registered on a tag at a time!
- *
- * Once registered, any of the following operations on or in the tag will result in the callback
- * being called:
- *
- *      * starting a tag read operation.
- *      * a tag read operation ending.
- *      * a tag read being aborted.
- *      * starting a tag write operation.
- *      * a tag write operation ending.
- *      * a tag write being aborted.
- *      * a tag being destroyed
- *
- * The callback is called outside of the internal tag mutex so it can call any tag functions safely.   However,
- * the callback is called in the context of the internal tag helper thread and not the client library thread(s).
- * This means that YOU are responsible for making sure that all client application data structures the callback
- * function touches are safe to access by the callback!
- *
- * Do not do any operations in the callback that block for any significant time.   This will cause library
- * performance to be poor or even to start failing!
- *
- * When the callback is called with the PLCTAG_EVENT_DESTROY_STARTED, do not call any tag functions.  It is
- * not guaranteed that they will work and they will possibly hang or fail.
- *
- * Return values:
- *void (*tag_callback_func)(int32_t tag_id, uint32_t event, int status)
- * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
- * function may be registered at a time on each tag.
+ * plc_tag_get_member_offset
  *
- * If all is successful, the function will return PLCTAG_STATUS_OK.
+ * Resolve a path to a member of a structure tag to a byte offset.  This
+ * is protocol specific.
  */
 
-LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_func)(int32_t tag_id, int event, int status))
+LIB_EXPORT int plc_tag_get_member_offset(int32_t id, const char *member_path, int *member_type, int *bit_num)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(tag_id);
+    int rc = PLCTAG_ERR_UNSUPPORTED;
+    plc_tag_p tag = lookup_tag(id);
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
+    if(!member_path) {
+        pdebug(DEBUG_WARN, "Member path is null!");
+        rc_dec(tag);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
     critical_block(tag->api_mutex) {
-        if(tag->callback) {
-            rc = PLCTAG_ERR_DUPLICATE;
+        if(tag->vtable->get_member_offset) {
+            rc = tag->vtable->get_member_offset(tag, member_path, member_type, bit_num);
         } else {
-            rc = PLCTAG_STATUS_OK;
-            tag->callback = tag_callback_func;
+            pdebug(DEBUG_WARN, "Tag type does not support structure members.");
         }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_DETAIL, "Done.");
 
     return rc;
 }
@@ -679,40 +3000,50 @@ LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_fun
 
 
 /*
- * plc_tag_unregister_callback
+ * plc_tag_get_bytes
  *
- * This function removes the callback already registered on the tag.
- *
- * Return values:
- *
- * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
- * An error of PLCTAG_ERR_NOT_FOUND is returned if there was no registered callback.
+ * Copy length bytes of the tag data starting at offset into the passed
+ * buffer.  The data is copied raw, without any byte order conversion.
+ * This takes the tag mutex once for the whole copy.
  */
 
-LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
+LIB_EXPORT int plc_tag_get_bytes(int32_t id, int offset, uint8_t *buffer, int length)
 {
     int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(tag_id);
+    plc_tag_p tag = NULL;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!buffer) {
+        pdebug(DEBUG_WARN, "Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
+    tag = lookup_tag(id);
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
     critical_block(tag->api_mutex) {
-        if(tag->callback) {
-            rc = PLCTAG_STATUS_OK;
-            tag->callback = NULL;
-        } else {
-            rc = PLCTAG_ERR_NOT_FOUND;
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            rc = PLCTAG_ERR_NO_DATA;
+            break;
         }
+
+        if(offset < 0 || length < 0 || length > tag->size - offset) {
+            pdebug(DEBUG_WARN,"Data offset or length out of bounds.");
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        mem_copy(buffer, tag->data + offset, length);
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
 }
@@ -721,71 +3052,99 @@ LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
 
 
 /*
- * plc_tag_register_logger
- *
- * This function registers the passed callback function with the library.  Only one callback function
- * may be registered with the library at a time!
- *
- * Once registered, the function will be called with any logging message that is normally printed due 
- * to the current log level setting.
- *
- * WARNING: the callback will usually be called when the internal tag API mutex is held.   You cannot
- * call any tag functions within the callback!
- *
- * Return values:
- *
- * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
- * function may be registered at a time on each tag.
+ * plc_tag_set_bytes
  *
- * If all is successful, the function will return PLCTAG_STATUS_OK.
+ * Copy length bytes from the passed buffer into the tag data starting at
+ * offset.  The data is copied raw, without any byte order conversion.
+ * Tags that do not support setting data return PLCTAG_ERR_UNSUPPORTED.
  */
 
-LIB_EXPORT int plc_tag_register_logger(void (*log_callback_func)(int32_t tag_id, int debug_level, const char *message))
+LIB_EXPORT int plc_tag_set_bytes(int32_t id, int offset, uint8_t *buffer, int length)
 {
-    pdebug(DEBUG_DETAIL, "Starting");
-    return debug_register_logger(log_callback_func);
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!buffer) {
+        pdebug(DEBUG_WARN, "Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    tag = lookup_tag(id);
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        /* read-only tags do not have any set functions. */
+        if(!tag->vtable->set_uint8) {
+            pdebug(DEBUG_WARN,"Tag does not support set operations!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            rc = PLCTAG_ERR_NO_DATA;
+            break;
+        }
+
+        if(offset < 0 || length < 0 || length > tag->size - offset) {
+            pdebug(DEBUG_WARN,"Data offset or length out of bounds.");
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        mem_copy(tag->data + offset, buffer, length);
+
+        mark_dirty(tag, offset, length);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
 }
 
 
+LIB_EXPORT int plc_tag_get_bit(int32_t id, int offset_bit)
+{
+    int res = PLCTAG_ERR_OUT_OF_BOUNDS;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        /* is there a function? */
+        if(!tag->vtable->get_bit) {
+            pdebug(DEBUG_WARN,"Tag does not support get bit operation!");
+            res = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        res = tag->vtable->get_bit(tag, offset_bit);
+    }
 
-/*
- * plc_tag_unregister_logger
- *
- * This function removes the logger callback already registered for the library.
- *
- * Return values:
- *
- * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
- * An error of PLCTAG_ERR_NOT_FOUND is returned if there was no registered callback.
- */
+    rc_dec(tag);
 
-LIB_EXPORT int plc_tag_unregister_logger(void)
-{
-    pdebug(DEBUG_DETAIL, "Starting");
-    return debug_unregister_logger();
+    return res;
 }
 
 
-
-/*
- * plc_tag_lock
- *
- * Lock the tag against use by other threads.  Because operations on a tag are
- * very much asynchronous, actions like getting and extracting the data from
- * a tag take more than one API call.  If more than one thread is using the same tag,
- * then the internal state of the tag will get broken and you will probably experience
- * a crash.
- *
- * This should be used to initially lock a tag when starting operations with it
- * followed by a call to plc_tag_unlock when you have everything you need from the tag.
- */
-
-LIB_EXPORT int plc_tag_lock(int32_t id)
+LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
 {
-    int rc = PLCTAG_STATUS_OK;
+    int res = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
@@ -793,70 +3152,62 @@ LIB_EXPORT int plc_tag_lock(int32_t id)
     }
 
     critical_block(tag->api_mutex) {
-        rc = mutex_lock(tag->ext_mutex);
+        /* is there a function? */
+        if(!tag->vtable->get_bit) {
+            pdebug(DEBUG_WARN,"Tag does not support set bit operation!");
+            res = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        res = tag->vtable->set_bit(tag, offset_bit, val);
+
+        if(res == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset_bit / 8, 1);
+        }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done.");
-
-    return rc;
+    return res;
 }
 
 
 
-
-/*
- * plc_tag_unlock
- *
- * The opposite action of plc_tag_unlock.  This allows other threads to access the
- * tag.
- */
-
-LIB_EXPORT int plc_tag_unlock(int32_t id)
+LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
 {
-    int rc = PLCTAG_STATUS_OK;
+    uint64_t res = UINT64_MAX;
     plc_tag_p tag = lookup_tag(id);
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+        return res;
     }
 
     critical_block(tag->api_mutex) {
-        rc = mutex_unlock(tag->ext_mutex);
+        /* is there a function? */
+        if(!tag->vtable->get_uint64) {
+            pdebug(DEBUG_WARN,"Tag does not support get uint64 operation!");
+            break;
+        }
+
+        res = tag->vtable->get_uint64(tag, offset);
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done.");
-
-    return rc;
+    return res;
 }
 
 
 
-
-/*
- * plc_tag_abort()
- *
- * This function calls through the vtable in the passed tag to call
- * the protocol-specific implementation.
- *
- * The implementation must do whatever is necessary to abort any
- * ongoing IO.
- *
- * The status of the operation is returned.
- */
-
-int plc_tag_abort(int32_t id)
+LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
@@ -864,221 +3215,127 @@ int plc_tag_abort(int32_t id)
     }
 
     critical_block(tag->api_mutex) {
-        /* who knows what state the tag data is in.  */
-        tag->read_cache_expire = (uint64_t)0;
-
-        if(!tag->vtable || !tag->vtable->abort) {
-            pdebug(DEBUG_WARN,"Tag does not have a abort function!");
-            rc = PLCTAG_ERR_NOT_IMPLEMENTED;
+        /* is there a function? */
+        if(!tag->vtable->set_uint64) {
+            pdebug(DEBUG_WARN,"Tag does not support set uint64 operation!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
         }
 
-        /* this may be synchronous. */
-        rc = tag->vtable->abort(tag);
-    }
+        rc = tag->vtable->set_uint64(tag, offset, val);
 
-    if(tag->callback) {
-        tag->callback(id, PLCTAG_EVENT_ABORTED, PLCTAG_STATUS_OK);
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 8);
+        }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done.");
-
     return rc;
 }
 
 
 
 
-/*
- * plc_tag_destroy()
- *
- * Remove all implementation specific details about a tag and clear its
- * memory.
- */
-
-
-LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
+LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
 {
-    plc_tag_p tag = NULL;
-
-    pdebug(DEBUG_INFO, "Starting.");
-
-    if(tag_id <= 0 || tag_id >= TAG_ID_MASK) {
-        pdebug(DEBUG_WARN, "Called with zero or invalid tag!");
-        return PLCTAG_ERR_NULL_PTR;
-    }
+    int64_t res = INT64_MIN;
+    plc_tag_p tag = lookup_tag(id);
 
-    critical_block(tag_lookup_mutex) {
-        tag = hashtable_remove(tags, tag_id);
-    }
+    pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
-        pdebug(DEBUG_WARN, "Called with non-existent tag!");
-        return PLCTAG_ERR_NOT_FOUND;
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
     }
 
-    /* abort anything in flight */
-    pdebug(DEBUG_DETAIL, "Aborting any in-flight operations.");
-
     critical_block(tag->api_mutex) {
-        if(!tag->vtable || !tag->vtable->abort) {
-            pdebug(DEBUG_WARN,"Tag does not have a abort function!");
+        /* is there a function? */
+        if(!tag->vtable->get_int64) {
+            pdebug(DEBUG_WARN,"Tag does not support get int64 operation!");
+            break;
         }
 
-        /* Force a clean up. */
-        tag->vtable->abort(tag);
-    }
-
-    if(tag->callback) {
-        tag->callback(tag_id, PLCTAG_EVENT_DESTROYED, PLCTAG_STATUS_OK);
+        res = tag->vtable->get_int64(tag, offset);
     }
 
-    /* release the reference outside the mutex. */
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done.");
-
-    debug_set_tag_id(0);
-
-    return PLCTAG_STATUS_OK;
+    return res;
 }
 
 
 
-
-
-/*
- * plc_tag_read()
- *
- * This function calls through the vtable in the passed tag to call
- * the protocol-specific implementation.  That starts the read operation.
- * If there is a timeout passed, then this routine waits for either
- * a timeout or an error.
- *
- * The status of the operation is returned.
- */
-
-LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
+LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t val)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    if(tag->callback) {
-        tag->callback(id, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
-    }
-
     critical_block(tag->api_mutex) {
-        /* check read cache, if not expired, return existing data. */
-        if(tag->read_cache_expire > time_ms()) {
-            pdebug(DEBUG_INFO, "Returning cached data.");
-            rc = PLCTAG_STATUS_OK;
+        /* is there a function? */
+        if(!tag->vtable->set_int64) {
+            pdebug(DEBUG_WARN,"Tag does not support set int64 operation!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
             break;
         }
 
-        /* the protocol implementation does not do the timeout. */
-        rc = tag->vtable->read(tag);
+        rc = tag->vtable->set_int64(tag, offset, val);
 
-        /* if error, return now */
-        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
-            break;
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 8);
         }
+    }
 
-        /* set up the cache time.  This works when read_cache_ms is zero as it is already expired. */
-        tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+    rc_dec(tag);
 
-        /*
-         * if there is a timeout, then loop until we get
-         * an error or we timeout.
-         */
-        if(timeout) {
-            int64_t timeout_time = timeout + time_ms();
-            int64_t start_time = time_ms();
+    return rc;
+}
 
-            while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
-                /* give some time to the tickler function. */
-                if(tag->vtable->tickler) {
-                    tag->vtable->tickler(tag);
-                }
 
-                rc = tag->vtable->status(tag);
 
-                /*
-                 * terminate early and do not wait again if the
-                 * IO is done.
-                 */
-                if(rc != PLCTAG_STATUS_PENDING) {
-                    break;
-                }
 
-                sleep_ms(1); /* MAGIC */
-            }
 
-            /*
-             * if we dropped out of the while loop but the status is
-             * still pending, then we timed out.
-             *
-             * Abort the operation and set the status to show the timeout.
-             */
-            if(rc != PLCTAG_STATUS_OK) {
-                /* abort the request. */
-                if(tag->vtable->abort) {
-                    tag->vtable->abort(tag);
-                }
 
-                /* translate error if we are still pending. */
-                if(rc == PLCTAG_STATUS_PENDING) {
-                    pdebug(DEBUG_WARN, "Read operation timed out.");
-                    rc = PLCTAG_ERR_TIMEOUT;
-                }
-            }
 
-            /* don't trigger the callback twice. */
-            if(tag->read_complete) {
-                tag->read_complete = 0;
-            }
 
-            pdebug(DEBUG_INFO,"elapsed time %ldms",(time_ms()-start_time));
-        }
-    } /* end of api mutex block */
 
-    if(tag->callback) {
-        if(timeout) {
-            tag->callback(id, PLCTAG_EVENT_READ_COMPLETED, rc);
+LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset)
+{
+    uint32_t res = UINT32_MAX;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
+    }
+
+    critical_block(tag->api_mutex) {
+        /* is there a function? */
+        if(!tag->vtable->get_uint32) {
+            pdebug(DEBUG_WARN,"Tag does not support get uint32 operation!");
+            break;
         }
+
+        res = tag->vtable->get_uint32(tag, offset);
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done");
-
-    return rc;
+    return res;
 }
 
 
 
-
-
-
-/*
- * plc_tag_status
- *
- * Return the current status of the tag.  This will be PLCTAG_STATUS_PENDING if there is
- * an uncompleted IO operation.  It will be PLCTAG_STATUS_OK if everything is fine.  Other
- * errors will be returned as appropriate.
- *
- * This is a function provided by the underlying protocol implementation.
- */
-
-
-int plc_tag_status(int32_t id)
+LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
@@ -1091,126 +3348,86 @@ int plc_tag_status(int32_t id)
     }
 
     critical_block(tag->api_mutex) {
-        if(tag && tag->vtable->tickler) {
-            tag->vtable->tickler(tag);
+        /* is there a function? */
+        if(!tag->vtable->set_uint32) {
+            pdebug(DEBUG_WARN,"Tag does not support set uint32 operation!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
         }
 
-        rc = tag->vtable->status(tag);
+        rc = tag->vtable->set_uint32(tag, offset, val);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 4);
+        }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_SPEW, "Done with rc=%s.", plc_tag_decode_error(rc));
-
     return rc;
 }
 
 
 
 
-
-/*
- * plc_tag_write()
- *
- * This function calls through the vtable in the passed tag to call
- * the protocol-specific implementation.  That starts the write operation.
- * If there is a timeout passed, then this routine waits for either
- * a timeout or an error.
- *
- * The status of the operation is returned.
- */
-
-LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
+LIB_EXPORT int32_t  plc_tag_get_int32(int32_t id, int offset)
 {
-    int rc = PLCTAG_STATUS_OK;
+    int32_t res = INT32_MIN;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
-
-    if(tag->callback) {
-        tag->callback(id, PLCTAG_EVENT_WRITE_STARTED, PLCTAG_STATUS_OK);
+        return res;
     }
 
     critical_block(tag->api_mutex) {
-        /* the protocol implementation does not do the timeout. */
-        rc = tag->vtable->write(tag);
-
-        /* if error, return now */
-        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Response from write command is not OK!");
+        /* is there a function? */
+        if(!tag->vtable->get_int32) {
+            pdebug(DEBUG_WARN,"Tag does not support get int32 operation!");
             break;
         }
 
-        /*
-         * if there is a timeout, then loop until we get
-         * an error or we timeout.
-         */
-        if(timeout) {
-            int64_t start_time = time_ms();
-            int64_t timeout_time = timeout + start_time;
+        res = tag->vtable->get_int32(tag, offset);
+    }
 
-            while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
-                /* give some time to the tickler function. */
-                if(tag->vtable->tickler) {
-                    tag->vtable->tickler(tag);
-                }
+    rc_dec(tag);
 
-                rc = tag->vtable->status(tag);
+    return res;
+}
 
-                /*
-                 * terminate early and do not wait again if the
-                 * IO is done.
-                 */
-                if(rc != PLCTAG_STATUS_PENDING) {
-                    break;
-                }
 
-                sleep_ms(1); /* MAGIC */
-            }
 
-            /*
-             * if we dropped out of the while loop but the status is
-             * still pending, then we timed out.
-             *
-             * Abort the operation and set the status to show the timeout.
-             */
-            if(rc != PLCTAG_STATUS_OK) {
-                /* abort the request. */
-                if(tag->vtable->abort) {
-                    tag->vtable->abort(tag);
-                }
+LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t val)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
 
-                /* translate error if we are still pending. */
-                if(rc == PLCTAG_STATUS_PENDING) {
-                    pdebug(DEBUG_WARN, "Write operation timed out.");
-                    rc = PLCTAG_ERR_TIMEOUT;
-                }
-            }
+    pdebug(DEBUG_SPEW, "Starting.");
 
-            /* don't trigger the callback twice. */
-            if(tag->write_complete) {
-                tag->write_complete = 0;
-            }
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
 
-            pdebug(DEBUG_INFO,"elapsed time %lldms",(time_ms()-start_time));
+    critical_block(tag->api_mutex) {
+        /* is there a function? */
+        if(!tag->vtable->set_int32) {
+            pdebug(DEBUG_WARN,"Tag does not support set int32 operation!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
         }
-    } /* end of api mutex block */
 
-    if(tag->callback) {
-        if(timeout) {
-            tag->callback(id, PLCTAG_EVENT_WRITE_COMPLETED, rc);
+        rc = tag->vtable->set_int32(tag, offset, val);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 4);
         }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done");
-
     return rc;
 }
 
@@ -1218,122 +3435,113 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
 
 
 
-/*
- * Tag data accessors.
- */
 
 
 
 
-LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, int default_value)
+LIB_EXPORT uint16_t plc_tag_get_uint16(int32_t id, int offset)
 {
-    int res = default_value;
-    plc_tag_p tag = NULL;
+    uint16_t res = UINT16_MAX;
+    plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    /* get library attributes */
-    if(id == 0) {
-        if(str_cmp_i(attrib_name, "version_major") == 0) {
-            res = (int)version_major;
-        } else if(str_cmp_i(attrib_name, "version_minor") == 0) {
-            res = (int)version_minor;
-        } else if(str_cmp_i(attrib_name, "version_patch") == 0) {
-            res = (int)version_patch;
-        } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
-            res = (int)get_debug_level();
-        }
-    } else {
-        tag = lookup_tag(id);
-
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            return default_value;
-        }
-
-        critical_block(tag->api_mutex) {
-            /* match the generic ones first. */
-            if(str_cmp_i(attrib_name, "size") == 0) {
-                res = (int)tag->size;
-            } else if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
-                /* FIXME - what happens if this overflows? */
-                res = (int)tag->read_cache_ms;
-            } else  {
-                if(tag->vtable->get_int_attrib) {
-                    res = tag->vtable->get_int_attrib(tag, attrib_name, default_value);
-                }
-            }
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
+    }
 
+    critical_block(tag->api_mutex) {
+        /* is there a function? */
+        if(!tag->vtable->get_uint16) {
+            pdebug(DEBUG_WARN,"Tag does not support get uint16 operation!");
+            break;
         }
 
-        rc_dec(tag);
+        res = tag->vtable->get_uint16(tag, offset);
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    rc_dec(tag);
 
     return res;
 }
 
 
 
-LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, int new_value)
+
+LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
 {
-    int res = PLCTAG_ERR_NOT_FOUND;
-    plc_tag_p tag = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    /* get library attributes */
-    if(id == 0) {
-        if(str_cmp_i(attrib_name, "debug_level") == 0) {
-            if(new_value >= DEBUG_ERROR && new_value < DEBUG_SPEW) {
-                set_debug_level(new_value);
-                res = PLCTAG_STATUS_OK;
-            } else {
-                res = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        /* is there a function? */
+        if(!tag->vtable->set_uint16) {
+            pdebug(DEBUG_WARN,"Tag does not support set uint16 operation!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
         }
-    } else {
-        tag = lookup_tag(id);
 
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            return PLCTAG_ERR_NOT_FOUND;
+        rc = tag->vtable->set_uint16(tag, offset, val);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 2);
         }
+    }
 
-        critical_block(tag->api_mutex) {
-            /* match the generic ones first. */
-            if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
-                if(new_value >= 0) {
-                    /* expire the cache. */
-                    tag->read_cache_expire = (int64_t)0;
-                    tag->read_cache_ms = (int64_t)new_value;
-                    res = PLCTAG_STATUS_OK;
-                } else {
-                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
-                }
-            } else {
-                if(tag->vtable->set_int_attrib) {
-                    res = tag->vtable->set_int_attrib(tag, attrib_name, new_value);
-                }
-            }
+    rc_dec(tag);
+
+    return rc;
+}
+
+
+
+
+
+
+
+
+
+LIB_EXPORT int16_t  plc_tag_get_int16(int32_t id, int offset)
+{
+    int16_t res = INT16_MIN;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
+    }
+
+    critical_block(tag->api_mutex) {
+        /* is there a function? */
+        if(!tag->vtable->get_int16) {
+            pdebug(DEBUG_WARN,"Tag does not support get int16 operation!");
+            break;
         }
 
+        res = tag->vtable->get_int16(tag, offset);
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_SPEW, "Done.");
-
     return res;
 }
 
 
 
 
-LIB_EXPORT int plc_tag_get_size(int32_t id)
+LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t val)
 {
-    int result = 0;
+    int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1344,39 +3552,52 @@ LIB_EXPORT int plc_tag_get_size(int32_t id)
     }
 
     critical_block(tag->api_mutex) {
-        result = tag->size;
+        /* is there a function? */
+        if(!tag->vtable->set_int16) {
+            pdebug(DEBUG_WARN,"Tag does not support set int16 operation!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        rc = tag->vtable->set_int16(tag, offset, val);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 2);
+        }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_SPEW, "Done.");
-
-    return result;
+    return rc;
 }
 
 
 
-LIB_EXPORT int plc_tag_get_bit(int32_t id, int offset_bit)
+
+
+
+
+
+LIB_EXPORT uint8_t plc_tag_get_uint8(int32_t id, int offset)
 {
-    int res = PLCTAG_ERR_OUT_OF_BOUNDS;
+    uint8_t res = UINT8_MAX;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+        return res;
     }
 
     critical_block(tag->api_mutex) {
         /* is there a function? */
-        if(!tag->vtable->get_bit) {
-            pdebug(DEBUG_WARN,"Tag does not support get bit operation!");
-            res = PLCTAG_ERR_UNSUPPORTED;
+        if(!tag->vtable->get_uint8) {
+            pdebug(DEBUG_WARN,"Tag does not support get uint8 operation!");
             break;
         }
 
-        res = tag->vtable->get_bit(tag, offset_bit);
+        res = tag->vtable->get_uint8(tag, offset);
     }
 
     rc_dec(tag);
@@ -1385,9 +3606,11 @@ LIB_EXPORT int plc_tag_get_bit(int32_t id, int offset_bit)
 }
 
 
-LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
+
+
+LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val)
 {
-    int res = PLCTAG_STATUS_OK;
+    int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1399,25 +3622,31 @@ LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
 
     critical_block(tag->api_mutex) {
         /* is there a function? */
-        if(!tag->vtable->get_bit) {
-            pdebug(DEBUG_WARN,"Tag does not support set bit operation!");
-            res = PLCTAG_ERR_UNSUPPORTED;
+        if(!tag->vtable->set_uint8) {
+            pdebug(DEBUG_WARN,"Tag does not support set uint8 operation!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
             break;
         }
 
-        res = tag->vtable->set_bit(tag, offset_bit, val);
+        rc = tag->vtable->set_uint8(tag, offset, val);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 1);
+        }
     }
 
     rc_dec(tag);
 
-    return res;
+    return rc;
 }
 
 
 
-LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
+
+
+LIB_EXPORT int8_t plc_tag_get_int8(int32_t id, int offset)
 {
-    uint64_t res = UINT64_MAX;
+    int8_t res = INT8_MIN;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1429,12 +3658,12 @@ LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
 
     critical_block(tag->api_mutex) {
         /* is there a function? */
-        if(!tag->vtable->get_uint64) {
-            pdebug(DEBUG_WARN,"Tag does not support get uint64 operation!");
+        if(!tag->vtable->get_int8) {
+            pdebug(DEBUG_WARN,"Tag does not support get int8 operation!");
             break;
         }
 
-        res = tag->vtable->get_uint64(tag, offset);
+        res = tag->vtable->get_int8(tag, offset);
     }
 
     rc_dec(tag);
@@ -1444,7 +3673,8 @@ LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
 
 
 
-LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
+
+LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t val)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
@@ -1458,13 +3688,17 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
 
     critical_block(tag->api_mutex) {
         /* is there a function? */
-        if(!tag->vtable->set_uint64) {
-            pdebug(DEBUG_WARN,"Tag does not support set uint64 operation!");
+        if(!tag->vtable->set_int8) {
+            pdebug(DEBUG_WARN,"Tag does not support set int8 operation!");
             rc = PLCTAG_ERR_UNSUPPORTED;
             break;
         }
 
-        rc = tag->vtable->set_uint64(tag, offset, val);
+        rc = tag->vtable->set_int8(tag, offset, val);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 1);
+        }
     }
 
     rc_dec(tag);
@@ -1475,9 +3709,11 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
 
 
 
-LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
+
+
+LIB_EXPORT double plc_tag_get_float64(int32_t id, int offset)
 {
-    int64_t res = INT64_MIN;
+    double res = DBL_MAX;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1489,12 +3725,12 @@ LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
 
     critical_block(tag->api_mutex) {
         /* is there a function? */
-        if(!tag->vtable->get_int64) {
-            pdebug(DEBUG_WARN,"Tag does not support get int64 operation!");
+        if(!tag->vtable->get_float64) {
+            pdebug(DEBUG_WARN,"Tag does not support get float64 operation!");
             break;
         }
 
-        res = tag->vtable->get_int64(tag, offset);
+        res = tag->vtable->get_float64(tag, offset);
     }
 
     rc_dec(tag);
@@ -1504,7 +3740,8 @@ LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
 
 
 
-LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t val)
+
+LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double val)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
@@ -1518,13 +3755,17 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t val)
 
     critical_block(tag->api_mutex) {
         /* is there a function? */
-        if(!tag->vtable->set_int64) {
-            pdebug(DEBUG_WARN,"Tag does not support set int64 operation!");
+        if(!tag->vtable->set_float64) {
+            pdebug(DEBUG_WARN,"Tag does not support set float64 operation!");
             rc = PLCTAG_ERR_UNSUPPORTED;
             break;
         }
 
-        rc = tag->vtable->set_int64(tag, offset, val);
+        rc = tag->vtable->set_float64(tag, offset, val);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 8);
+        }
     }
 
     rc_dec(tag);
@@ -1534,15 +3775,9 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t val)
 
 
 
-
-
-
-
-
-
-LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset)
+LIB_EXPORT float plc_tag_get_float32(int32_t id, int offset)
 {
-    uint32_t res = UINT32_MAX;
+    float res = FLT_MAX;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1554,12 +3789,12 @@ LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset)
 
     critical_block(tag->api_mutex) {
         /* is there a function? */
-        if(!tag->vtable->get_uint32) {
-            pdebug(DEBUG_WARN,"Tag does not support get uint32 operation!");
+        if(!tag->vtable->get_float32) {
+            pdebug(DEBUG_WARN,"Tag does not support get float32 operation!");
             break;
         }
 
-        res = tag->vtable->get_uint32(tag, offset);
+        res = tag->vtable->get_float32(tag, offset);
     }
 
     rc_dec(tag);
@@ -1569,7 +3804,8 @@ LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset)
 
 
 
-LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
+
+LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float val)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
@@ -1583,13 +3819,17 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
 
     critical_block(tag->api_mutex) {
         /* is there a function? */
-        if(!tag->vtable->set_uint32) {
-            pdebug(DEBUG_WARN,"Tag does not support set uint32 operation!");
+        if(!tag->vtable->set_float32) {
+            pdebug(DEBUG_WARN,"Tag does not support set float32 operation!");
             rc = PLCTAG_ERR_UNSUPPORTED;
             break;
         }
 
-        rc = tag->vtable->set_uint32(tag, offset, val);
+        rc = tag->vtable->set_float32(tag, offset, val);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mark_dirty(tag, offset, 4);
+        }
     }
 
     rc_dec(tag);
@@ -1600,545 +3840,1155 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
 
 
 
-LIB_EXPORT int32_t  plc_tag_get_int32(int32_t id, int offset)
+/*
+ * Typed array accessors.
+ *
+ * These copy count elements starting at the byte offset in the tag data
+ * to or from the passed array.  The elements are converted between the
+ * tag byte order and the host byte order as a block.  The whole range
+ * must be within the tag data.
+ */
+
+LIB_EXPORT int plc_tag_get_uint64_array(int32_t id, int offset, uint64_t *buffer, int count)
 {
-    int32_t res = INT32_MIN;
-    plc_tag_p tag = lookup_tag(id);
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(uint64_t), count);
+}
 
-    pdebug(DEBUG_SPEW, "Starting.");
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+LIB_EXPORT int plc_tag_set_uint64_array(int32_t id, int offset, uint64_t *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(uint64_t), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_int64_array(int32_t id, int offset, int64_t *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(int64_t), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_int64_array(int32_t id, int offset, int64_t *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(int64_t), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_uint32_array(int32_t id, int offset, uint32_t *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(uint32_t), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_uint32_array(int32_t id, int offset, uint32_t *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(uint32_t), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_int32_array(int32_t id, int offset, int32_t *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(int32_t), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_int32_array(int32_t id, int offset, int32_t *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(int32_t), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_uint16_array(int32_t id, int offset, uint16_t *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(uint16_t), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_uint16_array(int32_t id, int offset, uint16_t *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(uint16_t), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_int16_array(int32_t id, int offset, int16_t *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(int16_t), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_int16_array(int32_t id, int offset, int16_t *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(int16_t), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_uint8_array(int32_t id, int offset, uint8_t *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(uint8_t), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_uint8_array(int32_t id, int offset, uint8_t *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(uint8_t), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_int8_array(int32_t id, int offset, int8_t *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(int8_t), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_int8_array(int32_t id, int offset, int8_t *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(int8_t), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_float64_array(int32_t id, int offset, double *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(double), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_float64_array(int32_t id, int offset, double *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(double), count);
+}
+
+
+
+LIB_EXPORT int plc_tag_get_float32_array(int32_t id, int offset, float *buffer, int count)
+{
+    return get_array(id, offset, (uint8_t *)buffer, (int)sizeof(float), count);
+}
+
+
+LIB_EXPORT int plc_tag_set_float32_array(int32_t id, int offset, float *buffer, int count)
+{
+    return set_array(id, offset, (uint8_t *)buffer, (int)sizeof(float), count);
+}
+
+
+
+/*****************************************************************************************************
+ *****************************  Support routines for extra indirection *******************************
+ ****************************************************************************************************/
+
+
+plc_tag_p lookup_tag(int32_t tag_id)
+{
+    plc_tag_p tag = NULL;
+
+    if(tag_id <= 0 || tag_id > TAG_ID_MASK) {
+        pdebug(DEBUG_WARN, "Tag ID %d is not valid.", tag_id);
+        return NULL;
+    }
+
+    tag = tag_slot_get_tag(get_tag_slot(tag_id & TAG_INDEX_MASK), tag_id);
+
+    if(tag) {
+        debug_set_tag_id(tag->tag_id);
+        pdebug(DEBUG_SPEW, "Found tag %p with id %d.", tag, tag->tag_id);
+    } else {
+        debug_set_tag_id(0);
+        pdebug(DEBUG_WARN, "Tag with ID %d not found.", tag_id);
+    }
+
+    return tag;
+}
+
+
+
+/*
+ * plc_tag_signal_completion
+ *
+ * Called by the protocol layers when a response for a tag comes in.
+ * This wakes up any thread waiting in a synchronous read or write and
+ * puts the tag on the tickler's list.
+ */
+void plc_tag_signal_completion(int32_t tag_id)
+{
+    tag_slot_p slot = NULL;
+
+    if(tag_id <= 0 || tag_id > TAG_ID_MASK) {
+        return;
+    }
+
+    slot = get_tag_slot(tag_id & TAG_INDEX_MASK);
+    if(!slot) {
+        return;
     }
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->get_int32) {
-            pdebug(DEBUG_WARN,"Tag does not support get int32 operation!");
-            break;
+    /* the tag cannot go away while we are counted as a reader. */
+    atomic_int32_add(&slot->readers, 1);
+
+    if(atomic_int32_get(&slot->tag_id) == tag_id) {
+        if(slot->tag->tag_cond_wait) {
+            cond_signal(slot->tag->tag_cond_wait);
         }
 
-        res = tag->vtable->get_int32(tag, offset);
+        /* the tickler needs to process the response. */
+        tickler_schedule(slot->tag);
     }
 
-    rc_dec(tag);
-
-    return res;
+    atomic_int32_add(&slot->readers, -1);
 }
 
 
 
-LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t val)
+/*
+ * wait_for_completion
+ *
+ * Wait for the operation in flight on the tag to finish or for the
+ * timeout to pass.  The API mutex must not be held.  The tag is signaled
+ * when a response comes in, so we only run the tickler when there is
+ * something for it to do.
+ */
+int wait_for_completion(plc_tag_p tag, int64_t timeout_time)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
+    int rc = PLCTAG_STATUS_PENDING;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
+        critical_block(tag->api_mutex) {
+            /* give some time to the tickler function. */
+            if(tag->vtable->tickler) {
+                tag->vtable->tickler(tag);
+            }
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
+            rc = tag->vtable->status(tag);
+        }
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->set_int32) {
-            pdebug(DEBUG_WARN,"Tag does not support set int32 operation!");
-            rc = PLCTAG_ERR_UNSUPPORTED;
+        /*
+         * terminate early and do not wait again if the
+         * IO is done.
+         */
+        if(rc != PLCTAG_STATUS_PENDING) {
             break;
         }
 
-        rc = tag->vtable->set_int32(tag, offset, val);
+        cond_wait(tag->tag_cond_wait, (int)(timeout_time - time_ms()));
     }
 
-    rc_dec(tag);
-
     return rc;
 }
 
 
 
+/*
+ * do_many
+ *
+ * Common code for plc_tag_read_many() and plc_tag_write_many().  All
+ * operations are started first so that the requests sit in the
+ * session queues together.  Then we wait on each tag in turn with the
+ * same deadline, so the total wait is bounded by the single timeout.
+ */
+int do_many(int32_t *ids, int num_tags, int *statuses, int timeout, int is_write)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p *tag_list = NULL;
+    plc_tag_p *lock_order = NULL;
+    int *sync_ops = NULL;
+    int64_t timeout_time = time_ms() + timeout;
+    int start_event = (is_write ? PLCTAG_EVENT_WRITE_STARTED : PLCTAG_EVENT_READ_STARTED);
+    int completed_event = (is_write ? PLCTAG_EVENT_WRITE_COMPLETED : PLCTAG_EVENT_READ_COMPLETED);
 
+    pdebug(DEBUG_DETAIL, "Starting.");
 
+    if(!ids || !statuses || num_tags <= 0 || timeout < 0) {
+        pdebug(DEBUG_WARN, "Called with bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
 
+    tag_list = (plc_tag_p *)mem_alloc((int)(sizeof(plc_tag_p) * (size_t)num_tags));
+    lock_order = (plc_tag_p *)mem_alloc((int)(sizeof(plc_tag_p) * (size_t)num_tags));
+    sync_ops = (int *)mem_alloc((int)(sizeof(int) * (size_t)num_tags));
 
+    if(!tag_list || !lock_order || !sync_ops) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag list!");
 
+        if(tag_list) {
+            mem_free(tag_list);
+        }
 
-LIB_EXPORT uint16_t plc_tag_get_uint16(int32_t id, int offset)
-{
-    uint16_t res = UINT16_MAX;
-    plc_tag_p tag = lookup_tag(id);
+        if(lock_order) {
+            mem_free(lock_order);
+        }
 
-    pdebug(DEBUG_SPEW, "Starting.");
+        if(sync_ops) {
+            mem_free(sync_ops);
+        }
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+        return PLCTAG_ERR_NO_MEM;
     }
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->get_uint16) {
-            pdebug(DEBUG_WARN,"Tag does not support get uint16 operation!");
-            break;
+    for(int i=0; i < num_tags; i++) {
+        tag_list[i] = lookup_tag(ids[i]);
+        lock_order[i] = tag_list[i];
+
+        if(tag_list[i] && tag_list[i]->callback) {
+            tag_list[i]->callback(ids[i], start_event, PLCTAG_STATUS_OK);
         }
+    }
 
-        res = tag->vtable->get_uint16(tag, offset);
+    /*
+     * only one synchronous operation at a time waits on a tag.  Lock the
+     * tags in address order so that two overlapping calls cannot deadlock.
+     */
+    if(timeout) {
+        qsort(lock_order, (size_t)num_tags, sizeof(plc_tag_p), compare_tag_ptrs);
+
+        for(int i=0; i < num_tags; i++) {
+            if(lock_order[i] && (i == 0 || lock_order[i] != lock_order[i-1])) {
+                mutex_lock(lock_order[i]->sync_op_mutex);
+            }
+        }
     }
 
-    rc_dec(tag);
+    /* start all the operations. */
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_p tag = tag_list[i];
 
-    return res;
-}
+        if(!tag) {
+            pdebug(DEBUG_WARN, "Tag %d not found.", ids[i]);
+            statuses[i] = PLCTAG_ERR_NOT_FOUND;
+            continue;
+        }
 
+        critical_block(tag->api_mutex) {
+            /* check read cache, if not expired, return existing data. */
+            if(!is_write && tag->read_cache_expire > time_ms()) {
+                pdebug(DEBUG_DETAIL, "Returning cached data for tag %d.", ids[i]);
+                statuses[i] = PLCTAG_STATUS_OK;
+                break;
+            }
 
+            /* the tag is in the list more than once, the first entry does the work. */
+            if(timeout && tag->sync_op_in_progress) {
+                pdebug(DEBUG_DETAIL, "Tag %d is already in the list.", ids[i]);
+                statuses[i] = PLCTAG_STATUS_PENDING;
+                break;
+            }
 
+            /* if we are going to wait, get rid of any old signal first. */
+            if(timeout) {
+                cond_clear(tag->tag_cond_wait);
+                tag->sync_op_in_progress = 1;
+                sync_ops[i] = 1;
+            }
 
-LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
-{
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
+            /* the protocol implementation does not do the timeout. */
+            statuses[i] = (is_write ? tag->vtable->write(tag) : tag->vtable->read(tag));
 
-    pdebug(DEBUG_SPEW, "Starting.");
+            if(statuses[i] != PLCTAG_STATUS_PENDING && statuses[i] != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to start operation on tag %d, got error %s!", ids[i], plc_tag_decode_error(statuses[i]));
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
+                if(sync_ops[i]) {
+                    tag->sync_op_in_progress = 0;
+                    sync_ops[i] = 0;
+                }
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->set_uint16) {
-            pdebug(DEBUG_WARN,"Tag does not support set uint16 operation!");
-            rc = PLCTAG_ERR_UNSUPPORTED;
-            break;
-        }
+                break;
+            }
 
-        rc = tag->vtable->set_uint16(tag, offset, val);
+            if(!is_write) {
+                tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+            } else {
+                tag->auto_sync_write_dirty = 0;
+            }
+
+            tickler_schedule(tag);
+        }
     }
 
-    rc_dec(tag);
+    /* now wait for all of them with the same deadline. */
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_p tag = tag_list[i];
 
-    return rc;
-}
+        if(!tag || !sync_ops[i]) {
+            continue;
+        }
 
+        if(statuses[i] == PLCTAG_STATUS_PENDING) {
+            statuses[i] = wait_for_completion(tag, timeout_time);
+        }
 
+        critical_block(tag->api_mutex) {
+            /*
+             * the deadline may have passed while we waited for earlier
+             * tags.  Check one last time before giving up on this one.
+             */
+            if(statuses[i] == PLCTAG_STATUS_PENDING) {
+                if(tag->vtable->tickler) {
+                    tag->vtable->tickler(tag);
+                }
 
+                statuses[i] = tag->vtable->status(tag);
+            }
 
+            if(statuses[i] != PLCTAG_STATUS_OK) {
+                if(tag->vtable->abort) {
+                    tag->vtable->abort(tag);
+                }
 
+                if(statuses[i] == PLCTAG_STATUS_PENDING) {
+                    pdebug(DEBUG_WARN, "Operation on tag %d timed out.", ids[i]);
+                    statuses[i] = PLCTAG_ERR_TIMEOUT;
+                }
+            }
 
+            /* don't trigger the callback twice. */
+            if(is_write) {
+                tag->write_complete = 0;
+            } else {
+                tag->read_complete = 0;
+                tag->data_change_checked = 0;
 
+                /* the sync op flag is not needed after this, reuse it. */
+                if(statuses[i] == PLCTAG_STATUS_OK && check_data_changed(tag)) {
+                    sync_ops[i] = 2;
+                }
+            }
 
+            tag->sync_op_in_progress = 0;
 
-LIB_EXPORT int16_t  plc_tag_get_int16(int32_t id, int offset)
-{
-    int16_t res = INT16_MIN;
-    plc_tag_p tag = lookup_tag(id);
+            /* let the tickler start an automatic write that waited for us. */
+            if(tag->auto_sync_write_dirty) {
+                tickler_schedule(tag);
+            }
+        }
+    }
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    if(timeout) {
+        /* a tag in the list more than once gets the status of its first entry. */
+        for(int i=0; i < num_tags; i++) {
+            if(tag_list[i] && !sync_ops[i] && statuses[i] == PLCTAG_STATUS_PENDING) {
+                for(int j=0; j < i; j++) {
+                    if(tag_list[j] == tag_list[i] && sync_ops[j]) {
+                        statuses[i] = statuses[j];
+                        break;
+                    }
+                }
+            }
+        }
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+        for(int i=0; i < num_tags; i++) {
+            if(lock_order[i] && (i == 0 || lock_order[i] != lock_order[i-1])) {
+                mutex_unlock(lock_order[i]->sync_op_mutex);
+            }
+        }
     }
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->get_int16) {
-            pdebug(DEBUG_WARN,"Tag does not support get int16 operation!");
-            break;
+    /* fire the callbacks, release the tags and find the overall status. */
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_p tag = tag_list[i];
+
+        if(tag) {
+            if(tag->callback && timeout) {
+                tag->callback(ids[i], completed_event, statuses[i]);
+            }
+
+            if(tag->callback && sync_ops[i] == 2) {
+                tag->callback(ids[i], PLCTAG_EVENT_DATA_CHANGED, PLCTAG_STATUS_OK);
+            }
+
+            rc_dec(tag);
         }
 
-        res = tag->vtable->get_int16(tag, offset);
+        if(rc == PLCTAG_STATUS_OK && statuses[i] != PLCTAG_STATUS_OK) {
+            rc = statuses[i];
+        }
     }
 
-    rc_dec(tag);
+    mem_free(tag_list);
+    mem_free(lock_order);
+    mem_free(sync_ops);
 
-    return res;
+    pdebug(DEBUG_DETAIL, "Done with status %s.", plc_tag_decode_error(rc));
+
+    return rc;
 }
 
 
 
+/* order tags by address for locking. */
+int compare_tag_ptrs(const void *a, const void *b)
+{
+    uintptr_t tag_a = (uintptr_t)(*(const plc_tag_p *)a);
+    uintptr_t tag_b = (uintptr_t)(*(const plc_tag_p *)b);
+
+    return (tag_a > tag_b) - (tag_a < tag_b);
+}
+
 
-LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t val)
+
+/*
+ * start_async
+ *
+ * Common code for plc_tag_read_async() and plc_tag_write_async().  The
+ * operation is started like plc_tag_read() or plc_tag_write() with a zero
+ * timeout.  The tickler thread queues the completion when the status is
+ * no longer pending.  Operations that finish right away, like cached
+ * reads, are queued here.
+ */
+int start_async(int32_t id, void *cookie, int is_write)
 {
     int rc = PLCTAG_STATUS_OK;
+    int event = (is_write ? PLCTAG_EVENT_WRITE_COMPLETED : PLCTAG_EVENT_READ_COMPLETED);
+    int done = 0;
     plc_tag_p tag = lookup_tag(id);
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
+    if(tag->callback) {
+        tag->callback(id, (is_write ? PLCTAG_EVENT_WRITE_STARTED : PLCTAG_EVENT_READ_STARTED), PLCTAG_STATUS_OK);
+    }
+
     critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->set_int16) {
-            pdebug(DEBUG_WARN,"Tag does not support set int16 operation!");
-            rc = PLCTAG_ERR_UNSUPPORTED;
+        if(tag->async_event) {
+            pdebug(DEBUG_WARN, "Async operation already in flight!");
+            rc = PLCTAG_ERR_BUSY;
             break;
         }
 
-        rc = tag->vtable->set_int16(tag, offset, val);
+        /* check read cache, if not expired, return existing data. */
+        if(!is_write && tag->read_cache_expire > time_ms()) {
+            pdebug(DEBUG_DETAIL, "Returning cached data.");
+            done = 1;
+            break;
+        }
+
+        rc = (is_write ? tag->vtable->write(tag) : tag->vtable->read(tag));
+
+        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to start operation, got error %s!", plc_tag_decode_error(rc));
+            break;
+        }
+
+        if(!is_write) {
+            tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+        } else {
+            tag->auto_sync_write_dirty = 0;
+        }
+
+        /* tags without a tickler finish in the call. */
+        if(!tag->vtable->tickler && tag->vtable->status(tag) != PLCTAG_STATUS_PENDING) {
+            done = 1;
+            break;
+        }
+
+        tag->async_event = event;
+        tag->async_cookie = cookie;
+
+        tickler_schedule(tag);
+    }
+
+    if(done) {
+        rc = completion_push(id, event, PLCTAG_STATUS_OK, cookie);
     }
 
     rc_dec(tag);
 
-    return rc;
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return (rc == PLCTAG_STATUS_OK ? PLCTAG_STATUS_PENDING : rc);
 }
 
 
 
+/*
+ * completion_push
+ *
+ * Add a completion to the end of the queue, growing it if needed.  The
+ * notifier is signaled when the queue goes from empty to not empty.
+ */
+int completion_push(int32_t tag_id, int event, int status, void *cookie)
+{
+    int rc = PLCTAG_STATUS_OK;
 
+    critical_block(completion_mutex) {
+        if(completion_count >= completion_capacity) {
+            int new_capacity = (completion_capacity ? completion_capacity * 2 : 64); /* MAGIC */
+            plc_tag_completion_t *new_queue = (plc_tag_completion_t *)mem_alloc((int)(sizeof(plc_tag_completion_t) * (size_t)new_capacity));
 
+            if(!new_queue) {
+                pdebug(DEBUG_ERROR, "Unable to grow completion queue!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
 
+            /* unwrap the ring into the new buffer. */
+            for(int i=0; i < completion_count; i++) {
+                new_queue[i] = completion_queue[(completion_head + i) % completion_capacity];
+            }
 
+            if(completion_queue) {
+                mem_free(completion_queue);
+            }
 
-LIB_EXPORT uint8_t plc_tag_get_uint8(int32_t id, int offset)
-{
-    uint8_t res = UINT8_MAX;
-    plc_tag_p tag = lookup_tag(id);
+            completion_queue = new_queue;
+            completion_capacity = new_capacity;
+            completion_head = 0;
+        }
 
-    pdebug(DEBUG_SPEW, "Starting.");
+        {
+            plc_tag_completion_t *entry = &completion_queue[(completion_head + completion_count) % completion_capacity];
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+            entry->tag_id = tag_id;
+            entry->event = event;
+            entry->status = status;
+            entry->cookie = cookie;
+        }
+
+        completion_count++;
+
+        if(completion_count == 1) {
+            notifier_signal(completion_notifier);
+        }
     }
 
+    return rc;
+}
+
+
+
+/*
+ * async_abort
+ *
+ * Queue an aborted completion for any async operation outstanding on the
+ * tag.  Used when the tag is aborted or destroyed.
+ */
+void async_abort(plc_tag_p tag, int32_t tag_id)
+{
+    int event = 0;
+    void *cookie = NULL;
+
     critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->get_uint8) {
-            pdebug(DEBUG_WARN,"Tag does not support get uint8 operation!");
-            break;
-        }
+        event = tag->async_event;
+        cookie = tag->async_cookie;
+        tag->async_event = 0;
+        tag->async_cookie = NULL;
+    }
 
-        res = tag->vtable->get_uint8(tag, offset);
+    if(event) {
+        completion_push(tag_id, event, PLCTAG_ERR_ABORT, cookie);
     }
+}
 
-    rc_dec(tag);
 
-    return res;
+
+/*
+ * get_tag_slot
+ *
+ * Find the slot for the index.  Returns NULL if the chunk holding the
+ * slot has not been allocated yet.  No locks are needed as chunks are
+ * only freed at library teardown.
+ */
+tag_slot_p get_tag_slot(int index)
+{
+    tag_slot_p chunk = tag_chunks[(index >> TAG_CHUNK_BITS) & (TAG_MAX_CHUNKS - 1)];
+
+    if(!chunk) {
+        return NULL;
+    }
+
+    return &chunk[index & (TAG_CHUNK_SIZE - 1)];
 }
 
 
 
-
-LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val)
+/*
+ * tag_slot_get_tag
+ *
+ * Take a reference to the tag in the slot if the slot's tag ID matches
+ * the passed ID.  If the passed ID is zero, any live tag matches.
+ */
+plc_tag_p tag_slot_get_tag(tag_slot_p slot, int32_t id)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
-
-    pdebug(DEBUG_SPEW, "Starting.");
+    plc_tag_p tag = NULL;
+    int32_t slot_tag_id = 0;
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+    if(!slot) {
+        return NULL;
     }
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->set_uint8) {
-            pdebug(DEBUG_WARN,"Tag does not support set uint8 operation!");
-            rc = PLCTAG_ERR_UNSUPPORTED;
-            break;
-        }
+    /* mark that we are looking.  Removal waits for us to finish. */
+    atomic_int32_add(&slot->readers, 1);
 
-        rc = tag->vtable->set_uint8(tag, offset, val);
+    slot_tag_id = atomic_int32_get(&slot->tag_id);
+
+    if(slot_tag_id && (id == 0 || slot_tag_id == id)) {
+        tag = rc_inc(slot->tag);
     }
 
-    rc_dec(tag);
+    atomic_int32_add(&slot->readers, -1);
 
-    return rc;
+    return tag;
 }
 
 
 
-
-
-LIB_EXPORT int8_t plc_tag_get_int8(int32_t id, int offset)
+/*
+ * add_tag_lookup
+ *
+ * Find a free slot for the tag and return the new tag ID.  Free slots
+ * are handed out round robin so that a slot is not reused quickly.  If
+ * there are no free slots, a new chunk of slots is allocated.
+ */
+int add_tag_lookup(plc_tag_p tag)
 {
-    int8_t res = INT8_MIN;
-    plc_tag_p tag = lookup_tag(id);
+    int rc = PLCTAG_ERR_NO_RESOURCES;
+    int new_id = 0;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
-    }
+    critical_block(tag_table_mutex) {
+        int slot_count = tag_slot_count;
+        tag_slot_p slot = NULL;
+        int index = 0;
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->get_int8) {
-            pdebug(DEBUG_WARN,"Tag does not support get int8 operation!");
-            break;
+        for(int i=0; i < slot_count; i++) {
+            index = (next_tag_slot + i) % slot_count;
+
+            if(!get_tag_slot(index)->tag) {
+                slot = get_tag_slot(index);
+                break;
+            }
         }
 
-        res = tag->vtable->get_int8(tag, offset);
-    }
+        if(!slot) {
+            tag_slot_p chunk = NULL;
 
-    rc_dec(tag);
+            if(slot_count >= TAG_MAX_CHUNKS * TAG_CHUNK_SIZE) {
+                pdebug(DEBUG_WARN, "Tag table is full!");
+                rc = PLCTAG_ERR_NO_RESOURCES;
+                break;
+            }
 
-    return res;
-}
+            pdebug(DEBUG_DETAIL, "Allocating new chunk of tag slots.");
 
+            chunk = (tag_slot_p)mem_alloc((int)(sizeof(struct tag_slot_t) * TAG_CHUNK_SIZE));
+            if(!chunk) {
+                pdebug(DEBUG_ERROR, "Unable to allocate tag slots!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
 
+            /* make sure the chunk is visible before the count covers it. */
+            tag_chunks[slot_count >> TAG_CHUNK_BITS] = chunk;
+            atomic_int32_add(&tag_slot_count, TAG_CHUNK_SIZE);
 
+            index = slot_count;
+            slot = chunk;
+        }
 
-LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t val)
-{
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
+        /* bump the generation, skipping zero so that IDs are never zero. */
+        slot->generation = (slot->generation + 1) & TAG_GENERATION_MASK;
+        if(slot->generation == 0) {
+            slot->generation = 1;
+        }
 
-    pdebug(DEBUG_SPEW, "Starting.");
+        new_id = (slot->generation << TAG_INDEX_BITS) | index;
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
+        /* set the tag first so that readers that see the ID also see the tag. */
+        slot->tag = tag;
+        atomic_int32_set(&slot->tag_id, new_id);
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->set_int8) {
-            pdebug(DEBUG_WARN,"Tag does not support set int8 operation!");
-            rc = PLCTAG_ERR_UNSUPPORTED;
-            break;
-        }
+        next_tag_slot = index + 1;
 
-        rc = tag->vtable->set_int8(tag, offset, val);
+        rc = PLCTAG_STATUS_OK;
     }
 
-    rc_dec(tag);
-
-    return rc;
-}
-
+    if(rc != PLCTAG_STATUS_OK) {
+        new_id = rc;
+    }
 
+    pdebug(DEBUG_DETAIL, "Done.");
 
+    return new_id;
+}
 
 
 
-LIB_EXPORT double plc_tag_get_float64(int32_t id, int offset)
+/*
+ * remove_tag_lookup
+ *
+ * Take the tag out of the table and return the table's reference to it.
+ * Once the ID is cleared, no new reader can find the tag.  We wait for
+ * any reader that is still looking at the slot before the slot can be
+ * reused.
+ */
+plc_tag_p remove_tag_lookup(int32_t id)
 {
-    double res = DBL_MAX;
-    plc_tag_p tag = lookup_tag(id);
+    plc_tag_p tag = NULL;
+    tag_slot_p slot = get_tag_slot(id & TAG_INDEX_MASK);
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+    if(!slot) {
+        pdebug(DEBUG_DETAIL, "Slot for tag %d does not exist.", id);
+        return NULL;
     }
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->get_float64) {
-            pdebug(DEBUG_WARN,"Tag does not support get float64 operation!");
+    critical_block(tag_table_mutex) {
+        if(atomic_int32_get(&slot->tag_id) != id) {
             break;
         }
 
-        res = tag->vtable->get_float64(tag, offset);
+        atomic_int32_set(&slot->tag_id, 0);
+
+        /* readers only hold the slot for a few instructions. */
+        while(atomic_int32_get(&slot->readers) > 0) {
+            /* spin */
+        }
+
+        tag = slot->tag;
+        slot->tag = NULL;
     }
 
-    rc_dec(tag);
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    return res;
+    return tag;
 }
 
 
 
-
-LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double val)
+/*
+ * host_is_big_endian
+ *
+ * Returns non-zero if the host stores the most significant byte first.
+ */
+int host_is_big_endian(void)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
+    uint16_t test_val = 1;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    return (*((uint8_t *)&test_val) == 0);
+}
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+
+
+/*
+ * copy_elements
+ *
+ * Copy count elements of elem_size bytes each, reversing the byte order
+ * of each element if swap is set.  The swap loops are kept simple so that
+ * the compiler can turn them into vector byte shuffles.
+ */
+void copy_elements(uint8_t *dest, uint8_t *src, int elem_size, int count, int swap)
+{
+    if(!swap || elem_size == 1) {
+        mem_copy(dest, src, elem_size * count);
+        return;
     }
 
-    critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->set_float64) {
-            pdebug(DEBUG_WARN,"Tag does not support set float64 operation!");
-            rc = PLCTAG_ERR_UNSUPPORTED;
+    switch(elem_size) {
+        case 2:
+            for(int i=0; i < count*2; i += 2) {
+                dest[i] = src[i+1];
+                dest[i+1] = src[i];
+            }
             break;
-        }
 
-        rc = tag->vtable->set_float64(tag, offset, val);
-    }
+        case 4:
+            for(int i=0; i < count*4; i += 4) {
+                dest[i] = src[i+3];
+                dest[i+1] = src[i+2];
+                dest[i+2] = src[i+1];
+                dest[i+3] = src[i];
+            }
+            break;
 
-    rc_dec(tag);
+        case 8:
+            for(int i=0; i < count*8; i += 8) {
+                dest[i] = src[i+7];
+                dest[i+1] = src[i+6];
+                dest[i+2] = src[i+5];
+                dest[i+3] = src[i+4];
+                dest[i+4] = src[i+3];
+                dest[i+5] = src[i+2];
+                dest[i+6] = src[i+1];
+                dest[i+7] = src[i];
+            }
+            break;
 
-    return rc;
+        default:
+            pdebug(DEBUG_WARN, "Unsupported element size %d!", elem_size);
+            break;
+    }
 }
 
 
 
-LIB_EXPORT float plc_tag_get_float32(int32_t id, int offset)
+/*
+ * get_array/set_array
+ *
+ * Common code for the typed array accessors.  The tag mutex is held once
+ * for the whole copy.
+ */
+int get_array(int32_t id, int offset, uint8_t *buffer, int elem_size, int count)
 {
-    float res = FLT_MAX;
-    plc_tag_p tag = lookup_tag(id);
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(!buffer) {
+        pdebug(DEBUG_WARN, "Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    tag = lookup_tag(id);
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+        return PLCTAG_ERR_NOT_FOUND;
     }
 
     critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->get_float32) {
-            pdebug(DEBUG_WARN,"Tag does not support get float32 operation!");
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            rc = PLCTAG_ERR_NO_DATA;
             break;
         }
 
-        res = tag->vtable->get_float32(tag, offset);
+        if(offset < 0 || offset > tag->size || count < 0 || count > (tag->size - offset) / elem_size) {
+            pdebug(DEBUG_WARN,"Data offset or element count out of bounds.");
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        copy_elements(buffer, tag->data + offset, elem_size, count, (tag->endian == PLCTAG_DATA_BIG_ENDIAN) != host_is_big_endian());
     }
 
     rc_dec(tag);
 
-    return res;
-}
+    pdebug(DEBUG_SPEW, "Done.");
 
+    return rc;
+}
 
 
 
-LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float val)
+int set_array(int32_t id, int offset, uint8_t *buffer, int elem_size, int count)
 {
     int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
+    plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(!buffer) {
+        pdebug(DEBUG_WARN, "Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    tag = lookup_tag(id);
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
     critical_block(tag->api_mutex) {
-        /* is there a function? */
-        if(!tag->vtable->set_float32) {
-            pdebug(DEBUG_WARN,"Tag does not support set float32 operation!");
+        /* read-only tags do not have any set functions. */
+        if(!tag->vtable->set_uint8) {
+            pdebug(DEBUG_WARN,"Tag does not support set operations!");
             rc = PLCTAG_ERR_UNSUPPORTED;
             break;
         }
 
-        rc = tag->vtable->set_float32(tag, offset, val);
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            rc = PLCTAG_ERR_NO_DATA;
+            break;
+        }
+
+        if(offset < 0 || offset > tag->size || count < 0 || count > (tag->size - offset) / elem_size) {
+            pdebug(DEBUG_WARN,"Data offset or element count out of bounds.");
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        copy_elements(tag->data + offset, buffer, elem_size, count, (tag->endian == PLCTAG_DATA_BIG_ENDIAN) != host_is_big_endian());
+
+        mark_dirty(tag, offset, elem_size * count);
     }
 
     rc_dec(tag);
 
+    pdebug(DEBUG_SPEW, "Done.");
+
     return rc;
 }
 
 
 
-/*****************************************************************************************************
- *****************************  Support routines for extra indirection *******************************
- ****************************************************************************************************/
-
 
-plc_tag_p lookup_tag(int32_t tag_id)
+/*
+ * parse_deadband_type
+ *
+ * Map the deadband_type attribute to the element type and size.  Returns
+ * DEADBAND_TYPE_NONE if the name is not known.
+ */
+int parse_deadband_type(const char *type_str, int *elem_size)
 {
-    plc_tag_p tag = NULL;
-
-    critical_block(tag_lookup_mutex) {
-        tag = hashtable_get(tags, (int64_t)tag_id);
-
-        if(tag) {
-            debug_set_tag_id(tag->tag_id);
-        } else {
-            /* FIXME - remove this. */
-            pdebug(DEBUG_WARN, "Tag with ID %d not found.", tag_id);
-        }
-
-        if(tag && tag->tag_id == tag_id) {
-            pdebug(DEBUG_SPEW, "Found tag %p with id %d.", tag, tag->tag_id);
-            tag = rc_inc(tag);
-        } else {
-            debug_set_tag_id(0);
-            tag = NULL;
+    static const struct {
+        const char *name;
+        int type;
+        int size;
+    } deadband_types[] = {
+        { "int8", DEADBAND_TYPE_INT8, 1 },
+        { "uint8", DEADBAND_TYPE_UINT8, 1 },
+        { "int16", DEADBAND_TYPE_INT16, 2 },
+        { "uint16", DEADBAND_TYPE_UINT16, 2 },
+        { "int32", DEADBAND_TYPE_INT32, 4 },
+        { "uint32", DEADBAND_TYPE_UINT32, 4 },
+        { "int64", DEADBAND_TYPE_INT64, 8 },
+        { "uint64", DEADBAND_TYPE_UINT64, 8 },
+        { "float32", DEADBAND_TYPE_FLOAT32, 4 },
+        { "float64", DEADBAND_TYPE_FLOAT64, 8 }
+    };
+
+    for(size_t i=0; i < sizeof(deadband_types)/sizeof(deadband_types[0]); i++) {
+        if(str_cmp_i(type_str, deadband_types[i].name) == 0) {
+            *elem_size = deadband_types[i].size;
+            return deadband_types[i].type;
         }
     }
 
-    return tag;
+    return DEADBAND_TYPE_NONE;
 }
 
 
 
-int tag_id_inc(int id)
+/*
+ * get_deadband_value
+ *
+ * Decode one element of the deadband type from the tag byte order.
+ */
+double get_deadband_value(plc_tag_p tag, uint8_t *data)
 {
-    if(id <= 0) {
-        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
-        /* try to correct. */
-        id = (TAG_ID_MASK/2);
-    }
+    uint64_t raw = 0;
+    int size = tag->deadband_elem_size;
 
-    id = (id + 1) & TAG_ID_MASK;
+    /* assemble the raw value in host order. */
+    for(int i=0; i < size; i++) {
+        int byte_index = (tag->endian == PLCTAG_DATA_BIG_ENDIAN ? i : (size - 1 - i));
 
-    if(id == 0) {
-        id = 1; /* skip zero intentionally! Can't return an ID of zero because it looks like a NULL pointer */
+        raw = (raw << 8) | (uint64_t)data[byte_index];
     }
 
-    return id;
-}
+    switch(tag->deadband_type) {
+        case DEADBAND_TYPE_INT8: return (double)(int8_t)(uint8_t)raw;
+        case DEADBAND_TYPE_UINT8: return (double)(uint8_t)raw;
+        case DEADBAND_TYPE_INT16: return (double)(int16_t)(uint16_t)raw;
+        case DEADBAND_TYPE_UINT16: return (double)(uint16_t)raw;
+        case DEADBAND_TYPE_INT32: return (double)(int32_t)(uint32_t)raw;
+        case DEADBAND_TYPE_UINT32: return (double)(uint32_t)raw;
+        case DEADBAND_TYPE_INT64: return (double)(int64_t)raw;
+        case DEADBAND_TYPE_UINT64: return (double)raw;
 
+        case DEADBAND_TYPE_FLOAT32: {
+                uint32_t raw32 = (uint32_t)raw;
+                float fval = 0.0f;
 
+                mem_copy(&fval, &raw32, (int)sizeof(fval));
 
-int add_tag_lookup(plc_tag_p tag)
-{
-    int rc = PLCTAG_ERR_NOT_FOUND;
-    int new_id = 0;
+                return (double)fval;
+            }
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+        case DEADBAND_TYPE_FLOAT64: {
+                double dval = 0.0;
 
-    critical_block(tag_lookup_mutex) {
-        int attempts = 0;
+                mem_copy(&dval, &raw, (int)sizeof(dval));
 
-        /* only get this when we hold the mutex. */
-        new_id = next_tag_id;
+                return dval;
+            }
 
-        do {
-            new_id = tag_id_inc(new_id);
+        default:
+            return 0.0;
+    }
+}
 
-            if(new_id <=0) {
-                pdebug(DEBUG_WARN,"ID %d is illegal!", new_id);
-                attempts = MAX_TAG_MAP_ATTEMPTS;
-                break;
-            }
 
-            pdebug(DEBUG_SPEW,"Trying new ID %d.", new_id);
 
-            if(!hashtable_get(tags,(int64_t)new_id)) {
-                pdebug(DEBUG_DETAIL,"Found unused ID %d", new_id);
-                break;
-            }
+/*
+ * check_data_changed
+ *
+ * Called with the tag API mutex held after a read completed successfully.
+ * Compare the tag data against the copy from the last change and update
+ * the copy if the data changed.  Returns 1 if a data changed event should
+ * be sent.
+ *
+ * Without a deadband any difference counts.  With a deadband, the change
+ * of at least one element must be larger than the absolute deadband and
+ * larger than the percent deadband of the old value.  The copy is only
+ * updated when a change is reported so slow drifts are not lost.
+ */
+int check_data_changed(plc_tag_p tag)
+{
+    int changed = 0;
+
+    /* nobody is listening, skip the work. */
+    if(!tag->callback || !tag->data || tag->size <= 0) {
+        return 0;
+    }
 
-            attempts++;
-        } while(attempts < MAX_TAG_MAP_ATTEMPTS);
+    /* the first read or a change in size always counts. */
+    if(!tag->data_snapshot || tag->data_snapshot_size != tag->size) {
+        if(tag->data_snapshot) {
+            mem_free(tag->data_snapshot);
+        }
 
-        if(attempts < MAX_TAG_MAP_ATTEMPTS) {
-            rc = hashtable_put(tags, (int64_t)new_id, tag);
-        } else {
-            rc = PLCTAG_ERR_NO_RESOURCES;
+        tag->data_snapshot_size = 0;
+        tag->data_snapshot = (uint8_t *)mem_alloc(tag->size);
+        if(!tag->data_snapshot) {
+            pdebug(DEBUG_WARN, "Unable to allocate data snapshot!");
+            return 1;
         }
 
-        next_tag_id = new_id;
+        tag->data_snapshot_size = tag->size;
+        mem_copy(tag->data_snapshot, tag->data, tag->size);
+
+        return 1;
     }
 
-    if(rc != PLCTAG_STATUS_OK) {
-        new_id = rc;
+    /* most reads return the same data. */
+    if(mem_cmp(tag->data_snapshot, tag->data_snapshot_size, tag->data, tag->size) == 0) {
+        return 0;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    if(tag->deadband_type == DEADBAND_TYPE_NONE) {
+        changed = 1;
+    } else {
+        int elem_size = tag->deadband_elem_size;
 
-    return new_id;
+        for(int offset = 0; !changed && offset + elem_size <= tag->size; offset += elem_size) {
+            double old_val = get_deadband_value(tag, tag->data_snapshot + offset);
+            double new_val = get_deadband_value(tag, tag->data + offset);
+            double diff = (new_val > old_val ? new_val - old_val : old_val - new_val);
+            double percent_limit = (old_val < 0.0 ? -old_val : old_val) * tag->deadband_percent / 100.0;
+
+            /* NaN and other non-numbers never compare, treat any difference as a change. */
+            if(diff != diff || (diff > tag->deadband && diff > percent_limit)) {
+                changed = 1;
+            }
+        }
+    }
+
+    if(changed) {
+        mem_copy(tag->data_snapshot, tag->data, tag->size);
+    }
+
+    return changed;
 }
@@ -182,6 +182,11 @@ LIB_EXPORT int plc_tag_check_lib_version(int req_major, int req_minor, int req_p
  * until the status changes to PLCTAG_STATUS_OK if the creation was successful or
  * another PLCTAG_ERR_xyz if it was not.
  *
+ * For Logix-class PLCs, creating a tag normally reads it once to find its type and size.
+ * If another tag with the same name on the same connection has already done that, the
+ * new tag is set up from the saved information without a read and its data is zero
+ * until the first read.
+ *
  * An opaque handle is returned. If the value is greater than zero, then
  * the operation was a success.  If the value is less than zero then the
  * tag was not created and the failure error is one of the PLCTAG_ERR_xyz
@@ -192,6 +197,24 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout);
 
 
 
+/*
+ * plc_tag_create_many
+ *
+ * Create num_tags tags from the attribute strings in attrib_strs.  All the
+ * tags are set up before waiting on any of them, so the underlying protocol
+ * can pack their first requests together.  If the timeout is not zero, wait
+ * until all the tags are ready or the timeout occurs, whichever is first.
+ * The timeout is for the whole set, not each tag.
+ *
+ * The tag handle or error for each attribute string is put in the matching
+ * entry of the tag_ids array.  The return value is PLCTAG_STATUS_OK if all
+ * tags were created or the first error.  Tags that were created are valid
+ * even if others failed.
+ */
+LIB_EXPORT int plc_tag_create_many(const char **attrib_strs, int num_tags, int32_t *tag_ids, int timeout);
+
+
+
 /*
  * plc_tag_shutdown
  *
@@ -228,12 +251,24 @@ LIB_EXPORT void plc_tag_shutdown(void);
  *      * a tag write operation ending.
  *      * a tag write being aborted.
  *      * a tag being destroyed
+ *      * the tag data changing after a read.
+ *
+ * PLCTAG_EVENT_DATA_CHANGED is sent after PLCTAG_EVENT_READ_COMPLETED when a read returned data
+ * different from the data at the last change event.  The first successful read always counts as a change.
+ * To filter out noise on numeric tags, set the deadband_type attribute to the element type (int8, uint8,
+ * int16, uint16, int32, uint32, int64, uint64, float32 or float64) and set deadband (absolute) and/or
+ * deadband_percent (of the old value).  An event is only sent when some element changed by more than both.
  *
  * The callback is called outside of the internal tag mutex so it can call any tag functions safely.   However,
  * the callback is called in the context of the internal tag helper thread and not the client library thread(s).
  * This means that YOU are responsible for making sure that all client application data structures the callback
  * function touches are safe to access by the callback!
  *
+ * If the tag was created with the callback_threads=N attribute (1 to 64), its callbacks are run on a shared
+ * pool of N threads instead.  A tag's callbacks still run in order and never overlap.  There is only one pool
+ * per process and the first tag that asks for it sets the number of threads.  Later tags with a different
+ * callback_threads value share that pool and a warning is logged.
+ *
  * Do not do any operations in the callback that block for any significant time.   This will cause library
  * performance to be poor or even to start failing!
  *
@@ -258,6 +293,8 @@ LIB_EXPORT void plc_tag_shutdown(void);
 
 #define PLCTAG_EVENT_DESTROYED          (6)
 
+#define PLCTAG_EVENT_DATA_CHANGED       (7)
+
 LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_func)(int32_t tag_id, int event, int status));
 
 
@@ -397,6 +434,21 @@ LIB_EXPORT int plc_tag_read(int32_t tag, int timeout);
 
 
 
+/*
+ * plc_tag_read_range
+ *
+ * Read elem_count elements of an array tag starting at element start_elem.
+ * Only that part of the tag data is refreshed, the rest is left as it
+ * was.  The timeout works as it does for plc_tag_read.  The read cache is
+ * not used.  Tags that cannot read part of their data read all of it.
+ * Returns PLCTAG_ERR_OUT_OF_BOUNDS if the elements are not all in the
+ * tag.
+ */
+LIB_EXPORT int plc_tag_read_range(int32_t tag, int start_elem, int elem_count, int timeout);
+
+
+
+
 /*
  * plc_tag_status
  *
@@ -429,6 +481,95 @@ LIB_EXPORT int plc_tag_write(int32_t tag, int timeout);
 
 
 
+/*
+ * plc_tag_read_many
+ *
+ * Start a read on each of the num_tags tags in the tags array before
+ * waiting on any of them.  This lets the underlying protocol pack the
+ * requests together.  If the timeout is not zero, wait until all the reads
+ * complete or the timeout occurs, whichever is first.  The timeout is for
+ * the whole set, not each tag.
+ *
+ * The status of each tag is put in the matching entry of the statuses
+ * array.  The return value is PLCTAG_STATUS_OK if all reads succeeded or
+ * the first status that was not OK.  If the timeout is zero, tags that
+ * are still in progress will have the status PLCTAG_STATUS_PENDING.
+ */
+LIB_EXPORT int plc_tag_read_many(int32_t *tags, int num_tags, int *statuses, int timeout);
+
+
+
+
+/*
+ * plc_tag_write_many
+ *
+ * Start a write on each of the num_tags tags in the tags array.  This
+ * works the same way as plc_tag_read_many() above.
+ */
+LIB_EXPORT int plc_tag_write_many(int32_t *tags, int num_tags, int *statuses, int timeout);
+
+
+
+
+/*
+ * plc_tag_read_async
+ * plc_tag_write_async
+ *
+ * Start a read or write and return PLCTAG_STATUS_PENDING without waiting.
+ * When the operation finishes, a completion holding the tag ID, the event
+ * (PLCTAG_EVENT_READ_COMPLETED or PLCTAG_EVENT_WRITE_COMPLETED), the final
+ * status and the passed cookie is put on the library completion queue.
+ * Every call that returns PLCTAG_STATUS_PENDING produces exactly one
+ * completion.  If the tag is aborted or destroyed first, the completion
+ * has the status PLCTAG_ERR_ABORT.  Any other return value is an error
+ * and no completion will be queued.
+ *
+ * Only one async operation may be outstanding on a tag at a time,
+ * otherwise PLCTAG_ERR_BUSY is returned.  Callbacks registered on the tag
+ * are still called.
+ */
+LIB_EXPORT int plc_tag_read_async(int32_t tag, void *cookie);
+LIB_EXPORT int plc_tag_write_async(int32_t tag, void *cookie);
+
+
+
+
+/*
+ * plc_tag_poll_completions
+ *
+ * Copy up to max_completions completions from the queue into the
+ * completions array, oldest first.  Returns the number copied, which is
+ * zero if the queue is empty, or an error.  This never blocks.
+ */
+
+typedef struct {
+    int32_t tag_id;
+    int event;
+    int status;
+    void *cookie;
+} plc_tag_completion_t;
+
+LIB_EXPORT int plc_tag_poll_completions(plc_tag_completion_t *completions, int max_completions);
+
+
+
+
+/*
+ * plc_tag_get_completion_fd
+ *
+ * Return a handle that is signaled while the completion queue is not
+ * empty, for use in the application's own event loop.  On POSIX systems
+ * it is a file descriptor that polls as readable (an eventfd on Linux).
+ * On Windows it is an event HANDLE.  Do not read, close or reset it, call
+ * plc_tag_poll_completions() until it returns zero instead.  The handle
+ * is valid until plc_tag_shutdown() is called.  A negative value is an
+ * error.
+ */
+LIB_EXPORT intptr_t plc_tag_get_completion_fd(void);
+
+
+
+
 /*
  * Tag data accessors.
  */
@@ -439,6 +580,35 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t tag, const char *attrib_name, i
 
 LIB_EXPORT int plc_tag_get_size(int32_t tag);
 
+/*
+ * Find where a member of a UDT tag is in the tag data.  The path is
+ * relative to the tag, so for a tag named "Motor" the path of
+ * "Motor.Status.Speed" is "Status.Speed".  Array elements are given as
+ * "Data[3]".  The lookup is done once, up front, and the offset is then
+ * used with the normal accessors on each read.
+ *
+ * The result is the byte offset or an error.  If member_type is not NULL,
+ * it is set to the CIP type code of the member, 0x8000 plus the template
+ * ID for structures.  If bit_num is not NULL, it is set to the bit number
+ * for BOOL members and -1 for everything else.
+ *
+ * This only works on Logix tags after the tag has been read once and
+ * after the tag's template has been read with a tag named
+ * "@udt/<template ID>".  The template ID is the low 12 bits of the symbol
+ * type found by an "@tags" listing.  Templates of nested structures are
+ * read along with it.  If the template is not known yet,
+ * PLCTAG_ERR_NOT_FOUND is returned.
+ */
+LIB_EXPORT int plc_tag_get_member_offset(int32_t tag, const char *member_path, int *member_type, int *bit_num);
+
+/*
+ * Copy raw tag data into or out of a buffer.  The bytes are copied as is
+ * with no byte order conversion.  The whole range must be within the tag
+ * data or PLCTAG_ERR_OUT_OF_BOUNDS is returned.
+ */
+LIB_EXPORT int plc_tag_get_bytes(int32_t tag, int offset, uint8_t *buffer, int length);
+LIB_EXPORT int plc_tag_set_bytes(int32_t tag, int offset, uint8_t *buffer, int length);
+
 LIB_EXPORT int plc_tag_get_bit(int32_t tag, int offset_bit);
 LIB_EXPORT int plc_tag_set_bit(int32_t tag, int offset_bit, int val);
 
@@ -477,6 +647,47 @@ LIB_EXPORT float plc_tag_get_float32(int32_t tag, int offset);
 LIB_EXPORT int plc_tag_set_float32(int32_t tag, int offset, float val);
 
 
+
+/*
+ * Typed array accessors.
+ *
+ * Copy count elements starting at the byte offset in the tag data to or
+ * from the passed array, converting between the tag byte order and the
+ * host byte order.  If the whole range is not within the tag data, nothing
+ * is copied and PLCTAG_ERR_OUT_OF_BOUNDS is returned.
+ */
+
+LIB_EXPORT int plc_tag_get_uint64_array(int32_t tag, int offset, uint64_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_uint64_array(int32_t tag, int offset, uint64_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_int64_array(int32_t tag, int offset, int64_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_int64_array(int32_t tag, int offset, int64_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_uint32_array(int32_t tag, int offset, uint32_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_uint32_array(int32_t tag, int offset, uint32_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_int32_array(int32_t tag, int offset, int32_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_int32_array(int32_t tag, int offset, int32_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_uint16_array(int32_t tag, int offset, uint16_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_uint16_array(int32_t tag, int offset, uint16_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_int16_array(int32_t tag, int offset, int16_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_int16_array(int32_t tag, int offset, int16_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_uint8_array(int32_t tag, int offset, uint8_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_uint8_array(int32_t tag, int offset, uint8_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_int8_array(int32_t tag, int offset, int8_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_int8_array(int32_t tag, int offset, int8_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_float64_array(int32_t tag, int offset, double *buffer, int count);
+LIB_EXPORT int plc_tag_set_float64_array(int32_t tag, int offset, double *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_float32_array(int32_t tag, int offset, float *buffer, int count);
+LIB_EXPORT int plc_tag_set_float32_array(int32_t tag, int offset, float *buffer, int count);
+
+
 #ifdef __cplusplus
 }
 #endif
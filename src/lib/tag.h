@@ -109,11 +109,49 @@ struct tag_vtable_t {
 
     float (*get_float32)(plc_tag_p tag, int offset);
     int (*set_float32)(plc_tag_p tag, int offset, float val);
+
+    /* structure members. */
+    int (*get_member_offset)(plc_tag_p tag, const char *member_path, int *member_type, int *bit_num);
 };
 
 typedef struct tag_vtable_t *tag_vtable_p;
 
 
+/*
+ * Callbacks that are run by the callback thread pool are queued per tag
+ * so that they run in order, one at a time.  All fields are protected by
+ * the callback pool mutex.  idle_cond is signaled each time the pool
+ * finishes the tag's queue.
+ */
+
+#define TAG_CALLBACK_QUEUE_SIZE (8)
+
+struct tag_callback_queue_t {
+    int use_pool;
+    int scheduled;
+    int head;
+    int count;
+    int events[TAG_CALLBACK_QUEUE_SIZE];
+    int statuses[TAG_CALLBACK_QUEUE_SIZE];
+    cond_p idle_cond;
+};
+
+
+/*
+ * The byte ranges of the tag data that the set functions changed since
+ * the last write started.  They are only kept if the protocol set
+ * partial_writes for the tag.  All fields are protected by the tag API
+ * mutex.
+ */
+
+#define TAG_MAX_DIRTY_RANGES (8)
+
+struct tag_range_t {
+    int start;
+    int end;    /* one past the last byte. */
+};
+
+
 /*
  * The base definition of the tag structure.  This is used
  * by the protocol-specific implementations.
@@ -124,14 +162,41 @@ typedef struct tag_vtable_t *tag_vtable_p;
 #define TAG_BASE_STRUCT tag_vtable_p vtable; \
                         mutex_p ext_mutex; \
                         mutex_p api_mutex; \
+                        mutex_p sync_op_mutex; \
                         int status; \
                         int endian; \
                         int tag_id; \
                         int64_t read_cache_expire; \
                         int64_t read_cache_ms; \
+                        int auto_sync_read_ms; \
+                        int64_t auto_sync_next_read; \
+                        int auto_sync_write_ms; \
+                        int auto_sync_write_dirty; \
+                        int64_t auto_sync_next_write; \
+                        int auto_sync_waiting; \
                         int read_complete; \
                         int write_complete; \
+                        int data_change_checked; \
+                        int data_changed; \
+                        uint8_t *data_snapshot; \
+                        int data_snapshot_size; \
+                        int deadband_type; \
+                        int deadband_elem_size; \
+                        double deadband; \
+                        double deadband_percent; \
                         void (*callback)(int32_t tag_id, int event, int status); \
+                        struct tag_callback_queue_t callback_queue; \
+                        cond_p tag_cond_wait; \
+                        int sync_op_in_progress; \
+                        volatile int32_t tickler_scheduled; \
+                        int tickler_poll; \
+                        int async_event; \
+                        void *async_cookie; \
+                        int read_range_start; \
+                        int read_range_count; \
+                        int partial_writes; \
+                        int num_dirty_ranges; \
+                        struct tag_range_t dirty_ranges[TAG_MAX_DIRTY_RANGES]; \
                         int size; \
                         uint8_t *data
 
@@ -152,6 +217,8 @@ extern void lib_teardown(void);
 extern int plc_tag_abort_mapped(plc_tag_p tag);
 extern int plc_tag_destroy_mapped(plc_tag_p tag);
 extern int plc_tag_status_mapped(plc_tag_p tag);
+extern void plc_tag_signal_completion(int32_t tag_id);
+extern void plc_tag_mark_dirty_range(plc_tag_p tag, int offset, int length);
 
 
 
@@ -64,6 +64,15 @@
     #endif
 #endif
 
+/* Linux has epoll and eventfd, everyone else gets poll and a pipe. */
+#if defined(__linux__)
+    #define USE_EPOLL
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+#endif
+
+#include <poll.h>
+
 
 /***************************************************************************
  ******************************* Memory ************************************
@@ -562,6 +571,199 @@ int mutex_destroy(mutex_p *m)
 
 
 
+/***************************************************************************
+ ************************** Condition Variables ****************************
+ **************************************************************************/
+
+/* use the monotonic clock for timeouts where we can. */
+#if defined(__linux__)
+    #define COND_CLOCK CLOCK_MONOTONIC
+#else
+    #define COND_CLOCK CLOCK_REALTIME
+#endif
+
+struct cond_t {
+    pthread_mutex_t p_mutex;
+    pthread_cond_t p_cond;
+    int flag;
+};
+
+
+int cond_create(cond_p *c)
+{
+    pthread_condattr_t attr;
+    int rc = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *c = (struct cond_t *)mem_alloc(sizeof(struct cond_t));
+    if(! *c) {
+        pdebug(DEBUG_ERROR, "Unable to allocate condition variable.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if(pthread_mutex_init(&((*c)->p_mutex), NULL)) {
+        mem_free(*c);
+        *c = NULL;
+        pdebug(DEBUG_ERROR, "Error initializing condition variable mutex.");
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    pthread_condattr_init(&attr);
+
+#if defined(__linux__)
+    pthread_condattr_setclock(&attr, COND_CLOCK);
+#endif
+
+    rc = pthread_cond_init(&((*c)->p_cond), &attr);
+
+    pthread_condattr_destroy(&attr);
+
+    if(rc) {
+        pthread_mutex_destroy(&((*c)->p_mutex));
+        mem_free(*c);
+        *c = NULL;
+        pdebug(DEBUG_ERROR, "Error initializing condition variable.");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * cond_wait
+ *
+ * Wait until the condition variable is signaled or the timeout passes.
+ * Getting the signal clears it.  Returns PLCTAG_ERR_TIMEOUT if there
+ * was no signal in time.
+ */
+int cond_wait(cond_p c, int timeout_ms)
+{
+    struct timespec deadline;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout_ms < 0) {
+        timeout_ms = 0;
+    }
+
+    clock_gettime(COND_CLOCK, &deadline);
+
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&(c->p_mutex));
+
+    while(!c->flag) {
+        int wait_rc = pthread_cond_timedwait(&(c->p_cond), &(c->p_mutex), &deadline);
+
+        if(wait_rc == ETIMEDOUT) {
+            break;
+        } else if(wait_rc && wait_rc != EINTR) {
+            pdebug(DEBUG_WARN, "Error %d waiting on condition variable!", wait_rc);
+            rc = PLCTAG_ERR_BAD_STATUS;
+            break;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        if(c->flag) {
+            c->flag = 0;
+        } else {
+            rc = PLCTAG_ERR_TIMEOUT;
+        }
+    }
+
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+int cond_signal(cond_p c)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_mutex_lock(&(c->p_mutex));
+
+    c->flag = 1;
+    pthread_cond_signal(&(c->p_cond));
+
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_clear(cond_p c)
+{
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_mutex_lock(&(c->p_mutex));
+    c->flag = 0;
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_destroy(cond_p *c)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c || ! *c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_cond_destroy(&((*c)->p_cond));
+    pthread_mutex_destroy(&((*c)->p_mutex));
+
+    mem_free(*c);
+    *c = NULL;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
 /***************************************************************************
  ******************************* Threads ***********************************
  **************************************************************************/
@@ -753,18 +955,74 @@ extern void lock_release(lock_t *lock)
 }
 
 
+
+
+/*
+ * atomic_int32_get/set/add/cas
+ *
+ * Atomic operations on 32-bit integers.  These are all full barriers.
+ * atomic_int32_add returns the new value.  atomic_int32_cas returns
+ * non-zero if the value was swapped.
+ */
+
+int32_t atomic_int32_get(volatile int32_t *val)
+{
+    return __sync_add_and_fetch(val, 0);
+}
+
+
+void atomic_int32_set(volatile int32_t *val, int32_t new_val)
+{
+    __sync_synchronize();
+    *val = new_val;
+    __sync_synchronize();
+}
+
+
+int32_t atomic_int32_add(volatile int32_t *val, int32_t delta)
+{
+    return __sync_add_and_fetch(val, delta);
+}
+
+
+int atomic_int32_cas(volatile int32_t *val, int32_t old_val, int32_t new_val)
+{
+    return __sync_bool_compare_and_swap(val, old_val, new_val) ? 1 : 0;
+}
+
+
 /***************************************************************************
  ******************************* Sockets ***********************************
  **************************************************************************/
 
+#define MAX_IPS (8)
+
 struct sock_t {
     int fd;
     int port;
     int is_open;
+
+    /* addresses left to try while a connection is being set up. */
+    int is_connecting;
+    struct in_addr ips[MAX_IPS];
+    int num_ips;
+    int ip_index;
+
+    /* used to wake up a thread waiting on the socket. */
+    int wake_read_fd;
+    int wake_write_fd;
+
+#ifdef USE_EPOLL
+    int epoll_fd;
+    uint32_t epoll_events; /* events the socket fd is registered for, zero if not registered. */
+#else
+    int wait_events; /* events last waited for, used by socket sets. */
+#endif
 };
 
 
-#define MAX_IPS (8)
+static int socket_open_fd(int *fd_out);
+static int socket_connect_next_ip(sock_p s);
 
 extern int socket_create(sock_p *s)
 {
@@ -782,27 +1040,198 @@ extern int socket_create(sock_p *s)
         return PLCTAG_ERR_NO_MEM;
     }
 
+    (*s)->fd = -1;
+
+#ifdef USE_EPOLL
+    (*s)->wake_read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if((*s)->wake_read_fd < 0) {
+        pdebug(DEBUG_ERROR, "Unable to create wake up eventfd, errno: %d", errno);
+        mem_free(*s);
+        *s = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* an eventfd is both ends at once. */
+    (*s)->wake_write_fd = (*s)->wake_read_fd;
+
+    (*s)->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if((*s)->epoll_fd < 0) {
+        pdebug(DEBUG_ERROR, "Unable to create epoll instance, errno: %d", errno);
+        close((*s)->wake_read_fd);
+        mem_free(*s);
+        *s = NULL;
+        return PLCTAG_ERR_CREATE;
+    } else {
+        struct epoll_event ev;
+
+        mem_set(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = (*s)->wake_read_fd;
+
+        if(epoll_ctl((*s)->epoll_fd, EPOLL_CTL_ADD, (*s)->wake_read_fd, &ev)) {
+            pdebug(DEBUG_ERROR, "Unable to add wake up eventfd to epoll instance, errno: %d", errno);
+            close((*s)->epoll_fd);
+            close((*s)->wake_read_fd);
+            mem_free(*s);
+            *s = NULL;
+            return PLCTAG_ERR_CREATE;
+        }
+    }
+#else
+    {
+        int wake_fds[2];
+
+        if(pipe(wake_fds)) {
+            pdebug(DEBUG_ERROR, "Unable to create wake up pipe, errno: %d", errno);
+            mem_free(*s);
+            *s = NULL;
+            return PLCTAG_ERR_CREATE;
+        }
+
+        /* neither end should ever block. */
+        fcntl(wake_fds[0], F_SETFL, fcntl(wake_fds[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(wake_fds[1], F_SETFL, fcntl(wake_fds[1], F_GETFL, 0) | O_NONBLOCK);
+
+        (*s)->wake_read_fd = wake_fds[0];
+        (*s)->wake_write_fd = wake_fds[1];
+    }
+#endif
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_OK;
 }
 
 
-extern int socket_connect_tcp(sock_p s, const char *host, int port)
+/*
+ * socket_connect_tcp_start
+ *
+ * Look up the host and start connecting to it without blocking.  The
+ * host name lookup itself can still block.  Returns PLCTAG_STATUS_OK if
+ * the connection is already up and PLCTAG_STATUS_PENDING if it is in
+ * progress.  Wait for SOCK_EVENT_CAN_WRITE and call
+ * socket_connect_tcp_check() to find out how it went.
+ */
+extern int socket_connect_tcp_start(sock_p s, const char *host, int port)
+{
+    pdebug(DEBUG_DETAIL,"Starting.");
+
+    if(!s || !host) {
+        pdebug(DEBUG_WARN, "Null socket or host pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* figure out what address we are connecting to. */
+    mem_set(s->ips, 0, sizeof(s->ips));
+    s->num_ips = 0;
+    s->ip_index = 0;
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET,host,(struct in_addr *)s->ips) > 0) {
+        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s",host);
+        s->num_ips = 1;
+    } else {
+        struct addrinfo hints;
+        struct addrinfo *res_head=NULL;
+        struct addrinfo *res=NULL;
+        int rc = 0;
+
+        mem_set(&hints, 0, sizeof(hints));
+
+        hints.ai_socktype = SOCK_STREAM; /* TCP */
+        hints.ai_family = AF_INET; /* IP V4 only */
+
+        if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
+            pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+            if(res_head) {
+                freeaddrinfo(res_head);
+            }
+
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        for(res = res_head; res && s->num_ips < MAX_IPS; res = res->ai_next) {
+            s->ips[s->num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
+            s->num_ips++;
+        }
+
+        freeaddrinfo(res_head);
+    }
+
+    s->port = port;
+
+    return socket_connect_next_ip(s);
+}
+
+
+/*
+ * socket_connect_tcp_check
+ *
+ * See if a connection started by socket_connect_tcp_start() is up.  If
+ * the current address refused it, the next one is tried.  Returns
+ * PLCTAG_STATUS_PENDING while the connection is still in progress.
+ */
+extern int socket_connect_tcp_check(sock_p s)
+{
+    struct pollfd pfd;
+    int sock_err = 0;
+    socklen_t sock_err_len = (socklen_t)sizeof(sock_err);
+    int rc = 0;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(!s->is_connecting) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    mem_set(&pfd, 0, sizeof(pfd));
+    pfd.fd = s->fd;
+    pfd.events = POLLOUT;
+
+    rc = poll(&pfd, 1, 0);
+    if(rc == 0 || (rc < 0 && errno == EINTR)) {
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    if(rc < 0) {
+        pdebug(DEBUG_WARN, "Error checking socket connection, errno: %d", errno);
+        socket_close(s);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(getsockopt(s->fd, SOL_SOCKET, SO_ERROR, (char*)&sock_err, &sock_err_len) == 0 && sock_err == 0) {
+        pdebug(DEBUG_DETAIL, "Connection to %s succeeded.", inet_ntoa(s->ips[s->ip_index]));
+        s->is_connecting = 0;
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d", inet_ntoa(s->ips[s->ip_index]), sock_err);
+
+    /* this address did not work, try the next one. */
+    socket_close(s);
+    s->ip_index++;
+
+    return socket_connect_next_ip(s);
+}
+
+
+/* make a non-blocking TCP socket with the options we want. */
+int socket_open_fd(int *fd_out)
 {
-    struct in_addr ips[MAX_IPS];
-    int num_ips = 0;
-    struct sockaddr_in gw_addr;
     int sock_opt = 1;
-    int i = 0;
-    int done = 0;
     int fd;
     int flags;
     struct timeval timeout; /* used for timing out connections etc. */
     struct linger so_linger; /* used to set up short/no lingering after connections are close()ed. */
 
-    pdebug(DEBUG_DETAIL,"Starting.");
-
     /* Open a socket for communication with the gateway. */
     fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
@@ -855,105 +1284,73 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
         return PLCTAG_ERR_OPEN;
     }
 
-    /* figure out what address we are connecting to. */
+    /* connect() must not block either. */
+    flags=fcntl(fd,F_GETFL,0);
 
-    /* try a numeric IP address conversion first. */
-    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
-        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s",host);
-        num_ips = 1;
-    } else {
-        struct addrinfo hints;
-        struct addrinfo *res=NULL;
-        int rc = 0;
+    if(flags<0) {
+        pdebug(DEBUG_ERROR, "Error getting socket options, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
 
-        mem_set(&ips, 0, sizeof(ips));
-        mem_set(&hints, 0, sizeof(hints));
+    flags |= O_NONBLOCK;
 
-        hints.ai_socktype = SOCK_STREAM; /* TCP */
-        hints.ai_family = AF_INET; /* IP V4 only */
+    if(fcntl(fd,F_SETFL,flags)<0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
 
-        if ((rc = getaddrinfo(host, NULL, &hints, &res)) != 0) {
-            pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
-
-            if(res) {
-                freeaddrinfo(res);
-            }
-
-            return PLCTAG_ERR_BAD_GATEWAY;
-        }
-
-        for(num_ips = 0; res && num_ips < MAX_IPS; num_ips++) {
-            ips[num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
-            res = res->ai_next;
-        }
-
-        freeaddrinfo(res);
-    }
+    *fd_out = fd;
 
+    return PLCTAG_STATUS_OK;
+}
 
-    /* now try to connect to the remote gateway.  We may need to
-     * try several of the IPs we have.
-     */
 
-    i = 0;
-    done = 0;
+/* start connecting to the remaining addresses until one is in progress or connected. */
+int socket_connect_next_ip(sock_p s)
+{
+    struct sockaddr_in gw_addr;
+    int rc = PLCTAG_STATUS_OK;
 
     memset((void *)&gw_addr,0, sizeof(gw_addr));
     gw_addr.sin_family = AF_INET ;
-    gw_addr.sin_port = htons((uint16_t)port);
-
-    do {
-        int rc;
-        /* try each IP until we run out or get a connection. */
-        gw_addr.sin_addr.s_addr = ips[i].s_addr;
-
-        pdebug(DEBUG_DETAIL, "Attempting to connect to %s",inet_ntoa(*((struct in_addr *)&ips[i])));
+    gw_addr.sin_port = htons((uint16_t)s->port);
 
-        rc = connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr));
+    for(; s->ip_index < s->num_ips; s->ip_index++) {
+        int fd = -1;
 
-        if( rc == 0) {
-            pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(*((struct in_addr *)&ips[i])));
-            done = 1;
-        } else {
-            pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(*((struct in_addr *)&ips[i])),errno);
-            i++;
+        if((rc = socket_open_fd(&fd)) != PLCTAG_STATUS_OK) {
+            return rc;
         }
-    } while(!done && i < num_ips);
 
-    if(!done) {
-        close(fd);
-        pdebug(DEBUG_ERROR, "Unable to connect to any gateway host IP address!");
-        return PLCTAG_ERR_OPEN;
-    }
+        gw_addr.sin_addr.s_addr = s->ips[s->ip_index].s_addr;
 
+        pdebug(DEBUG_DETAIL, "Attempting to connect to %s",inet_ntoa(s->ips[s->ip_index]));
 
-    /* FIXME
-     * connect() is a little easier to handle in blocking mode, for now
-     * we make the socket non-blocking here, after connect(). */
-    flags=fcntl(fd,F_GETFL,0);
+        s->fd = fd;
+        s->is_open = 1;
 
-    if(flags<0) {
-        pdebug(DEBUG_ERROR, "Error getting socket options, errno: %d", errno);
-        close(fd);
-        return PLCTAG_ERR_OPEN;
-    }
+        if(connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr)) == 0) {
+            pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(s->ips[s->ip_index]));
+            s->is_connecting = 0;
+            return PLCTAG_STATUS_OK;
+        }
 
-    flags |= O_NONBLOCK;
+        if(errno == EINPROGRESS) {
+            pdebug(DEBUG_DETAIL, "Connection to %s is in progress.",inet_ntoa(s->ips[s->ip_index]));
+            s->is_connecting = 1;
+            return PLCTAG_STATUS_PENDING;
+        }
 
-    if(fcntl(fd,F_SETFL,flags)<0) {
-        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
-        close(fd);
-        return PLCTAG_ERR_OPEN;
-    }
+        pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(s->ips[s->ip_index]),errno);
 
-    /* save the values */
-    s->fd = fd;
-    s->port = port;
-    s->is_open = 1;
+        socket_close(s);
+    }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    pdebug(DEBUG_ERROR, "Unable to connect to any gateway host IP address!");
 
-    return PLCTAG_STATUS_OK;
+    return PLCTAG_ERR_OPEN;
 }
 
 
@@ -984,6 +1381,12 @@ extern int socket_read(sock_p s, uint8_t *buf, int size)
         }
     }
 
+    /* zero bytes from a readable socket means the other end closed it. */
+    if(rc == 0 && size > 0) {
+        pdebug(DEBUG_WARN, "Socket closed by remote end.");
+        return PLCTAG_ERR_READ;
+    }
+
     return rc;
 }
 
@@ -1026,6 +1429,8 @@ extern int socket_write(sock_p s, uint8_t *buf, int size)
 
 extern int socket_close(sock_p s)
 {
+    int rc = 0;
+
     if(!s) {
         return PLCTAG_ERR_NULL_PTR;
     }
@@ -1034,12 +1439,23 @@ extern int socket_close(sock_p s)
         return PLCTAG_STATUS_OK;
     }
 
-    if(!close(s->fd)) {
-        return PLCTAG_ERR_CLOSE;
+#ifdef USE_EPOLL
+    if(s->epoll_events) {
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+        s->epoll_events = 0;
     }
+#endif
 
-    s->fd = 0;
+    rc = close(s->fd);
+
+    s->fd = -1;
     s->is_open = 0;
+    s->is_connecting = 0;
+
+    if(rc) {
+        pdebug(DEBUG_WARN, "Error closing socket, errno: %d", errno);
+        return PLCTAG_ERR_CLOSE;
+    }
 
     return PLCTAG_STATUS_OK;
 }
@@ -1052,6 +1468,20 @@ extern int socket_destroy(sock_p *s)
 
     socket_close(*s);
 
+#ifdef USE_EPOLL
+    if((*s)->epoll_fd >= 0) {
+        close((*s)->epoll_fd);
+    }
+#else
+    if((*s)->wake_write_fd >= 0) {
+        close((*s)->wake_write_fd);
+    }
+#endif
+
+    if((*s)->wake_read_fd >= 0) {
+        close((*s)->wake_read_fd);
+    }
+
     mem_free(*s);
 
     *s = 0;
@@ -1061,8 +1491,851 @@ extern int socket_destroy(sock_p *s)
 
 
 
+/*
+ * socket_wait_event
+ *
+ * Wait until the socket is ready for the requested events, another
+ * thread calls socket_wake(), or the timeout passes.  A negative timeout
+ * waits forever.  If the socket is not open, only wake ups and the
+ * timeout are waited on.
+ *
+ * Returns a mask of SOCK_EVENT_* flags or an error code.
+ */
+
+#ifdef USE_EPOLL
+
+extern int socket_wait_event(sock_p s, int events, int timeout_ms)
+{
+    struct epoll_event ready[2];
+    uint32_t wanted = 0;
+    int num_ready = 0;
+    int result = SOCK_EVENT_NONE;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(s->is_open) {
+        if(events & SOCK_EVENT_CAN_READ) {
+            wanted |= EPOLLIN;
+        }
+
+        if(events & SOCK_EVENT_CAN_WRITE) {
+            wanted |= EPOLLOUT;
+        }
+    }
+
+    /* only touch the registration when it changes. */
+    if(s->is_open && wanted != s->epoll_events) {
+        struct epoll_event ev;
+        int op = EPOLL_CTL_MOD;
+
+        if(!wanted) {
+            op = EPOLL_CTL_DEL;
+        } else if(!s->epoll_events) {
+            op = EPOLL_CTL_ADD;
+        }
+
+        mem_set(&ev, 0, sizeof(ev));
+        ev.events = wanted;
+        ev.data.fd = s->fd;
+
+        if(epoll_ctl(s->epoll_fd, op, s->fd, &ev)) {
+            pdebug(DEBUG_WARN, "Unable to change epoll registration of socket, errno: %d", errno);
+            return PLCTAG_ERR_BAD_STATUS;
+        }
+
+        s->epoll_events = wanted;
+    }
+
+    num_ready = epoll_wait(s->epoll_fd, ready, (int)(sizeof(ready)/sizeof(ready[0])), (timeout_ms < 0 ? -1 : timeout_ms));
+
+    if(num_ready < 0) {
+        if(errno == EINTR) {
+            /* a signal, let the caller try again. */
+            return SOCK_EVENT_NONE;
+        }
+
+        pdebug(DEBUG_WARN, "Error waiting for socket events, errno: %d", errno);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    if(num_ready == 0) {
+        return SOCK_EVENT_TIMEOUT;
+    }
+
+    for(int i=0; i < num_ready; i++) {
+        if(ready[i].data.fd == s->wake_read_fd) {
+            uint64_t count = 0;
+
+            /* clear the wake up. */
+            if(read(s->wake_read_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                pdebug(DEBUG_WARN, "Error clearing wake up eventfd, errno: %d", errno);
+            }
+
+            result |= SOCK_EVENT_WAKE_UP;
+        } else {
+            if(ready[i].events & EPOLLIN) {
+                result |= SOCK_EVENT_CAN_READ;
+            }
+
+            if(ready[i].events & EPOLLOUT) {
+                result |= SOCK_EVENT_CAN_WRITE;
+            }
+
+            if(ready[i].events & (EPOLLERR | EPOLLHUP)) {
+                /* let the read or write find out what happened. */
+                result |= SOCK_EVENT_ERROR | (events & (SOCK_EVENT_CAN_READ | SOCK_EVENT_CAN_WRITE));
+            }
+        }
+    }
+
+    return result;
+}
+
+
+extern int socket_wake(sock_p s)
+{
+    uint64_t one = 1;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(write(s->wake_write_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        pdebug(DEBUG_WARN, "Error writing wake up eventfd, errno: %d", errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+#else
+
+extern int socket_wait_event(sock_p s, int events, int timeout_ms)
+{
+    struct pollfd fds[2];
+    int num_fds = 1;
+    int num_ready = 0;
+    int result = SOCK_EVENT_NONE;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mem_set(fds, 0, sizeof(fds));
+
+    s->wait_events = events;
+
+    fds[0].fd = s->wake_read_fd;
+    fds[0].events = POLLIN;
+
+    if(s->is_open && (events & (SOCK_EVENT_CAN_READ | SOCK_EVENT_CAN_WRITE))) {
+        fds[1].fd = s->fd;
+        fds[1].events = (short)(((events & SOCK_EVENT_CAN_READ) ? POLLIN : 0) | ((events & SOCK_EVENT_CAN_WRITE) ? POLLOUT : 0));
+        num_fds = 2;
+    }
+
+    num_ready = poll(fds, (nfds_t)num_fds, (timeout_ms < 0 ? -1 : timeout_ms));
+
+    if(num_ready < 0) {
+        if(errno == EINTR) {
+            /* a signal, let the caller try again. */
+            return SOCK_EVENT_NONE;
+        }
+
+        pdebug(DEBUG_WARN, "Error waiting for socket events, errno: %d", errno);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    if(num_ready == 0) {
+        return SOCK_EVENT_TIMEOUT;
+    }
+
+    if(fds[0].revents & POLLIN) {
+        uint8_t dummy[32];
+
+        /* drain the pipe. */
+        while(read(s->wake_read_fd, dummy, sizeof(dummy)) > 0) { }
+
+        result |= SOCK_EVENT_WAKE_UP;
+    }
+
+    if(num_fds > 1) {
+        if(fds[1].revents & POLLIN) {
+            result |= SOCK_EVENT_CAN_READ;
+        }
+
+        if(fds[1].revents & POLLOUT) {
+            result |= SOCK_EVENT_CAN_WRITE;
+        }
+
+        if(fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            /* let the read or write find out what happened. */
+            result |= SOCK_EVENT_ERROR | (events & (SOCK_EVENT_CAN_READ | SOCK_EVENT_CAN_WRITE));
+        }
+    }
+
+    return result;
+}
+
+
+extern int socket_wake(sock_p s)
+{
+    uint8_t one = 1;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* a full pipe still wakes up the other side. */
+    if(write(s->wake_write_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        pdebug(DEBUG_WARN, "Error writing wake up pipe, errno: %d", errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+#endif
+
+
+
+
+
+
+
+
+/***************************************************************************
+ ****************************** Socket Sets ********************************
+ **************************************************************************/
+
+/*
+ * A socket set lets a few threads wait on many sockets at once.  Each
+ * socket is delivered to only one waiting thread when it has events
+ * and is not delivered again until it is rearmed.  Which events a
+ * socket is waited for is whatever was last passed to socket_wait_event()
+ * for it.  Wake ups from socket_wake() always count.
+ */
+
+#ifdef USE_EPOLL
+
+struct sock_set_t {
+    int epoll_fd;
+    int wake_fd;
+};
+
+
+extern int sock_set_create(sock_set_p *set)
+{
+    struct epoll_event ev;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!set) {
+        pdebug(DEBUG_WARN, "null socket set pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *set = (sock_set_p)mem_alloc(sizeof(struct sock_set_t));
+    if(! *set) {
+        pdebug(DEBUG_ERROR, "Failed to allocate memory for socket set.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*set)->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    (*set)->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if((*set)->wake_fd < 0 || (*set)->epoll_fd < 0) {
+        pdebug(DEBUG_ERROR, "Unable to create socket set, errno: %d", errno);
+        sock_set_destroy(set);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* the set wake up is never cleared, so it is level triggered. */
+    mem_set(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if(epoll_ctl((*set)->epoll_fd, EPOLL_CTL_ADD, (*set)->wake_fd, &ev)) {
+        pdebug(DEBUG_ERROR, "Unable to add wake up eventfd to socket set, errno: %d", errno);
+        sock_set_destroy(set);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_add(sock_set_p set, sock_p s, void *context)
+{
+    struct epoll_event ev;
+
+    if(!set || !s || !context) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* the socket's own epoll instance is readable when the socket has events. */
+    mem_set(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = context;
+
+    if(epoll_ctl(set->epoll_fd, EPOLL_CTL_ADD, s->epoll_fd, &ev)) {
+        pdebug(DEBUG_WARN, "Unable to add socket to socket set, errno: %d", errno);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_rearm(sock_set_p set, sock_p s, void *context)
+{
+    struct epoll_event ev;
+
+    if(!set || !s || !context) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mem_set(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = context;
+
+    if(epoll_ctl(set->epoll_fd, EPOLL_CTL_MOD, s->epoll_fd, &ev)) {
+        pdebug(DEBUG_WARN, "Unable to rearm socket in socket set, errno: %d", errno);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_remove(sock_set_p set, sock_p s)
+{
+    if(!set || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, s->epoll_fd, NULL)) {
+        pdebug(DEBUG_WARN, "Unable to remove socket from socket set, errno: %d", errno);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * sock_set_wait
+ *
+ * Wait for sockets in the set to have events.  The contexts of the
+ * ready sockets are put into the passed array.  Returns the number of
+ * contexts, zero on timeout or wake up, or an error.
+ */
+extern int sock_set_wait(sock_set_p set, void **ready, int max_ready, int timeout_ms)
+{
+    struct epoll_event events[32];
+    int num_events = 0;
+    int num_ready = 0;
+
+    if(!set || !ready) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(max_ready > (int)(sizeof(events)/sizeof(events[0]))) {
+        max_ready = (int)(sizeof(events)/sizeof(events[0]));
+    }
+
+    num_events = epoll_wait(set->epoll_fd, events, max_ready, (timeout_ms < 0 ? -1 : timeout_ms));
+
+    if(num_events < 0) {
+        if(errno == EINTR) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "Error waiting on socket set, errno: %d", errno);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    for(int i=0; i < num_events; i++) {
+        if(events[i].data.ptr) {
+            ready[num_ready] = events[i].data.ptr;
+            num_ready++;
+        }
+    }
+
+    return num_ready;
+}
+
+
+/*
+ * sock_set_wake
+ *
+ * Wake up all the threads waiting on the set.  This stays in effect,
+ * it is meant for shutting down.
+ */
+extern int sock_set_wake(sock_set_p set)
+{
+    uint64_t one = 1;
+
+    if(!set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(write(set->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        pdebug(DEBUG_WARN, "Error writing socket set wake up eventfd, errno: %d", errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_destroy(sock_set_p *set)
+{
+    if(!set || ! *set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if((*set)->epoll_fd >= 0) {
+        close((*set)->epoll_fd);
+    }
+
+    if((*set)->wake_fd >= 0) {
+        close((*set)->wake_fd);
+    }
 
+    mem_free(*set);
+    *set = NULL;
 
+    return PLCTAG_STATUS_OK;
+}
+
+#else
+
+struct sock_set_entry_t {
+    sock_p sock;
+    void *context;
+    int armed;
+};
+
+struct sock_set_t {
+    mutex_p mutex;
+    volatile int wake_all;
+    int wake_read_fd;
+    int wake_write_fd;
+    int num_entries;
+    int capacity;
+    struct sock_set_entry_t *entries;
+};
+
+
+extern int sock_set_create(sock_set_p *set)
+{
+    int wake_fds[2];
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!set) {
+        pdebug(DEBUG_WARN, "null socket set pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *set = (sock_set_p)mem_alloc(sizeof(struct sock_set_t));
+    if(! *set) {
+        pdebug(DEBUG_ERROR, "Failed to allocate memory for socket set.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*set)->wake_read_fd = -1;
+    (*set)->wake_write_fd = -1;
+
+    if((rc = mutex_create(&((*set)->mutex))) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create socket set mutex!");
+        sock_set_destroy(set);
+        return rc;
+    }
+
+    if(pipe(wake_fds)) {
+        pdebug(DEBUG_ERROR, "Unable to create socket set wake up pipe, errno: %d", errno);
+        sock_set_destroy(set);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    fcntl(wake_fds[0], F_SETFL, fcntl(wake_fds[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(wake_fds[1], F_SETFL, fcntl(wake_fds[1], F_GETFL, 0) | O_NONBLOCK);
+
+    (*set)->wake_read_fd = wake_fds[0];
+    (*set)->wake_write_fd = wake_fds[1];
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_add(sock_set_p set, sock_p s, void *context)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!set || !s || !context) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(set->mutex) {
+        if(set->num_entries >= set->capacity) {
+            int new_capacity = (set->capacity ? set->capacity * 2 : 16);
+            struct sock_set_entry_t *new_entries = mem_realloc(set->entries, (int)sizeof(*new_entries) * new_capacity);
+
+            if(!new_entries) {
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            set->entries = new_entries;
+            set->capacity = new_capacity;
+        }
+
+        set->entries[set->num_entries].sock = s;
+        set->entries[set->num_entries].context = context;
+        set->entries[set->num_entries].armed = 1;
+        set->num_entries++;
+    }
+
+    return rc;
+}
+
+
+extern int sock_set_rearm(sock_set_p set, sock_p s, void *context)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!set || !s || !context) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(set->mutex) {
+        for(int i=0; i < set->num_entries; i++) {
+            if(set->entries[i].sock == s) {
+                set->entries[i].context = context;
+                set->entries[i].armed = 1;
+                rc = PLCTAG_STATUS_OK;
+                break;
+            }
+        }
+    }
+
+    /* get the waiting threads to pick up the change. */
+    if(rc == PLCTAG_STATUS_OK) {
+        uint8_t one = 1;
+
+        if(write(set->wake_write_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            pdebug(DEBUG_WARN, "Error writing socket set wake up pipe, errno: %d", errno);
+        }
+    }
+
+    return rc;
+}
+
+
+extern int sock_set_remove(sock_set_p set, sock_p s)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!set || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(set->mutex) {
+        for(int i=0; i < set->num_entries; i++) {
+            if(set->entries[i].sock == s) {
+                set->entries[i] = set->entries[set->num_entries - 1];
+                set->num_entries--;
+                rc = PLCTAG_STATUS_OK;
+                break;
+            }
+        }
+    }
+
+    return rc;
+}
+
+
+extern int sock_set_wait(sock_set_p set, void **ready, int max_ready, int timeout_ms)
+{
+    struct pollfd *fds = NULL;
+    sock_p *socks = NULL;
+    int num_fds = 1;
+    int num_socks = 0;
+    int num_ready = 0;
+    int rc = 0;
+
+    if(!set || !ready) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* take a snapshot of the armed sockets. */
+    critical_block(set->mutex) {
+        fds = mem_alloc((int)sizeof(*fds) * (1 + (2 * set->num_entries)));
+        socks = mem_alloc((int)sizeof(*socks) * (1 + set->num_entries));
+
+        if(!fds || !socks) {
+            break;
+        }
+
+        fds[0].fd = set->wake_read_fd;
+        fds[0].events = POLLIN;
+
+        for(int i=0; i < set->num_entries; i++) {
+            sock_p s = set->entries[i].sock;
+
+            if(!set->entries[i].armed) {
+                continue;
+            }
+
+            socks[num_socks] = s;
+            num_socks++;
+
+            fds[num_fds].fd = s->wake_read_fd;
+            fds[num_fds].events = POLLIN;
+            num_fds++;
+
+            /* a negative fd is ignored by poll(). */
+            fds[num_fds].fd = ((s->is_open && (s->wait_events & (SOCK_EVENT_CAN_READ | SOCK_EVENT_CAN_WRITE))) ? s->fd : -1);
+            fds[num_fds].events = (short)(((s->wait_events & SOCK_EVENT_CAN_READ) ? POLLIN : 0) | ((s->wait_events & SOCK_EVENT_CAN_WRITE) ? POLLOUT : 0));
+            num_fds++;
+        }
+    }
+
+    if(!fds || !socks) {
+        mem_free(fds);
+        mem_free(socks);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    rc = poll(fds, (nfds_t)num_fds, (timeout_ms < 0 ? -1 : timeout_ms));
+
+    if(rc < 0 && errno != EINTR) {
+        pdebug(DEBUG_WARN, "Error waiting on socket set, errno: %d", errno);
+        num_ready = PLCTAG_ERR_BAD_STATUS;
+    } else if(rc > 0) {
+        /* clear rearm notices, but leave a shut down wake up in place. */
+        if((fds[0].revents & POLLIN) && !set->wake_all) {
+            uint8_t dummy[32];
+
+            while(read(set->wake_read_fd, dummy, sizeof(dummy)) > 0) { }
+        }
+
+        /* hand out each ready socket once. */
+        critical_block(set->mutex) {
+            for(int i=0; i < num_socks && num_ready < max_ready; i++) {
+                if((fds[1 + (2*i)].revents | fds[2 + (2*i)].revents) == 0) {
+                    continue;
+                }
+
+                for(int j=0; j < set->num_entries; j++) {
+                    if(set->entries[j].sock == socks[i] && set->entries[j].armed) {
+                        set->entries[j].armed = 0;
+                        ready[num_ready] = set->entries[j].context;
+                        num_ready++;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    mem_free(fds);
+    mem_free(socks);
+
+    return num_ready;
+}
+
+
+extern int sock_set_wake(sock_set_p set)
+{
+    uint8_t one = 1;
+
+    if(!set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    set->wake_all = 1;
+
+    if(write(set->wake_write_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        pdebug(DEBUG_WARN, "Error writing socket set wake up pipe, errno: %d", errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_destroy(sock_set_p *set)
+{
+    if(!set || ! *set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if((*set)->wake_read_fd >= 0) {
+        close((*set)->wake_read_fd);
+    }
+
+    if((*set)->wake_write_fd >= 0) {
+        close((*set)->wake_write_fd);
+    }
+
+    if((*set)->mutex) {
+        mutex_destroy(&((*set)->mutex));
+    }
+
+    mem_free((*set)->entries);
+    mem_free(*set);
+    *set = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+#endif
+
+
+
+
+/***************************************************************************
+ ******************************* Notifiers *********************************
+ **************************************************************************/
+
+/*
+ * A notifier is a file descriptor that is readable while it is signaled.
+ * Applications can add it to their own poll, epoll or libuv loop.  Linux
+ * uses an eventfd, everyone else uses a pipe.
+ */
+
+struct notifier_t {
+    int read_fd;
+    int write_fd;
+};
+
+
+extern int notifier_create(notifier_p *n)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!n) {
+        pdebug(DEBUG_WARN, "null notifier pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *n = (notifier_p)mem_alloc(sizeof(struct notifier_t));
+    if(! *n) {
+        pdebug(DEBUG_ERROR, "Failed to allocate memory for notifier.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+#ifdef USE_EPOLL
+    (*n)->read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if((*n)->read_fd < 0) {
+        pdebug(DEBUG_ERROR, "Unable to create notifier eventfd, errno: %d", errno);
+        mem_free(*n);
+        *n = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    (*n)->write_fd = (*n)->read_fd;
+#else
+    {
+        int fds[2];
+
+        if(pipe(fds)) {
+            pdebug(DEBUG_ERROR, "Unable to create notifier pipe, errno: %d", errno);
+            mem_free(*n);
+            *n = NULL;
+            return PLCTAG_ERR_CREATE;
+        }
+
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+        (*n)->read_fd = fds[0];
+        (*n)->write_fd = fds[1];
+    }
+#endif
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+extern int notifier_signal(notifier_p n)
+{
+    uint64_t one = 1;
+
+    if(!n) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* a full pipe is still readable, so EAGAIN is fine. */
+    if(write(n->write_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        pdebug(DEBUG_WARN, "Error signaling notifier, errno: %d", errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+extern int notifier_clear(notifier_p n)
+{
+    uint64_t buf[16];
+
+    if(!n) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* an eventfd is cleared by one read, a pipe needs draining. */
+    while(read(n->read_fd, buf, sizeof(buf)) > 0) { }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+extern intptr_t notifier_get_handle(notifier_p n)
+{
+    if(!n) {
+        return (intptr_t)PLCTAG_ERR_NULL_PTR;
+    }
+
+    return (intptr_t)n->read_fd;
+}
+
+
+
+extern int notifier_destroy(notifier_p *n)
+{
+    if(!n || !*n) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if((*n)->write_fd != (*n)->read_fd) {
+        close((*n)->write_fd);
+    }
+
+    close((*n)->read_fd);
+
+    mem_free(*n);
+    *n = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
 
 
 
@@ -109,6 +109,17 @@ extern int mutex_try_lock(mutex_p m);
 extern int mutex_unlock(mutex_p m);
 extern int mutex_destroy(mutex_p *m);
 
+/*
+ * condition variables.  A signal is remembered until a waiter gets it,
+ * so a signal sent before the wait starts is not lost.
+ */
+typedef struct cond_t *cond_p;
+extern int cond_create(cond_p *c);
+extern int cond_wait(cond_p c, int timeout_ms);
+extern int cond_signal(cond_p c);
+extern int cond_clear(cond_p c);
+extern int cond_destroy(cond_p *c);
+
 
 
 /* macros are evil */
@@ -161,15 +172,51 @@ extern int lock_acquire_try(lock_t *lock);
 extern int lock_acquire(lock_t *lock);
 extern void lock_release(lock_t *lock);
 
+/* atomic integers, all of these act as full memory barriers */
+extern int32_t atomic_int32_get(volatile int32_t *val);
+extern void atomic_int32_set(volatile int32_t *val, int32_t new_val);
+extern int32_t atomic_int32_add(volatile int32_t *val, int32_t delta);
+extern int atomic_int32_cas(volatile int32_t *val, int32_t old_val, int32_t new_val);
+
 /* socket functions */
 typedef struct sock_t *sock_p;
 extern int socket_create(sock_p *s);
-extern int socket_connect_tcp(sock_p s, const char *host, int port);
+extern int socket_connect_tcp_start(sock_p s, const char *host, int port);
+extern int socket_connect_tcp_check(sock_p s);
 extern int socket_read(sock_p s, uint8_t *buf, int size);
 extern int socket_write(sock_p s, uint8_t *buf, int size);
 extern int socket_close(sock_p s);
 extern int socket_destroy(sock_p *s);
 
+/* waiting for socket events, returns a mask of these or an error. */
+#define SOCK_EVENT_NONE         (0)
+#define SOCK_EVENT_TIMEOUT      (1 << 0)
+#define SOCK_EVENT_WAKE_UP      (1 << 1)
+#define SOCK_EVENT_CAN_READ     (1 << 2)
+#define SOCK_EVENT_CAN_WRITE    (1 << 3)
+#define SOCK_EVENT_ERROR        (1 << 4)
+
+extern int socket_wait_event(sock_p s, int events, int timeout_ms);
+extern int socket_wake(sock_p s);
+
+/* waiting on many sockets from a few threads. */
+typedef struct sock_set_t *sock_set_p;
+extern int sock_set_create(sock_set_p *set);
+extern int sock_set_add(sock_set_p set, sock_p s, void *context);
+extern int sock_set_rearm(sock_set_p set, sock_p s, void *context);
+extern int sock_set_remove(sock_set_p set, sock_p s);
+extern int sock_set_wait(sock_set_p set, void **ready, int max_ready, int timeout_ms);
+extern int sock_set_wake(sock_set_p set);
+extern int sock_set_destroy(sock_set_p *set);
+
+/* signaled by library threads and waited on by the application's event loop. */
+typedef struct notifier_t *notifier_p;
+extern int notifier_create(notifier_p *n);
+extern int notifier_signal(notifier_p n);
+extern int notifier_clear(notifier_p n);
+extern intptr_t notifier_get_handle(notifier_p n);
+extern int notifier_destroy(notifier_p *n);
+
 /* serial handling */
 typedef struct serial_port_t *serial_port_p;
 #define PLC_SERIAL_PORT_NULL ((plc_serial_port)NULL)
@@ -588,6 +588,133 @@ int mutex_destroy(mutex_p *m)
 
 
 
+/***************************************************************************
+ ************************** Condition Variables ****************************
+ **************************************************************************/
+
+/*
+ * An auto-reset event does what we need: it stays set until one waiter
+ * gets it.
+ */
+
+struct cond_t {
+    HANDLE h_event;
+};
+
+
+int cond_create(cond_p *c)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *c = (struct cond_t *)mem_alloc(sizeof(struct cond_t));
+    if(! *c) {
+        pdebug(DEBUG_ERROR, "Unable to allocate condition variable.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*c)->h_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if(!(*c)->h_event) {
+        mem_free(*c);
+        *c = NULL;
+        pdebug(DEBUG_ERROR, "Error creating condition variable event.");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * cond_wait
+ *
+ * Wait until the condition variable is signaled or the timeout passes.
+ * Getting the signal clears it.  Returns PLCTAG_ERR_TIMEOUT if there
+ * was no signal in time.
+ */
+int cond_wait(cond_p c, int timeout_ms)
+{
+    DWORD rc = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    rc = WaitForSingleObject(c->h_event, (timeout_ms < 0 ? 0 : (DWORD)timeout_ms));
+
+    if(rc == WAIT_TIMEOUT) {
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    if(rc != WAIT_OBJECT_0) {
+        pdebug(DEBUG_WARN, "Error waiting on condition variable!");
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_signal(cond_p c)
+{
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    SetEvent(c->h_event);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_clear(cond_p c)
+{
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    ResetEvent(c->h_event);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_destroy(cond_p *c)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c || ! *c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    CloseHandle((*c)->h_event);
+
+    mem_free(*c);
+    *c = NULL;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
 /***************************************************************************
  ******************************* Threads ***********************************
  **************************************************************************/
@@ -797,6 +924,40 @@ extern void lock_release(lock_t *lock)
 
 
 
+/*
+ * atomic_int32_get/set/add/cas
+ *
+ * Atomic operations on 32-bit integers.  These are all full barriers.
+ * atomic_int32_add returns the new value.  atomic_int32_cas returns
+ * non-zero if the value was swapped.
+ */
+
+int32_t atomic_int32_get(volatile int32_t *val)
+{
+    return (int32_t)InterlockedCompareExchange((volatile LONG *)val, 0, 0);
+}
+
+
+void atomic_int32_set(volatile int32_t *val, int32_t new_val)
+{
+    InterlockedExchange((volatile LONG *)val, (LONG)new_val);
+}
+
+
+int32_t atomic_int32_add(volatile int32_t *val, int32_t delta)
+{
+    return (int32_t)InterlockedExchangeAdd((volatile LONG *)val, (LONG)delta) + delta;
+}
+
+
+int atomic_int32_cas(volatile int32_t *val, int32_t old_val, int32_t new_val)
+{
+    return (InterlockedCompareExchange((volatile LONG *)val, (LONG)new_val, (LONG)old_val) == (LONG)old_val) ? 1 : 0;
+}
+
+
+
+
 
 
 
@@ -807,14 +968,29 @@ extern void lock_release(lock_t *lock)
  **************************************************************************/
 
 
+#define MAX_IPS (8)
+
 struct sock_t {
     SOCKET fd;
     int port;
     int is_open;
+
+    /* addresses left to try while a connection is being set up. */
+    int is_connecting;
+    IN_ADDR ips[MAX_IPS];
+    int num_ips;
+    int ip_index;
+
+    /* socket readiness and wake ups from other threads. */
+    WSAEVENT sock_event;
+    WSAEVENT wake_event;
+
+    int wait_events; /* events last waited for, used by socket sets. */
 };
 
 
-#define MAX_IPS (8)
+static int socket_open_fd(sock_p s, SOCKET *fd_out);
+static int socket_connect_next_ip(sock_p s);
 
 
 /* windows needs to have the Winsock library initialized
@@ -851,6 +1027,26 @@ extern int socket_create(sock_p *s)
         return PLCTAG_ERR_NO_MEM;
     }
 
+    (*s)->sock_event = WSACreateEvent();
+    (*s)->wake_event = WSACreateEvent();
+
+    if((*s)->sock_event == WSA_INVALID_EVENT || (*s)->wake_event == WSA_INVALID_EVENT) {
+        pdebug(DEBUG_ERROR, "Unable to create socket events!");
+
+        if((*s)->sock_event != WSA_INVALID_EVENT) {
+            WSACloseEvent((*s)->sock_event);
+        }
+
+        if((*s)->wake_event != WSA_INVALID_EVENT) {
+            WSACloseEvent((*s)->wake_event);
+        }
+
+        mem_free(*s);
+        *s = NULL;
+
+        return PLCTAG_ERR_CREATE;
+    }
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -858,21 +1054,139 @@ extern int socket_create(sock_p *s)
 
 
 
-extern int socket_connect_tcp(sock_p s, const char *host, int port)
+/*
+ * socket_connect_tcp_start
+ *
+ * Look up the host and start connecting to it without blocking.  The
+ * host name lookup itself can still block.  Returns PLCTAG_STATUS_OK if
+ * the connection is already up and PLCTAG_STATUS_PENDING if it is in
+ * progress.  Wait for SOCK_EVENT_CAN_WRITE and call
+ * socket_connect_tcp_check() to find out how it went.
+ */
+extern int socket_connect_tcp_start(sock_p s, const char *host, int port)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s || !host) {
+        pdebug(DEBUG_WARN, "Null socket or host pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* figure out what address we are connecting to. */
+    mem_set(s->ips, 0, sizeof(s->ips));
+    s->num_ips = 0;
+    s->ip_index = 0;
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET,host,(struct in_addr *)s->ips) > 0) {
+        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s", host);
+        s->num_ips = 1;
+    } else {
+        struct addrinfo hints;
+        struct addrinfo* res_head = NULL;
+        struct addrinfo *res = NULL;
+        int rc = 0;
+
+        mem_set(&hints, 0, sizeof(hints));
+
+        hints.ai_socktype = SOCK_STREAM; /* TCP */
+        hints.ai_family = AF_INET; /* IP V4 only */
+
+        if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
+            pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+            if (res_head) {
+                freeaddrinfo(res_head);
+            }
+
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        for(res = res_head; res && s->num_ips < MAX_IPS; res = res->ai_next) {
+            s->ips[s->num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
+            s->num_ips++;
+        }
+
+        freeaddrinfo(res_head);
+    }
+
+    s->port = port;
+
+    return socket_connect_next_ip(s);
+}
+
+
+/*
+ * socket_connect_tcp_check
+ *
+ * See if a connection started by socket_connect_tcp_start() is up.  If
+ * the current address refused it, the next one is tried.  Returns
+ * PLCTAG_STATUS_PENDING while the connection is still in progress.
+ */
+extern int socket_connect_tcp_check(sock_p s)
+{
+    fd_set write_fds;
+    fd_set error_fds;
+    struct timeval no_wait;
+    int rc = 0;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(!s->is_connecting) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    FD_ZERO(&write_fds);
+    FD_ZERO(&error_fds);
+    FD_SET(s->fd, &write_fds);
+    FD_SET(s->fd, &error_fds);
+
+    no_wait.tv_sec = 0;
+    no_wait.tv_usec = 0;
+
+    /* the first argument is ignored on Windows. */
+    rc = select(0, NULL, &write_fds, &error_fds, &no_wait);
+    if(rc == 0) {
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    if(rc == SOCKET_ERROR) {
+        pdebug(DEBUG_WARN, "Error checking socket connection, error: %d", WSAGetLastError());
+        socket_close(s);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(FD_ISSET(s->fd, &write_fds)) {
+        pdebug(DEBUG_DETAIL, "Connection succeeded.");
+        s->is_connecting = 0;
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_DETAIL, "Connection attempt failed.");
+
+    /* this address did not work, try the next one. */
+    socket_close(s);
+    s->ip_index++;
+
+    return socket_connect_next_ip(s);
+}
+
+
+/* make a non-blocking TCP socket with the options we want. */
+int socket_open_fd(sock_p s, SOCKET *fd_out)
 {
-    IN_ADDR ips[MAX_IPS];
-    int num_ips = 0;
-    struct sockaddr_in gw_addr;
     int sock_opt = 1;
-    u_long non_blocking=1;
-    int i = 0;
-    int done = 0;
     SOCKET fd;
     struct timeval timeout; /* used for timing out connections etc. */
     struct linger so_linger;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
-
     /* Open a socket for communication with the gateway. */
     fd = socket(AF_INET, SOCK_STREAM, 0/*IPPROTO_TCP*/);
 
@@ -916,104 +1230,63 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
         return PLCTAG_ERR_OPEN;
     }
 
-    /* figure out what address we are connecting to. */
-
-    /* try a numeric IP address conversion first. */
-    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
-        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s", host);
-        num_ips = 1;
-    } else {
-        struct addrinfo hints;
-        struct addrinfo* res_head = NULL;
-        struct addrinfo *res = NULL;
-        int rc = 0;
-
-        mem_set(&ips, 0, sizeof(ips));
-        mem_set(&hints, 0, sizeof(hints));
-
-        hints.ai_socktype = SOCK_STREAM; /* TCP */
-        hints.ai_family = AF_INET; /* IP V4 only */
-
-        if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
-            pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
-
-            if (res) {
-                freeaddrinfo(res_head);
-            }
-
-            return PLCTAG_ERR_BAD_GATEWAY;
-        }
-
-        res = res_head;
-        for (num_ips = 0; res && num_ips < MAX_IPS; num_ips++) {
-            ips[num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
-            res = res->ai_next;
-        }
-
-        freeaddrinfo(res_head);
+    /* this makes the socket non-blocking, connect() included. */
+    if(WSAEventSelect(fd, s->sock_event, FD_CONNECT | FD_READ | FD_WRITE | FD_CLOSE)) {
+        pdebug(DEBUG_WARN, "Error setting up socket events, error: %d", WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
     }
 
+    *fd_out = fd;
 
-    /*
-     * now try to connect to the remote gateway.  We may need to
-     * try several of the IPs we have.
-     */
+    return PLCTAG_STATUS_OK;
+}
 
-    i = 0;
-    done = 0;
+
+/* start connecting to the remaining addresses until one is in progress or connected. */
+int socket_connect_next_ip(sock_p s)
+{
+    struct sockaddr_in gw_addr;
+    int rc = PLCTAG_STATUS_OK;
 
     memset((void *)&gw_addr,0, sizeof(gw_addr));
     gw_addr.sin_family = AF_INET ;
-    gw_addr.sin_port = htons(port);
+    gw_addr.sin_port = htons((u_short)s->port);
 
-    do {
-        int rc;
-        /* try each IP until we run out or get a connection. */
-        gw_addr.sin_addr.s_addr = ips[i].s_addr;
+    for(; s->ip_index < s->num_ips; s->ip_index++) {
+        SOCKET fd;
+        int err = 0;
 
-        /*pdebug(DEBUG_DETAIL,"Attempting to connect to %s",inet_ntoa(*((struct in_addr *)&ips[i])));*/
+        if((rc = socket_open_fd(s, &fd)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
 
-        rc = connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr));
+        gw_addr.sin_addr.s_addr = s->ips[s->ip_index].s_addr;
 
-        if( rc == 0) {
-            /* Windows MSVC does not like inet_ntoa(), not safe.
-             * pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(*((struct in_addr *)&ips[i])));
-             */
-            done = 1;
-        } else {
-            /* MSVC does not like inet_ntoa(), not safe.
-             * pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(*((struct in_addr *)&ips[i])),errno);
-             */
-            i++;
-        }
-    } while(!done && i < num_ips);
+        s->fd = fd;
+        s->is_open = 1;
 
-    if(!done) {
-        closesocket(fd);
-        pdebug(DEBUG_WARN,"Unable to connect to any gateway host IP address!");
-        return PLCTAG_ERR_OPEN;
-    }
+        if(connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr)) == 0) {
+            s->is_connecting = 0;
+            return PLCTAG_STATUS_OK;
+        }
 
+        err = WSAGetLastError();
+        if(err == WSAEWOULDBLOCK) {
+            pdebug(DEBUG_DETAIL, "Connection is in progress.");
+            s->is_connecting = 1;
+            return PLCTAG_STATUS_PENDING;
+        }
 
-    /* FIXME
-     * connect() is a little easier to handle in blocking mode, for now
-     * we make the socket non-blocking here, after connect().
-     */
+        /* MSVC does not like inet_ntoa(), not safe. */
+        pdebug(DEBUG_DETAIL, "Attempt to connect failed, error: %d", err);
 
-    if(ioctlsocket(fd,FIONBIO,&non_blocking)) {
-        /*pdebug("Error getting socket options, errno: %d", errno);*/
-        closesocket(fd);
-        return PLCTAG_ERR_OPEN;
+        socket_close(s);
     }
 
-    /* save the values */
-    s->fd = fd;
-    s->port = port;
-    s->is_open = 1;
-
-    pdebug(DEBUG_DETAIL, "Done.");
+    pdebug(DEBUG_WARN,"Unable to connect to any gateway host IP address!");
 
-    return PLCTAG_STATUS_OK;
+    return PLCTAG_ERR_OPEN;
 }
 
 
@@ -1052,6 +1325,12 @@ extern int socket_read(sock_p s, uint8_t *buf, int size)
         }
     }
 
+    /* zero bytes from a readable socket means the other end closed it. */
+    if(rc == 0 && size > 0) {
+        pdebug(DEBUG_WARN, "Socket closed by remote end.");
+        return PLCTAG_ERR_READ;
+    }
+
     return rc;
 }
 
@@ -1090,6 +1369,8 @@ extern int socket_write(sock_p s, uint8_t *buf, int size)
 
 extern int socket_close(sock_p s)
 {
+    int rc = 0;
+
     if(!s) {
         return PLCTAG_ERR_NULL_PTR;
     }
@@ -1098,12 +1379,16 @@ extern int socket_close(sock_p s)
         return PLCTAG_STATUS_OK;
     }
 
-    if(!closesocket(s->fd)) {
-        return PLCTAG_ERR_CLOSE;
-    }
+    rc = closesocket(s->fd);
 
     s->fd = 0;
     s->is_open = 0;
+    s->is_connecting = 0;
+
+    if(rc) {
+        pdebug(DEBUG_WARN, "Error closing socket, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_CLOSE;
+    }
 
     return PLCTAG_STATUS_OK;
 }
@@ -1116,6 +1401,9 @@ extern int socket_destroy(sock_p *s)
 
     socket_close(*s);
 
+    WSACloseEvent((*s)->sock_event);
+    WSACloseEvent((*s)->wake_event);
+
     mem_free(*s);
 
     *s = 0;
@@ -1128,6 +1416,95 @@ extern int socket_destroy(sock_p *s)
 
 
 
+/*
+ * socket_wait_event
+ *
+ * Wait until the socket is ready for the requested events, another
+ * thread calls socket_wake(), or the timeout passes.  A negative timeout
+ * waits forever.  If the socket is not open, only wake ups and the
+ * timeout are waited on.
+ *
+ * Returns a mask of SOCK_EVENT_* flags or an error code.
+ */
+
+extern int socket_wait_event(sock_p s, int events, int timeout_ms)
+{
+    WSAEVENT wait_events[2];
+    DWORD num_events = 1;
+    DWORD rc = 0;
+    int result = SOCK_EVENT_NONE;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    wait_events[0] = s->wake_event;
+
+    s->wait_events = events;
+
+    if(s->is_open && (events & (SOCK_EVENT_CAN_READ | SOCK_EVENT_CAN_WRITE))) {
+        wait_events[1] = s->sock_event;
+        num_events = 2;
+    }
+
+    rc = WSAWaitForMultipleEvents(num_events, wait_events, FALSE, (timeout_ms < 0 ? WSA_INFINITE : (DWORD)timeout_ms), FALSE);
+
+    if(rc == WSA_WAIT_TIMEOUT) {
+        return SOCK_EVENT_TIMEOUT;
+    }
+
+    if(rc == WSA_WAIT_FAILED) {
+        pdebug(DEBUG_WARN, "Error waiting for socket events, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    /* check both, more than one may be set. */
+    if(WSAWaitForMultipleEvents(1, &s->wake_event, FALSE, 0, FALSE) == WSA_WAIT_EVENT_0) {
+        WSAResetEvent(s->wake_event);
+        result |= SOCK_EVENT_WAKE_UP;
+    }
+
+    if(num_events > 1) {
+        WSANETWORKEVENTS net_events;
+
+        /* this resets the socket event. */
+        if(WSAEnumNetworkEvents(s->fd, s->sock_event, &net_events) == 0) {
+            if(net_events.lNetworkEvents & FD_READ) {
+                result |= SOCK_EVENT_CAN_READ;
+            }
+
+            /* a finished connect, good or bad, is checked like a write. */
+            if(net_events.lNetworkEvents & (FD_WRITE | FD_CONNECT)) {
+                result |= SOCK_EVENT_CAN_WRITE;
+            }
+
+            if(net_events.lNetworkEvents & FD_CLOSE) {
+                /* let the read or write find out what happened. */
+                result |= SOCK_EVENT_ERROR | (events & (SOCK_EVENT_CAN_READ | SOCK_EVENT_CAN_WRITE));
+            }
+        }
+    }
+
+    return result;
+}
+
+
+extern int socket_wake(sock_p s)
+{
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!WSASetEvent(s->wake_event)) {
+        pdebug(DEBUG_WARN, "Error setting wake up event, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 
 
@@ -1399,6 +1776,322 @@ int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size
 
 
 
+/***************************************************************************
+ ****************************** Socket Sets ********************************
+ **************************************************************************/
+
+/*
+ * A socket set lets a few threads wait on many sockets at once.  Each
+ * socket is delivered to only one waiting thread when it has events
+ * and is not delivered again until it is rearmed.
+ *
+ * WSAWaitForMultipleEvents() is limited to a small number of events so
+ * the set checks the sockets' events itself and sleeps briefly between
+ * checks.
+ */
+
+#define SOCK_SET_POLL_MS (10)
+
+struct sock_set_entry_t {
+    sock_p sock;
+    void *context;
+    int armed;
+};
+
+struct sock_set_t {
+    mutex_p mutex;
+    volatile int wake_all;
+    int num_entries;
+    int capacity;
+    struct sock_set_entry_t *entries;
+};
+
+
+extern int sock_set_create(sock_set_p *set)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!set) {
+        pdebug(DEBUG_WARN, "null socket set pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *set = (sock_set_p)mem_alloc(sizeof(struct sock_set_t));
+    if(! *set) {
+        pdebug(DEBUG_ERROR, "Failed to allocate memory for socket set.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if((rc = mutex_create(&((*set)->mutex))) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create socket set mutex!");
+        mem_free(*set);
+        *set = NULL;
+        return rc;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_add(sock_set_p set, sock_p s, void *context)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!set || !s || !context) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(set->mutex) {
+        if(set->num_entries >= set->capacity) {
+            int new_capacity = (set->capacity ? set->capacity * 2 : 16);
+            struct sock_set_entry_t *new_entries = mem_realloc(set->entries, (int)sizeof(*new_entries) * new_capacity);
+
+            if(!new_entries) {
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            set->entries = new_entries;
+            set->capacity = new_capacity;
+        }
+
+        set->entries[set->num_entries].sock = s;
+        set->entries[set->num_entries].context = context;
+        set->entries[set->num_entries].armed = 1;
+        set->num_entries++;
+    }
+
+    return rc;
+}
+
+
+extern int sock_set_rearm(sock_set_p set, sock_p s, void *context)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!set || !s || !context) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(set->mutex) {
+        for(int i=0; i < set->num_entries; i++) {
+            if(set->entries[i].sock == s) {
+                set->entries[i].context = context;
+                set->entries[i].armed = 1;
+                rc = PLCTAG_STATUS_OK;
+                break;
+            }
+        }
+    }
+
+    return rc;
+}
+
+
+extern int sock_set_remove(sock_set_p set, sock_p s)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!set || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(set->mutex) {
+        for(int i=0; i < set->num_entries; i++) {
+            if(set->entries[i].sock == s) {
+                set->entries[i] = set->entries[set->num_entries - 1];
+                set->num_entries--;
+                rc = PLCTAG_STATUS_OK;
+                break;
+            }
+        }
+    }
+
+    return rc;
+}
+
+
+static int sock_set_is_ready(sock_p s)
+{
+    if(WSAWaitForMultipleEvents(1, &s->wake_event, FALSE, 0, FALSE) == WSA_WAIT_EVENT_0) {
+        return 1;
+    }
+
+    if(s->is_open && (s->wait_events & (SOCK_EVENT_CAN_READ | SOCK_EVENT_CAN_WRITE))) {
+        if(WSAWaitForMultipleEvents(1, &s->sock_event, FALSE, 0, FALSE) == WSA_WAIT_EVENT_0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+extern int sock_set_wait(sock_set_p set, void **ready, int max_ready, int timeout_ms)
+{
+    int64_t end_time = time_ms() + timeout_ms;
+    int num_ready = 0;
+
+    if(!set || !ready) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    do {
+        critical_block(set->mutex) {
+            for(int i=0; i < set->num_entries && num_ready < max_ready; i++) {
+                if(set->entries[i].armed && sock_set_is_ready(set->entries[i].sock)) {
+                    set->entries[i].armed = 0;
+                    ready[num_ready] = set->entries[i].context;
+                    num_ready++;
+                }
+            }
+        }
+
+        if(num_ready > 0 || set->wake_all) {
+            break;
+        }
+
+        sleep_ms(SOCK_SET_POLL_MS);
+    } while(timeout_ms < 0 || time_ms() < end_time);
+
+    return num_ready;
+}
+
+
+extern int sock_set_wake(sock_set_p set)
+{
+    if(!set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    set->wake_all = 1;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_destroy(sock_set_p *set)
+{
+    if(!set || ! *set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mutex_destroy(&((*set)->mutex));
+
+    mem_free((*set)->entries);
+    mem_free(*set);
+    *set = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/***************************************************************************
+ ******************************* Notifiers *********************************
+ **************************************************************************/
+
+/*
+ * A notifier is a manual reset event that is set while it is signaled.
+ * Applications can wait on the handle in their own event loop.
+ */
+
+struct notifier_t {
+    HANDLE h_event;
+};
+
+
+extern int notifier_create(notifier_p *n)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!n) {
+        pdebug(DEBUG_WARN, "null notifier pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *n = (notifier_p)mem_alloc(sizeof(struct notifier_t));
+    if(! *n) {
+        pdebug(DEBUG_ERROR, "Failed to allocate memory for notifier.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*n)->h_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if(!(*n)->h_event) {
+        pdebug(DEBUG_ERROR, "Unable to create notifier event, error: %d", (int)GetLastError());
+        mem_free(*n);
+        *n = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+extern int notifier_signal(notifier_p n)
+{
+    if(!n) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!SetEvent(n->h_event)) {
+        pdebug(DEBUG_WARN, "Error signaling notifier, error: %d", (int)GetLastError());
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+extern int notifier_clear(notifier_p n)
+{
+    if(!n) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    ResetEvent(n->h_event);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+extern intptr_t notifier_get_handle(notifier_p n)
+{
+    if(!n) {
+        return (intptr_t)PLCTAG_ERR_NULL_PTR;
+    }
+
+    return (intptr_t)n->h_event;
+}
+
+
+
+extern int notifier_destroy(notifier_p *n)
+{
+    if(!n || !*n) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    CloseHandle((*n)->h_event);
+
+    mem_free(*n);
+    *n = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 /***************************************************************************
  ***************************** Miscellaneous *******************************
  **************************************************************************/
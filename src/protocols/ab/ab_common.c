@@ -31,6 +31,7 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <ctype.h>
 #include <limits.h>
 #include <float.h>
 #include <platform.h>
@@ -85,8 +86,11 @@ volatile int ab_protocol_terminating = 0;
 
 /* forward declarations*/
 static int get_tag_data_type(ab_tag_p tag, attr attribs);
+static int udt_member_elem_size(ab_session_p session, uint16_t type);
 
 static void ab_tag_destroy(ab_tag_p tag);
+static uint8_t *ab_tag_cache_name(ab_tag_p tag, int *name_size);
+static void abort_frags(struct ab_frag_t *frags, int num_frags);
 static int default_abort(plc_tag_p tag);
 static int default_read(plc_tag_p tag);
 static int default_status(plc_tag_p tag);
@@ -137,7 +141,10 @@ struct tag_vtable_t default_vtable = {
     ab_set_float64,
 
     ab_get_float32,
-    ab_set_float32
+    ab_set_float32,
+
+    /* structure members */
+    ab_get_member_offset
 };
 
 
@@ -293,6 +300,11 @@ plc_tag_p ab_tag_create(attr attribs)
         tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
         tag->vtable = &eip_cip_vtable;
 
+        /* the template is only read with connected messages. */
+        if(tag->udt_template) {
+            tag->use_connected_msg = 1;
+        }
+
         break;
 
     case AB_PROTOCOL_MLGX800:
@@ -312,6 +324,13 @@ plc_tag_p ab_tag_create(attr attribs)
     /* pass the connection requirement since it may be overridden above. */
     attr_set_int(attribs, "use_connected_msg", tag->use_connected_msg);
 
+    /* only CIP reads and writes can be split up. */
+    if(tag->vtable == &eip_cip_vtable) {
+        tag->parallel_reads = attr_get_int(attribs, "parallel_reads", 0);
+        tag->parallel_writes = attr_get_int(attribs, "parallel_writes", 0);
+        tag->partial_writes = attr_get_int(attribs, "partial_writes", 0);
+    }
+
     /* determine the total tag size if this is not a tag list. */
 //    if(!tag->tag_list) {
 //        if(!tag->elem_size) {
@@ -372,17 +391,58 @@ plc_tag_p ab_tag_create(attr attribs)
      * check the tag name, this is protocol specific.
      */
 
-    if(!tag->tag_list && check_tag_name(tag, attr_get_str(attribs,"name",NULL)) != PLCTAG_STATUS_OK) {
+    if(!tag->tag_list && !tag->udt_template && check_tag_name(tag, attr_get_str(attribs,"name",NULL)) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_INFO,"Bad tag name!");
         tag->status = PLCTAG_ERR_BAD_PARAM;
         return (plc_tag_p)tag;
     }
 
+    /* address Logix tags by symbol instance ID if a tag listing found it. */
+    if(attr_get_int(attribs, "use_instance_id", 0) && !tag->tag_list && !tag->udt_template && tag->protocol_type == AB_PROTOCOL_LGX) {
+        uint8_t symbolic_name[MAX_TAG_NAME];
+        int symbolic_name_size = tag->encoded_name_size;
+
+        /* instance IDs change with a download, keep the symbolic name for the caches. */
+        mem_copy(symbolic_name, tag->encoded_name, symbolic_name_size);
+
+        if(cip_encode_symbol_instance(tag) == PLCTAG_STATUS_OK) {
+            tag->symbolic_name = (uint8_t *)mem_alloc(symbolic_name_size);
+            if(!tag->symbolic_name) {
+                pdebug(DEBUG_ERROR, "Unable to allocate memory for the symbolic tag name!");
+                tag->status = PLCTAG_ERR_NO_MEM;
+                return (plc_tag_p)tag;
+            }
+
+            mem_copy(tag->symbolic_name, symbolic_name, symbolic_name_size);
+            tag->symbolic_name_size = symbolic_name_size;
+        } else {
+            pdebug(DEBUG_DETAIL, "Using the symbolic tag name.");
+        }
+    }
+
+    /* share reads with other handles to the same tag? Only CIP tags support this. */
+    if(attr_get_int(attribs, "share_reads", 0) && !tag->tag_list && !tag->udt_template && tag->vtable == &eip_cip_vtable) {
+        uint8_t *name = NULL;
+        int name_size = 0;
+
+        name = ab_tag_cache_name(tag, &name_size);
+
+        rc = session_get_shared_read(tag->session, name, name_size, tag->elem_count, &(tag->shared_read));
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to set up shared reads, error %s!", plc_tag_decode_error(rc));
+            tag->status = rc;
+            return (plc_tag_p)tag;
+        }
+    }
+
     /* trigger the first read. */
     tag->first_read = 1;
 
-    /* kick off a read to get the tag type and size. */
-    if(tag->vtable->read) {
+    /* if another tag already found the type and size, do not ask again. */
+    if(!tag->tag_list && !tag->udt_template && tag->vtable == &eip_cip_vtable && ab_tag_use_cached_metadata(tag) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Using cached tag type and size, skipping the first read.");
+    } else if(tag->vtable->read) {
+        /* kick off a read to get the tag type and size. */
         tag->vtable->read((plc_tag_p)tag);
     }
 
@@ -542,6 +602,11 @@ int get_tag_data_type(ab_tag_p tag, attr attribs)
                     pdebug(DEBUG_WARN, "Tag listing request is malformed!");
                     return PLCTAG_ERR_BAD_PARAM;
                 }
+
+                if(tag_listing_rc == PLCTAG_ERR_NOT_FOUND && setup_udt_template(tag, tag_name) == PLCTAG_ERR_BAD_PARAM) {
+                    pdebug(DEBUG_WARN, "UDT template request is malformed!");
+                    return PLCTAG_ERR_BAD_PARAM;
+                }
             }
         }
 
@@ -581,11 +646,10 @@ int default_read(plc_tag_p tag)
 
 int default_status(plc_tag_p tag)
 {
-    (void)tag;
-
     pdebug(DEBUG_WARN, "This should be overridden by a PLC-specific function!");
 
-    return PLCTAG_STATUS_OK;
+    /* pass on any error found while setting the tag up. */
+    return tag->status;
 }
 
 
@@ -611,6 +675,28 @@ int default_write(plc_tag_p tag)
 
 
 
+/* abort the requests of each piece and free the pieces. */
+void abort_frags(struct ab_frag_t *frags, int num_frags)
+{
+    if(!frags) {
+        return;
+    }
+
+    for(int i=0; i < num_frags; i++) {
+        if(frags[i].req) {
+            spin_block(&frags[i].req->lock) {
+                frags[i].req->abort_request = 1;
+            }
+
+            frags[i].req = rc_dec(frags[i].req);
+        }
+    }
+
+    mem_free(frags);
+}
+
+
+
 /*
 * ab_tag_abort
 *
@@ -633,6 +719,26 @@ int ab_tag_abort(ab_tag_p tag)
         pdebug(DEBUG_DETAIL, "Called without a request in flight.");
     }
 
+    /* a read or write in pieces has a request per piece. */
+    abort_frags(tag->read_frags, tag->num_read_frags);
+    tag->read_frags = NULL;
+    tag->num_read_frags = 0;
+
+    abort_frags(tag->write_frags, tag->num_write_frags);
+    tag->write_frags = NULL;
+    tag->num_write_frags = 0;
+
+    /* the changes in an unfinished write still need to be written. */
+    for(int i=0; i < tag->num_sending_ranges; i++) {
+        plc_tag_mark_dirty_range((plc_tag_p)tag, tag->sending_ranges[i].start, tag->sending_ranges[i].end - tag->sending_ranges[i].start);
+    }
+
+    tag->num_sending_ranges = 0;
+
+    /* let any handles waiting on our read do their own. */
+    ab_tag_shared_read_done(tag, PLCTAG_ERR_ABORT);
+    tag->shared_read_waiting = 0;
+
     tag->read_in_progress = 0;
     tag->write_in_progress = 0;
     tag->offset = 0;
@@ -644,6 +750,131 @@ int ab_tag_abort(ab_tag_p tag)
 
 
 
+/*
+ * ab_tag_use_cached_metadata
+ *
+ * Set up the tag type and size from what an earlier tag with the same
+ * name on the session found.  The data buffer is grown and zeroed if
+ * needed.  Returns PLCTAG_ERR_NOT_FOUND if there is nothing cached.
+ */
+int ab_tag_use_cached_metadata(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int elem_size = 0;
+    uint8_t type_info[MAX_TAG_TYPE_INFO];
+    int type_info_size = MAX_TAG_TYPE_INFO;
+    int new_size = 0;
+    uint8_t *name = NULL;
+    int name_size = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    name = ab_tag_cache_name(tag, &name_size);
+
+    rc = session_get_tag_metadata(tag->session, name, name_size, &elem_size, type_info, &type_info_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "No cached type information.");
+        return rc;
+    }
+
+    /* the cache may come from a file, do not trust it. */
+    if(elem_size <= 0 || tag->elem_count <= 0 || elem_size > INT_MAX / tag->elem_count) {
+        pdebug(DEBUG_WARN, "Cached element size %d is not usable with %d elements!", elem_size, tag->elem_count);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    new_size = elem_size * tag->elem_count;
+
+    if(new_size > tag->size) {
+        uint8_t *new_data = (uint8_t *)mem_realloc(tag->data, new_size);
+
+        if(!new_data) {
+            pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        mem_set(new_data + tag->size, 0, new_size - tag->size);
+
+        tag->data = new_data;
+        tag->size = new_size;
+    }
+
+    tag->elem_size = elem_size;
+
+    if(tag->encoded_type_info_size == 0) {
+        mem_copy(tag->encoded_type_info, type_info, type_info_size);
+        tag->encoded_type_info_size = type_info_size;
+    }
+
+    tag->first_read = 0;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * ab_tag_save_metadata
+ *
+ * Remember the type and size found by the first read of the tag so that
+ * later tags with the same name can skip it.
+ */
+void ab_tag_save_metadata(ab_tag_p tag)
+{
+    uint8_t *name = NULL;
+    int name_size = 0;
+
+    if(tag->tag_list || tag->encoded_type_info_size <= 0 || tag->elem_size <= 0) {
+        return;
+    }
+
+    name = ab_tag_cache_name(tag, &name_size);
+
+    session_put_tag_metadata(tag->session, name, name_size, tag->elem_size, tag->encoded_type_info, tag->encoded_type_info_size);
+}
+
+
+
+/*
+ * ab_tag_cache_name
+ *
+ * The name that session caches are keyed on.  Tags addressed by symbol
+ * instance use their symbolic name since instance IDs are not stable.
+ */
+uint8_t *ab_tag_cache_name(ab_tag_p tag, int *name_size)
+{
+    if(tag->symbolic_name) {
+        *name_size = tag->symbolic_name_size;
+        return tag->symbolic_name;
+    }
+
+    *name_size = tag->encoded_name_size;
+    return tag->encoded_name;
+}
+
+
+
+/*
+ * ab_tag_shared_read_done
+ *
+ * If this tag is doing the read for the handles sharing it, pass on the
+ * result.  Must be called with the tag API mutex held.
+ */
+void ab_tag_shared_read_done(ab_tag_p tag, int status)
+{
+    if(!tag->shared_read_owner) {
+        return;
+    }
+
+    tag->shared_read_owner = 0;
+
+    session_shared_read_done(tag->shared_read, status, tag->data, tag->size, tag->encoded_type_info, tag->encoded_type_info_size);
+}
+
+
+
 
 /*
  * ab_tag_status
@@ -700,6 +931,12 @@ void ab_tag_destroy(ab_tag_p tag)
 
     session = tag->session;
 
+    /* this needs the session, release it first. */
+    if(tag->shared_read) {
+        ab_tag_shared_read_done(tag, PLCTAG_ERR_ABORT);
+        tag->shared_read = rc_dec(tag->shared_read);
+    }
+
     /* tags should always have a session.  Release it. */
     pdebug(DEBUG_DETAIL,"Getting ready to release tag session %p",tag->session);
     if(session) {
@@ -720,11 +957,36 @@ void ab_tag_destroy(ab_tag_p tag)
         tag->api_mutex = NULL;
     }
 
+    if(tag->sync_op_mutex) {
+        mutex_destroy(&(tag->sync_op_mutex));
+        tag->sync_op_mutex = NULL;
+    }
+
+    if(tag->tag_cond_wait) {
+        cond_destroy(&(tag->tag_cond_wait));
+        tag->tag_cond_wait = NULL;
+    }
+
+    if(tag->callback_queue.idle_cond) {
+        cond_destroy(&(tag->callback_queue.idle_cond));
+        tag->callback_queue.idle_cond = NULL;
+    }
+
     if (tag->data) {
         mem_free(tag->data);
         tag->data = NULL;
     }
 
+    if(tag->data_snapshot) {
+        mem_free(tag->data_snapshot);
+        tag->data_snapshot = NULL;
+    }
+
+    if(tag->symbolic_name) {
+        mem_free(tag->symbolic_name);
+        tag->symbolic_name = NULL;
+    }
+
     pdebug(DEBUG_INFO,"Finished releasing all tag resources.");
 
     pdebug(DEBUG_INFO, "done");
@@ -760,6 +1022,254 @@ int ab_set_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int new_value)
 
 
 
+/*
+ * ab_get_member_offset
+ *
+ * Walk a member path like "Status.Speed" or "[2].Data[5]" through the
+ * UDT templates the session has decoded.  The tag's own template is found
+ * with the structure handle in its type information.
+ *
+ * BOOL members are bits in a hidden SINT, so they get a bit number.  BOOL
+ * arrays in a UDT are stored as DWORDs and are indexed by bit.
+ */
+int ab_get_member_offset(plc_tag_p raw_tag, const char *member_path, int *member_type, int *bit_num)
+{
+    ab_tag_p tag = (ab_tag_p)raw_tag;
+    struct ab_udt_template_t *udt_template = NULL;
+    const char *path = member_path;
+    uint16_t type = 0;
+    int count = 0;
+    int offset = 0;
+    int bit = -1;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->protocol_type != AB_PROTOCOL_LGX || tag->tag_list || tag->udt_template) {
+        pdebug(DEBUG_WARN, "Only Logix data tags have structure members.");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(tag->encoded_type_info_size <= 0) {
+        pdebug(DEBUG_WARN, "Tag has not been read yet!");
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    /* structures have the abbreviated type, 0xA0 0x02 and the 16-bit handle. */
+    if(tag->encoded_type_info_size < 4 || tag->encoded_type_info[0] != AB_CIP_DATA_ABREV_STRUCT) {
+        pdebug(DEBUG_WARN, "Tag is not a structure!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    udt_template = session_find_udt_template(tag->session, (uint16_t)(tag->encoded_type_info[2] | (tag->encoded_type_info[3] << 8)));
+    if(!udt_template) {
+        pdebug(DEBUG_WARN, "The template of the tag has not been read!");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    type = (uint16_t)(AB_UDT_TYPE_STRUCT | udt_template->id);
+    count = tag->elem_count;
+
+    while(*path) {
+        if(*path == '[') {
+            int index = 0;
+            int elem_size = 0;
+
+            path++;
+
+            if(!isdigit((unsigned char)*path)) {
+                pdebug(DEBUG_WARN, "Bad array index in %s!", member_path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            while(isdigit((unsigned char)*path)) {
+                index = (index * 10) + (*path - '0');
+                path++;
+
+                if(index > INT_MAX / 64) {
+                    pdebug(DEBUG_WARN, "Array index in %s is too large!", member_path);
+                    return PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+            }
+
+            if(*path != ']') {
+                pdebug(DEBUG_WARN, "Bad array index in %s!", member_path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            path++;
+
+            if(bit >= 0) {
+                pdebug(DEBUG_WARN, "A BOOL cannot be indexed in %s!", member_path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            if(type == AB_CIP_DATA_DWORD) {
+                /* a BOOL array, indexed by bit. */
+                if(index >= count * 32) {
+                    pdebug(DEBUG_WARN, "Array index %d in %s is out of bounds!", index, member_path);
+                    return PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+
+                offset += (index / 32) * 4;
+                bit = index % 32;
+                count = 1;
+                continue;
+            }
+
+            if(index >= count) {
+                pdebug(DEBUG_WARN, "Array index %d in %s is out of bounds!", index, member_path);
+                return PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+
+            elem_size = udt_member_elem_size(tag->session, type);
+            if(elem_size < 0) {
+                pdebug(DEBUG_WARN, "Unable to find the size of type %x in %s!", (unsigned int)type, member_path);
+                return elem_size;
+            }
+
+            offset += index * elem_size;
+            count = 1;
+        } else {
+            const char *name = NULL;
+            int name_len = 0;
+            struct ab_udt_member_t *member = NULL;
+
+            /* a member name after the first one needs a dot in front. */
+            if(*path == '.') {
+                path++;
+            } else if(path != member_path) {
+                pdebug(DEBUG_WARN, "Missing '.' in %s!", member_path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            name = path;
+            while(*path && *path != '.' && *path != '[') {
+                path++;
+            }
+
+            name_len = (int)(path - name);
+            if(name_len == 0) {
+                pdebug(DEBUG_WARN, "Empty member name in %s!", member_path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            if(!(type & AB_UDT_TYPE_STRUCT) || bit >= 0) {
+                pdebug(DEBUG_WARN, "Only structures have members in %s!", member_path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            if(count != 1) {
+                pdebug(DEBUG_WARN, "Array needs an index in %s!", member_path);
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            udt_template = session_get_udt_template(tag->session, (uint16_t)(type & AB_UDT_TYPE_ID_MASK));
+            if(!udt_template) {
+                pdebug(DEBUG_WARN, "Template %u has not been read!", (unsigned int)(type & AB_UDT_TYPE_ID_MASK));
+                return PLCTAG_ERR_NOT_FOUND;
+            }
+
+            /* the PLC ignores case in names. */
+            for(int i=0; i < udt_template->member_count && !member; i++) {
+                const char *candidate = udt_template->members[i].name;
+                int match = (str_length(candidate) == name_len);
+
+                for(int j=0; match && j < name_len; j++) {
+                    match = (tolower((unsigned char)candidate[j]) == tolower((unsigned char)name[j]));
+                }
+
+                if(match) {
+                    member = &udt_template->members[i];
+                }
+            }
+
+            if(!member) {
+                pdebug(DEBUG_WARN, "Member %.*s not found in %s!", name_len, name, member_path);
+                return PLCTAG_ERR_NOT_FOUND;
+            }
+
+            offset += (int)member->offset;
+
+            /* strip the array flags. */
+            if(member->type & AB_UDT_TYPE_STRUCT) {
+                type = (uint16_t)(AB_UDT_TYPE_STRUCT | (member->type & AB_UDT_TYPE_ID_MASK));
+            } else {
+                type = (uint16_t)(member->type & 0xFF);
+            }
+
+            if(type == AB_CIP_DATA_BIT) {
+                bit = (int)member->info;
+                count = 1;
+            } else {
+                count = (member->info > 0 ? (int)member->info : 1);
+            }
+        }
+    }
+
+    if(bit >= 0) {
+        type = AB_CIP_DATA_BIT;
+    }
+
+    if(tag->size > 0 && offset >= tag->size) {
+        pdebug(DEBUG_WARN, "Member %s is past the end of the tag data!", member_path);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    if(member_type) {
+        *member_type = (int)type;
+    }
+
+    if(bit_num) {
+        *bit_num = bit;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return offset;
+}
+
+
+
+/* size in bytes of one element of a UDT member type. */
+int udt_member_elem_size(ab_session_p session, uint16_t type)
+{
+    if(type & AB_UDT_TYPE_STRUCT) {
+        struct ab_udt_template_t *udt_template = session_get_udt_template(session, (uint16_t)(type & AB_UDT_TYPE_ID_MASK));
+
+        return (udt_template ? (int)udt_template->struct_size : PLCTAG_ERR_NOT_FOUND);
+    }
+
+    switch(type) {
+    case AB_CIP_DATA_BIT:
+    case AB_CIP_DATA_SINT:
+    case AB_CIP_DATA_USINT:
+    case AB_CIP_DATA_BYTE:
+        return 1;
+
+    case AB_CIP_DATA_INT:
+    case AB_CIP_DATA_UINT:
+    case AB_CIP_DATA_WORD:
+        return 2;
+
+    case AB_CIP_DATA_DINT:
+    case AB_CIP_DATA_UDINT:
+    case AB_CIP_DATA_REAL:
+    case AB_CIP_DATA_DWORD:
+        return 4;
+
+    case AB_CIP_DATA_LINT:
+    case AB_CIP_DATA_ULINT:
+    case AB_CIP_DATA_LREAL:
+    case AB_CIP_DATA_LWORD:
+        return 8;
+
+    default:
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+}
+
+
+
 int ab_get_bit(plc_tag_p raw_tag, int offset_bit)
 {
     int res = PLCTAG_ERR_OUT_OF_BOUNDS;
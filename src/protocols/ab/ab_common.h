@@ -47,14 +47,21 @@ typedef struct ab_session_t *ab_session_p;
 typedef struct ab_request_t *ab_request_p;
 #define AB_REQUEST_NULL ((ab_request_p)NULL)
 
+typedef struct ab_shared_read_t *ab_shared_read_p;
+
 
 extern int ab_tag_abort(ab_tag_p tag);
 extern int ab_tag_status(ab_tag_p tag);
+extern void ab_tag_shared_read_done(ab_tag_p tag, int status);
+extern int ab_tag_use_cached_metadata(ab_tag_p tag);
+extern void ab_tag_save_metadata(ab_tag_p tag);
 
 
 extern int ab_get_int_attrib(plc_tag_p tag, const char *attrib_name, int default_value);
 extern int ab_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value);
 
+extern int ab_get_member_offset(plc_tag_p tag, const char *member_path, int *member_type, int *bit_num);
+
 extern int ab_get_bit(plc_tag_p tag, int offset_bit);
 extern int ab_set_bit(plc_tag_p tag, int offset_bit, int val);
 
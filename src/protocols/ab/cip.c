@@ -42,6 +42,7 @@
 #include <ab/cip.h>
 #include <ab/tag.h>
 #include <ab/defs.h>
+#include <ab/session.h>
 #include <util/debug.h>
 
 /* Apparently ssize_t is not on Windows. */
@@ -55,6 +56,7 @@ static int skip_whitespace(const char *name, int *name_index);
 static int parse_bit_segment(ab_tag_p tag, const char *name, int *name_index);
 static int parse_symbolic_segment(ab_tag_p tag, const char *name, int *encoded_index, int *name_index);
 static int parse_numeric_segment(ab_tag_p tag, const char *name, int *encoded_index, int *name_index);
+static int is_program_segment(const uint8_t *seg);
 
 static int match_numeric_segment(const char *path, size_t *path_index, uint8_t *conn_path, size_t *conn_path_index);
 static int match_ip_addr_segment(const char *path, size_t *path_index, uint8_t *conn_path, size_t *conn_path_index);
@@ -848,6 +850,125 @@ int cip_encode_tag_name(ab_tag_p tag, const char *name)
     return PLCTAG_STATUS_OK;
 }
 
+/*
+ * cip_encode_symbol_instance
+ *
+ * Replace the symbolic segment for the base tag in the encoded name with
+ * a logical segment for its Symbol Object (class 0x6B) instance.  The
+ * instance ID must have been found by a tag listing on the same session.
+ * Program tags keep the program segment and the symbol after it is
+ * replaced.  Member and element segments are left alone.
+ */
+
+int cip_encode_symbol_instance(ab_tag_p tag)
+{
+    uint8_t *encoded = tag->encoded_name;
+    uint8_t instance_seg[8];
+    int instance_seg_size = 0;
+    int seg_start = 1;
+    int seg_size = 0;
+    int prefix_len = 0;
+    char name[MAX_TAG_NAME];
+    int name_len = 0;
+    int new_size = 0;
+    uint32_t instance_id = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->encoded_name_size < 3 || encoded[1] != 0x91) {
+        pdebug(DEBUG_DETAIL, "Tag name does not start with a symbolic segment.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    seg_size = 2 + encoded[2] + (encoded[2] & 0x01);
+
+    /* program tags are looked up as "Program:name.symbol". */
+    if(is_program_segment(&encoded[1]) && seg_start + seg_size + 2 < tag->encoded_name_size && encoded[seg_start + seg_size] == 0x91) {
+        prefix_len = encoded[2];
+        mem_copy(name, &encoded[3], prefix_len);
+        name[prefix_len] = '.';
+
+        seg_start += seg_size;
+        seg_size = 2 + encoded[seg_start + 1] + (encoded[seg_start + 1] & 0x01);
+
+        name_len = prefix_len + 1;
+    }
+
+    mem_copy(&name[name_len], &encoded[seg_start + 2], encoded[seg_start + 1]);
+    name_len += encoded[seg_start + 1];
+
+    rc = session_get_symbol_instance(tag->session, name, name_len, &instance_id);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "No symbol instance ID found for %.*s.", name_len, name);
+        return rc;
+    }
+
+    /* class segment, then the smallest instance segment that fits. */
+    instance_seg[0] = 0x20;
+    instance_seg[1] = 0x6B;
+
+    if(instance_id <= 0xFF) {
+        instance_seg[2] = 0x24;
+        instance_seg[3] = (uint8_t)instance_id;
+        instance_seg_size = 4;
+    } else if(instance_id <= 0xFFFF) {
+        instance_seg[2] = 0x25;
+        instance_seg[3] = 0x00; /* padding */
+        instance_seg[4] = (uint8_t)(instance_id & 0xFF);
+        instance_seg[5] = (uint8_t)((instance_id >> 8) & 0xFF);
+        instance_seg_size = 6;
+    } else {
+        instance_seg[2] = 0x26;
+        instance_seg[3] = 0x00; /* padding */
+        instance_seg[4] = (uint8_t)(instance_id & 0xFF);
+        instance_seg[5] = (uint8_t)((instance_id >> 8) & 0xFF);
+        instance_seg[6] = (uint8_t)((instance_id >> 16) & 0xFF);
+        instance_seg[7] = (uint8_t)((instance_id >> 24) & 0xFF);
+        instance_seg_size = 8;
+    }
+
+    new_size = tag->encoded_name_size - seg_size + instance_seg_size;
+    if(new_size > MAX_TAG_NAME) {
+        pdebug(DEBUG_WARN, "Encoded name would be too long with the symbol instance!");
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    /* move the rest of the name and put the instance segment in the gap. */
+    mem_move(&encoded[seg_start + instance_seg_size], &encoded[seg_start + seg_size], tag->encoded_name_size - (seg_start + seg_size));
+    mem_copy(&encoded[seg_start], instance_seg, instance_seg_size);
+
+    tag->encoded_name_size = new_size;
+    encoded[0] = (uint8_t)((new_size - 1)/2);
+
+    pdebug(DEBUG_DETAIL, "Using symbol instance %u for %.*s.", instance_id, name_len, name);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* does the symbolic segment hold a "Program:" name? */
+int is_program_segment(const uint8_t *seg)
+{
+    const char *program = "program:";
+    int len = str_length(program);
+
+    if(seg[1] <= len) {
+        return 0;
+    }
+
+    for(int i=0; i < len; i++) {
+        if(tolower(seg[2 + i]) != program[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+
 int skip_whitespace(const char *name, int *name_index)
 {
     while(name[*name_index] == ' ') {
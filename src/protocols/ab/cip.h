@@ -44,6 +44,7 @@ extern int cip_encode_path(const char *path, int needs_connection, plc_type_t pl
 
 //~ char *cip_decode_status(int status);
 extern int cip_encode_tag_name(ab_tag_p tag,const char *name);
+extern int cip_encode_symbol_instance(ab_tag_p tag);
 
 
 
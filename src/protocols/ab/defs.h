@@ -78,6 +78,7 @@
 #define AB_EIP_CMD_FORWARD_OPEN_EX      ((uint8_t)0x5B)
 
 /* CIP embedded packet commands */
+#define AB_EIP_CMD_CIP_GET_ATTR_LIST    ((uint8_t)0x03)
 #define AB_EIP_CMD_CIP_MULTI            ((uint8_t)0x0A)
 #define AB_EIP_CMD_CIP_READ             ((uint8_t)0x4C)
 #define AB_EIP_CMD_CIP_WRITE            ((uint8_t)0x4D)
@@ -85,6 +86,7 @@
 #define AB_EIP_CMD_CIP_READ_FRAG        ((uint8_t)0x52)
 #define AB_EIP_CMD_CIP_WRITE_FRAG       ((uint8_t)0x53)
 #define AB_EIP_CMD_CIP_LIST_TAGS        ((uint8_t)0x55)
+#define AB_EIP_CMD_CIP_READ_TEMPLATE    ((uint8_t)0x4C)
 
 /* flag set when command is OK */
 #define AB_EIP_CMD_CIP_OK               ((uint8_t)0x80)
@@ -172,6 +174,10 @@
 #define AB_CIP_DATA_ENGUNIT     ((uint8_t)0xDD) /* Engineering units */
 #define AB_CIP_DATA_STRINGI     ((uint8_t)0xDE) /* International character string (encoding?) */
 
+/* UDT template member types */
+#define AB_UDT_TYPE_STRUCT      ((uint16_t)0x8000) /* member is a structure, the rest is the template ID */
+#define AB_UDT_TYPE_ID_MASK     ((uint16_t)0x0FFF) /* template ID of a structure member */
+
 /* aggregate data type byte values */
 #define AB_CIP_DATA_ABREV_STRUCT    ((uint8_t)0xA0) /* Data is an abbreviated struct type, i.e. a CRC of the actual type descriptor */
 #define AB_CIP_DATA_ABREV_ARRAY     ((uint8_t)0xA1) /* Data is an abbreviated array type. The limits are left off */
@@ -127,20 +127,85 @@ START_PACK typedef struct {
 } END_PACK tag_list_entry;
 
 
+/* UDT template packet formats are as follows:
 
-static int build_read_request_connected(ab_tag_p tag, int byte_offset);
+CIP Get Attribute List command, template attributes
+    uint8_t request_service    0x03
+    uint8_t request_path_size  3 words
+    uint8_t   0x20    get class
+    uint8_t   0x6C    template class
+    uint8_t   0x25    get instance (16-bit)
+    uint8_t   0x00    padding
+    uint8_t   0x00    instance byte 0
+    uint8_t   0x00    instance byte 1
+    uint16_t  0x04    number of attributes to get
+    uint16_t  0x04    attribute #4 - template definition size in 32-bit words
+    uint16_t  0x05    attribute #5 - structure size in bytes
+    uint16_t  0x02    attribute #2 - number of members
+    uint16_t  0x01    attribute #1 - structure handle
+
+CIP Read Template command
+    uint8_t request_service    0x4C
+    uint8_t request_path_size  3 words
+      (same path as above)
+    uint32_t  byte offset
+    uint16_t  number of bytes left to read, (definition size * 4) - 23 in all
+
+The template definition is one 8 byte entry per member (uint16_t array
+length or bit number, uint16_t type, uint32_t byte offset) followed by the
+zero terminated template name, "name;n...", and the zero terminated
+member names.
+
+*/
+
+#define UDT_MEMBER_DEF_SIZE (8)
+#define UDT_MAX_NESTING     (16)
+
+/*
+ * The data of an @udt tag is this header followed by the raw template
+ * definition.  All fields are little endian.
+ *
+ *   uint16_t template ID
+ *   uint32_t definition size in bytes
+ *   uint32_t structure size in bytes
+ *   uint16_t number of members
+ *   uint16_t structure handle
+ */
+#define UDT_HEADER_SIZE     (14)
+
+
+
+static int build_read_request_connected(ab_tag_p tag, int byte_offset, int end);
 static int build_tag_list_request_connected(ab_tag_p tag);
-static int build_read_request_unconnected(ab_tag_p tag, int byte_offset);
-static int build_write_request_connected(ab_tag_p tag, int byte_offset);
-static int build_write_request_unconnected(ab_tag_p tag, int byte_offset);
+static int build_read_request_unconnected(ab_tag_p tag, int byte_offset, int end);
+static int build_write_request_connected(ab_tag_p tag, int byte_offset, int end);
+static int build_write_request_unconnected(ab_tag_p tag, int byte_offset, int end);
 static int build_write_bit_request_connected(ab_tag_p tag);
 static int build_write_bit_request_unconnected(ab_tag_p tag);
 static int check_read_status_connected(ab_tag_p tag);
 static int check_read_tag_list_status_connected(ab_tag_p tag);
+static int build_udt_request_connected(ab_tag_p tag);
+static int check_read_udt_status_connected(ab_tag_p tag);
+static int decode_udt_attributes(ab_tag_p tag, uint8_t *data, uint8_t *data_end);
+static int decode_udt_template(ab_tag_p tag, struct ab_udt_template_t **udt_template);
+static int find_missing_udt_template(ab_session_p session, uint16_t template_id, int depth, uint16_t *missing_id);
+static int udt_template_done(ab_tag_p tag);
+static int copy_udt_template_to_tag(ab_tag_p tag);
+static int read_elem_count(ab_tag_p tag, int end);
+static int read_frag_size(ab_tag_p tag);
+static int start_read_frags(ab_tag_p tag, int start, int end);
+static int start_read_frag(ab_tag_p tag, struct ab_frag_t *frag);
+static int check_read_frags_status(ab_tag_p tag);
+static int check_read_frag_response(ab_tag_p tag, struct ab_frag_t *frag, int *partial_data);
 static int check_read_status_unconnected(ab_tag_p tag);
 static int check_write_status_connected(ab_tag_p tag);
 static int check_write_status_unconnected(ab_tag_p tag);
+static int start_write_frags(ab_tag_p tag, struct tag_range_t *ranges, int num_ranges);
+static int check_write_frags_status(ab_tag_p tag);
+static int check_write_frag_response(ab_tag_p tag, struct ab_frag_t *frag);
 static int calculate_write_data_per_packet(ab_tag_p tag);
+static int check_shared_read_status(ab_tag_p tag);
+static void update_type_info(ab_tag_p tag, uint8_t *type_info, int type_info_size);
 
 static int tag_read_start(ab_tag_p tag);
 static int tag_tickler(ab_tag_p tag);
@@ -189,7 +254,10 @@ struct tag_vtable_t eip_cip_vtable = {
     ab_set_float64,
 
     ab_get_float32,
-    ab_set_float32
+    ab_set_float32,
+
+    /* structure members */
+    ab_get_member_offset
 };
 
 
@@ -207,9 +275,15 @@ int tag_tickler(ab_tag_p tag)
     pdebug(DEBUG_SPEW,"Starting.");
 
     if (tag->read_in_progress) {
-        if(tag->use_connected_msg) {
+        if(tag->shared_read_waiting) {
+            rc = check_shared_read_status(tag);
+        } else if(tag->read_frags) {
+            rc = check_read_frags_status(tag);
+        } else if(tag->use_connected_msg) {
             if(tag->tag_list) {
                 rc = check_read_tag_list_status_connected(tag);
+            } else if(tag->udt_template) {
+                rc = check_read_udt_status_connected(tag);
             } else {
                 rc = check_read_status_connected(tag);
             }
@@ -230,7 +304,9 @@ int tag_tickler(ab_tag_p tag)
     }
 
     if (tag->write_in_progress) {
-        if(tag->use_connected_msg) {
+        if(tag->write_frags) {
+            rc = check_write_frags_status(tag);
+        } else if(tag->use_connected_msg) {
             rc = check_write_status_connected(tag);
         } else {
             rc = check_write_status_unconnected(tag);
@@ -277,23 +353,112 @@ int tag_read_start(ab_tag_p tag)
         return PLCTAG_ERR_BUSY;
     }
 
+    /* read just some of the elements? */
+    if(tag->read_range_count > 0 && !tag->tag_list && !tag->udt_template) {
+        if(tag->read_range_start + tag->read_range_count > tag->elem_count) {
+            pdebug(DEBUG_WARN, "Elements %d to %d are not all in the tag!", tag->read_range_start, tag->read_range_start + tag->read_range_count - 1);
+            return PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+
+        /* the type and element size come with the first read. */
+        if(!tag->first_read && !tag->pre_write_read && tag->elem_size > 0) {
+            tag->read_in_progress = 1;
+
+            rc = start_read_frags(tag, tag->read_range_start * tag->elem_size, (tag->read_range_start + tag->read_range_count) * tag->elem_size);
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to start read of elements, error %s!", plc_tag_decode_error(rc));
+                ab_tag_abort(tag);
+                return rc;
+            }
+
+            pdebug(DEBUG_INFO, "Done.");
+
+            return PLCTAG_STATUS_PENDING;
+        }
+    }
+
+    /* a new read of a shared tag may not need to go to the PLC. */
+    if(tag->shared_read && !tag->pre_write_read && tag->offset == 0) {
+        rc = session_shared_read_start(tag->shared_read, tag->tag_id, tag->read_cache_ms, &(tag->shared_read_generation));
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_DETAIL, "Waiting for the read of another handle.");
+            tag->read_in_progress = 1;
+            tag->shared_read_waiting = 1;
+            return PLCTAG_STATUS_PENDING;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_DETAIL, "Using recent data read by another handle.");
+            tag->read_in_progress = 1;
+            tag->shared_read_waiting = 1;
+            rc = check_shared_read_status(tag);
+            tag->status = rc;
+
+            if(!tag->read_in_progress) {
+                tag->read_complete = 1;
+            }
+
+            return rc;
+        }
+
+        /* we do the read for everyone. */
+        tag->shared_read_owner = 1;
+    }
+
+    /* a template that is already decoded does not need to be read again. */
+    if(tag->udt_template && tag->udt_fetch_id == tag->udt_id && !tag->udt_read_definition && tag->offset == 0) {
+        uint16_t missing_id = 0;
+
+        if(session_get_udt_template(tag->session, tag->udt_id) && find_missing_udt_template(tag->session, tag->udt_id, 0, &missing_id) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_DETAIL, "Using the already decoded template.");
+
+            rc = copy_udt_template_to_tag(tag);
+            tag->status = rc;
+            tag->read_complete = 1;
+
+            return rc;
+        }
+    }
+
     /* mark the tag read in progress */
     tag->read_in_progress = 1;
 
+    /* ask for all the pieces of a large tag at once if we know its size. */
+    if(tag->parallel_reads && !tag->first_read && !tag->pre_write_read && !tag->tag_list && !tag->udt_template && tag->offset == 0 && tag->size > read_frag_size(tag)) {
+        rc = start_read_frags(tag, 0, tag->size);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to start read in pieces!");
+
+            ab_tag_shared_read_done(tag, rc);
+            ab_tag_abort(tag);
+
+            return rc;
+        }
+
+        pdebug(DEBUG_INFO, "Done.");
+
+        return PLCTAG_STATUS_PENDING;
+    }
+
     /* i is the index of the first new request */
     if(tag->use_connected_msg) {
         if(tag->tag_list) {
             rc = build_tag_list_request_connected(tag);
+        } else if(tag->udt_template) {
+            rc = build_udt_request_connected(tag);
         } else {
-            rc = build_read_request_connected(tag, tag->offset);
+            rc = build_read_request_connected(tag, tag->offset, tag->size);
         }
     } else {
-        rc = build_read_request_unconnected(tag, tag->offset);
+        rc = build_read_request_unconnected(tag, tag->offset, tag->size);
     }
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to build read request!");
 
+        ab_tag_shared_read_done(tag, rc);
         tag->read_in_progress = 0;
 
         return rc;
@@ -331,6 +496,12 @@ int tag_write_start(ab_tag_p tag)
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
+    if(tag->udt_template) {
+        pdebug(DEBUG_WARN, "A UDT template cannot be written!");
+
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
     if(tag->read_in_progress || tag->write_in_progress) {
         pdebug(DEBUG_WARN, "Read or write operation already in flight!");
         return PLCTAG_ERR_BUSY;
@@ -346,6 +517,11 @@ int tag_write_start(ab_tag_p tag)
      * buffers.
      */
 
+    /* another tag may have found the type information already. */
+    if(tag->first_read && ab_tag_use_cached_metadata(tag) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Using cached type information, skipping the pre-read.");
+    }
+
     if (tag->first_read) {
         pdebug(DEBUG_DETAIL, "No read has completed yet, doing pre-read to get type information.");
 
@@ -355,6 +531,53 @@ int tag_write_start(ab_tag_p tag)
         return tag_read_start(tag);
     }
 
+    /* send only what changed, or all the pieces of a large tag at once? */
+    if((tag->partial_writes || tag->parallel_writes) && !tag->is_bit && tag->offset == 0) {
+        struct tag_range_t whole_tag = { 0, 0 };
+        struct tag_range_t *ranges = &whole_tag;
+        int num_ranges = 1;
+
+        whole_tag.end = tag->size;
+
+        if(tag->partial_writes) {
+            ranges = tag->dirty_ranges;
+            num_ranges = tag->num_dirty_ranges;
+        }
+
+        rc = calculate_write_data_per_packet(tag);
+
+        if(rc == PLCTAG_STATUS_OK && num_ranges == 0) {
+            pdebug(DEBUG_DETAIL, "Nothing changed since the last write.");
+
+            tag->write_in_progress = 0;
+            tag->write_complete = 1;
+
+            return PLCTAG_STATUS_OK;
+        }
+
+        if(rc == PLCTAG_STATUS_OK && (tag->partial_writes || tag->size > tag->write_data_per_packet)) {
+            /* keep the changed ranges until every piece is acknowledged. */
+            if(tag->partial_writes) {
+                mem_copy(tag->sending_ranges, tag->dirty_ranges, num_ranges * (int)sizeof(tag->dirty_ranges[0]));
+                tag->num_sending_ranges = num_ranges;
+                tag->num_dirty_ranges = 0;
+
+                ranges = tag->sending_ranges;
+            }
+
+            rc = start_write_frags(tag, ranges, num_ranges);
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to start write in pieces, error %s!", plc_tag_decode_error(rc));
+                ab_tag_abort(tag);
+                return rc;
+            }
+
+            pdebug(DEBUG_INFO, "Done.");
+
+            return PLCTAG_STATUS_PENDING;
+        }
+    }
+
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to calculate write sizes!");
         tag->write_in_progress = 0;
@@ -363,9 +586,9 @@ int tag_write_start(ab_tag_p tag)
     }
 
     if(tag->use_connected_msg) {
-        rc = build_write_request_connected(tag, tag->offset);
+        rc = build_write_request_connected(tag, tag->offset, tag->size);
     } else {
-        rc = build_write_request_unconnected(tag, tag->offset);
+        rc = build_write_request_unconnected(tag, tag->offset, tag->size);
     }
 
     if (rc != PLCTAG_STATUS_OK) {
@@ -383,7 +606,24 @@ int tag_write_start(ab_tag_p tag)
 }
 
 
-int build_read_request_connected(ab_tag_p tag, int byte_offset)
+/*
+ * The PLC sends the data from the byte offset up to the end of the element
+ * count.  Asking for just enough elements to cover the end keeps it from
+ * sending data we do not want.
+ */
+
+int read_elem_count(ab_tag_p tag, int end)
+{
+    if(tag->elem_size <= 0 || end >= tag->size) {
+        return tag->elem_count;
+    }
+
+    return (end + tag->elem_size - 1) / tag->elem_size;
+}
+
+
+
+int build_read_request_connected(ab_tag_p tag, int byte_offset, int end)
 {
     eip_cip_co_req* cip = NULL;
     uint8_t* data = NULL;
@@ -425,7 +665,7 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     data += tag->encoded_name_size;
 
     /* add the count of elements to read. */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    *((uint16_le*)data) = h2le16((uint16_t)read_elem_count(tag, end));
     data += sizeof(uint16_le);
 
     /* add the byte offset for this request */
@@ -455,6 +695,15 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
 
     req->allow_packing = tag->allow_packing;
 
+    /*
+     * the session can merge this with reads of the next elements of the
+     * array.  Unconnected reads are not merged and elem_size is zero until
+     * the attributes or the first read set it.
+     */
+    if(tag->elem_count == 1 && tag->elem_size > 0 && !tag->is_bit && byte_offset == 0) {
+        req->merge_elem_size = tag->elem_size;
+    }
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -609,7 +858,7 @@ int build_tag_list_request_connected(ab_tag_p tag)
 
 
 
-int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
+int build_read_request_unconnected(ab_tag_p tag, int byte_offset, int end)
 {
     eip_cip_uc_req* cip;
     uint8_t* data;
@@ -654,7 +903,7 @@ int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
 
     /* add the count of elements to read. */
     /* FIXME BUG - this may not work on some processors! */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    *((uint16_le*)data) = h2le16((uint16_t)read_elem_count(tag, end));
     data += sizeof(uint16_le);
 
     /* add the byte offset for this request */
@@ -1271,7 +1520,7 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
 
 
 
-int build_write_request_connected(ab_tag_p tag, int byte_offset)
+int build_write_request_connected(ab_tag_p tag, int byte_offset, int end)
 {
     int rc = PLCTAG_STATUS_OK;
     eip_cip_co_req* cip = NULL;
@@ -1299,7 +1548,8 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* part of the tag needs the offset of the fragmented write. */
+    if(tag->write_data_per_packet < tag->size || byte_offset > 0 || end < tag->size) {
         multiple_requests = 1;
     }
 
@@ -1353,7 +1603,7 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = end - tag->offset;
 
     if(write_size > tag->write_data_per_packet) {
         write_size = tag->write_data_per_packet;
@@ -1411,7 +1661,7 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
 
 
 
-int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
+int build_write_request_unconnected(ab_tag_p tag, int byte_offset, int end)
 {
     int rc = PLCTAG_STATUS_OK;
     eip_cip_uc_req* cip = NULL;
@@ -1441,7 +1691,8 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* part of the tag needs the offset of the fragmented write. */
+    if(tag->write_data_per_packet < tag->size || byte_offset > 0 || end < tag->size) {
         multiple_requests = 1;
     }
 
@@ -1497,7 +1748,7 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = end - tag->offset;
 
     if(write_size > tag->write_data_per_packet) {
         write_size = tag->write_data_per_packet;
@@ -1650,6 +1901,8 @@ static int check_read_status_connected(ab_tag_p tag)
             tag->offset = 0;
 
             tag->req = rc_dec(tag->req);
+
+            ab_tag_shared_read_done(tag, rc);
         }
 
         return rc;
@@ -1722,10 +1975,7 @@ static int check_read_status_connected(ab_tag_p tag)
             /* check for a simple/base type */
             if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
                 /* copy the type info for later. */
-                if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = 2;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-                }
+                update_type_info(tag, data, 2);
 
                 /* skip the type byte and zero length byte */
                 data += 2;
@@ -1746,10 +1996,7 @@ static int check_read_status_connected(ab_tag_p tag)
                 }
 
                 /* copy the type info for later. */
-                if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = type_length;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-                }
+                update_type_info(tag, data, type_length);
 
                 data += type_length;
             } else {
@@ -1778,6 +2025,11 @@ static int check_read_status_connected(ab_tag_p tag)
 
             pdebug(DEBUG_INFO, "Got %d bytes of data", (int)payload_size);
 
+            /* a partial response is as full as the PLC will make it. */
+            if(partial_data && (int)payload_size > tag->read_frag_max) {
+                tag->read_frag_max = (int)payload_size;
+            }
+
             /*
              * copy the data, but only if this is not
              * a pre-read for a subsequent write!  We do not
@@ -1814,9 +2066,16 @@ static int check_read_status_connected(ab_tag_p tag)
             rc = tag_read_start(tag);
         } else {
             /* done! */
+            if(tag->first_read) {
+                ab_tag_save_metadata(tag);
+            }
+
             tag->first_read = 0;
             tag->offset = 0;
 
+            /* pass the data on to any handles sharing this read. */
+            ab_tag_shared_read_done(tag, PLCTAG_STATUS_OK);
+
             /* if this is a pre-read for a write, then pass off to the write routine */
             if (tag->pre_write_read) {
                 pdebug(DEBUG_DETAIL, "Restarting write call now.");
@@ -1843,217 +2102,1185 @@ static int check_read_status_connected(ab_tag_p tag)
 
 
 /*
- * check_read_tag_list_status_connected
+ * read_frag_size
  *
- * This routine checks for any outstanding tag list requests.  It will
- * terminate when there is no data in the response and the error is not "more data".
+ * How many bytes of the tag fit in one read response.  Once the PLC has
+ * sent a partial response we know exactly.  Until then, guess from the
+ * packet size, leaving room for the reply header and the type information.
+ * A piece that does not fit comes back short and the rest is asked for
+ * again.
+ */
+
+int read_frag_size(ab_tag_p tag)
+{
+    int frag_size = 0;
+
+    if(tag->read_frag_max > 0) {
+        return tag->read_frag_max;
+    }
+
+    frag_size = session_get_max_payload(tag->session)
+                    - 4                             /* reply service, reserved, status and status size */
+                    - tag->encoded_type_info_size   /* encoded type */
+                    - 8;                            /* MAGIC fudge factor */
+
+    /* we want a multiple of 8 bytes */
+    frag_size &= 0xFFFFF8;
+
+    return frag_size;
+}
+
+
+
+/*
+ * start_read_frags
  *
- * This is not thread-safe!  It should be called with the tag mutex
- * locked!
+ * Split the bytes from start to end of the tag into pieces that fit into
+ * one response each and queue a Read Tag Fragmented request for every
+ * piece.  A full piece fills a response so the requests are not packed
+ * together.  With more than one request in flight on the session, they
+ * are pipelined instead of waiting a round trip each.
  */
 
-static int check_read_tag_list_status_connected(ab_tag_p tag)
+int start_read_frags(ab_tag_p tag, int start, int end)
 {
     int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp* cip_resp;
-    uint8_t* data;
-    uint8_t* data_end;
-    int partial_data = 0;
+    int frag_size = read_frag_size(tag);
+    int num_frags = 0;
 
-    static int symbol_index=0;
+    pdebug(DEBUG_INFO, "Starting.");
 
+    if(frag_size <= 0) {
+        pdebug(DEBUG_WARN, "Packets are too small to read in pieces!");
+        return PLCTAG_ERR_TOO_SMALL;
+    }
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    num_frags = (end - start + frag_size - 1) / frag_size;
 
-    if(!tag) {
-        pdebug(DEBUG_ERROR,"Null tag pointer passed!");
-        return PLCTAG_ERR_NULL_PTR;
+    tag->read_frags = (struct ab_frag_t *)mem_alloc(num_frags * (int)sizeof(struct ab_frag_t));
+    if(!tag->read_frags) {
+        pdebug(DEBUG_WARN, "Unable to allocate read pieces!");
+        return PLCTAG_ERR_NO_MEM;
     }
 
-    if (!tag->req) {
-        tag->read_in_progress = 0;
-        tag->offset = 0;
+    tag->num_read_frags = num_frags;
 
-        pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
+    for(int i=0; i < num_frags; i++) {
+        tag->read_frags[i].offset = start + (i * frag_size);
+        tag->read_frags[i].end = (start + ((i + 1) * frag_size) < end ? start + ((i + 1) * frag_size) : end);
+    }
 
-        return PLCTAG_ERR_READ;
+    for(int i=0; i < num_frags && rc == PLCTAG_STATUS_OK; i++) {
+        rc = start_read_frag(tag, &(tag->read_frags[i]));
     }
 
-    /* request can be used by two threads at once. */
-    spin_block(&tag->req->lock) {
-        if(!tag->req->resp_received) {
-            rc = PLCTAG_STATUS_PENDING;
-            break;
-        }
+    pdebug(DEBUG_INFO, "Reading bytes %d to %d in %d pieces of %d bytes.", start, end, num_frags, frag_size);
 
-        /* check to see if it was an abort on the session side. */
-        if(tag->req->status != PLCTAG_STATUS_OK) {
-            rc = tag->req->status;
-            tag->req->abort_request = 1;
+    pdebug(DEBUG_INFO, "Done.");
 
-            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+    return rc;
+}
 
-            tag->read_in_progress = 0;
-            tag->offset = 0;
-            tag->next_id = 0;
-            tag->size = tag->elem_count * tag->elem_size;
 
-            break;
-        }
+
+/* queue the request for the rest of one piece. */
+int start_read_frag(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int allow_packing = tag->allow_packing;
+
+    /* the request builders take the packing and leave the request in the tag. */
+    tag->allow_packing = 0;
+
+    if(tag->use_connected_msg) {
+        rc = build_read_request_connected(tag, frag->offset, frag->end);
+    } else {
+        rc = build_read_request_unconnected(tag, frag->offset, frag->end);
     }
 
-    if(rc != PLCTAG_STATUS_OK) {
-        if(rc_is_error(rc)) {
-            /* the request is dead, from session side. */
-            tag->req = rc_dec(tag->req);
-        }
+    tag->allow_packing = allow_packing;
 
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build read request for offset %d!", frag->offset);
         return rc;
     }
 
-    /* the request is ours exclusively. */
+    frag->req = tag->req;
+    tag->req = NULL;
 
-    /* point to the data */
-    cip_resp = (eip_cip_co_resp*)(tag->req->data);
+    return PLCTAG_STATUS_OK;
+}
 
-    /* point to the start of the data */
-    data = (tag->req->data) + sizeof(eip_cip_co_resp);
 
-    /* point the end of the data */
-    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
 
-    /* check the status */
-    do {
-        ptrdiff_t payload_size = (data_end - data);
+/*
+ * check_read_frags_status
+ *
+ * Copy in the pieces that have arrived.  A piece that came back short is
+ * asked for again from where it stopped.  The read is done when all the
+ * pieces are in.
+ *
+ * This is not thread-safe!  It should be called with the tag mutex
+ * locked!
+ */
 
-        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
+static int check_read_frags_status(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int pending = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int i=0; i < tag->num_read_frags && rc == PLCTAG_STATUS_OK; i++) {
+        struct ab_frag_t *frag = &(tag->read_frags[i]);
+        int partial_data = 0;
+
+        if(!frag->req) {
+            continue;
         }
 
-        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
+        /* request can be used by two threads at once. */
+        spin_block(&frag->req->lock) {
+            if(!frag->req->resp_received) {
+                rc = PLCTAG_STATUS_PENDING;
+                break;
+            }
+
+            /* check to see if it was an abort on the session side. */
+            if(frag->req->status != PLCTAG_STATUS_OK) {
+                rc = frag->req->status;
+
+                pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
         }
 
-        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_LIST_TAGS | AB_EIP_CMD_CIP_OK) ) {
-            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
+        if(rc == PLCTAG_STATUS_PENDING) {
+            pending = 1;
+            rc = PLCTAG_STATUS_OK;
+            continue;
         }
 
-        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
-            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
-            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
-            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+        /* the request is ours exclusively. */
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = check_read_frag_response(tag, frag, &partial_data);
+        }
+
+        /* clean up the request */
+        frag->req->abort_request = 1;
+        frag->req = rc_dec(frag->req);
+
+        if(rc != PLCTAG_STATUS_OK) {
             break;
         }
 
-        /* check to see if this is a partial response. */
-        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+        if(frag->offset < frag->end) {
+            if(!partial_data) {
+                pdebug(DEBUG_WARN, "Tag data ended at %d, before the expected %d bytes!", frag->offset, frag->end);
+                rc = PLCTAG_ERR_BAD_DATA;
+                break;
+            }
 
-        /*
-         * check to see if there is any data to process.  If this is a packed
-         * response, there might not be.
-         */
-        if(payload_size > 0) {
-            uint8_t *current_entry_data = data;
+            pdebug(DEBUG_DETAIL, "Asking for the rest of the piece at offset %d.", frag->offset);
 
-            /* copy the data into the tag and realloc if we need more space. */
+            rc = start_read_frag(tag, frag);
+            pending = 1;
+        }
+    }
 
-            if(payload_size + tag->offset > tag->size) {
-                tag->elem_count = tag->size = (int)payload_size + tag->offset;
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
 
-                pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", tag->size);
+        /* clean up everything. */
+        ab_tag_shared_read_done(tag, rc);
+        ab_tag_abort(tag);
 
-                tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
-                if(!tag->data) {
-                    pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
-                    rc = PLCTAG_ERR_NO_MEM;
-                    break;
-                }
-            }
+        return rc;
+    }
 
-            /* copy the data into the tag's data buffer. */
-            mem_copy(tag->data + tag->offset, data, (int)payload_size);
+    if(pending) {
+        pdebug(DEBUG_SPEW, "Done.  Waiting for more pieces.");
+        return PLCTAG_STATUS_PENDING;
+    }
 
-            tag->offset += (int)payload_size;
+    /* all the pieces are in. */
+    mem_free(tag->read_frags);
+    tag->read_frags = NULL;
+    tag->num_read_frags = 0;
 
-            pdebug(DEBUG_DETAIL, "current offset %d", tag->offset);
+    tag->read_in_progress = 0;
+    tag->offset = 0;
 
-            /* scan through the data to get the next ID to use. */
-            while((data_end - current_entry_data) > 0) {
+    /* pass the data on to any handles sharing this read. */
+    ab_tag_shared_read_done(tag, PLCTAG_STATUS_OK);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* check one response of a read in pieces and copy in its data. */
+int check_read_frag_response(ab_tag_p tag, struct ab_frag_t *frag, int *partial_data)
+{
+    uint8_t *data = NULL;
+    uint8_t *data_end = NULL;
+    uint16_t encap_command = 0;
+    uint32_t encap_status = 0;
+    uint8_t reply_service = 0;
+    uint8_t *status = NULL;
+    int payload_size = 0;
+
+    if(tag->use_connected_msg) {
+        eip_cip_co_resp *cip_resp = (eip_cip_co_resp*)(frag->req->data);
+
+        data = (frag->req->data) + sizeof(eip_cip_co_resp);
+        data_end = (frag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+        encap_command = le2h16(cip_resp->encap_command);
+        encap_status = le2h32(cip_resp->encap_status);
+        reply_service = cip_resp->reply_service;
+        status = &(cip_resp->status);
+    } else {
+        eip_cip_uc_resp *cip_resp = (eip_cip_uc_resp*)(frag->req->data);
+
+        data = (frag->req->data) + sizeof(eip_cip_uc_resp);
+        data_end = (frag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+        encap_command = le2h16(cip_resp->encap_command);
+        encap_status = le2h32(cip_resp->encap_status);
+        reply_service = cip_resp->reply_service;
+        status = &(cip_resp->status);
+    }
+
+    if (encap_command != (tag->use_connected_msg ? AB_EIP_CONNECTED_SEND : AB_EIP_UNCONNECTED_SEND)) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (encap_status != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", encap_status);
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if (reply_service != (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", reply_service);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (*status != AB_CIP_STATUS_OK && *status != AB_CIP_STATUS_FRAG) {
+        pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", *status, decode_cip_error_short(status));
+        pdebug(DEBUG_INFO, decode_cip_error_long(status));
+        return decode_cip_error_code(status);
+    }
+
+    *partial_data = (*status == AB_CIP_STATUS_FRAG);
+
+    /* step past the type information. */
+    if(data_end - data < 2) {
+        pdebug(DEBUG_WARN, "Response is too short for the type information!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
+        update_type_info(tag, data, 2);
+        data += 2;
+    } else if ((*data) == AB_CIP_DATA_ABREV_STRUCT || (*data) == AB_CIP_DATA_ABREV_ARRAY ||
+               (*data) == AB_CIP_DATA_FULL_STRUCT || (*data) == AB_CIP_DATA_FULL_ARRAY) {
+        int type_length = *(data + 1) + 2;  /* MAGIC, type byte and length byte. */
+
+        if (type_length > MAX_TAG_TYPE_INFO || type_length > (int)(data_end - data)) {
+            pdebug(DEBUG_WARN, "Read data type info is too long (%d)!", type_length);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        update_type_info(tag, data, type_length);
+        data += type_length;
+    } else {
+        pdebug(DEBUG_WARN, "Unsupported data type returned, type byte=%d", *data);
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    payload_size = (int)(data_end - data);
+
+    /* size later pieces by what the PLC really fits in a response. */
+    if(*partial_data && payload_size > tag->read_frag_max) {
+        tag->read_frag_max = payload_size;
+    }
+
+    /* only refresh the piece, the PLC may send more. */
+    if(payload_size > frag->end - frag->offset) {
+        payload_size = frag->end - frag->offset;
+    }
+
+    if(payload_size <= 0 && *partial_data) {
+        pdebug(DEBUG_WARN, "Partial response with no data!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    pdebug(DEBUG_DETAIL, "Got %d bytes of data at offset %d", payload_size, frag->offset);
+
+    mem_copy(tag->data + frag->offset, data, payload_size);
+
+    frag->offset += payload_size;
+    if(frag->offset > frag->end) {
+        frag->offset = frag->end;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int build_udt_request_connected(ab_tag_p tag)
+{
+    eip_cip_co_req* cip = NULL;
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t *data_start = NULL;
+    uint8_t *data = NULL;
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint32_le tmp_u32 = UINT32LE_INIT(0);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* get a request buffer */
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    /* point the request struct at the buffer */
+    cip = (eip_cip_co_req*)(req->data);
+
+    /* point to the end of the struct */
+    data_start = data = (uint8_t*)(cip + 1);
+
+    /* first the attributes to find the size, then the definition itself. */
+    if(tag->udt_read_definition) {
+        *data = AB_EIP_CMD_CIP_READ_TEMPLATE;
+    } else {
+        *data = AB_EIP_CMD_CIP_GET_ATTR_LIST;
+    }
+    data++;
+
+    /* request path size, in 16-bit words */
+    *data = (uint8_t)3;
+    data++;
+
+    data[0] = 0x20; /* class type */
+    data[1] = 0x6C; /* template class */
+    data[2] = 0x25; /* 16-bit instance ID type */
+    data[3] = 0x00; /* padding */
+    data += 4;
+
+    /* now the instance ID */
+    tmp_u16 = h2le16(tag->udt_fetch_id);
+    mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+    data += (int)sizeof(tmp_u16);
+
+    if(tag->udt_read_definition) {
+        /* where to start and how much is left. */
+        tmp_u32 = h2le32((uint32_t)tag->offset);
+        mem_copy(data, &tmp_u32, (int)sizeof(tmp_u32));
+        data += (int)sizeof(tmp_u32);
+
+        tmp_u16 = h2le16((uint16_t)(tag->udt_definition_size - (uint32_t)tag->offset));
+        mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+        data += (int)sizeof(tmp_u16);
+    } else {
+        uint16_t attribs[] = { 0x04, 0x05, 0x02, 0x01 }; /* MAGIC, see the packet format above. */
+
+        tmp_u16 = h2le16((uint16_t)4);  /* MAGIC, we have four attributes we want. */
+        mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+        data += (int)sizeof(tmp_u16);
+
+        for(int i=0; i < 4; i++) {
+            tmp_u16 = h2le16(attribs[i]);
+            mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+            data += (int)sizeof(tmp_u16);
+        }
+    }
+
+    /* now we go back and fill in the fields of the static part */
+
+    /* encap fields */
+    cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND); /* ALWAYS 0x0070 Connected Send*/
+
+    /* router timeout */
+    cip->router_timeout = h2le16(1); /* one second timeout, enough? */
+
+    /* Common Packet Format fields for unconnected send. */
+    cip->cpf_item_count = h2le16(2);                 /* ALWAYS 2 */
+    cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);/* ALWAYS 0x00A1 connected address item */
+    cip->cpf_cai_item_length = h2le16(4);            /* ALWAYS 4, size of connection ID*/
+    cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);/* ALWAYS 0x00B1 - connected Data Item */
+    cip->cpf_cdi_item_length = h2le16((uint16_t)((int)(data - data_start) + (int)sizeof(cip->cpf_conn_seq_num)));
+
+    /* set the size of the request */
+    req->request_size = (int)((int)sizeof(*cip) + (int)(data - data_start));
+
+    req->allow_packing = tag->allow_packing;
+
+    /* add the request to the session's list. */
+    rc = session_add_request(tag->session, req);
+
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        tag->req = rc_dec(req);
+        return rc;
+    }
+
+    /* save the request for later */
+    tag->req = req;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * check_read_tag_list_status_connected
+ *
+ * This routine checks for any outstanding tag list requests.  It will
+ * terminate when there is no data in the response and the error is not "more data".
+ *
+ * This is not thread-safe!  It should be called with the tag mutex
+ * locked!
+ */
+
+static int check_read_tag_list_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp* cip_resp;
+    uint8_t* data;
+    uint8_t* data_end;
+    int partial_data = 0;
+
+    static int symbol_index=0;
+
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_ERROR,"Null tag pointer passed!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if (!tag->req) {
+        tag->read_in_progress = 0;
+        tag->offset = 0;
+
+        pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
+
+        return PLCTAG_ERR_READ;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        /* check to see if it was an abort on the session side. */
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+
+            tag->read_in_progress = 0;
+            tag->offset = 0;
+            tag->next_id = 0;
+            tag->size = tag->elem_count * tag->elem_size;
+
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc_is_error(rc)) {
+            /* the request is dead, from session side. */
+            tag->req = rc_dec(tag->req);
+        }
+
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+
+    /* point to the data */
+    cip_resp = (eip_cip_co_resp*)(tag->req->data);
+
+    /* point to the start of the data */
+    data = (tag->req->data) + sizeof(eip_cip_co_resp);
+
+    /* point the end of the data */
+    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    /* check the status */
+    do {
+        ptrdiff_t payload_size = (data_end - data);
+
+        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_LIST_TAGS | AB_EIP_CMD_CIP_OK) ) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            break;
+        }
+
+        /* check to see if this is a partial response. */
+        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+        /*
+         * check to see if there is any data to process.  If this is a packed
+         * response, there might not be.
+         */
+        if(payload_size > 0) {
+            uint8_t *current_entry_data = data;
+
+            /* copy the data into the tag and realloc if we need more space. */
+
+            if(payload_size + tag->offset > tag->size) {
+                tag->elem_count = tag->size = (int)payload_size + tag->offset;
+
+                pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", tag->size);
+
+                tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
+                if(!tag->data) {
+                    pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+                    rc = PLCTAG_ERR_NO_MEM;
+                    break;
+                }
+            }
+
+            /* copy the data into the tag's data buffer. */
+            mem_copy(tag->data + tag->offset, data, (int)payload_size);
+
+            tag->offset += (int)payload_size;
+
+            pdebug(DEBUG_DETAIL, "current offset %d", tag->offset);
+
+            /* scan through the data to get the next ID to use. */
+            while((data_end - current_entry_data) > 0) {
                 tag_list_entry *current_entry = (tag_list_entry*)current_entry_data;
 
-                /* first element is the symbol instance ID */
-                tag->next_id = (uint16_t)(le2h32(current_entry->instance_id) + 1);
+                /* first element is the symbol instance ID */
+                tag->next_id = (uint16_t)(le2h32(current_entry->instance_id) + 1);
+
+                pdebug(DEBUG_DETAIL, "Next ID: %d", tag->next_id);
+
+                /* remember the instance ID so other tags can use it instead of the name. */
+                if((data_end - current_entry_data) >= (ptrdiff_t)(sizeof(*current_entry) + le2h16(current_entry->string_len))) {
+                    const char *prefix = NULL;
+                    int prefix_len = 0;
+
+                    /* program listings have the program name as the encoded name. */
+                    if(tag->encoded_name_size > 2 && tag->encoded_name[1] == 0x91) {
+                        prefix = (const char *)&tag->encoded_name[3];
+                        prefix_len = tag->encoded_name[2];
+                    }
+
+                    session_put_symbol_instance(tag->session, prefix, prefix_len, (const char *)(current_entry + 1), le2h16(current_entry->string_len), le2h32(current_entry->instance_id));
+                }
+
+                /* skip past to the next instance. */
+                current_entry_data += (sizeof(*current_entry) + le2h16(current_entry->string_len));
+
+                symbol_index++;
+            }
+        } else {
+            pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
+        }
+
+        /* set the return code */
+        rc = PLCTAG_STATUS_OK;
+    } while(0);
+
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    /* are we actually done? */
+    if (rc == PLCTAG_STATUS_OK) {
+        /* this read is done. */
+        tag->read_in_progress = 0;
+
+        /* keep going if we are not done yet. */
+        if (partial_data) {
+            /* call read start again to get the next piece */
+            pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
+            rc = tag_read_start(tag);
+        } else {
+            /* done! */
+            pdebug(DEBUG_DETAIL, "Done reading tag list data!");
+
+            pdebug(DEBUG_DETAIL, "total symbols: %d", symbol_index);
+
+            tag->elem_count = tag->offset;
+
+            tag->first_read = 0;
+            tag->offset = 0;
+            tag->next_id = 0;
+        }
+    }
+
+    /* this is not an else clause because the above if could result in bad rc. */
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        /* error ! */
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+
+        tag->offset = 0;
+        tag->next_id = 0;
+
+        /* clean up everything. */
+        ab_tag_abort(tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * check_read_udt_status_connected
+ *
+ * This routine checks the responses of a UDT template read.  The attributes
+ * come first, then the definition in as many pieces as the PLC wants to
+ * send.  Templates of nested structures are read the same way before the
+ * read is done.
+ *
+ * This is not thread-safe!  It should be called with the tag mutex
+ * locked!
+ */
+
+static int check_read_udt_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp* cip_resp;
+    uint8_t* data;
+    uint8_t* data_end;
+    int partial_data = 0;
+    uint8_t expected_service = (tag->udt_read_definition ? AB_EIP_CMD_CIP_READ_TEMPLATE : AB_EIP_CMD_CIP_GET_ATTR_LIST);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if (!tag->req) {
+        tag->read_in_progress = 0;
+        tag->offset = 0;
+
+        pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
+
+        return PLCTAG_ERR_READ;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        /* check to see if it was an abort on the session side. */
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+
+            tag->read_in_progress = 0;
+            tag->offset = 0;
+            tag->udt_read_definition = 0;
+            tag->udt_fetch_id = tag->udt_id;
+
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc_is_error(rc)) {
+            /* the request is dead, from session side. */
+            tag->req = rc_dec(tag->req);
+        }
+
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+
+    /* point to the data */
+    cip_resp = (eip_cip_co_resp*)(tag->req->data);
+
+    /* point to the start of the data */
+    data = (tag->req->data) + sizeof(eip_cip_co_resp);
+
+    /* point the end of the data */
+    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    /* check the status */
+    do {
+        ptrdiff_t payload_size = (data_end - data);
+
+        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if (cip_resp->reply_service != (expected_service | AB_EIP_CMD_CIP_OK) ) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            break;
+        }
+
+        /* check to see if this is a partial response. */
+        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+        if(!tag->udt_read_definition) {
+            rc = decode_udt_attributes(tag, data, data_end);
+            break;
+        }
+
+        /* copy the piece of the definition into the tag and realloc if we need more space. */
+        if(payload_size + tag->offset > tag->size) {
+            tag->elem_count = tag->size = (int)payload_size + tag->offset;
+
+            pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", tag->size);
+
+            tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
+            if(!tag->data) {
+                pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+        }
+
+        if(payload_size > 0) {
+            mem_copy(tag->data + tag->offset, data, (int)payload_size);
+            tag->offset += (int)payload_size;
+        }
+
+        pdebug(DEBUG_DETAIL, "current offset %d", tag->offset);
+
+        /* set the return code */
+        rc = PLCTAG_STATUS_OK;
+    } while(0);
+
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    /* are we actually done? */
+    if (rc == PLCTAG_STATUS_OK) {
+        /* this read is done. */
+        tag->read_in_progress = 0;
+
+        if(!tag->udt_read_definition) {
+            /* we know the size, now get the definition. */
+            pdebug(DEBUG_DETAIL, "Reading the definition of template %u.", (unsigned int)tag->udt_fetch_id);
+
+            tag->udt_read_definition = 1;
+            tag->offset = 0;
+
+            rc = tag_read_start(tag);
+        } else if(partial_data && (uint32_t)tag->offset < tag->udt_definition_size) {
+            /* call read start again to get the next piece */
+            pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
+            rc = tag_read_start(tag);
+        } else {
+            rc = udt_template_done(tag);
+        }
+    }
+
+    /* this is not an else clause because the above if could result in bad rc. */
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        /* error ! */
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+
+        tag->offset = 0;
+        tag->udt_read_definition = 0;
+        tag->udt_fetch_id = tag->udt_id;
+
+        /* clean up everything. */
+        ab_tag_abort(tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * Pull the template size, structure size, member count and handle out of
+ * a Get Attribute List response.  Each attribute is a uint16_t ID, a
+ * uint16_t status and the value.
+ */
+
+int decode_udt_attributes(ab_tag_p tag, uint8_t *data, uint8_t *data_end)
+{
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint32_le tmp_u32 = UINT32LE_INIT(0);
+    uint32_t definition_words = 0;
+    int attr_count = 0;
+    int found = 0;
+
+    if(data_end - data < (ptrdiff_t)sizeof(tmp_u16)) {
+        pdebug(DEBUG_WARN, "Template attribute response is too short!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    mem_copy(&tmp_u16, data, (int)sizeof(tmp_u16));
+    attr_count = le2h16(tmp_u16);
+    data += sizeof(tmp_u16);
+
+    for(int i=0; i < attr_count; i++) {
+        uint16_t attr_id = 0;
+        uint16_t attr_status = 0;
+
+        if(data_end - data < (ptrdiff_t)(2 * sizeof(tmp_u16))) {
+            pdebug(DEBUG_WARN, "Template attribute response is too short!");
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        mem_copy(&tmp_u16, data, (int)sizeof(tmp_u16));
+        attr_id = le2h16(tmp_u16);
+        data += sizeof(tmp_u16);
+
+        mem_copy(&tmp_u16, data, (int)sizeof(tmp_u16));
+        attr_status = le2h16(tmp_u16);
+        data += sizeof(tmp_u16);
+
+        if(attr_status != 0) {
+            pdebug(DEBUG_WARN, "Template %u attribute %u returned status %u!", (unsigned int)tag->udt_fetch_id, (unsigned int)attr_id, (unsigned int)attr_status);
+            return PLCTAG_ERR_REMOTE_ERR;
+        }
+
+        switch(attr_id) {
+        case 0x01:
+        case 0x02:
+            if(data_end - data < (ptrdiff_t)sizeof(tmp_u16)) {
+                pdebug(DEBUG_WARN, "Template attribute response is too short!");
+                return PLCTAG_ERR_BAD_DATA;
+            }
+
+            mem_copy(&tmp_u16, data, (int)sizeof(tmp_u16));
+            data += sizeof(tmp_u16);
+
+            if(attr_id == 0x01) {
+                tag->udt_handle = le2h16(tmp_u16);
+            } else {
+                tag->udt_member_count = le2h16(tmp_u16);
+            }
+
+            break;
+
+        case 0x04:
+        case 0x05:
+            if(data_end - data < (ptrdiff_t)sizeof(tmp_u32)) {
+                pdebug(DEBUG_WARN, "Template attribute response is too short!");
+                return PLCTAG_ERR_BAD_DATA;
+            }
+
+            mem_copy(&tmp_u32, data, (int)sizeof(tmp_u32));
+            data += sizeof(tmp_u32);
+
+            if(attr_id == 0x04) {
+                definition_words = le2h32(tmp_u32);
+            } else {
+                tag->udt_struct_size = le2h32(tmp_u32);
+            }
+
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unexpected template attribute %u!", (unsigned int)attr_id);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        found |= (1 << attr_id);
+    }
+
+    if(found != ((1 << 0x01) | (1 << 0x02) | (1 << 0x04) | (1 << 0x05))) {
+        pdebug(DEBUG_WARN, "Template attribute response is missing attributes!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    /* MAGIC, the definition is 23 bytes shorter than the size in words says. */
+    if(definition_words * 4 <= 23 || definition_words * 4 - 23 > UINT16_MAX) {
+        pdebug(DEBUG_WARN, "Template definition size %u words is not usable!", (unsigned int)definition_words);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    tag->udt_definition_size = definition_words * 4 - 23;
+
+    pdebug(DEBUG_DETAIL, "Template %u has %u members, %u bytes of definition and is %u bytes long.",
+                         (unsigned int)tag->udt_fetch_id,
+                         (unsigned int)tag->udt_member_count,
+                         (unsigned int)tag->udt_definition_size,
+                         (unsigned int)tag->udt_struct_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Decode the definition in the tag's buffer into one block with the
+ * members, a copy of the definition and the names.
+ */
+
+int decode_udt_template(ab_tag_p tag, struct ab_udt_template_t **udt_template)
+{
+    struct ab_udt_template_t *result = NULL;
+    int member_count = (int)tag->udt_member_count;
+    int defs_size = member_count * UDT_MEMBER_DEF_SIZE;
+    int raw_size = tag->offset;
+    int names_size = 0;
+    char *names = NULL;
+    int pos = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(defs_size > raw_size) {
+        pdebug(DEBUG_WARN, "Template definition is too short for %d members!", member_count);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    names_size = raw_size - defs_size;
+
+    result = (struct ab_udt_template_t *)mem_alloc((int)sizeof(*result) + (member_count * (int)sizeof(struct ab_udt_member_t)) + raw_size + names_size + 1);
+    if(!result) {
+        pdebug(DEBUG_WARN, "Unable to allocate UDT template!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    result->id = tag->udt_fetch_id;
+    result->handle = tag->udt_handle;
+    result->struct_size = tag->udt_struct_size;
+    result->member_count = member_count;
+    result->members = (struct ab_udt_member_t *)(result + 1);
+    result->raw = (uint8_t *)(result->members + member_count);
+    result->raw_size = raw_size;
+    mem_copy(result->raw, tag->data, raw_size);
+
+    /* the names are zero terminated, the last one may be cut off. */
+    names = (char *)(result->raw + raw_size);
+    mem_copy(names, result->raw + defs_size, names_size);
+    names[names_size] = 0;
+
+    /* the template name ends at the ';'. */
+    result->name = names;
+    while(pos < names_size && names[pos]) {
+        if(names[pos] == ';') {
+            names[pos] = 0;
+        }
+
+        pos++;
+    }
+    pos++;
+
+    for(int i=0; i < member_count; i++) {
+        uint8_t *def = result->raw + (i * UDT_MEMBER_DEF_SIZE);
+        struct ab_udt_member_t *member = &result->members[i];
+
+        member->info = (uint16_t)(def[0] | (def[1] << 8));
+        member->type = (uint16_t)(def[2] | (def[3] << 8));
+        member->offset = (uint32_t)def[4] | ((uint32_t)def[5] << 8) | ((uint32_t)def[6] << 16) | ((uint32_t)def[7] << 24);
+
+        if(pos < names_size) {
+            member->name = &names[pos];
+
+            while(pos < names_size && names[pos]) {
+                pos++;
+            }
+            pos++;
+        } else {
+            member->name = "";
+        }
+
+        pdebug(DEBUG_DETAIL, "Member %s type %x info %u offset %u.", member->name, (unsigned int)member->type, (unsigned int)member->info, (unsigned int)member->offset);
+    }
+
+    *udt_template = result;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Look for a template that the given template uses, directly or through
+ * its members, and that the session does not have yet.  Returns
+ * PLCTAG_STATUS_OK and the ID if one is missing.
+ */
+
+int find_missing_udt_template(ab_session_p session, uint16_t template_id, int depth, uint16_t *missing_id)
+{
+    struct ab_udt_template_t *udt_template = session_get_udt_template(session, template_id);
+
+    if(!udt_template) {
+        *missing_id = template_id;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(depth >= UDT_MAX_NESTING) {
+        pdebug(DEBUG_WARN, "Templates are nested too deeply!");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    for(int i=0; i < udt_template->member_count; i++) {
+        uint16_t type = udt_template->members[i].type;
+
+        if((type & AB_UDT_TYPE_STRUCT) && find_missing_udt_template(session, (uint16_t)(type & AB_UDT_TYPE_ID_MASK), depth + 1, missing_id) == PLCTAG_STATUS_OK) {
+            return PLCTAG_STATUS_OK;
+        }
+    }
+
+    return PLCTAG_ERR_NOT_FOUND;
+}
+
+
+
+/*
+ * The definition of one template is in.  Hand it to the session and go on
+ * to the next missing nested template, if any.
+ */
+
+int udt_template_done(ab_tag_p tag)
+{
+    struct ab_udt_template_t *udt_template = NULL;
+    uint16_t missing_id = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    rc = decode_udt_template(tag, &udt_template);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to decode template %u!", (unsigned int)tag->udt_fetch_id);
+        return rc;
+    }
+
+    rc = session_put_udt_template(tag->session, udt_template);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to store template %u!", (unsigned int)tag->udt_fetch_id);
+        return rc;
+    }
+
+    tag->offset = 0;
+    tag->udt_read_definition = 0;
 
-                pdebug(DEBUG_DETAIL, "Next ID: %d", tag->next_id);
+    if(find_missing_udt_template(tag->session, tag->udt_id, 0, &missing_id) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Reading nested template %u.", (unsigned int)missing_id);
 
-                /* skip past to the next instance. */
-                current_entry_data += (sizeof(*current_entry) + le2h16(current_entry->string_len));
+        tag->udt_fetch_id = missing_id;
 
-                symbol_index++;
-            }
-        } else {
-            pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
-        }
+        return tag_read_start(tag);
+    }
 
-        /* set the return code */
-        rc = PLCTAG_STATUS_OK;
-    } while(0);
+    tag->udt_fetch_id = tag->udt_id;
 
-    /* clean up the request */
-    tag->req->abort_request = 1;
-    tag->req = rc_dec(tag->req);
+    rc = copy_udt_template_to_tag(tag);
 
-    /* are we actually done? */
-    if (rc == PLCTAG_STATUS_OK) {
-        /* this read is done. */
-        tag->read_in_progress = 0;
+    pdebug(DEBUG_DETAIL, "Done.");
 
-        /* keep going if we are not done yet. */
-        if (partial_data) {
-            /* call read start again to get the next piece */
-            pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
-            rc = tag_read_start(tag);
-        } else {
-            /* done! */
-            pdebug(DEBUG_DETAIL, "Done reading tag list data!");
+    return rc;
+}
 
-            pdebug(DEBUG_DETAIL, "total symbols: %d", symbol_index);
 
-            tag->elem_count = tag->offset;
 
-            tag->first_read = 0;
-            tag->offset = 0;
-            tag->next_id = 0;
-        }
+/* fill in the tag data with the header and the definition of the template asked for. */
+int copy_udt_template_to_tag(ab_tag_p tag)
+{
+    struct ab_udt_template_t *udt_template = session_get_udt_template(tag->session, tag->udt_id);
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint32_le tmp_u32 = UINT32LE_INIT(0);
+    int new_size = 0;
+
+    if(!udt_template) {
+        pdebug(DEBUG_WARN, "Template %u is not known!", (unsigned int)tag->udt_id);
+        return PLCTAG_ERR_NOT_FOUND;
     }
 
-    /* this is not an else clause because the above if could result in bad rc. */
-    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
-        /* error ! */
-        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+    new_size = UDT_HEADER_SIZE + udt_template->raw_size;
 
-        tag->offset = 0;
-        tag->next_id = 0;
+    if(new_size != tag->size) {
+        tag->data = (uint8_t*)mem_realloc(tag->data, new_size);
+        if(!tag->data) {
+            pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+            tag->size = tag->elem_count = 0;
+            return PLCTAG_ERR_NO_MEM;
+        }
 
-        /* clean up everything. */
-        ab_tag_abort(tag);
+        tag->size = tag->elem_count = new_size;
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    tmp_u16 = h2le16(udt_template->id);
+    mem_copy(tag->data, &tmp_u16, (int)sizeof(tmp_u16));
 
-    return rc;
+    tmp_u32 = h2le32((uint32_t)udt_template->raw_size);
+    mem_copy(tag->data + 2, &tmp_u32, (int)sizeof(tmp_u32));
+
+    tmp_u32 = h2le32(udt_template->struct_size);
+    mem_copy(tag->data + 6, &tmp_u32, (int)sizeof(tmp_u32));
+
+    tmp_u16 = h2le16((uint16_t)udt_template->member_count);
+    mem_copy(tag->data + 10, &tmp_u16, (int)sizeof(tmp_u16));
+
+    tmp_u16 = h2le16(udt_template->handle);
+    mem_copy(tag->data + 12, &tmp_u16, (int)sizeof(tmp_u16));
+
+    mem_copy(tag->data + UDT_HEADER_SIZE, udt_template->raw, udt_template->raw_size);
+
+    tag->first_read = 0;
+
+    return PLCTAG_STATUS_OK;
 }
 
 
 
 
 
+
 static int check_read_status_unconnected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -2104,6 +3331,8 @@ static int check_read_status_unconnected(ab_tag_p tag)
         if(rc_is_error(rc)) {
             /* the request is dead, from session side. */
             tag->req = rc_dec(tag->req);
+
+            ab_tag_shared_read_done(tag, rc);
         }
 
         return rc;
@@ -2171,10 +3400,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
         if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
             /* copy the type info for later. */
-            if (tag->encoded_type_info_size == 0) {
-                tag->encoded_type_info_size = 2;
-                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-            }
+            update_type_info(tag, data, 2);
 
             /* skip the type byte and zero length byte */
             data += 2;
@@ -2196,10 +3422,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
             }
 
             /* copy the type info for later. */
-            if (tag->encoded_type_info_size == 0) {
-                tag->encoded_type_info_size = type_length;
-                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-            }
+            update_type_info(tag, data, type_length);
 
             data += type_length;
         } else {
@@ -2228,6 +3451,10 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
         pdebug(DEBUG_INFO, "Got %d bytes of data", (int)payload_size);
 
+        /* a partial response is as full as the PLC will make it. */
+        if(partial_data && (int)payload_size > tag->read_frag_max) {
+            tag->read_frag_max = (int)payload_size;
+        }
 
         /*
          * copy the data, but only if this is not
@@ -2263,9 +3490,16 @@ static int check_read_status_unconnected(ab_tag_p tag)
             rc = tag_read_start(tag);
         } else {
             /* done! */
+            if(tag->first_read) {
+                ab_tag_save_metadata(tag);
+            }
+
             tag->first_read = 0;
             tag->offset = 0;
 
+            /* pass the data on to any handles sharing this read. */
+            ab_tag_shared_read_done(tag, PLCTAG_STATUS_OK);
+
             /* if this is a pre-read for a write, then pass off to the write routine */
             if (tag->pre_write_read) {
                 pdebug(DEBUG_DETAIL, "Restarting write call now.");
@@ -2530,6 +3764,308 @@ static int check_write_status_unconnected(ab_tag_p tag)
 
 
 
+/*
+ * start_write_frags
+ *
+ * Split the passed byte ranges of the tag data into packet sized pieces
+ * and queue a Write Tag Fragmented request for each one.  The ranges are
+ * widened to whole elements.  The data is copied into the requests here,
+ * so the tag buffer can change once this returns.  With more than one
+ * request in flight on the session, the pieces are pipelined instead of
+ * waiting a round trip each.
+ */
+
+int start_write_frags(ab_tag_p tag, struct tag_range_t *ranges, int num_ranges)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int elem_size = (tag->elem_size > 0 ? tag->elem_size : 1);
+    int num_frags = 0;
+    int frag_index = 0;
+    int total_size = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* count the pieces first. */
+    for(int i=0; i < num_ranges; i++) {
+        int start = (ranges[i].start / elem_size) * elem_size;
+        int end = ((ranges[i].end + elem_size - 1) / elem_size) * elem_size;
+
+        if(end > tag->size) {
+            end = tag->size;
+        }
+
+        if(start < end) {
+            num_frags += (end - start + tag->write_data_per_packet - 1) / tag->write_data_per_packet;
+        }
+    }
+
+    if(num_frags == 0) {
+        pdebug(DEBUG_WARN, "No tag data to write!");
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    tag->write_frags = (struct ab_frag_t *)mem_alloc(num_frags * (int)sizeof(struct ab_frag_t));
+    if(!tag->write_frags) {
+        pdebug(DEBUG_WARN, "Unable to allocate write pieces!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->num_write_frags = num_frags;
+
+    for(int i=0; i < num_ranges && rc == PLCTAG_STATUS_OK; i++) {
+        int end = ((ranges[i].end + elem_size - 1) / elem_size) * elem_size;
+
+        if(end > tag->size) {
+            end = tag->size;
+        }
+
+        /* the request builders take the data at the tag offset and move it along. */
+        tag->offset = (ranges[i].start / elem_size) * elem_size;
+
+        while(tag->offset < end && frag_index < num_frags) {
+            struct ab_frag_t *frag = &(tag->write_frags[frag_index]);
+
+            frag->offset = tag->offset;
+
+            if(tag->use_connected_msg) {
+                rc = build_write_request_connected(tag, tag->offset, end);
+            } else {
+                rc = build_write_request_unconnected(tag, tag->offset, end);
+            }
+
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to build write request for offset %d!", frag->offset);
+                break;
+            }
+
+            frag->end = tag->offset;
+            frag->req = tag->req;
+            tag->req = NULL;
+
+            total_size += frag->end - frag->offset;
+            frag_index++;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Writing %d of %d bytes in %d pieces.", total_size, tag->size, frag_index);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * check_write_frags_status
+ *
+ * Check the acknowledgements of the pieces that have come back.  The write
+ * is done when every piece has been acknowledged.  If any piece fails, the
+ * rest are aborted and the write fails.
+ *
+ * This is not thread-safe!  It should be called with the tag mutex
+ * locked!
+ */
+
+static int check_write_frags_status(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int pending = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int i=0; i < tag->num_write_frags && rc == PLCTAG_STATUS_OK; i++) {
+        struct ab_frag_t *frag = &(tag->write_frags[i]);
+
+        if(!frag->req) {
+            continue;
+        }
+
+        /* request can be used by two threads at once. */
+        spin_block(&frag->req->lock) {
+            if(!frag->req->resp_received) {
+                rc = PLCTAG_STATUS_PENDING;
+                break;
+            }
+
+            /* check to see if it was an abort on the session side. */
+            if(frag->req->status != PLCTAG_STATUS_OK) {
+                rc = frag->req->status;
+
+                pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
+        }
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            pending = 1;
+            rc = PLCTAG_STATUS_OK;
+            continue;
+        }
+
+        /* the request is ours exclusively. */
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = check_write_frag_response(tag, frag);
+        }
+
+        /* clean up the request */
+        frag->req->abort_request = 1;
+        frag->req = rc_dec(frag->req);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Write failed, %s!", plc_tag_decode_error(rc));
+
+        /* clean up everything, this puts back the ranges that were being sent. */
+        ab_tag_abort(tag);
+
+        return rc;
+    }
+
+    if(pending) {
+        pdebug(DEBUG_SPEW, "Done.  Waiting for more pieces.");
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    /* every piece has been acknowledged. */
+    mem_free(tag->write_frags);
+    tag->write_frags = NULL;
+    tag->num_write_frags = 0;
+    tag->num_sending_ranges = 0;
+
+    tag->write_in_progress = 0;
+    tag->offset = 0;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* check the acknowledgement of one piece of a write in pieces. */
+int check_write_frag_response(ab_tag_p tag, struct ab_frag_t *frag)
+{
+    uint16_t encap_command = 0;
+    uint32_t encap_status = 0;
+    uint8_t reply_service = 0;
+    uint8_t *status = NULL;
+
+    if(tag->use_connected_msg) {
+        eip_cip_co_resp *cip_resp = (eip_cip_co_resp*)(frag->req->data);
+
+        encap_command = le2h16(cip_resp->encap_command);
+        encap_status = le2h32(cip_resp->encap_status);
+        reply_service = cip_resp->reply_service;
+        status = &(cip_resp->status);
+    } else {
+        eip_cip_uc_resp *cip_resp = (eip_cip_uc_resp*)(frag->req->data);
+
+        encap_command = le2h16(cip_resp->encap_command);
+        encap_status = le2h32(cip_resp->encap_status);
+        reply_service = cip_resp->reply_service;
+        status = &(cip_resp->status);
+    }
+
+    if (encap_command != (tag->use_connected_msg ? AB_EIP_CONNECTED_SEND : AB_EIP_UNCONNECTED_SEND)) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (encap_status != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", encap_status);
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if (reply_service != (AB_EIP_CMD_CIP_WRITE_FRAG | AB_EIP_CMD_CIP_OK)) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", reply_service);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (*status != AB_CIP_STATUS_OK && *status != AB_CIP_STATUS_FRAG) {
+        pdebug(DEBUG_WARN, "CIP write failed with status: 0x%x %s", *status, decode_cip_error_short(status));
+        pdebug(DEBUG_INFO, decode_cip_error_long(status));
+        return decode_cip_error_code(status);
+    }
+
+    pdebug(DEBUG_DETAIL, "Bytes %d to %d written.", frag->offset, frag->end);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*
+ * check_shared_read_status
+ *
+ * This routine must be called with the tag mutex locked.  It checks whether
+ * the read of another handle that this tag is waiting for is done and copies
+ * the data.  If that read failed, this tag starts its own read.
+ */
+static int check_shared_read_status(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    rc = session_shared_read_get_result(tag->shared_read, tag->shared_read_generation, &(tag->data), &(tag->size), tag->encoded_type_info, &(tag->encoded_type_info_size));
+    if(rc == PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_SPEW, "Done.  Shared read still in flight.");
+        return rc;
+    }
+
+    tag->shared_read_waiting = 0;
+    tag->read_in_progress = 0;
+
+    if(rc == PLCTAG_ERR_NO_MEM) {
+        pdebug(DEBUG_WARN, "Unable to copy shared read data!");
+        return rc;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Shared read failed with %s, reading the tag ourselves.", plc_tag_decode_error(rc));
+        return tag_read_start(tag);
+    }
+
+    if(tag->elem_count > 0) {
+        tag->elem_size = tag->size / tag->elem_count;
+    }
+
+    tag->first_read = 0;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * update_type_info
+ *
+ * Keep the type info from a read response.  If it changed since the last
+ * read, the tag was changed in the PLC.  Mark the tag so that the new type
+ * replaces the cached one when the read is done.
+ */
+static void update_type_info(ab_tag_p tag, uint8_t *type_info, int type_info_size)
+{
+    if(tag->encoded_type_info_size == type_info_size && mem_cmp(tag->encoded_type_info, tag->encoded_type_info_size, type_info, type_info_size) == 0) {
+        return;
+    }
+
+    if(tag->encoded_type_info_size != 0) {
+        pdebug(DEBUG_INFO, "Tag type changed in the PLC.");
+        tag->first_read = 1;
+    }
+
+    tag->encoded_type_info_size = type_info_size;
+    mem_copy(tag->encoded_type_info, type_info, type_info_size);
+}
+
+
+
+
 int calculate_write_data_per_packet(ab_tag_p tag)
 {
     int overhead = 0;
@@ -2699,3 +4235,49 @@ int setup_tag_listing(ab_tag_p tag, const char *name)
 
     return PLCTAG_STATUS_OK;
 }
+
+
+
+/*
+ * setup_udt_template
+ *
+ * Set up a tag named "@udt/<template ID>" that reads a Logix UDT template.
+ * The template ID is the low 12 bits of the symbol type of a structure
+ * tag in a tag listing.  Returns PLCTAG_ERR_NOT_FOUND if the name is not
+ * a template request.
+ */
+
+int setup_udt_template(ab_tag_p tag, const char *name)
+{
+    int template_id = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!name || str_length(name) <= str_length("@udt/")) {
+        pdebug(DEBUG_INFO, "Tag is not a UDT template request.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    for(int i=0; i < str_length("@udt/"); i++) {
+        if(tolower((unsigned char)name[i]) != "@udt/"[i]) {
+            pdebug(DEBUG_INFO, "Tag is not a UDT template request.");
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    if(str_to_int(name + str_length("@udt/"), &template_id) != 0 || template_id < 0 || template_id > AB_UDT_TYPE_ID_MASK) {
+        pdebug(DEBUG_WARN, "Template ID in %s is not valid!", name);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag->udt_template = 1;
+    tag->udt_id = (uint16_t)template_id;
+    tag->udt_fetch_id = (uint16_t)template_id;
+    tag->elem_type = AB_TYPE_UDT_TEMPLATE;
+    tag->elem_count = 1;  /* place holder */
+    tag->elem_size = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
@@ -45,6 +45,7 @@ extern struct tag_vtable_t eip_cip_vtable;
 
 /* tag listing helpers */
 extern int setup_tag_listing(ab_tag_p tag, const char *name);
+extern int setup_udt_template(ab_tag_p tag, const char *name);
 
 
 #endif
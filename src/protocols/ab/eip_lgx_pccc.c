@@ -114,7 +114,10 @@ struct tag_vtable_t lgx_pccc_vtable = {
     ab_set_float64,
 
     ab_get_float32,
-    ab_set_float32
+    ab_set_float32,
+
+    /* structure members */
+    NULL
 };
 
 static int check_read_status(ab_tag_p tag);
@@ -95,7 +95,10 @@ struct tag_vtable_t eip_plc5_dhp_vtable = {
     ab_set_float64,
 
     ab_get_float32,
-    ab_set_float32
+    ab_set_float32,
+
+    /* structure members */
+    NULL
 };
 
 
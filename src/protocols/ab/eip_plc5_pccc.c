@@ -90,7 +90,10 @@ struct tag_vtable_t plc5_vtable = {
     ab_set_float64,
 
     ab_get_float32,
-    ab_set_float32
+    ab_set_float32,
+
+    /* structure members */
+    NULL
 };
 
 
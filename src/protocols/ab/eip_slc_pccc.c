@@ -89,7 +89,10 @@ struct tag_vtable_t slc_vtable = {
     ab_set_float64,
 
     ab_get_float32,
-    ab_set_float32
+    ab_set_float32,
+
+    /* structure members */
+    NULL
 };
 
 
@@ -38,12 +38,18 @@
 #include <ab/error_codes.h>
 #include <ab/session.h>
 #include <util/debug.h>
+#include <util/hash.h>
 #include <inttypes.h>
+#include <ctype.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
-#define MAX_REQUESTS (200)
+#define MAX_REQUESTS (SESSION_MAX_BUNDLED_REQUESTS)
+
+/* bytes of a merged read response that are not data: reply header, type info and packed offset. */
+#define MERGED_READ_OVERHEAD (10)
 
 #define EIP_CIP_PREFIX_SIZE (44) /* bytes of encap header and CFP connected header */
 
@@ -67,40 +73,99 @@
 
 #define SESSION_DISCONNECT_TIMEOUT (5000)
 
+/*
+ * The metadata file starts with a magic string and a format version.  Each
+ * record after that is a 32-bit payload length, a 32-bit hash of the
+ * payload and the payload.  Records with a bad hash are skipped.  Change
+ * the version if the payload layout changes.
+ */
+#define METADATA_FILE_MAGIC "LPTGMETA"
+#define METADATA_FILE_MAGIC_SIZE (8)
+#define METADATA_FILE_VERSION (1)
+#define METADATA_MAX_RECORD_SIZE (2048)
+
+/* program name, a dot and a symbol name, with plenty of room. */
+#define MAX_SYMBOL_INSTANCE_NAME (256)
+
+/*
+ * Limits for the shared session pool.  A pool thread waits at most
+ * SESSION_POOL_MAX_WAIT_MS before checking session timers and steps
+ * one session at most SESSION_POOL_MAX_STEPS times before moving on.
+ */
+#define SESSION_POOL_MAX_WAIT_MS (1000)
+#define SESSION_POOL_MAX_READY (4)
+#define SESSION_POOL_MAX_STEPS (16)
+
 
 
 static ab_session_p session_create_unsafe(const char *host, int gw_port, const char *path, plc_type_t plc_type, int use_connected_msg);
-static int session_init(ab_session_p session);
+static int session_init(ab_session_p session, int pool_threads);
 //static int get_plc_type(attr attribs);
 static int add_session_unsafe(ab_session_p n);
 static int remove_session_unsafe(ab_session_p n);
 static ab_session_p find_session_by_host_unsafe(const char *gateway, const char *path);
 static int session_match_valid(const char *host, const char *path, ab_session_p session);
 static int session_add_request_unsafe(ab_session_p sess, ab_request_p req);
-static int session_open_socket(ab_session_p session);
+static int session_open_socket(ab_session_p session, int *wait_events, int *wait_ms);
 static void session_destroy(void *session);
-static int session_register(ab_session_p session);
+static void shared_read_destroy(void *shared_arg);
+static int64_t tag_metadata_key(uint8_t *encoded_name, int encoded_name_size);
+static struct ab_tag_metadata_t *find_tag_metadata_unsafe(ab_session_p session, uint8_t *encoded_name, int encoded_name_size);
+static int put_tag_metadata_unsafe(ab_session_p session, uint8_t *encoded_name, int encoded_name_size, int elem_size, uint8_t *type_info, int type_info_size, int *changed);
+static int session_use_metadata_file(ab_session_p session, const char *file_name);
+static int load_metadata_file_unsafe(ab_session_p session);
+static void queue_metadata_record_unsafe(ab_session_p session, struct ab_tag_metadata_t *entry);
+static void write_metadata_records(ab_session_p session, uint8_t *records, int records_size);
+static int put_record_field(uint8_t *buf, int *offset, const void *field, int field_size);
+static int get_record_field(uint8_t *buf, int buf_size, int *offset, uint8_t **field, int *field_size);
+static int symbol_instance_name(char *buf, const char *prefix, int prefix_len, const char *name, int name_len);
+static struct ab_symbol_instance_t *find_symbol_instance_unsafe(ab_session_p session, const char *name, int name_len);
+static int session_register(ab_session_p session, int *wait_events, int *wait_ms);
 static int session_close_socket(ab_session_p session);
 static int session_unregister(ab_session_p session);
 static THREAD_FUNC(session_handler);
+static void session_step(ab_session_p session, int *wait_events, int *wait_ms);
+static int session_pool_add(ab_session_p session, int num_threads);
+static void session_pool_remove(ab_session_p session);
+static int session_pool_start_unsafe(int num_threads);
+static void session_pool_stop(void);
+static THREAD_FUNC(session_pool_handler);
+static ab_session_p session_pool_claim_unsafe(void *context);
+static void session_pool_run(ab_session_p session);
+static void session_pool_release(ab_session_p session, int64_t next_step_time);
+static void session_pool_run_timers(void);
 static int purge_aborted_requests_unsafe(ab_session_p session);
-static int process_requests(ab_session_p session);
+static int process_requests(ab_session_p session, int *wait_events, int *wait_ms);
+static int get_packet_requests(ab_session_p session, struct ab_packet_in_flight_t *packet);
+static ab_request_p merge_element_reads_unsafe(ab_session_p session, int remaining_space);
+static int get_element_read(ab_request_p request, int *prefix_size, uint32_t *elem_index);
+static int start_packet(ab_session_p session, struct ab_packet_in_flight_t *packet);
+static int handle_response(ab_session_p session);
+static int unpack_packet(ab_session_p session, struct ab_packet_in_flight_t *packet);
+static void fail_packet(struct ab_packet_in_flight_t *packet, int status);
+static void fail_request(ab_request_p request, int status);
+static void fail_packets_in_flight(ab_session_p session, int status);
+static void session_reset_io(ab_session_p session, int status);
 //static int check_packing(ab_session_p session, ab_request_p request);
 static int get_payload_size(ab_request_p request);
 static int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests);
 static int prepare_request(ab_session_p session);
-static int send_eip_request(ab_session_p session, int timeout);
-static int recv_eip_response(ab_session_p session, int timeout);
+static int send_eip_data(ab_session_p session);
+static int recv_eip_data(ab_session_p session);
+static int session_setup_exchange(ab_session_p session, int timeout, int *wait_events, int *wait_ms);
 static int unpack_response(ab_session_p session, ab_request_p request, int sub_packet);
-static int perform_forward_open(ab_session_p session);
-static int perform_forward_close(ab_session_p session);
-static int try_forward_open_ex(ab_session_p session, int *max_payload_size_guess);
-static int try_forward_open(ab_session_p session);
-static int send_forward_open_req(ab_session_p session);
-static int send_forward_open_req_ex(ab_session_p session);
-static int recv_forward_open_resp(ab_session_p session, int *max_payload_size_guess);
-static int send_forward_close_req(ab_session_p session);
-static int recv_forward_close_resp(ab_session_p session);
+static int unpack_merged_response(ab_session_p session, ab_request_p merged, int sub_packet);
+static int set_merged_response(ab_request_p request, uint8_t *header, int header_size, uint8_t *elem_data, int elem_size);
+static void requeue_merged_requests(ab_session_p session, ab_request_p merged);
+static void start_forward_open(ab_session_p session);
+static int perform_forward_open(ab_session_p session, int *wait_events, int *wait_ms);
+static int perform_forward_close(ab_session_p session, int *wait_events, int *wait_ms);
+static void build_forward_open_req(ab_session_p session);
+static void build_forward_open_req_ex(ab_session_p session);
+static int check_forward_open_resp(ab_session_p session, int *max_payload_size_guess);
+static void build_forward_close_req(ab_session_p session);
+static int check_forward_close_resp(ab_session_p session);
+static int request_create(int tag_id, int request_capacity, ab_request_p *req);
 static void request_destroy(void *req_arg);
 static int session_request_increase_buffer(ab_request_p request, int new_capacity);
 
@@ -108,6 +173,15 @@ static int session_request_increase_buffer(ab_request_p request, int new_capacit
 static volatile mutex_p session_mutex = NULL;
 static volatile vector_p sessions = NULL;
 
+/* the shared session pool, started when the first session asks for it. */
+static volatile mutex_p session_pool_mutex = NULL;
+static vector_p session_pool = NULL;
+static sock_set_p session_pool_socks = NULL;
+static thread_p session_pool_threads[SESSION_POOL_MAX_THREADS];
+static int session_pool_num_threads = 0;
+static volatile int session_pool_terminating = 0;
+static int64_t session_pool_next_timer = INT64_MAX;
+
 
 
 
@@ -125,6 +199,11 @@ int session_startup()
         return PLCTAG_ERR_NO_MEM;
     }
 
+    if((rc = mutex_create((mutex_p *)&session_pool_mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create session pool mutex %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
     return rc;
 }
 
@@ -143,6 +222,13 @@ void session_teardown()
         sessions = NULL;
     }
 
+    /* the sessions are gone, so the pool threads can go too. */
+    session_pool_stop();
+
+    if(session_pool_mutex) {
+        mutex_destroy((mutex_p *)&session_pool_mutex);
+        session_pool_mutex = NULL;
+    }
 
     if(session_mutex) {
         mutex_destroy((mutex_p *)&session_mutex);
@@ -222,9 +308,22 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
     int rc = PLCTAG_STATUS_OK;
     int auto_disconnect_enabled = 0;
     int auto_disconnect_timeout_ms = INT_MAX;
+    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 1);
+    int use_pool = attr_get_int(attribs, "session_pool", 0);
+    int pool_threads = attr_get_int(attribs, "session_pool_threads", SESSION_POOL_DEFAULT_THREADS);
 
     pdebug(DEBUG_DETAIL, "Starting");
 
+    if(max_requests_in_flight < 1 || max_requests_in_flight > SESSION_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "Number of requests in flight must be between 1 and %d, not %d!", SESSION_MAX_REQUESTS_IN_FLIGHT, max_requests_in_flight);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(pool_threads < 1 || pool_threads > SESSION_POOL_MAX_THREADS) {
+        pdebug(DEBUG_WARN, "Number of session pool threads must be between 1 and %d, not %d!", SESSION_POOL_MAX_THREADS, pool_threads);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
     auto_disconnect_timeout_ms = attr_get_int(attribs, "auto_disconnect_ms", INT_MAX);
     if(auto_disconnect_timeout_ms != INT_MAX) {
         pdebug(DEBUG_DETAIL, "Setting auto-disconnect after %dms.", auto_disconnect_timeout_ms);
@@ -256,6 +355,8 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
             } else {
                 session->auto_disconnect_enabled = auto_disconnect_enabled;
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+                session->max_requests_in_flight = max_requests_in_flight;
+                session->use_pool = (use_pool ? 1 : 0);
 
                 new_session = 1;
             }
@@ -270,6 +371,11 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
             }
 
+            /* the pipeline window only goes up. */
+            if(session->max_requests_in_flight < max_requests_in_flight) {
+                session->max_requests_in_flight = max_requests_in_flight;
+            }
+
             pdebug(DEBUG_DETAIL, "Reusing existing session.");
         }
     }
@@ -280,7 +386,7 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
      */
 
     if(new_session) {
-        rc = session_init(session);
+        rc = session_init(session, pool_threads);
         if(rc != PLCTAG_STATUS_OK) {
             rc_dec(session);
             session = AB_SESSION_NULL;
@@ -290,6 +396,11 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
         }
     }
 
+    /* keep the type information of the tags between runs? */
+    if(session && attr_get_str(attribs, "metadata_cache_file", NULL)) {
+        session_use_metadata_file(session, attr_get_str(attribs, "metadata_cache_file", NULL));
+    }
+
     /* store it into the tag */
     *tag_session = session;
 
@@ -497,11 +608,43 @@ ab_session_p session_create_unsafe(const char *host, int gw_port, const char *pa
         return NULL;
     }
 
+    session->shared_reads = vector_create(SESSION_MIN_REQUESTS, SESSION_INC_REQUESTS);
+    if(!session->shared_reads) {
+        pdebug(DEBUG_WARN, "Unable to allocate vector for shared reads!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->tag_metadata = hashtable_create(SESSION_MIN_REQUESTS);
+    if(!session->tag_metadata) {
+        pdebug(DEBUG_WARN, "Unable to allocate tag metadata table!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->symbol_instances = hashtable_create(SESSION_MIN_REQUESTS);
+    if(!session->symbol_instances) {
+        pdebug(DEBUG_WARN, "Unable to allocate symbol instance table!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->udt_templates = hashtable_create(SESSION_MIN_REQUESTS);
+    if(!session->udt_templates) {
+        pdebug(DEBUG_WARN, "Unable to allocate UDT template table!");
+        rc_dec(session);
+        return NULL;
+    }
+
     session->plc_type = plc_type;
     session->data_capacity = MAX_PACKET_SIZE_EX;
     session->use_connected_msg = use_connected_msg;
     session->failed = 0;
     session->conn_serial_number = (uint16_t)(intptr_t)(session);
+    session->state = SESSION_OPEN_SOCKET;
+    session->io_state = SESSION_IO_NONE;
+    session->auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+    session->pool_lock = LOCK_INIT;
 
     /* check for ID set up. This does not need to be thread safe since we just need a random value. */
     if(connection_id == 0) {
@@ -567,8 +710,12 @@ ab_session_p session_create_unsafe(const char *host, int gw_port, const char *pa
  *
  * This calls several blocking methods and so must not keep the main mutex
  * locked during them.
+ *
+ * The session either gets its own handler thread or is handed to the
+ * shared session pool, starting the pool with the passed number of
+ * threads if needed.
  */
-int session_init(ab_session_p session)
+int session_init(ab_session_p session, int pool_threads)
 {
     int rc = PLCTAG_STATUS_OK;
 
@@ -580,7 +727,23 @@ int session_init(ab_session_p session)
         return rc;
     }
 
-    if((rc = thread_create((thread_p *)&(session->handler_thread), session_handler, 32*1024, session)) != PLCTAG_STATUS_OK) {
+    /*
+     * The socket lives as long as the session so that the handler
+     * thread can always be woken up, even when disconnected.
+     */
+    if((rc = socket_create(&(session->sock))) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create session socket!");
+        session->failed = 1;
+        return rc;
+    }
+
+    if(session->use_pool) {
+        if((rc = session_pool_add(session, pool_threads)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add session to the session pool!");
+            session->failed = 1;
+            return rc;
+        }
+    } else if((rc = thread_create((thread_p *)&(session->handler_thread), session_handler, 32*1024, session)) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to create session thread!");
         session->failed = 1;
         return rc;
@@ -595,24 +758,43 @@ int session_init(ab_session_p session)
 /*
  * session_open_socket()
  *
- * Connect to the host/port passed via TCP.
+ * Connect to the host/port passed via TCP.  This does not block, it
+ * returns PLCTAG_STATUS_PENDING until the connection is up.  While the
+ * connection is in progress, the setup I/O state is "sending".
  */
 
-int session_open_socket(ab_session_p session)
+int session_open_socket(ab_session_p session, int *wait_events, int *wait_ms)
 {
     int rc = PLCTAG_STATUS_OK;
+    int64_t time_left = 0;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    if(session->setup_io_state == SESSION_IO_NONE) {
+        pdebug(DEBUG_INFO, "Starting.");
 
-    /* Open a socket for communication with the gateway. */
-    rc = socket_create(&(session->sock));
+        /* Open a connection to the gateway. */
+        rc = socket_connect_tcp_start(session->sock, session->host, AB_EIP_DEFAULT_PORT);
+        session->setup_timeout_time = time_ms() + SESSION_CONNECT_TIMEOUT;
+    } else {
+        rc = socket_connect_tcp_check(session->sock);
+    }
 
-    if (rc) {
-        pdebug(DEBUG_WARN, "Unable to create socket for session!");
-        return 0;
+    if(rc == PLCTAG_STATUS_PENDING) {
+        time_left = session->setup_timeout_time - time_ms();
+
+        if(time_left > 0) {
+            /* the socket is writable once the connection attempt is done. */
+            session->setup_io_state = SESSION_IO_SENDING;
+            *wait_events = SOCK_EVENT_CAN_WRITE;
+            *wait_ms = (int)time_left;
+
+            return rc;
+        }
+
+        pdebug(DEBUG_WARN, "Timed out connecting to the gateway!");
+        rc = PLCTAG_ERR_TIMEOUT;
     }
 
-    rc = socket_connect_tcp(session->sock, session->host, AB_EIP_DEFAULT_PORT);
+    session->setup_io_state = SESSION_IO_NONE;
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to connect socket for session!");
@@ -626,56 +808,54 @@ int session_open_socket(ab_session_p session)
 
 
 
-int session_register(ab_session_p session)
+/*
+ * session_register()
+ *
+ * Register the EIP session with the gateway.  This does not block, it
+ * returns PLCTAG_STATUS_PENDING until the response is in.
+ */
+
+int session_register(ab_session_p session, int *wait_events, int *wait_ms)
 {
     eip_session_reg_req *req;
     eip_encap *resp;
     int rc = PLCTAG_STATUS_OK;
 
-    pdebug(DEBUG_INFO, "Starting.");
-
-    /*
-     * clear the session data.
-     *
-     * We use the receiving buffer because we do not have a request and nothing can
-     * be coming in (we hope) on the socket yet.
-     */
-    mem_set(session->data, 0, sizeof(eip_session_reg_req));
+    if(session->setup_io_state == SESSION_IO_NONE) {
+        pdebug(DEBUG_INFO, "Starting.");
 
-    req = (eip_session_reg_req *)(session->data);
+        /*
+         * clear the session data.
+         *
+         * We use the receiving buffer because we do not have a request and nothing can
+         * be coming in (we hope) on the socket yet.
+         */
+        mem_set(session->data, 0, sizeof(eip_session_reg_req));
 
-    /* fill in the fields of the request */
-    req->encap_command = h2le16(AB_EIP_REGISTER_SESSION);
-    req->encap_length = h2le16(sizeof(eip_session_reg_req) - sizeof(eip_encap));
-    req->encap_session_handle = h2le32(session->session_handle);
-    req->encap_status = h2le32(0);
-    req->encap_sender_context = h2le64((uint64_t)0);
-    req->encap_options = h2le32(0);
+        req = (eip_session_reg_req *)(session->data);
 
-    req->eip_version = h2le16(AB_EIP_VERSION);
-    req->option_flags = h2le16(0);
+        /* fill in the fields of the request */
+        req->encap_command = h2le16(AB_EIP_REGISTER_SESSION);
+        req->encap_length = h2le16(sizeof(eip_session_reg_req) - sizeof(eip_encap));
+        req->encap_session_handle = h2le32(session->session_handle);
+        req->encap_status = h2le32(0);
+        req->encap_sender_context = h2le64((uint64_t)0);
+        req->encap_options = h2le32(0);
 
-    /*
-     * socket ops here are _ASYNCHRONOUS_!
-     *
-     * This is done this way because we do not have everything
-     * set up for a request to be handled by the thread.  I think.
-     */
+        req->eip_version = h2le16(AB_EIP_VERSION);
+        req->option_flags = h2le16(0);
 
-    /* send registration to the gateway */
-    session->data_size = sizeof(eip_session_reg_req);
-    session->data_offset = 0;
+        session->data_size = sizeof(eip_session_reg_req);
+    }
 
-    rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Error sending session registration request %s!", plc_tag_decode_error(rc));
+    /* send registration to the gateway and get the response. */
+    rc = session_setup_exchange(session, SESSION_DEFAULT_TIMEOUT, wait_events, wait_ms);
+    if(rc == PLCTAG_STATUS_PENDING) {
         return rc;
     }
 
-    /* get the response from the gateway */
-    rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT);
     if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Error receiving session registration response %s!", plc_tag_decode_error(rc));
+        pdebug(DEBUG_WARN, "Error exchanging session registration %s!", plc_tag_decode_error(rc));
         return rc;
     }
 
@@ -726,8 +906,6 @@ int session_close_socket(ab_session_p session)
 
     if (session->sock) {
         socket_close(session->sock);
-        socket_destroy(&(session->sock));
-        session->sock = NULL;
     }
 
     pdebug(DEBUG_INFO, "Done.");
@@ -740,6 +918,7 @@ int session_close_socket(ab_session_p session)
 void session_destroy(void *session_arg)
 {
     ab_session_p session = session_arg;
+    int io_busy = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -757,6 +936,11 @@ void session_destroy(void *session_arg)
     /* terminate the session thread first. */
     session->terminating = 1;
 
+    /* make sure the thread is not waiting for something to happen. */
+    if(session->sock) {
+        socket_wake(session->sock);
+    }
+
     /* get rid of the handler thread. */
     if (session->handler_thread) {
         /* this cannot be guarded by the mutex since the session thread also locks it. */
@@ -769,19 +953,31 @@ void session_destroy(void *session_arg)
         }
     }
 
+    /* or make sure no pool thread is using the session. */
+    if(session->use_pool) {
+        session_pool_remove(session);
+    }
+
 
     /* this needs to be handled in the mutex to prevent double frees due to queued requests. */
     critical_block(session->mutex) {
-        /* close off the connection if is one. This helps the PLC clean up. */
-        if (session->targ_connection_id) {
-            /*
-             * we do not want the internal loop to immediately
-             * return, so set the flag like we are not terminating.
-             * There is still a timeout that applies.
-             */
-            session->terminating = 0;
-            perform_forward_close(session);
-            session->terminating = 1;
+        /* release any requests that were being sent or were sent but not answered. */
+        io_busy = (session->io_state != SESSION_IO_NONE || session->setup_io_state != SESSION_IO_NONE);
+        session_reset_io(session, PLCTAG_ERR_ABORT);
+
+        /*
+         * close off the connection if is one. This helps the PLC clean up.
+         * If we stopped part way through a packet, the connection is not
+         * usable for that.
+         */
+        if (session->targ_connection_id && !io_busy) {
+            int wait_events = SOCK_EVENT_NONE;
+            int wait_ms = 0;
+
+            /* nothing else runs the session now, so wait here.  The timeout is short. */
+            while(perform_forward_close(session, &wait_events, &wait_ms) == PLCTAG_STATUS_PENDING) {
+                socket_wait_event(session->sock, wait_events, wait_ms);
+            }
         }
 
         /* try to be nice and un-register the session */
@@ -791,6 +987,8 @@ void session_destroy(void *session_arg)
 
         if (session->sock) {
             session_close_socket(session);
+            socket_destroy(&(session->sock));
+            session->sock = NULL;
         }
 
         /* release all the requests that are in the queue. */
@@ -802,6 +1000,57 @@ void session_destroy(void *session_arg)
             vector_destroy(session->requests);
             session->requests = NULL;
         }
+
+        /* the tags hold the shared reads and the tags are all gone. */
+        if(session->shared_reads) {
+            vector_destroy(session->shared_reads);
+            session->shared_reads = NULL;
+        }
+
+        if(session->tag_metadata) {
+            for(int i=0; i < hashtable_capacity(session->tag_metadata); i++) {
+                struct ab_tag_metadata_t *entry = hashtable_get_index(session->tag_metadata, i);
+
+                while(entry) {
+                    struct ab_tag_metadata_t *next = entry->next;
+
+                    mem_free(entry);
+                    entry = next;
+                }
+            }
+
+            hashtable_destroy(session->tag_metadata);
+            session->tag_metadata = NULL;
+        }
+
+        if(session->symbol_instances) {
+            for(int i=0; i < hashtable_capacity(session->symbol_instances); i++) {
+                struct ab_symbol_instance_t *entry = hashtable_get_index(session->symbol_instances, i);
+
+                while(entry) {
+                    struct ab_symbol_instance_t *next = entry->next;
+
+                    mem_free(entry);
+                    entry = next;
+                }
+            }
+
+            hashtable_destroy(session->symbol_instances);
+            session->symbol_instances = NULL;
+        }
+
+        if(session->udt_templates) {
+            for(int i=0; i < hashtable_capacity(session->udt_templates); i++) {
+                struct ab_udt_template_t *entry = hashtable_get_index(session->udt_templates, i);
+
+                if(entry) {
+                    mem_free(entry);
+                }
+            }
+
+            hashtable_destroy(session->udt_templates);
+            session->udt_templates = NULL;
+        }
     }
 
     /* we are done with the mutex, finally destroy it. */
@@ -820,6 +1069,17 @@ void session_destroy(void *session_arg)
         session->path = NULL;
     }
 
+    /* the session thread is gone, write anything it did not get to. */
+    write_metadata_records(session, session->metadata_pending, session->metadata_pending_size);
+    session->metadata_pending = NULL;
+    session->metadata_pending_size = 0;
+    session->metadata_pending_capacity = 0;
+
+    if(session->metadata_file) {
+        mem_free(session->metadata_file);
+        session->metadata_file = NULL;
+    }
+
     if(session->host) {
         mem_free(session->host);
         session->host = NULL;
@@ -883,6 +1143,11 @@ int session_add_request(ab_session_p sess, ab_request_p req)
         rc = session_add_request_unsafe(sess, req);
     }
 
+    /* get the handler thread to send it right away. */
+    if(rc == PLCTAG_STATUS_OK) {
+        socket_wake(sess->sock);
+    }
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return rc;
@@ -890,492 +1155,2403 @@ int session_add_request(ab_session_p sess, ab_request_p req)
 
 
 /*
- * session_remove_request_unsafe
+ * session_get_tag_metadata
  *
- * You must hold the mutex before calling this!
+ * Look up the type information an earlier tag with the same encoded name
+ * found.  The type_info buffer must be able to hold the size passed in
+ * type_info_size.  Returns PLCTAG_ERR_NOT_FOUND if there is none.
  */
-int session_remove_request_unsafe(ab_session_p session, ab_request_p req)
+int session_get_tag_metadata(ab_session_p session, uint8_t *encoded_name, int encoded_name_size, int *elem_size, uint8_t *type_info, int *type_info_size)
 {
-    int rc = PLCTAG_STATUS_OK;
-//    ab_request_p cur, prev;
+    int rc = PLCTAG_ERR_NOT_FOUND;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    pdebug(DEBUG_SPEW, "Starting.");
 
-    if(session == NULL || req == NULL) {
-        return rc;
-    }
+    critical_block(session->mutex) {
+        struct ab_tag_metadata_t *entry = find_tag_metadata_unsafe(session, encoded_name, encoded_name_size);
 
-    for(int i=0; i < vector_length(session->requests); i++) {
-        if(vector_get(session->requests, i) == req) {
-            vector_remove(session->requests, i);
+        if(!entry || entry->type_info_size > *type_info_size) {
             break;
         }
-    }
 
-    /* release the request refcount */
-    rc_dec(req);
+        *elem_size = entry->elem_size;
+        mem_copy(type_info, entry->type_info, entry->type_info_size);
+        *type_info_size = entry->type_info_size;
 
-    pdebug(DEBUG_DETAIL, "Done.");
+        rc = PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
 }
 
 
 
-/*****************************************************************
- **************** Session handling functions *********************
- ****************************************************************/
+/*
+ * session_put_tag_metadata
+ *
+ * Remember the type information of a tag for later tags with the same
+ * name.  An existing entry is replaced.  New information is also queued
+ * for the metadata file if the session has one.  The session thread
+ * writes the queued records.
+ */
+int session_put_tag_metadata(ab_session_p session, uint8_t *encoded_name, int encoded_name_size, int elem_size, uint8_t *type_info, int type_info_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int changed = 0;
 
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-typedef enum { SESSION_OPEN_SOCKET, SESSION_REGISTER, SESSION_CONNECT,
-               SESSION_IDLE, SESSION_DISCONNECT, SESSION_UNREGISTER,
-               SESSION_CLOSE_SOCKET, SESSION_START_RETRY, SESSION_WAIT_RETRY,
-               SESSION_WAIT_RECONNECT
-             } session_state_t;
+    if(encoded_name_size <= 0 || elem_size <= 0 || type_info_size <= 0) {
+        pdebug(DEBUG_DETAIL, "Nothing to remember.");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
 
+    critical_block(session->mutex) {
+        rc = put_tag_metadata_unsafe(session, encoded_name, encoded_name_size, elem_size, type_info, type_info_size, &changed);
 
-THREAD_FUNC(session_handler)
-{
-    ab_session_p session = arg;
-    int rc = PLCTAG_STATUS_OK;
-    session_state_t state = SESSION_OPEN_SOCKET;
-    int64_t timeout_time = 0;
-    int64_t auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
-    int auto_disconnect = 0;
+        if(rc == PLCTAG_STATUS_OK && changed && session->metadata_file) {
+            queue_metadata_record_unsafe(session, find_tag_metadata_unsafe(session, encoded_name, encoded_name_size));
+        }
+    }
 
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    pdebug(DEBUG_INFO, "Starting thread for session %p", session);
+    return rc;
+}
 
-    while(!session->terminating) {
-        int idle = 0;
 
-        /*
-         * Do this on every cycle.   This keeps the queue clean(ish).
-         *
-         * Make sure we get rid of all the aborted requests queued.
-         * This keeps the overall memory usage lower.
-         */
 
-        pdebug(DEBUG_SPEW,"Critical block.");
-        critical_block(session->mutex) {
-            purge_aborted_requests_unsafe(session);
+/* You must hold the session mutex before calling this! */
+int put_tag_metadata_unsafe(ab_session_p session, uint8_t *encoded_name, int encoded_name_size, int elem_size, uint8_t *type_info, int type_info_size, int *changed)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t key = tag_metadata_key(encoded_name, encoded_name_size);
+    struct ab_tag_metadata_t *head = hashtable_get(session->tag_metadata, key);
+    struct ab_tag_metadata_t *entry = find_tag_metadata_unsafe(session, encoded_name, encoded_name_size);
+
+    *changed = 0;
+
+    if(entry) {
+        if(entry->type_info_size == type_info_size) {
+            if(entry->elem_size != elem_size || mem_cmp(entry->type_info, entry->type_info_size, type_info, type_info_size) != 0) {
+                entry->elem_size = elem_size;
+                mem_copy(entry->type_info, type_info, type_info_size);
+                *changed = 1;
+            }
+
+            return PLCTAG_STATUS_OK;
         }
 
-        switch(state) {
-        case SESSION_OPEN_SOCKET:
-            pdebug(DEBUG_DETAIL, "in SESSION_OPEN_SOCKET state.");
+        /* the type changed size, drop the old entry. */
+        pdebug(DEBUG_DETAIL, "Tag type changed size, replacing the entry.");
 
-            /* we must connect to the gateway*/
-            if ((rc = session_open_socket(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "session connect failed %s!", plc_tag_decode_error(rc));
-                state = SESSION_CLOSE_SOCKET;
-            } else {
-                /* set the timeout for disconnect. */
-                //if(session->auto_disconnect_enabled) {
-                auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
-                //}
+        if(head == entry) {
+            head = entry->next;
+        } else {
+            struct ab_tag_metadata_t *prev = head;
 
-                state = SESSION_REGISTER;
+            while(prev->next != entry) {
+                prev = prev->next;
             }
-            break;
 
-        case SESSION_REGISTER:
-            pdebug(DEBUG_DETAIL, "in SESSION_REGISTER state.");
+            prev->next = entry->next;
+        }
 
-            if ((rc = session_register(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "session registration failed %s!", plc_tag_decode_error(rc));
-                state = SESSION_CLOSE_SOCKET;
-            } else {
-                if(session->use_connected_msg) {
-                    state = SESSION_CONNECT;
-                } else {
-                    state = SESSION_IDLE;
-                }
-            }
-            break;
+        mem_free(entry);
 
-        case SESSION_CONNECT:
-            pdebug(DEBUG_DETAIL, "in SESSION_CONNECT state.");
+        /* the chain head is put back below. */
+        hashtable_remove(session->tag_metadata, key);
+        if(head) {
+            hashtable_put(session->tag_metadata, key, head);
+        }
+    }
 
-            if((rc = perform_forward_open(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Forward open failed %s!", plc_tag_decode_error(rc));
-                state = SESSION_UNREGISTER;
-            } else {
-                pdebug(DEBUG_DETAIL, "forward open succeeded, going to idle state.");
-                state = SESSION_IDLE;
-            }
-            break;
+    entry = (struct ab_tag_metadata_t *)mem_alloc((int)sizeof(*entry) + encoded_name_size + type_info_size);
+    if(!entry) {
+        pdebug(DEBUG_WARN, "Unable to allocate tag metadata entry!");
+        return PLCTAG_ERR_NO_MEM;
+    }
 
-        case SESSION_IDLE:
-            pdebug(DEBUG_SPEW, "in SESSION_IDLE state.");
+    entry->encoded_name = (uint8_t *)(entry + 1);
+    entry->encoded_name_size = encoded_name_size;
+    mem_copy(entry->encoded_name, encoded_name, encoded_name_size);
 
-            idle = 1;
+    entry->type_info = entry->encoded_name + encoded_name_size;
+    entry->type_info_size = type_info_size;
+    mem_copy(entry->type_info, type_info, type_info_size);
 
-            /* if there is work to do, make sure we do not disconnect. */
-            pdebug(DEBUG_SPEW,"Critical block.");
-            critical_block(session->mutex) {
-                if(vector_length(session->requests) > 0) {
-                    auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
-                }
-            }
+    entry->elem_size = elem_size;
 
-            if((rc = process_requests(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error while processing requests %s!", plc_tag_decode_error(rc));
-                idle = 0;
-                if(session->use_connected_msg) {
-                    state = SESSION_DISCONNECT;
-                } else {
-                    state = SESSION_UNREGISTER;
-                }
-            }
+    /* put the new entry at the head of the chain. */
+    if(head) {
+        hashtable_remove(session->tag_metadata, key);
+    }
 
-            /* check if we should disconnect */
-            //if(session->auto_disconnect_enabled) {
-            if(auto_disconnect_time < time_ms()) {
-                pdebug(DEBUG_DETAIL, "Disconnecting due to inactivity.");
+    entry->next = head;
 
-                auto_disconnect = 1;
-                idle = 0;
+    rc = hashtable_put(session->tag_metadata, key, entry);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to add tag metadata entry!");
 
-                if(session->use_connected_msg) {
-                    state = SESSION_DISCONNECT;
-                } else {
-                    state = SESSION_UNREGISTER;
-                }
-            }
-            //}
+        /* put back what was there. */
+        if(head) {
+            hashtable_put(session->tag_metadata, key, head);
+        }
 
-            break;
+        mem_free(entry);
+        return rc;
+    }
 
-        case SESSION_DISCONNECT:
-            pdebug(DEBUG_DETAIL, "in SESSION_DISCONNECT state.");
+    *changed = 1;
 
-            if((rc = perform_forward_close(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Forward close failed %s!", plc_tag_decode_error(rc));
-            }
+    return PLCTAG_STATUS_OK;
+}
 
-            state = SESSION_UNREGISTER;
-            break;
 
-        case SESSION_UNREGISTER:
-            pdebug(DEBUG_DETAIL, "in SESSION_UNREGISTER state.");
 
-            if((rc = session_unregister(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unregistering session failed %s!", plc_tag_decode_error(rc));
-            }
+/*
+ * session_get_symbol_instance
+ *
+ * Look up the Symbol Object instance ID a tag listing found for the
+ * symbol.  Program symbols are named "Program:name.symbol".  The match
+ * ignores case like the PLC does.  Returns PLCTAG_ERR_NOT_FOUND if no
+ * listing found the symbol.
+ */
+int session_get_symbol_instance(ab_session_p session, const char *name, int name_len, uint32_t *instance_id)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+    char key_name[MAX_SYMBOL_INSTANCE_NAME];
+    int key_len = symbol_instance_name(key_name, NULL, 0, name, name_len);
 
-            state = SESSION_CLOSE_SOCKET;
-            break;
+    pdebug(DEBUG_SPEW, "Starting.");
 
-        case SESSION_CLOSE_SOCKET:
-            pdebug(DEBUG_DETAIL, "in SESSION_CLOSE_SOCKET state.");
+    if(key_len < 0) {
+        return key_len;
+    }
 
-            if((rc = session_close_socket(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Closing session socket failed %s!", plc_tag_decode_error(rc));
-            }
+    critical_block(session->mutex) {
+        struct ab_symbol_instance_t *entry = find_symbol_instance_unsafe(session, key_name, key_len);
 
-            if(auto_disconnect) {
-                state = SESSION_WAIT_RECONNECT;
-            } else {
-                state = SESSION_START_RETRY;
-            }
+        if(entry) {
+            *instance_id = entry->instance_id;
+            rc = PLCTAG_STATUS_OK;
+        }
+    }
 
-            break;
+    pdebug(DEBUG_SPEW, "Done.");
 
-        case SESSION_START_RETRY:
-            pdebug(DEBUG_DETAIL, "in SESSION_START_RETRY state.");
+    return rc;
+}
 
-            /* set up timer for retry. */
-            idle = 0;
 
-            /* FIXME - make this a tag attribute. */
-            timeout_time = time_ms() + RETRY_WAIT_MS;
 
-            /* start waiting. */
-            state = SESSION_WAIT_RETRY;
+/*
+ * session_put_symbol_instance
+ *
+ * Remember the instance ID of a symbol found by a tag listing.  The prefix
+ * is the program name for program tag listings and empty for controller
+ * tag listings.  An existing entry is updated.
+ */
+int session_put_symbol_instance(ab_session_p session, const char *prefix, int prefix_len, const char *name, int name_len, uint32_t instance_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    char key_name[MAX_SYMBOL_INSTANCE_NAME];
+    int key_len = symbol_instance_name(key_name, prefix, prefix_len, name, name_len);
 
-            break;
+    pdebug(DEBUG_SPEW, "Starting.");
 
-        case SESSION_WAIT_RETRY:
-            pdebug(DEBUG_SPEW, "in SESSION_WAIT_RETRY state.");
+    if(key_len < 0) {
+        pdebug(DEBUG_DETAIL, "Symbol name is too long to remember.");
+        return key_len;
+    }
 
-            /* make us sleep on each iteration. */
-            idle = 1;
+    critical_block(session->mutex) {
+        int64_t key = (int64_t)hash((uint8_t *)key_name, (size_t)key_len, 0);
+        struct ab_symbol_instance_t *head = hashtable_get(session->symbol_instances, key);
+        struct ab_symbol_instance_t *entry = find_symbol_instance_unsafe(session, key_name, key_len);
 
-            if(timeout_time < time_ms()) {
-                pdebug(DEBUG_DETAIL, "Transitioning to SESSION_OPEN_SOCKET.");
-                state = SESSION_OPEN_SOCKET;
-            }
+        if(entry) {
+            entry->instance_id = instance_id;
+            break;
+        }
 
+        entry = (struct ab_symbol_instance_t *)mem_alloc((int)sizeof(*entry) + key_len);
+        if(!entry) {
+            pdebug(DEBUG_WARN, "Unable to allocate symbol instance entry!");
+            rc = PLCTAG_ERR_NO_MEM;
             break;
+        }
 
-        case SESSION_WAIT_RECONNECT:
-            /* wait for at least one request to queue before reconnecting. */
-            pdebug(DEBUG_SPEW, "in SESSION_WAIT_RECONNECT state.");
+        entry->instance_id = instance_id;
+        entry->name = (char *)(entry + 1);
+        entry->name_len = key_len;
+        mem_copy(entry->name, key_name, key_len);
 
-            idle = 1;
-            auto_disconnect = 0;
+        /* put the new entry at the head of the chain. */
+        if(head) {
+            hashtable_remove(session->symbol_instances, key);
+        }
 
-            /* if there is work to do, reconnect.. */
-            pdebug(DEBUG_DETAIL,"Critical block.");
-            critical_block(session->mutex) {
-                if(vector_length(session->requests) > 0) {
-                    pdebug(DEBUG_DETAIL, "There are requests waiting, reopening connection to PLC.");
+        entry->next = head;
 
-                    idle = 0;
-                    state = SESSION_OPEN_SOCKET;
-                }
+        rc = hashtable_put(session->symbol_instances, key, entry);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add symbol instance entry!");
+
+            /* put back what was there. */
+            if(head) {
+                hashtable_put(session->symbol_instances, key, head);
             }
 
+            mem_free(entry);
             break;
+        }
+    }
 
+    pdebug(DEBUG_SPEW, "Done.");
 
-        default:
-            pdebug(DEBUG_ERROR, "Unknown state %d!", state);
+    return rc;
+}
 
-            /* FIXME - this logic is not complete.  We might be here without
-             * a connected session or a registered session. */
-            if(session->use_connected_msg) {
-                state = SESSION_DISCONNECT;
-            } else {
-                state = SESSION_UNREGISTER;
-            }
 
-            break;
-        }
 
-        /*
-         * give up the CPU a bit, but only if we are not
-         * doing some linked states.
-         */
-        if(idle && !session->terminating) {
-            sleep_ms(1);
+/*
+ * session_get_udt_template
+ *
+ * Look up a decoded UDT template by its template instance ID.  Returns
+ * NULL if no @udt tag has read it yet.
+ */
+struct ab_udt_template_t *session_get_udt_template(ab_session_p session, uint16_t template_id)
+{
+    struct ab_udt_template_t *result = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    critical_block(session->mutex) {
+        result = hashtable_get(session->udt_templates, (int64_t)template_id);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return result;
+}
+
+
+
+/*
+ * session_find_udt_template
+ *
+ * Look up a decoded UDT template by the structure handle that a read
+ * returns in the type information.  Returns NULL if there is none.
+ */
+struct ab_udt_template_t *session_find_udt_template(ab_session_p session, uint16_t handle)
+{
+    struct ab_udt_template_t *result = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    critical_block(session->mutex) {
+        for(int i=0; i < hashtable_capacity(session->udt_templates); i++) {
+            struct ab_udt_template_t *entry = hashtable_get_index(session->udt_templates, i);
+
+            if(entry && entry->handle == handle) {
+                result = entry;
+                break;
+            }
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return result;
+}
+
+
+
+/*
+ * session_put_udt_template
+ *
+ * Hand a decoded template to the session.  The session owns it from here
+ * on.  If the template is already known, the new copy is freed and the
+ * existing one is kept so that pointers to it stay good.
+ */
+int session_put_udt_template(ab_session_p session, struct ab_udt_template_t *udt_template)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(session->mutex) {
+        if(hashtable_get(session->udt_templates, (int64_t)udt_template->id)) {
+            pdebug(DEBUG_DETAIL, "Template %u is already known.", (unsigned int)udt_template->id);
+            mem_free(udt_template);
+            break;
+        }
+
+        rc = hashtable_put(session->udt_templates, (int64_t)udt_template->id, udt_template);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add UDT template!");
+            mem_free(udt_template);
+            break;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/* build the lower case lookup name, "prefix.name" or just "name". */
+int symbol_instance_name(char *buf, const char *prefix, int prefix_len, const char *name, int name_len)
+{
+    int len = 0;
+
+    if(name_len <= 0 || prefix_len < 0 || prefix_len + 1 + name_len > MAX_SYMBOL_INSTANCE_NAME) {
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    for(int i=0; i < prefix_len; i++) {
+        buf[len++] = (char)tolower((unsigned char)prefix[i]);
+    }
+
+    if(prefix_len > 0) {
+        buf[len++] = '.';
+    }
+
+    for(int i=0; i < name_len; i++) {
+        buf[len++] = (char)tolower((unsigned char)name[i]);
+    }
+
+    return len;
+}
+
+
+
+/* You must hold the session mutex before calling this! */
+struct ab_symbol_instance_t *find_symbol_instance_unsafe(ab_session_p session, const char *name, int name_len)
+{
+    struct ab_symbol_instance_t *entry = hashtable_get(session->symbol_instances, (int64_t)hash((uint8_t *)name, (size_t)name_len, 0));
+
+    while(entry && mem_cmp(entry->name, entry->name_len, (void *)name, name_len) != 0) {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+
+
+/*
+ * session_use_metadata_file
+ *
+ * Load the type information saved for this session's gateway and path in
+ * the file and add anything new found later to it.  A session only uses
+ * the first file it is given.  Problems with the file are not fatal, the
+ * tags are just discovered the slow way.
+ */
+int session_use_metadata_file(ab_session_p session, const char *file_name)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(session->mutex) {
+        if(session->metadata_file) {
+            if(str_cmp(session->metadata_file, file_name) != 0) {
+                pdebug(DEBUG_WARN, "Session already uses metadata file %s, ignoring %s.", session->metadata_file, file_name);
+            }
+
+            break;
+        }
+
+        session->metadata_file = str_dup(file_name);
+        if(!session->metadata_file) {
+            pdebug(DEBUG_WARN, "Unable to copy metadata file name!");
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        rc = load_metadata_file_unsafe(session);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to use metadata file %s, error %s!", file_name, plc_tag_decode_error(rc));
+            mem_free(session->metadata_file);
+            session->metadata_file = NULL;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * load_metadata_file_unsafe
+ *
+ * Read all the records for this session from the metadata file.  If the
+ * file does not exist or is from a different version, start a new one.
+ *
+ * You must hold the session mutex before calling this!
+ */
+int load_metadata_file_unsafe(ab_session_p session)
+{
+    FILE *file = NULL;
+    uint8_t header[METADATA_FILE_MAGIC_SIZE + sizeof(uint32_t)];
+    uint8_t record[METADATA_MAX_RECORD_SIZE];
+    uint32_t version = 0;
+    const char *path = (session->path ? session->path : "");
+    int num_loaded = 0;
+
+    file = fopen(session->metadata_file, "rb");
+
+    if(file) {
+        if(fread(header, sizeof(header), 1, file) == 1) {
+            mem_copy(&version, header + METADATA_FILE_MAGIC_SIZE, (int)sizeof(version));
+        }
+
+        if(mem_cmp(header, METADATA_FILE_MAGIC_SIZE, METADATA_FILE_MAGIC, METADATA_FILE_MAGIC_SIZE) != 0 || version != METADATA_FILE_VERSION) {
+            pdebug(DEBUG_INFO, "Metadata file %s is not usable, starting a new one.", session->metadata_file);
+            fclose(file);
+            file = NULL;
+        }
+    }
+
+    /* start a new file. */
+    if(!file) {
+        version = METADATA_FILE_VERSION;
+
+        mem_copy(header, METADATA_FILE_MAGIC, METADATA_FILE_MAGIC_SIZE);
+        mem_copy(header + METADATA_FILE_MAGIC_SIZE, &version, (int)sizeof(version));
+
+        file = fopen(session->metadata_file, "wb");
+        if(!file) {
+            pdebug(DEBUG_WARN, "Unable to create metadata file %s!", session->metadata_file);
+            return PLCTAG_ERR_OPEN;
+        }
+
+        if(fwrite(header, sizeof(header), 1, file) != 1) {
+            pdebug(DEBUG_WARN, "Unable to write metadata file header!");
+            fclose(file);
+            return PLCTAG_ERR_WRITE;
+        }
+
+        fclose(file);
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* read the records. */
+    do {
+        uint32_t record_size = 0;
+        uint32_t record_hash = 0;
+        uint8_t *host = NULL, *rec_path = NULL, *name = NULL, *type_info = NULL, *elem_size_bytes = NULL;
+        int host_size = 0, path_size = 0, name_size = 0, type_info_size = 0, elem_size_size = 0;
+        int offset = 0;
+        int32_t elem_size = 0;
+        int changed = 0;
+
+        if(fread(&record_size, sizeof(record_size), 1, file) != 1 || fread(&record_hash, sizeof(record_hash), 1, file) != 1) {
+            break;
+        }
+
+        /* a damaged length means we cannot find the next record. */
+        if(record_size == 0 || record_size > METADATA_MAX_RECORD_SIZE) {
+            pdebug(DEBUG_WARN, "Bad record size %u in metadata file, ignoring the rest.", record_size);
+            break;
+        }
+
+        if(fread(record, record_size, 1, file) != 1) {
+            pdebug(DEBUG_DETAIL, "Partial record at the end of the metadata file.");
+            break;
+        }
+
+        if(hash(record, record_size, 0) != record_hash) {
+            pdebug(DEBUG_WARN, "Bad record hash in metadata file, skipping the record.");
+            continue;
+        }
+
+        if(get_record_field(record, (int)record_size, &offset, &host, &host_size) != PLCTAG_STATUS_OK
+           || get_record_field(record, (int)record_size, &offset, &rec_path, &path_size) != PLCTAG_STATUS_OK
+           || get_record_field(record, (int)record_size, &offset, &name, &name_size) != PLCTAG_STATUS_OK
+           || get_record_field(record, (int)record_size, &offset, &type_info, &type_info_size) != PLCTAG_STATUS_OK
+           || get_record_field(record, (int)record_size, &offset, &elem_size_bytes, &elem_size_size) != PLCTAG_STATUS_OK
+           || elem_size_size != (int)sizeof(elem_size)) {
+            pdebug(DEBUG_WARN, "Badly formed record in metadata file, skipping the record.");
+            continue;
+        }
+
+        /* only the records for our gateway and path. */
+        if(mem_cmp(host, host_size, session->host, str_length(session->host)) != 0
+           || mem_cmp(rec_path, path_size, (void *)path, str_length(path)) != 0) {
+            continue;
+        }
+
+        mem_copy(&elem_size, elem_size_bytes, (int)sizeof(elem_size));
+
+        /* the same checks as session_put_tag_metadata(). */
+        if(name_size <= 0 || elem_size <= 0 || type_info_size <= 0) {
+            pdebug(DEBUG_WARN, "Bad sizes in metadata file record, skipping the record.");
+            continue;
+        }
+
+        if(put_tag_metadata_unsafe(session, name, name_size, elem_size, type_info, type_info_size, &changed) == PLCTAG_STATUS_OK) {
+            num_loaded++;
+        }
+    } while(1);
+
+    fclose(file);
+
+    pdebug(DEBUG_INFO, "Loaded %d tag metadata records from %s.", num_loaded, session->metadata_file);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * queue_metadata_record_unsafe
+ *
+ * Add the entry to the records waiting to be written to the end of the
+ * metadata file.  The last record wins when the file is loaded, so changed
+ * entries are just appended again.
+ *
+ * You must hold the session mutex before calling this!
+ */
+void queue_metadata_record_unsafe(ab_session_p session, struct ab_tag_metadata_t *entry)
+{
+    uint8_t record[METADATA_MAX_RECORD_SIZE];
+    uint32_t record_size = 0;
+    uint32_t record_hash = 0;
+    int32_t elem_size = 0;
+    int offset = 0;
+    int needed = 0;
+    const char *path = (session->path ? session->path : "");
+
+    if(!entry) {
+        return;
+    }
+
+    elem_size = entry->elem_size;
+
+    if(put_record_field(record, &offset, session->host, str_length(session->host)) != PLCTAG_STATUS_OK
+       || put_record_field(record, &offset, path, str_length(path)) != PLCTAG_STATUS_OK
+       || put_record_field(record, &offset, entry->encoded_name, entry->encoded_name_size) != PLCTAG_STATUS_OK
+       || put_record_field(record, &offset, entry->type_info, entry->type_info_size) != PLCTAG_STATUS_OK
+       || put_record_field(record, &offset, &elem_size, (int)sizeof(elem_size)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Tag metadata is too large for the metadata file!");
+        return;
+    }
+
+    record_size = (uint32_t)offset;
+    record_hash = hash(record, record_size, 0);
+
+    needed = session->metadata_pending_size + (int)(sizeof(record_size) + sizeof(record_hash)) + offset;
+
+    if(needed > session->metadata_pending_capacity) {
+        int new_capacity = (session->metadata_pending_capacity ? session->metadata_pending_capacity * 2 : METADATA_MAX_RECORD_SIZE * 4); /* MAGIC */
+        uint8_t *new_pending = NULL;
+
+        while(new_capacity < needed) {
+            new_capacity *= 2;
+        }
+
+        new_pending = (uint8_t *)mem_realloc(session->metadata_pending, new_capacity);
+        if(!new_pending) {
+            pdebug(DEBUG_WARN, "Unable to queue metadata record!");
+            return;
+        }
+
+        session->metadata_pending = new_pending;
+        session->metadata_pending_capacity = new_capacity;
+    }
+
+    mem_copy(session->metadata_pending + session->metadata_pending_size, &record_size, (int)sizeof(record_size));
+    session->metadata_pending_size += (int)sizeof(record_size);
+
+    mem_copy(session->metadata_pending + session->metadata_pending_size, &record_hash, (int)sizeof(record_hash));
+    session->metadata_pending_size += (int)sizeof(record_hash);
+
+    mem_copy(session->metadata_pending + session->metadata_pending_size, record, offset);
+    session->metadata_pending_size += offset;
+}
+
+
+
+/*
+ * write_metadata_records
+ *
+ * Append queued records to the metadata file and free them.  This opens
+ * the file, so do not call it with the session mutex held.
+ */
+void write_metadata_records(ab_session_p session, uint8_t *records, int records_size)
+{
+    FILE *file = NULL;
+
+    if(!records) {
+        return;
+    }
+
+    file = fopen(session->metadata_file, "ab");
+    if(file) {
+        /* write all the records in one piece so other processes do not split them. */
+        if(fwrite(records, (size_t)records_size, 1, file) != 1) {
+            pdebug(DEBUG_WARN, "Unable to write metadata records!");
+        }
+
+        fclose(file);
+    } else {
+        pdebug(DEBUG_WARN, "Unable to open metadata file %s!", session->metadata_file);
+    }
+
+    mem_free(records);
+}
+
+
+
+/* fields are a 16-bit length and the bytes. */
+int put_record_field(uint8_t *buf, int *offset, const void *field, int field_size)
+{
+    uint16_t size = (uint16_t)field_size;
+
+    if(field_size < 0 || field_size > UINT16_MAX || *offset + (int)sizeof(size) + field_size > METADATA_MAX_RECORD_SIZE) {
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    mem_copy(buf + *offset, &size, (int)sizeof(size));
+    *offset += (int)sizeof(size);
+
+    mem_copy(buf + *offset, (void *)field, field_size);
+    *offset += field_size;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int get_record_field(uint8_t *buf, int buf_size, int *offset, uint8_t **field, int *field_size)
+{
+    uint16_t size = 0;
+
+    if(*offset + (int)sizeof(size) > buf_size) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    mem_copy(&size, buf + *offset, (int)sizeof(size));
+    *offset += (int)sizeof(size);
+
+    if(*offset + (int)size > buf_size) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    *field = buf + *offset;
+    *field_size = (int)size;
+    *offset += (int)size;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int64_t tag_metadata_key(uint8_t *encoded_name, int encoded_name_size)
+{
+    return (int64_t)hash(encoded_name, (size_t)encoded_name_size, 0);
+}
+
+
+
+/* You must hold the session mutex before calling this! */
+struct ab_tag_metadata_t *find_tag_metadata_unsafe(ab_session_p session, uint8_t *encoded_name, int encoded_name_size)
+{
+    struct ab_tag_metadata_t *entry = hashtable_get(session->tag_metadata, tag_metadata_key(encoded_name, encoded_name_size));
+
+    while(entry && mem_cmp(entry->encoded_name, entry->encoded_name_size, encoded_name, encoded_name_size) != 0) {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+
+
+/*
+ * session_get_shared_read
+ *
+ * Find the shared read for the encoded tag name and element count or
+ * create a new one.  The caller gets a reference to it.
+ */
+int session_get_shared_read(ab_session_p session, uint8_t *encoded_name, int encoded_name_size, int elem_count, ab_shared_read_p *shared)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_shared_read_p result = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!session || !encoded_name || encoded_name_size <= 0 || !shared) {
+        pdebug(DEBUG_WARN, "Called with bad parameters!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(session->mutex) {
+        for(int i=0; i < vector_length(session->shared_reads); i++) {
+            ab_shared_read_p entry = vector_get(session->shared_reads, i);
+
+            if(entry->elem_count == elem_count
+               && mem_cmp(entry->encoded_name, entry->encoded_name_size, encoded_name, encoded_name_size) == 0) {
+                /* this fails if the entry is being destroyed. */
+                result = rc_inc(entry);
+
+                if(result) {
+                    break;
+                }
+            }
+        }
+
+        if(result) {
+            break;
+        }
+
+        result = (ab_shared_read_p)rc_alloc((int)sizeof(struct ab_shared_read_t), shared_read_destroy);
+        if(!result) {
+            pdebug(DEBUG_WARN, "Unable to allocate shared read!");
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        result->elem_count = elem_count;
+        result->status = PLCTAG_ERR_NO_DATA;
+
+        result->encoded_name = (uint8_t *)mem_alloc(encoded_name_size);
+        if(!result->encoded_name) {
+            pdebug(DEBUG_WARN, "Unable to allocate shared read name!");
+            result = rc_dec(result);
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        mem_copy(result->encoded_name, encoded_name, encoded_name_size);
+        result->encoded_name_size = encoded_name_size;
+
+        rc = vector_put(session->shared_reads, vector_length(session->shared_reads), result);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add shared read to session!");
+            result = rc_dec(result);
+            break;
+        }
+
+        /* only set now, the destructor uses this to remove the entry from the list. */
+        result->session = session;
+    }
+
+    *shared = result;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * session_shared_read_start
+ *
+ * Called when a tag handle wants to read the shared tag.  Returns:
+ *
+ *  PLCTAG_STATUS_PENDING - another handle has a read in flight, the tag is
+ *      signaled when the result is in.
+ *  PLCTAG_STATUS_OK - the last result is not older than max_age_ms.
+ *  PLCTAG_ERR_NO_DATA - the caller must do the read and then call
+ *      session_shared_read_done().
+ *
+ * In the first two cases, pass the generation to session_shared_read_get_result().
+ */
+int session_shared_read_start(ab_shared_read_p shared, int32_t tag_id, int64_t max_age_ms, uint32_t *generation)
+{
+    int rc = PLCTAG_ERR_NO_DATA;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(shared->session->mutex) {
+        if(shared->in_flight) {
+            /* tags still being created have no ID yet, the tickler polls those. */
+            if(tag_id > 0) {
+                if(shared->num_waiters >= shared->waiters_capacity) {
+                    int new_capacity = shared->waiters_capacity + SESSION_INC_REQUESTS;
+                    int32_t *new_waiters = (int32_t *)mem_realloc(shared->waiters, (int)sizeof(int32_t) * new_capacity);
+
+                    if(!new_waiters) {
+                        pdebug(DEBUG_WARN, "Unable to grow shared read waiter list, doing our own read.");
+                        break;
+                    }
+
+                    shared->waiters = new_waiters;
+                    shared->waiters_capacity = new_capacity;
+                }
+
+                shared->waiters[shared->num_waiters] = tag_id;
+                shared->num_waiters++;
+            }
+
+            *generation = shared->generation;
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        if(max_age_ms > 0 && shared->status == PLCTAG_STATUS_OK && (time_ms() - shared->read_time) < max_age_ms) {
+            /* the result of the current generation is already in. */
+            *generation = shared->generation - 1;
+            rc = PLCTAG_STATUS_OK;
+            break;
+        }
+
+        shared->in_flight = 1;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * session_shared_read_get_result
+ *
+ * Copy the result of the read after the passed generation into the
+ * caller's buffers.  The data buffer is grown if needed.  The type info is
+ * only copied if the caller does not have it yet.  Returns
+ * PLCTAG_STATUS_PENDING if that read has not finished.
+ */
+int session_shared_read_get_result(ab_shared_read_p shared, uint32_t generation, uint8_t **data, int *size, uint8_t *type_info, int *type_info_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    critical_block(shared->session->mutex) {
+        if(shared->generation == generation) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        rc = shared->status;
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        if(*size < shared->size) {
+            uint8_t *new_data = (uint8_t *)mem_realloc(*data, shared->size);
+
+            if(!new_data) {
+                pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            *data = new_data;
+            *size = shared->size;
+        }
+
+        mem_copy(*data, shared->data, shared->size);
+
+        if(*type_info_size == 0 && shared->type_info_size > 0) {
+            mem_copy(type_info, shared->type_info, shared->type_info_size);
+            *type_info_size = shared->type_info_size;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * session_shared_read_done
+ *
+ * Called by the handle that did the read.  Store the result and wake up
+ * the handles waiting for it.  On error, the waiting handles start their
+ * own reads.
+ */
+void session_shared_read_done(ab_shared_read_p shared, int status, uint8_t *data, int size, uint8_t *type_info, int type_info_size)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(shared->session->mutex) {
+        if(status == PLCTAG_STATUS_OK && data && size > 0) {
+            if(shared->size < size) {
+                uint8_t *new_data = (uint8_t *)mem_realloc(shared->data, size);
+
+                if(!new_data) {
+                    pdebug(DEBUG_WARN, "Unable to allocate shared read data!");
+                    status = PLCTAG_ERR_NO_MEM;
+                } else {
+                    shared->data = new_data;
+                }
+            }
+
+            if(status == PLCTAG_STATUS_OK) {
+                mem_copy(shared->data, data, size);
+                shared->size = size;
+                shared->read_time = time_ms();
+            }
+        }
+
+        if(status == PLCTAG_STATUS_OK && !shared->type_info && type_info_size > 0) {
+            shared->type_info = (uint8_t *)mem_alloc(type_info_size);
+            if(shared->type_info) {
+                mem_copy(shared->type_info, type_info, type_info_size);
+                shared->type_info_size = type_info_size;
+            }
+        }
+
+        shared->status = status;
+        shared->in_flight = 0;
+        shared->generation++;
+
+        for(int i=0; i < shared->num_waiters; i++) {
+            plc_tag_signal_completion(shared->waiters[i]);
+        }
+
+        shared->num_waiters = 0;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+void shared_read_destroy(void *shared_arg)
+{
+    ab_shared_read_p shared = (ab_shared_read_p)shared_arg;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(shared->session) {
+        critical_block(shared->session->mutex) {
+            for(int i=0; i < vector_length(shared->session->shared_reads); i++) {
+                if(vector_get(shared->session->shared_reads, i) == shared) {
+                    vector_remove(shared->session->shared_reads, i);
+                    break;
+                }
+            }
+        }
+    }
+
+    if(shared->encoded_name) {
+        mem_free(shared->encoded_name);
+    }
+
+    if(shared->data) {
+        mem_free(shared->data);
+    }
+
+    if(shared->type_info) {
+        mem_free(shared->type_info);
+    }
+
+    if(shared->waiters) {
+        mem_free(shared->waiters);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/*
+ * session_remove_request_unsafe
+ *
+ * You must hold the mutex before calling this!
+ */
+int session_remove_request_unsafe(ab_session_p session, ab_request_p req)
+{
+    int rc = PLCTAG_STATUS_OK;
+//    ab_request_p cur, prev;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(session == NULL || req == NULL) {
+        return rc;
+    }
+
+    for(int i=0; i < vector_length(session->requests); i++) {
+        if(vector_get(session->requests, i) == req) {
+            vector_remove(session->requests, i);
+            break;
+        }
+    }
+
+    /* release the request refcount */
+    rc_dec(req);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*****************************************************************
+ **************** Session handling functions *********************
+ ****************************************************************/
+
+
+/*
+ * session_handler
+ *
+ * The handler thread for a session that does not use the shared pool.
+ */
+THREAD_FUNC(session_handler)
+{
+    ab_session_p session = arg;
+
+    pdebug(DEBUG_INFO, "Starting thread for session %p", session);
+
+    while(!session->terminating) {
+        int wait_events = SOCK_EVENT_NONE;
+        int wait_ms = 0;
+
+        session_step(session, &wait_events, &wait_ms);
+
+        /*
+         * wait for something to do, but only if we are not
+         * doing some linked states.  Queuing a request or
+         * destroying the session wakes us up.
+         */
+        if(!session->terminating && wait_ms != 0) {
+            socket_wait_event(session->sock, wait_events, wait_ms);
+        }
+    }
+
+    /*
+     * One last time before we exit.
+     */
+    pdebug(DEBUG_DETAIL,"Critical block.");
+    critical_block(session->mutex) {
+        purge_aborted_requests_unsafe(session);
+    }
+
+    THREAD_RETURN(0);
+}
+
+
+
+/*
+ * session_step
+ *
+ * Run the session state machine once.  The socket events to wait for
+ * and how long to wait are passed back.  A wait time of zero means
+ * that the next state should be run right away.  A negative wait time
+ * means that there is nothing to do until the session is woken up.
+ */
+void session_step(ab_session_p session, int *wait_events, int *wait_ms)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t time_left = 0;
+    uint8_t *metadata_records = NULL;
+    int metadata_records_size = 0;
+
+    *wait_events = SOCK_EVENT_NONE;
+    *wait_ms = 0;
+
+    /*
+     * Do this on every cycle.   This keeps the queue clean(ish).
+     *
+     * Make sure we get rid of all the aborted requests queued.
+     * This keeps the overall memory usage lower.
+     */
+
+    pdebug(DEBUG_SPEW,"Critical block.");
+    critical_block(session->mutex) {
+        purge_aborted_requests_unsafe(session);
+
+        /* take the queued metadata records, they are written below. */
+        metadata_records = session->metadata_pending;
+        metadata_records_size = session->metadata_pending_size;
+        session->metadata_pending = NULL;
+        session->metadata_pending_size = 0;
+        session->metadata_pending_capacity = 0;
+    }
+
+    /* file I/O is done outside the mutex. */
+    write_metadata_records(session, metadata_records, metadata_records_size);
+
+    switch(session->state) {
+    case SESSION_OPEN_SOCKET:
+        pdebug(DEBUG_DETAIL, "in SESSION_OPEN_SOCKET state.");
+
+        /* we must connect to the gateway*/
+        if ((rc = session_open_socket(session, wait_events, wait_ms)) == PLCTAG_STATUS_PENDING) {
+            /* still connecting. */
+        } else if (rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "session connect failed %s!", plc_tag_decode_error(rc));
+            session->state = SESSION_CLOSE_SOCKET;
+        } else {
+            /* set the timeout for disconnect. */
+            //if(session->auto_disconnect_enabled) {
+            session->auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+            //}
+
+            session->state = SESSION_REGISTER;
+        }
+        break;
+
+    case SESSION_REGISTER:
+        pdebug(DEBUG_DETAIL, "in SESSION_REGISTER state.");
+
+        if ((rc = session_register(session, wait_events, wait_ms)) == PLCTAG_STATUS_PENDING) {
+            /* still waiting for the response. */
+        } else if (rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "session registration failed %s!", plc_tag_decode_error(rc));
+            session->state = SESSION_CLOSE_SOCKET;
+        } else {
+            if(session->use_connected_msg) {
+                start_forward_open(session);
+                session->state = SESSION_CONNECT;
+            } else {
+                session->state = SESSION_IDLE;
+            }
+        }
+        break;
+
+    case SESSION_CONNECT:
+        pdebug(DEBUG_DETAIL, "in SESSION_CONNECT state.");
+
+        if((rc = perform_forward_open(session, wait_events, wait_ms)) == PLCTAG_STATUS_PENDING) {
+            /* still waiting for the response or trying another Forward Open. */
+        } else if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Forward open failed %s!", plc_tag_decode_error(rc));
+            session->state = SESSION_UNREGISTER;
+        } else {
+            pdebug(DEBUG_DETAIL, "forward open succeeded, going to idle state.");
+            session->state = SESSION_IDLE;
+        }
+        break;
+
+    case SESSION_IDLE:
+        pdebug(DEBUG_SPEW, "in SESSION_IDLE state.");
+
+        /* if there is work to do, make sure we do not disconnect. */
+        pdebug(DEBUG_SPEW,"Critical block.");
+        critical_block(session->mutex) {
+            if(vector_length(session->requests) > 0 || session->num_packets_in_flight > 0) {
+                session->auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+            }
+        }
+
+        if((rc = process_requests(session, wait_events, wait_ms)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error while processing requests %s!", plc_tag_decode_error(rc));
+
+            *wait_events = SOCK_EVENT_NONE;
+            *wait_ms = 0;
+
+            if(session->use_connected_msg) {
+                session->state = SESSION_DISCONNECT;
+            } else {
+                session->state = SESSION_UNREGISTER;
+            }
+
+            break;
+        }
+
+        /* check if we should disconnect, but only when nothing is happening. */
+        //if(session->auto_disconnect_enabled) {
+        if(session->io_state == SESSION_IO_NONE && session->num_packets_in_flight == 0) {
+            time_left = session->auto_disconnect_time - time_ms();
+
+            if(time_left < 0) {
+                pdebug(DEBUG_DETAIL, "Disconnecting due to inactivity.");
+
+                session->auto_disconnect = 1;
+                *wait_events = SOCK_EVENT_NONE;
+                *wait_ms = 0;
+
+                if(session->use_connected_msg) {
+                    session->state = SESSION_DISCONNECT;
+                } else {
+                    session->state = SESSION_UNREGISTER;
+                }
+            } else if(*wait_ms < 0 || *wait_ms > time_left) {
+                /* wake up in time to disconnect. */
+                *wait_ms = (int)time_left;
+            }
+        }
+        //}
+
+        break;
+
+    case SESSION_DISCONNECT:
+        pdebug(DEBUG_DETAIL, "in SESSION_DISCONNECT state.");
+
+        if((rc = perform_forward_close(session, wait_events, wait_ms)) == PLCTAG_STATUS_PENDING) {
+            /* still waiting for the response. */
+            break;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Forward close failed %s!", plc_tag_decode_error(rc));
+        }
+
+        session->state = SESSION_UNREGISTER;
+        break;
+
+    case SESSION_UNREGISTER:
+        pdebug(DEBUG_DETAIL, "in SESSION_UNREGISTER state.");
+
+        if((rc = session_unregister(session)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unregistering session failed %s!", plc_tag_decode_error(rc));
+        }
+
+        session->state = SESSION_CLOSE_SOCKET;
+        break;
+
+    case SESSION_CLOSE_SOCKET:
+        pdebug(DEBUG_DETAIL, "in SESSION_CLOSE_SOCKET state.");
+
+        if((rc = session_close_socket(session)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Closing session socket failed %s!", plc_tag_decode_error(rc));
+        }
+
+        /* drop anything left of a set up or tear down exchange. */
+        session->setup_io_state = SESSION_IO_NONE;
+
+        if(session->auto_disconnect) {
+            session->state = SESSION_WAIT_RECONNECT;
+        } else {
+            session->state = SESSION_START_RETRY;
+        }
+
+        break;
+
+    case SESSION_START_RETRY:
+        pdebug(DEBUG_DETAIL, "in SESSION_START_RETRY state.");
+
+        /* FIXME - make this a tag attribute. */
+        session->retry_time = time_ms() + RETRY_WAIT_MS;
+
+        /* start waiting. */
+        session->state = SESSION_WAIT_RETRY;
+
+        break;
+
+    case SESSION_WAIT_RETRY:
+        pdebug(DEBUG_SPEW, "in SESSION_WAIT_RETRY state.");
+
+        time_left = session->retry_time - time_ms();
+
+        if(time_left < 0) {
+            pdebug(DEBUG_DETAIL, "Transitioning to SESSION_OPEN_SOCKET.");
+            session->state = SESSION_OPEN_SOCKET;
+        } else {
+            *wait_ms = (int)time_left;
+        }
+
+        break;
+
+    case SESSION_WAIT_RECONNECT:
+        /* wait for at least one request to queue before reconnecting. */
+        pdebug(DEBUG_SPEW, "in SESSION_WAIT_RECONNECT state.");
+
+        session->auto_disconnect = 0;
+
+        /* nothing to do until a request is queued. */
+        *wait_ms = -1;
+
+        /* if there is work to do, reconnect.. */
+        pdebug(DEBUG_DETAIL,"Critical block.");
+        critical_block(session->mutex) {
+            if(vector_length(session->requests) > 0) {
+                pdebug(DEBUG_DETAIL, "There are requests waiting, reopening connection to PLC.");
+
+                *wait_ms = 0;
+                session->state = SESSION_OPEN_SOCKET;
+            }
+        }
+
+        break;
+
+
+    default:
+        pdebug(DEBUG_ERROR, "Unknown state %d!", session->state);
+
+        /* FIXME - this logic is not complete.  We might be here without
+         * a connected session or a registered session. */
+        if(session->use_connected_msg) {
+            session->state = SESSION_DISCONNECT;
+        } else {
+            session->state = SESSION_UNREGISTER;
+        }
+
+        break;
+    }
+}
+
+
+
+
+/*****************************************************************
+ ******************** Shared session pool ************************
+ ****************************************************************/
+
+/*
+ * Instead of a thread per session, sessions created with the
+ * session_pool attribute set are run by a small, fixed set of
+ * threads.  The pool threads wait on all the pool sessions' sockets
+ * at once and step whichever sessions have something to do.
+ *
+ * A session is only ever stepped by one pool thread at a time.  The
+ * thread claims it with the session's pool_lock.  Claims, releases and
+ * removal from the pool are all done with the pool mutex held so that
+ * a session cannot be destroyed while a pool thread is using it.
+ */
+
+int session_pool_add(ab_session_p session, int num_threads)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(session_pool_mutex) {
+        if(!session_pool_socks) {
+            if((rc = session_pool_start_unsafe(num_threads)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to start session pool, %s!", plc_tag_decode_error(rc));
+                break;
+            }
+        }
+
+        if((rc = vector_put(session_pool, vector_length(session_pool), session)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add session to the pool, %s!", plc_tag_decode_error(rc));
+            break;
+        }
+
+        if((rc = sock_set_add(session_pool_socks, session->sock, session)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add session socket to the pool, %s!", plc_tag_decode_error(rc));
+            vector_remove(session_pool, vector_length(session_pool) - 1);
+            break;
+        }
+
+        session->on_pool = 1;
+        session->pool_next_step_time = INT64_MAX;
+    }
+
+    /* get a pool thread to start the session up. */
+    if(rc == PLCTAG_STATUS_OK) {
+        socket_wake(session->sock);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * session_pool_remove
+ *
+ * Take the session out of the pool and wait until no pool thread is
+ * working on it.
+ */
+void session_pool_remove(ab_session_p session)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(session_pool_mutex) {
+        if(!session->on_pool) {
+            break;
+        }
+
+        session->on_pool = 0;
+
+        for(int i=0; i < vector_length(session_pool); i++) {
+            if(vector_get(session_pool, i) == session) {
+                vector_remove(session_pool, i);
+                break;
+            }
+        }
+
+        sock_set_remove(session_pool_socks, session->sock);
+    }
+
+    /* a pool thread might be in the middle of stepping the session. */
+    while(!lock_acquire_try(&session->pool_lock)) {
+        sleep_ms(1);
+    }
+
+    lock_release(&session->pool_lock);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+/*
+ * This must be called with the pool mutex held!
+ */
+int session_pool_start_unsafe(int num_threads)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting session pool with %d threads.", num_threads);
+
+    if((session_pool = vector_create(25, 5)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create session pool vector!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if((rc = sock_set_create(&session_pool_socks)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create session pool socket set!");
+        vector_destroy(session_pool);
+        session_pool = NULL;
+        return rc;
+    }
+
+    session_pool_terminating = 0;
+    session_pool_next_timer = INT64_MAX;
+
+    for(session_pool_num_threads = 0; session_pool_num_threads < num_threads; session_pool_num_threads++) {
+        rc = thread_create(&(session_pool_threads[session_pool_num_threads]), session_pool_handler, 32*1024, NULL);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create session pool thread %d, %s!", session_pool_num_threads, plc_tag_decode_error(rc));
+            break;
+        }
+    }
+
+    /* as long as we have one thread, we can keep going. */
+    if(session_pool_num_threads == 0) {
+        sock_set_destroy(&session_pool_socks);
+        vector_destroy(session_pool);
+        session_pool = NULL;
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+void session_pool_stop(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!session_pool_socks) {
+        pdebug(DEBUG_INFO, "Session pool was never started.");
+        return;
+    }
+
+    session_pool_terminating = 1;
+    sock_set_wake(session_pool_socks);
+
+    for(int i=0; i < session_pool_num_threads; i++) {
+        thread_join(session_pool_threads[i]);
+        thread_destroy(&(session_pool_threads[i]));
+    }
+
+    session_pool_num_threads = 0;
+
+    sock_set_destroy(&session_pool_socks);
+
+    vector_destroy(session_pool);
+    session_pool = NULL;
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+THREAD_FUNC(session_pool_handler)
+{
+    (void)arg;
+
+    pdebug(DEBUG_INFO, "Starting session pool thread.");
+
+    while(!session_pool_terminating) {
+        void *ready[SESSION_POOL_MAX_READY];
+        int num_ready = 0;
+        int64_t wait_ms = SESSION_POOL_MAX_WAIT_MS;
+
+        /* do not sleep past the next session timer. */
+        critical_block(session_pool_mutex) {
+            if(session_pool_next_timer - time_ms() < wait_ms) {
+                wait_ms = session_pool_next_timer - time_ms();
+            }
+        }
+
+        if(wait_ms < 0) {
+            wait_ms = 0;
+        }
+
+        num_ready = sock_set_wait(session_pool_socks, ready, SESSION_POOL_MAX_READY, (int)wait_ms);
+        if(num_ready < 0) {
+            pdebug(DEBUG_WARN, "Error waiting for session sockets, %s!", plc_tag_decode_error(num_ready));
+            sleep_ms(10);
+            num_ready = 0;
+        }
+
+        for(int i=0; i < num_ready && !session_pool_terminating; i++) {
+            ab_session_p session = NULL;
+
+            critical_block(session_pool_mutex) {
+                session = session_pool_claim_unsafe(ready[i]);
+            }
+
+            if(session) {
+                session_pool_run(session);
+            }
+        }
+
+        if(!session_pool_terminating) {
+            session_pool_run_timers();
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    THREAD_RETURN(0);
+}
+
+
+/*
+ * session_pool_claim_unsafe
+ *
+ * The context may be stale, so it is only used as a session once we
+ * know that it is still in the pool.  Returns NULL if the session is
+ * gone or another pool thread has it.  Must be called with the pool
+ * mutex held!
+ */
+ab_session_p session_pool_claim_unsafe(void *context)
+{
+    for(int i=0; i < vector_length(session_pool); i++) {
+        ab_session_p session = vector_get(session_pool, i);
+
+        if(session == context) {
+            if(!lock_acquire_try(&session->pool_lock)) {
+                /* whoever has it will pick up the events. */
+                return NULL;
+            }
+
+            /* no timers while claimed. */
+            session->pool_next_step_time = INT64_MAX;
+
+            return session;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * session_pool_run
+ *
+ * Step a claimed session until it has to wait, then release it.
+ */
+void session_pool_run(ab_session_p session)
+{
+    int wait_events = SOCK_EVENT_NONE;
+    int wait_ms = 0;
+    int steps = 0;
+    int64_t next_step_time = INT64_MAX;
+
+    debug_set_tag_id(0);
+
+    for(steps = 0; steps < SESSION_POOL_MAX_STEPS && !session->terminating; steps++) {
+        int events = 0;
+
+        session_step(session, &wait_events, &wait_ms);
+
+        if(wait_ms == 0) {
+            /* linked states, keep going. */
+            continue;
+        }
+
+        /*
+         * This sets up what the socket set waits for on this socket
+         * and tells us if it is already there.
+         */
+        events = socket_wait_event(session->sock, wait_events, 0);
+        if(events <= 0 || events == SOCK_EVENT_TIMEOUT) {
+            break;
+        }
+    }
+
+    if(steps >= SESSION_POOL_MAX_STEPS || wait_ms == 0) {
+        /* give other sessions a turn, but come back soon. */
+        next_step_time = time_ms();
+    } else if(wait_ms > 0) {
+        next_step_time = time_ms() + wait_ms;
+    }
+
+    session_pool_release(session, next_step_time);
+}
+
+
+void session_pool_release(ab_session_p session, int64_t next_step_time)
+{
+    critical_block(session_pool_mutex) {
+        session->pool_next_step_time = next_step_time;
+
+        if(next_step_time < session_pool_next_timer) {
+            session_pool_next_timer = next_step_time;
+        }
+
+        lock_release(&session->pool_lock);
+
+        /* if the session is being destroyed, it is no longer in the socket set. */
+        if(session->on_pool) {
+            sock_set_rearm(session_pool_socks, session->sock, session);
+        }
+    }
+}
+
+
+/*
+ * session_pool_run_timers
+ *
+ * Step the sessions that have waited as long as they wanted to.  Only
+ * one session is claimed at a time so that the others are not held
+ * up behind a session that takes a while.
+ */
+void session_pool_run_timers(void)
+{
+    int64_t now = time_ms();
+
+    while(!session_pool_terminating) {
+        ab_session_p due = NULL;
+
+        critical_block(session_pool_mutex) {
+            if(session_pool_next_timer > now) {
+                break;
+            }
+
+            session_pool_next_timer = INT64_MAX;
+
+            for(int i=0; i < vector_length(session_pool); i++) {
+                ab_session_p session = vector_get(session_pool, i);
+
+                if(!due && session->pool_next_step_time <= now && lock_acquire_try(&session->pool_lock)) {
+                    session->pool_next_step_time = INT64_MAX;
+                    due = session;
+                } else if(session->pool_next_step_time < session_pool_next_timer) {
+                    session_pool_next_timer = session->pool_next_step_time;
+                }
+            }
+        }
+
+        if(!due) {
+            break;
+        }
+
+        session_pool_run(due);
+    }
+}
+
+
+
+/*
+ * This must be called with the session mutex held!
+ */
+int purge_aborted_requests_unsafe(ab_session_p session)
+{
+    int purge_count = 0;
+    ab_request_p request = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* remove the aborted requests. */
+    for(int i=0; i < vector_length(session->requests); i++) {
+        request = vector_get(session->requests, i);
+
+        /* filter out the aborts. */
+        if(request && request->abort_request) {
+            purge_count++;
+
+            /* remove it from the queue. */
+            vector_remove(session->requests, i);
+
+            /* set the debug tag to the owning tag. */
+            debug_set_tag_id(request->tag_id);
+
+            pdebug(DEBUG_DETAIL, "Session thread releasing aborted request %p.", request);
+
+            request->status = PLCTAG_ERR_ABORT;
+            request->request_size = 0;
+            request->resp_received = 1;
+
+            /* release our hold on it. */
+            request = rc_dec(request);
+
+            /* vector size has changed, back up one. */
+            i--;
+        }
+    }
+
+    if(purge_count > 0) {
+        pdebug(DEBUG_DETAIL, "Removed %d aborted requests.", purge_count);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return purge_count;
+}
+
+
+/*
+ * process_requests
+ *
+ * Move packets through the session without blocking.  New packets are
+ * sent while there is room in the pipeline and responses are read as
+ * they arrive.  When nothing more can be done right now, the socket
+ * events and the time to wait for them are passed back.
+ */
+int process_requests(ab_session_p session, int *wait_events, int *wait_ms)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int max_in_flight = 1;
+    int have_requests = 0;
+    int done = 0;
+    int64_t time_left = 0;
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "Null session pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pdebug(DEBUG_SPEW, "Checking for requests to process.");
+
+    max_in_flight = session->max_requests_in_flight;
+    if(max_in_flight < 1 || max_in_flight > SESSION_MAX_REQUESTS_IN_FLIGHT) {
+        max_in_flight = 1;
+    }
+
+    /*
+     * Fill the pipeline first.  With the default window of one packet
+     * this is the same as the old send-then-wait behavior.
+     */
+    while(rc == PLCTAG_STATUS_OK && !done && !session->terminating) {
+        struct ab_packet_in_flight_t *packet = &(session->packets_in_flight[session->num_packets_in_flight]);
+
+        switch(session->io_state) {
+        case SESSION_IO_NONE:
+            if(session->num_packets_in_flight < max_in_flight && get_packet_requests(session, packet)) {
+                if((rc = start_packet(session, packet)) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Error starting packet, %s!", plc_tag_decode_error(rc));
+                    fail_packet(packet, rc);
+                }
+            } else if(session->num_packets_in_flight > 0) {
+                /* nothing (more) to send, get a response. */
+                session->data_offset = 0;
+                session->data_size = 0;
+                session->io_state = SESSION_IO_RECEIVING;
+            } else {
+                /* nothing to do until a request is queued. */
+                *wait_events = SOCK_EVENT_NONE;
+                *wait_ms = -1;
+                done = 1;
+            }
+
+            break;
+
+        case SESSION_IO_SENDING:
+            rc = send_eip_data(session);
+
+            if(rc == PLCTAG_STATUS_OK) {
+                session->num_packets_in_flight++;
+                session->io_state = SESSION_IO_NONE;
+
+                pdebug(DEBUG_DETAIL, "%d packets in flight.", session->num_packets_in_flight);
+            } else if(rc == PLCTAG_STATUS_PENDING) {
+                time_left = packet->time_sent + SESSION_DEFAULT_TIMEOUT - time_ms();
+
+                if(time_left > 0) {
+                    rc = PLCTAG_STATUS_OK;
+                    *wait_events = SOCK_EVENT_CAN_WRITE;
+                    *wait_ms = (int)time_left;
+                    done = 1;
+                } else {
+                    pdebug(DEBUG_WARN, "Timed out waiting to send data!");
+                    rc = PLCTAG_ERR_TIMEOUT;
+                }
+            }
+
+            break;
+
+        case SESSION_IO_RECEIVING:
+            rc = recv_eip_data(session);
+
+            if(rc == PLCTAG_STATUS_OK) {
+                session->io_state = SESSION_IO_NONE;
+                rc = handle_response(session);
+            } else if(rc == PLCTAG_STATUS_PENDING) {
+                rc = PLCTAG_STATUS_OK;
+
+                critical_block(session->mutex) {
+                    have_requests = (vector_length(session->requests) > 0);
+                }
+
+                time_left = session->packets_in_flight[0].time_sent + SESSION_DEFAULT_TIMEOUT - time_ms();
+
+                if(session->data_offset == 0 && session->num_packets_in_flight < max_in_flight && have_requests) {
+                    /* nothing partly read, so the buffer is free to send another packet. */
+                    session->io_state = SESSION_IO_NONE;
+                } else if(time_left > 0) {
+                    *wait_events = SOCK_EVENT_CAN_READ;
+                    *wait_ms = (int)time_left;
+                    done = 1;
+                } else {
+                    pdebug(DEBUG_WARN, "Timed out waiting for response to packet with sequence ID %" PRIx64 "!", session->packets_in_flight[0].seq_id);
+                    rc = PLCTAG_ERR_TIMEOUT;
+                }
+            }
+
+            break;
+
+        default:
+            pdebug(DEBUG_ERROR, "Unknown I/O state %d!", session->io_state);
+            rc = PLCTAG_ERR_BAD_STATUS;
+            break;
+        }
+    }
+
+    /* problem? clean up the pending requests and dump everything. */
+    if(rc != PLCTAG_STATUS_OK) {
+        session_reset_io(session, rc);
+    }
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * get_packet_requests
+ *
+ * Pull as many requests off the front of the queue as will fit into
+ * one packet.  Returns the number of requests taken.
+ */
+int get_packet_requests(ab_session_p session, struct ab_packet_in_flight_t *packet)
+{
+    ab_request_p request = NULL;
+    int num_bundled_requests = 0;
+    int remaining_space = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    packet->num_requests = 0;
+    packet->seq_id = 0;
+    packet->time_sent = 0;
+
+    /* grab a request off the front of the list. */
+    critical_block(session->mutex) {
+        /* is there anything to do? */
+        if(vector_length(session->requests)) {
+            /* get rid of all aborted requests. */
+            purge_aborted_requests_unsafe(session);
+
+            /* if there are still requests after purging all the aborted requests, process them. */
+
+            /* how much space do we have to work with. */
+            remaining_space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
+
+            if(vector_length(session->requests)) {
+                do {
+                    request = merge_element_reads_unsafe(session, remaining_space);
+
+                    remaining_space = remaining_space - get_payload_size(request);
+
+                    /*
+                     * If we have a non-packable request, only queue it if it is the first one.
+                     * If the request is packable, keep queuing as long as there is space.
+                     */
+
+                    if(num_bundled_requests == 0 || (request->allow_packing && remaining_space > 0)) {
+                        //pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1, remaining_space);
+                        packet->requests[num_bundled_requests] = request;
+                        num_bundled_requests++;
+
+                        /* remove it from the queue. */
+                        vector_remove(session->requests, 0);
+                    }
+                } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS && request->allow_packing);
+            } else {
+                pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
+            }
+        }
+    }
+
+    packet->num_requests = num_bundled_requests;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return num_bundled_requests;
+}
+
+
+
+/*
+ * merge_element_reads_unsafe
+ *
+ * Reads of single elements of the same array that are queued one after
+ * the other, each for the element after the last, are replaced with one
+ * read of all of the elements.  Only as many are merged as fit in the
+ * space left for the response.  The merged read takes the place of the
+ * first read in the queue.  Returns the request at the front of the queue.
+ *
+ * Only connected Logix reads with a known element size are marked for
+ * merging, see merge_elem_size in ab_request_t.
+ *
+ * This is not thread-safe!  It should be called with the session mutex
+ * locked!
+ */
+ab_request_p merge_element_reads_unsafe(ab_session_p session, int remaining_space)
+{
+    ab_request_p first = vector_get(session->requests, 0);
+    ab_request_p merged = NULL;
+    uint8_t *path = NULL;
+    int prefix_size = 0;
+    uint32_t first_index = 0;
+    int num_merged = 1;
+
+    if(!first->allow_packing || first->merge_elem_size <= 0 || get_element_read(first, &prefix_size, &first_index) != PLCTAG_STATUS_OK) {
+        return first;
+    }
+
+    path = first->data + sizeof(eip_cip_co_req) + 2;
+
+    while(num_merged < vector_length(session->requests)) {
+        ab_request_p next = vector_get(session->requests, num_merged);
+        int next_prefix_size = 0;
+        uint32_t next_index = 0;
+
+        if(((num_merged + 1) * first->merge_elem_size) + MERGED_READ_OVERHEAD > remaining_space) {
+            break;
+        }
+
+        if(!next->allow_packing || next->merge_elem_size != first->merge_elem_size) {
+            break;
+        }
+
+        if(get_element_read(next, &next_prefix_size, &next_index) != PLCTAG_STATUS_OK || next_index != first_index + (uint32_t)num_merged) {
+            break;
+        }
+
+        if(mem_cmp(path, prefix_size, next->data + sizeof(eip_cip_co_req) + 2, next_prefix_size) != 0) {
+            break;
+        }
+
+        num_merged++;
+    }
+
+    if(num_merged < 2) {
+        return first;
+    }
+
+    if(request_create(first->tag_id, first->request_capacity, &merged) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create merged read, sending the reads separately.");
+        return first;
+    }
+
+    merged->merged = (ab_request_p *)mem_alloc(num_merged * (int)sizeof(ab_request_p));
+    if(!merged->merged) {
+        pdebug(DEBUG_WARN, "Unable to allocate merged read list, sending the reads separately.");
+        rc_dec(merged);
+        return first;
+    }
+
+    /* read all the elements from the first one. */
+    mem_copy(merged->data, first->data, first->request_size);
+    merged->request_size = first->request_size;
+    merged->allow_packing = first->allow_packing;
+    path = merged->data + sizeof(eip_cip_co_req) + 2;
+    *((uint16_le *)(path + (path[-1] * 2))) = h2le16((uint16_t)num_merged);
+
+    /* the merged read takes over the queue references. */
+    merged->merged[0] = first;
+    for(int i=1; i < num_merged; i++) {
+        merged->merged[i] = vector_remove(session->requests, 1);
+    }
+    merged->num_merged = num_merged;
+
+    vector_put(session->requests, 0, merged);
+
+    pdebug(DEBUG_DETAIL, "Merged reads of elements %u to %u.", first_index, first_index + (uint32_t)num_merged - 1);
+
+    return merged;
+}
+
+
+
+/*
+ * get_element_read
+ *
+ * Check that the request is a connected read of one element at the start
+ * of the tag with an element segment at the end of its path.  The size of
+ * the path before that segment and the element index are passed back.
+ */
+int get_element_read(ab_request_p request, int *prefix_size, uint32_t *elem_index)
+{
+    eip_cip_co_req *req = (eip_cip_co_req *)(request->data);
+    uint8_t *data = request->data + sizeof(eip_cip_co_req);
+    uint8_t *path = data + 2;
+    uint8_t *path_end = NULL;
+    uint8_t *seg = path;
+    uint8_t *last_seg = NULL;
+
+    if(le2h16(req->encap_command) != AB_EIP_CONNECTED_SEND || request->request_size < (int)sizeof(eip_cip_co_req) + 2) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    path_end = path + (data[1] * 2);
+
+    if(data[0] != AB_EIP_CMD_CIP_READ_FRAG || path_end + sizeof(uint16_le) + sizeof(uint32_le) != request->data + request->request_size) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(le2h16(*((uint16_le *)path_end)) != 1 || le2h32(*((uint32_le *)(path_end + sizeof(uint16_le)))) != 0) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    /* find the last segment of the path. */
+    while(seg < path_end) {
+        last_seg = seg;
+
+        switch(seg[0]) {
+        case 0x91: /* symbolic name, padded to a whole word. */
+            seg += 2 + seg[1] + (seg[1] & 0x01);
+            break;
+
+        case 0x20: /* 8-bit class, instance or element. */
+        case 0x24:
+        case 0x28:
+            seg += 2;
+            break;
+
+        case 0x21: /* 16-bit class, instance or element. */
+        case 0x25:
+        case 0x29:
+            seg += 4;
+            break;
+
+        case 0x26: /* 32-bit instance or element. */
+        case 0x2A:
+            seg += 6;
+            break;
+
+        default:
+            return PLCTAG_ERR_UNSUPPORTED;
         }
     }
 
-    /*
-     * One last time before we exit.
-     */
-    pdebug(DEBUG_DETAIL,"Critical block.");
-    critical_block(session->mutex) {
-        purge_aborted_requests_unsafe(session);
+    if(!last_seg || seg != path_end) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    switch(last_seg[0]) {
+    case 0x28:
+        *elem_index = last_seg[1];
+        break;
+
+    case 0x29:
+        *elem_index = le2h16(*((uint16_le *)(last_seg + 2)));
+        break;
+
+    case 0x2A:
+        *elem_index = le2h32(*((uint32_le *)(last_seg + 2)));
+        break;
+
+    default:
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    *prefix_size = (int)(last_seg - path);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * start_packet
+ *
+ * Pack and prepare the requests in the packet and start sending it.
+ * The sequence ID used is saved so that the response can be matched
+ * up later.
+ */
+int start_packet(ab_session_p session, struct ab_packet_in_flight_t *packet)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_encap *encap = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    pdebug(DEBUG_DETAIL, "%d requests to process.", packet->num_requests);
+
+    session->data_size = 0;
+    session->data_offset = 0;
+
+    /* copy and pack the requests into the session buffer. */
+    rc = pack_requests(session, packet->requests, packet->num_requests);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* fill in all the necessary parts to the request. */
+    if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* remember how to find the response. */
+    encap = (eip_encap *)(session->data);
+    if(le2h16(encap->encap_command) == AB_EIP_CONNECTED_SEND) {
+        packet->seq_id = session->conn_seq_num;
+    } else {
+        packet->seq_id = session->session_seq_id;
+    }
+
+    packet->time_sent = time_ms();
+
+    for(int i=0; i < packet->num_requests; i++) {
+        packet->requests[i]->time_sent = packet->time_sent;
     }
 
-    THREAD_RETURN(0);
+    pdebug(DEBUG_DETAIL, "Sending packet of size %d", session->data_size);
+    pdebug_dump_bytes(DEBUG_DETAIL, session->data, (int)(session->data_size));
+
+    /* the rest is done as the socket is ready. */
+    session->data_offset = 0;
+    session->packet_count++;
+    session->io_state = SESSION_IO_SENDING;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
 }
 
 
 
 /*
- * This must be called with the session mutex held!
+ * handle_response
+ *
+ * Hand the response in the session buffer to the packet in flight
+ * that it belongs to.
  */
-int purge_aborted_requests_unsafe(ab_session_p session)
+int handle_response(ab_session_p session)
 {
-    int purge_count = 0;
-    ab_request_p request = NULL;
-
-    pdebug(DEBUG_SPEW, "Starting.");
-
-    /* remove the aborted requests. */
-    for(int i=0; i < vector_length(session->requests); i++) {
-        request = vector_get(session->requests, i);
+    int rc = PLCTAG_STATUS_OK;
+    uint64_t resp_seq_id = 0;
+    int index = -1;
+    int64_t now = 0;
 
-        /* filter out the aborts. */
-        if(request && request->abort_request) {
-            purge_count++;
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-            /* remove it from the queue. */
-            vector_remove(session->requests, i);
+    if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+        resp_seq_id = le2h16(((eip_cip_co_resp *)(session->data))->cpf_conn_seq_num);
+    } else {
+        resp_seq_id = session->resp_seq_id;
+    }
 
-            /* set the debug tag to the owning tag. */
-            debug_set_tag_id(request->tag_id);
+    for(int i=0; i < session->num_packets_in_flight; i++) {
+        if(session->packets_in_flight[i].seq_id == resp_seq_id) {
+            index = i;
+            break;
+        }
+    }
 
-            pdebug(DEBUG_DETAIL, "Session thread releasing aborted request %p.", request);
+    if(index < 0) {
+        if(session->num_packets_in_flight == 1 && session->max_requests_in_flight == 1) {
+            /* not pipelining, so there is only one place this can go. */
+            pdebug(DEBUG_DETAIL, "Response sequence ID %" PRIx64 " does not match request sequence ID %" PRIx64 ".", resp_seq_id, session->packets_in_flight[0].seq_id);
+            index = 0;
+        } else {
+            pdebug(DEBUG_WARN, "Dropping response with unknown sequence ID %" PRIx64 ".", resp_seq_id);
+
+            /* make sure that we do not wait forever for a response that was lost. */
+            now = time_ms();
+            for(int i=0; i < session->num_packets_in_flight; i++) {
+                if(session->packets_in_flight[i].time_sent + SESSION_DEFAULT_TIMEOUT < now) {
+                    pdebug(DEBUG_WARN, "Timed out waiting for response to packet with sequence ID %" PRIx64 "!", session->packets_in_flight[i].seq_id);
+                    return PLCTAG_ERR_TIMEOUT;
+                }
+            }
 
-            request->status = PLCTAG_ERR_ABORT;
-            request->request_size = 0;
-            request->resp_received = 1;
+            return PLCTAG_STATUS_OK;
+        }
+    }
 
-            /* release our hold on it. */
-            request = rc_dec(request);
+    rc = unpack_packet(session, &(session->packets_in_flight[index]));
 
-            /* vector size has changed, back up one. */
-            i--;
-        }
+    if(rc != PLCTAG_STATUS_OK) {
+        fail_packet(&(session->packets_in_flight[index]), rc);
     }
 
-    if(purge_count > 0) {
-        pdebug(DEBUG_DETAIL, "Removed %d aborted requests.", purge_count);
+    /* close up the hole, keep the packets in the order sent. */
+    session->num_packets_in_flight--;
+    for(int i=index; i < session->num_packets_in_flight; i++) {
+        mem_copy(&(session->packets_in_flight[i]), &(session->packets_in_flight[i+1]), (int)sizeof(session->packets_in_flight[i]));
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    return purge_count;
+    return rc;
 }
 
 
-int process_requests(ab_session_p session)
+
+/*
+ * unpack_packet
+ *
+ * The response in the session buffer belongs to the passed packet.
+ * Copy the results out to each request.
+ */
+int unpack_packet(ab_session_p session, struct ab_packet_in_flight_t *packet)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p request = NULL;
-    ab_request_p bundled_requests[MAX_REQUESTS] = {NULL};
-    int num_bundled_requests = 0;
-    int remaining_space = 0;
-
-    debug_set_tag_id(0);
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-    if(!session) {
-        pdebug(DEBUG_WARN, "Null session pointer!");
-        return PLCTAG_ERR_NULL_PTR;
+    /*
+     * check the CIP status, but only if this is a bundled
+     * response.   If it is a singleton, then we pass the
+     * status back to the tag.
+     */
+    if(packet->num_requests > 1) {
+        if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+            eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
+            pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
+
+            /* punt if we got an overall error or it is not a partial/bundled error. */
+            if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
+                rc = decode_cip_error_code(&(resp->status));
+                pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
+                return rc;
+            }
+        } else if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+            eip_cip_co_resp *resp = (eip_cip_co_resp *)(session->data);
+            pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)", le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
+
+            /* punt if we got an overall error or it is not a partial/bundled error. */
+            if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
+                rc = decode_cip_error_code(&(resp->status));
+                pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
+                return rc;
+            }
+        }
     }
 
-    pdebug(DEBUG_SPEW, "Checking for requests to process.");
-
-    rc = PLCTAG_STATUS_OK;
-    request = NULL;
-    session->data_size = 0;
-    session->data_offset = 0;
+    /* copy the results back out. Every request gets a copy. */
+    for(int i=0; i < packet->num_requests; i++) {
+        debug_set_tag_id(packet->requests[i]->tag_id);
 
-    /* grab a request off the front of the list. */
-    critical_block(session->mutex) {
-        /* is there anything to do? */
-        if(vector_length(session->requests)) {
-            /* get rid of all aborted requests. */
-            purge_aborted_requests_unsafe(session);
+        if(packet->requests[i]->num_merged > 0) {
+            rc = unpack_merged_response(session, packet->requests[i], i);
+        } else {
+            rc = unpack_response(session, packet->requests[i], i);
+        }
 
-            /* if there are still requests after purging all the aborted requests, process them. */
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to unpack response!");
+            return rc;
+        }
 
-            /* how much space do we have to work with. */
-            remaining_space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
+        /* release our reference */
+        packet->requests[i] = rc_dec(packet->requests[i]);
+    }
 
-            if(vector_length(session->requests)) {
-                do {
-                    request = vector_get(session->requests, 0);
+    packet->num_requests = 0;
 
-                    remaining_space = remaining_space - get_payload_size(request);
+    debug_set_tag_id(0);
 
-                    /*
-                     * If we have a non-packable request, only queue it if it is the first one.
-                     * If the request is packable, keep queuing as long as there is space.
-                     */
+    pdebug(DEBUG_DETAIL, "Done.");
 
-                    if(num_bundled_requests == 0 || (request->allow_packing && remaining_space > 0)) {
-                        //pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1, remaining_space);
-                        bundled_requests[num_bundled_requests] = request;
-                        num_bundled_requests++;
+    return PLCTAG_STATUS_OK;
+}
 
-                        /* remove it from the queue. */
-                        vector_remove(session->requests, 0);
-                    }
-                } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS && request->allow_packing);
-            } else {
-                pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
-            }
-        }
-    }
 
-    /* output debug display as no particular tag. */
-    debug_set_tag_id(0);
 
-    if(num_bundled_requests > 0) {
+/*
+ * fail_packet
+ *
+ * Pass the error status to every request still held by the packet
+ * and release them.
+ */
+void fail_packet(struct ab_packet_in_flight_t *packet, int status)
+{
+    for(int i=0; i < packet->num_requests; i++) {
+        if(packet->requests[i]) {
+            fail_request(packet->requests[i], status);
 
-        pdebug(DEBUG_DETAIL, "%d requests to process.", num_bundled_requests);
+            packet->requests[i] = rc_dec(packet->requests[i]);
+        }
+    }
 
-        do {
-            /* copy and pack the requests into the session buffer. */
-            rc = pack_requests(session, bundled_requests, num_bundled_requests);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
-                break;
-            }
+    packet->num_requests = 0;
+}
 
-            /* fill in all the necessary parts to the request. */
-            if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
-                break;
-            }
 
-            /* send the request */
-            if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
-                break;
-            }
+void fail_request(ab_request_p request, int status)
+{
+    spin_block(&request->lock) {
+        request->status = status;
+        request->request_size = 0;
+        request->resp_received = 1;
+    }
 
-            /* wait for the response */
-            if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
-                break;
-            }
+    /* wake up anyone waiting on the tag. */
+    plc_tag_signal_completion(request->tag_id);
 
-            /*
-             * check the CIP status, but only if this is a bundled
-             * response.   If it is a singleton, then we pass the
-             * status back to the tag.
-             */
-            if(num_bundled_requests > 1) {
-                if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
-                    eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
-                    pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
-
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
-                        rc = decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
-                } else if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
-                    eip_cip_co_resp *resp = (eip_cip_co_resp *)(session->data);
-                    pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)", le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
-
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
-                        rc = decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
-                }
-            }
+    /* the reads merged into this one fail too. */
+    for(int i=0; i < request->num_merged; i++) {
+        if(request->merged[i]) {
+            fail_request(request->merged[i], status);
+        }
+    }
+}
 
-            /* copy the results back out. Every request gets a copy. */
-            for(int i=0; i < num_bundled_requests; i++) {
-                debug_set_tag_id(bundled_requests[i]->tag_id);
 
-                rc = unpack_response(session, bundled_requests[i], i);
-                if(rc != PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_WARN, "Unable to unpack response!");
-                    break;
-                }
+void fail_packets_in_flight(ab_session_p session, int status)
+{
+    for(int i=0; i < session->num_packets_in_flight; i++) {
+        fail_packet(&(session->packets_in_flight[i]), status);
+    }
 
-                /* release our reference */
-                bundled_requests[i] = rc_dec(bundled_requests[i]);
-            }
+    session->num_packets_in_flight = 0;
+}
 
-            rc = PLCTAG_STATUS_OK;
-        } while(0);
 
-        /* problem? clean up the pending requests and dump everything. */
-        if(rc != PLCTAG_STATUS_OK) {
-            for(int i=0; i < num_bundled_requests; i++) {
-                if(bundled_requests[i]) {
-                    bundled_requests[i]->status = rc;
-                    bundled_requests[i]->request_size = 0;
-                    bundled_requests[i]->resp_received = 1;
-                    bundled_requests[i] = rc_dec(bundled_requests[i]);
-                }
-            }
-        }
+/*
+ * session_reset_io
+ *
+ * Drop any packet being sent or received and fail all the requests
+ * waiting on it.
+ */
+void session_reset_io(ab_session_p session, int status)
+{
+    if(session->io_state == SESSION_IO_SENDING) {
+        fail_packet(&(session->packets_in_flight[session->num_packets_in_flight]), status);
     }
 
-    debug_set_tag_id(0);
-
-    pdebug(DEBUG_SPEW, "Done.");
+    fail_packets_in_flight(session, status);
 
-    return rc;
+    session->io_state = SESSION_IO_NONE;
+    session->data_offset = 0;
+    session->data_size = 0;
 }
 
 
+
 int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1452,39 +3628,146 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
                 request_capacity = (int)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
             }
 
-            /* make sure it will fit. */
-            if(new_eip_len > request_capacity) {
-                pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len, request_capacity);
-                return PLCTAG_ERR_TOO_LARGE;
-            }
+            /* make sure it will fit. */
+            if(new_eip_len > request_capacity) {
+                pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len, request_capacity);
+                return PLCTAG_ERR_TOO_LARGE;
+            }
+
+            rc = session_request_increase_buffer(request, request_capacity);
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
+                return rc;
+            }
+        }
+
+        /* point to the response buffer in a structured way. */
+        unpacked_resp = (eip_cip_co_resp *)(request->data);
+
+        /* copy the header down */
+        mem_copy(request->data, session->data, (int)sizeof(eip_cip_co_resp));
+
+        /* size of the new packet */
+        new_eip_len = (uint16_t)(((uint8_t *)(&unpacked_resp->reply_service) + pkt_len) /* end of the packet */
+                                 - (uint8_t *)(request->data));                                      /* start of the packet */
+
+        /* now copy the packet over that. */
+        mem_copy(&unpacked_resp->reply_service, pkt_start, pkt_len);
+
+        /* stitch up the packet sizes. */
+        unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
+        unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (uint16_t)sizeof(eip_encap)));
+    }
+
+    pdebug(DEBUG_DETAIL, "Unpacked packet:");
+    pdebug_dump_bytes(DEBUG_DETAIL, request->data, new_eip_len);
+
+    /* notify the reading thread that the request is ready */
+    spin_block(&request->lock) {
+        request->status = PLCTAG_STATUS_OK;
+        request->request_size = new_eip_len;
+        request->resp_received = 1;
+    }
+
+    /* wake up anyone waiting on the tag. */
+    plc_tag_signal_completion(request->tag_id);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * unpack_merged_response
+ *
+ * Split the response to a merged read into the responses each of the
+ * element reads would have gotten.  If the response is an error or is
+ * not complete, the reads are queued again to be sent separately.
+ */
+int unpack_merged_response(ab_session_p session, ab_request_p merged, int sub_packet)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp *resp = NULL;
+    uint8_t *data = NULL;
+    uint8_t *data_end = NULL;
+    int type_info_size = 0;
+    int payload_size = 0;
+    int elem_size = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    rc = unpack_response(session, merged, sub_packet);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    resp = (eip_cip_co_resp *)(merged->data);
+    data = merged->data + sizeof(eip_cip_co_resp);
+    data_end = merged->data + merged->request_size;
+
+    if(data_end - data >= 2) {
+        if(data[0] >= AB_CIP_DATA_BIT && data[0] <= AB_CIP_DATA_STRINGI) {
+            type_info_size = 2;
+        } else if(data[0] == AB_CIP_DATA_ABREV_STRUCT || data[0] == AB_CIP_DATA_ABREV_ARRAY ||
+                  data[0] == AB_CIP_DATA_FULL_STRUCT || data[0] == AB_CIP_DATA_FULL_ARRAY) {
+            type_info_size = data[1] + 2;
+        }
+    }
+
+    payload_size = (int)(data_end - data) - type_info_size;
+
+    /*
+     * an error may belong to only some of the elements, e.g. the end of
+     * the array.  Send the reads separately so each gets its own status.
+     */
+    if(resp->status != AB_CIP_STATUS_OK || type_info_size <= 0 || payload_size <= 0 || (payload_size % merged->num_merged) != 0) {
+        pdebug(DEBUG_DETAIL, "Merged read failed with status %x or is not complete, sending the reads separately.", resp->status);
+        requeue_merged_requests(session, merged);
+        return PLCTAG_STATUS_OK;
+    }
+
+    elem_size = payload_size / merged->num_merged;
+
+    for(int i=0; i < merged->num_merged && rc == PLCTAG_STATUS_OK; i++) {
+        rc = set_merged_response(merged->merged[i], merged->data, (int)sizeof(eip_cip_co_resp) + type_info_size, data + type_info_size + (i * elem_size), elem_size);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
 
-            rc = session_request_increase_buffer(request, request_capacity);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
-                return rc;
-            }
-        }
 
-        /* point to the response buffer in a structured way. */
-        unpacked_resp = (eip_cip_co_resp *)(request->data);
 
-        /* copy the header down */
-        mem_copy(request->data, session->data, (int)sizeof(eip_cip_co_resp));
+/* build the response for one element read from the header and its part of the data. */
+int set_merged_response(ab_request_p request, uint8_t *header, int header_size, uint8_t *elem_data, int elem_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp *resp = NULL;
+    int new_eip_len = header_size + elem_size;
 
-        /* size of the new packet */
-        new_eip_len = (uint16_t)(((uint8_t *)(&unpacked_resp->reply_service) + pkt_len) /* end of the packet */
-                                 - (uint8_t *)(request->data));                                      /* start of the packet */
+    debug_set_tag_id(request->tag_id);
 
-        /* now copy the packet over that. */
-        mem_copy(&unpacked_resp->reply_service, pkt_start, pkt_len);
+    if(new_eip_len > request->request_capacity) {
+        rc = session_request_increase_buffer(request, new_eip_len);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", new_eip_len);
+            return rc;
+        }
+    }
 
-        /* stitch up the packet sizes. */
-        unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
-        unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (uint16_t)sizeof(eip_encap)));
+    mem_copy(request->data, header, header_size);
+
+    if(elem_size > 0) {
+        mem_copy(request->data + header_size, elem_data, elem_size);
     }
 
-    pdebug(DEBUG_DETAIL, "Unpacked packet:");
-    pdebug_dump_bytes(DEBUG_DETAIL, request->data, new_eip_len);
+    /* stitch up the packet sizes. */
+    resp = (eip_cip_co_resp *)(request->data);
+    resp->cpf_cdi_item_length = h2le16((uint16_t)(new_eip_len - (int)((uint8_t *)(&resp->cpf_conn_seq_num) - request->data)));
+    resp->encap_length = h2le16((uint16_t)(new_eip_len - (int)sizeof(eip_encap)));
 
     /* notify the reading thread that the request is ready */
     spin_block(&request->lock) {
@@ -1493,13 +3776,37 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
         request->resp_received = 1;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    /* wake up anyone waiting on the tag. */
+    plc_tag_signal_completion(request->tag_id);
 
     return PLCTAG_STATUS_OK;
 }
 
 
 
+/* put the merged reads back at the front of the queue, in order, to be sent separately. */
+void requeue_merged_requests(ab_session_p session, ab_request_p merged)
+{
+    critical_block(session->mutex) {
+        /* make room at the front in one pass, starting from the end. */
+        for(int j=vector_length(session->requests) - 1; j >= 0; j--) {
+            vector_put(session->requests, j + merged->num_merged, vector_get(session->requests, j));
+        }
+
+        for(int i=0; i < merged->num_merged; i++) {
+            ab_request_p request = merged->merged[i];
+
+            /* the queue takes back the reference. */
+            merged->merged[i] = NULL;
+            request->merge_elem_size = 0;
+
+            vector_put(session->requests, i, request);
+        }
+    }
+}
+
+
+
 int get_payload_size(ab_request_p request)
 {
     int request_data_size = 0;
@@ -1694,60 +4001,35 @@ int prepare_request(ab_session_p session)
 
 
 
-int send_eip_request(ab_session_p session, int timeout)
+/*
+ * send_eip_data
+ *
+ * Write as much of the packet in the session buffer as the socket
+ * will take right now.  Returns PLCTAG_STATUS_PENDING if there is
+ * still more to send.
+ */
+int send_eip_data(ab_session_p session)
 {
     int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
-
-    pdebug(DEBUG_DETAIL, "Starting.");
-
-    if(!session) {
-        pdebug(DEBUG_WARN, "Session pointer is null.");
-        return PLCTAG_ERR_NULL_PTR;
-    }
 
-    if(timeout > 0) {
-        timeout_time = time_ms() + timeout;
-    } else {
-        timeout_time = INT64_MAX;
-    }
-
-    pdebug(DEBUG_DETAIL, "Sending packet of size %d", session->data_size);
-    pdebug_dump_bytes(DEBUG_DETAIL, session->data, (int)(session->data_size));
-
-    session->data_offset = 0;
-    session->packet_count++;
+    pdebug(DEBUG_SPEW, "Starting.");
 
-    /* send the packet */
-    do {
+    while(session->data_offset < session->data_size) {
         rc = socket_write(session->sock, session->data + session->data_offset, (int)session->data_size - (int)session->data_offset);
 
-        if(rc >= 0) {
+        if(rc > 0) {
             session->data_offset += (uint32_t)rc;
+        } else if(rc == 0 || rc == PLCTAG_ERR_NO_DATA) {
+            /* the socket buffer is full. */
+            pdebug(DEBUG_SPEW, "Socket is full, %d bytes left to send.", (int)(session->data_size - session->data_offset));
+            return PLCTAG_STATUS_PENDING;
+        } else {
+            pdebug(DEBUG_WARN, "Error, %d, writing socket!", rc);
+            return rc;
         }
-
-        /* give up the CPU if we still are looping */
-        if(!session->terminating && rc >= 0 && session->data_offset < session->data_size) {
-            sleep_ms(1);
-        }
-    } while(!session->terminating && rc >= 0 && session->data_offset < session->data_size && timeout_time > time_ms());
-
-    if(session->terminating) {
-        pdebug(DEBUG_WARN, "Session is terminating.");
-        return PLCTAG_ERR_ABORT;
-    }
-
-    if(rc < 0) {
-        pdebug(DEBUG_WARN, "Error, %d, writing socket!", rc);
-        return rc;
-    }
-
-    if(timeout_time <= time_ms()) {
-        pdebug(DEBUG_WARN, "Timed out waiting to send data!");
-        return PLCTAG_ERR_TIMEOUT;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    pdebug(DEBUG_SPEW, "Done.");
 
     return PLCTAG_STATUS_OK;
 }
@@ -1755,37 +4037,34 @@ int send_eip_request(ab_session_p session, int timeout)
 
 
 /*
- * recv_eip_response
+ * recv_eip_data
  *
- * Look at the passed session and read any data we can
- * to fill in a packet.  If we already have a full packet,
- * punt.
+ * Read whatever is available on the socket towards filling in a
+ * packet in the session buffer.  Returns PLCTAG_STATUS_PENDING if the
+ * packet is not complete yet.
  */
-int recv_eip_response(ab_session_p session, int timeout)
+int recv_eip_data(ab_session_p session)
 {
-    uint32_t data_needed = 0;
+    uint32_t data_needed = sizeof(eip_encap);
     int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
-
-    pdebug(DEBUG_DETAIL, "Starting.");
 
-    if(!session) {
-        pdebug(DEBUG_WARN, "Called with null session!");
-        return PLCTAG_ERR_NULL_PTR;
-    }
+    pdebug(DEBUG_SPEW, "Starting.");
 
+    do {
+        /* recalculate the amount of data needed if we have the encap header */
+        if(session->data_offset >= sizeof(eip_encap)) {
+            data_needed = (uint32_t)(sizeof(eip_encap) + le2h16(((eip_encap *)(session->data))->encap_length));
 
-    if(timeout > 0) {
-        timeout_time = time_ms() + timeout;
-    } else {
-        timeout_time = INT64_MAX;
-    }
+            if(data_needed > session->data_capacity) {
+                pdebug(DEBUG_WARN, "Packet response (%d) is larger than possible buffer size (%d)!", data_needed, session->data_capacity);
+                return PLCTAG_ERR_TOO_LARGE;
+            }
+        }
 
-    session->data_offset = 0;
-    session->data_size = 0;
-    data_needed = sizeof(eip_encap);
+        if(session->data_offset >= data_needed) {
+            break;
+        }
 
-    do {
         rc = socket_read(session->sock, session->data + session->data_offset,
                          (int)(data_needed - session->data_offset));
 
@@ -1793,38 +4072,15 @@ int recv_eip_response(ab_session_p session, int timeout)
             /* error! */
             pdebug(DEBUG_WARN, "Error reading socket! rc=%d", rc);
             return rc;
-        } else {
-            session->data_offset += (uint32_t)rc;
-
-            /*pdebug_dump_bytes(session->debug, session->data, session->data_offset);*/
-
-            /* recalculate the amount of data needed if we have just completed the read of an encap header */
-            if(session->data_offset >= sizeof(eip_encap)) {
-                data_needed = (uint32_t)(sizeof(eip_encap) + le2h16(((eip_encap *)(session->data))->encap_length));
-
-                if(data_needed > session->data_capacity) {
-                    pdebug(DEBUG_WARN, "Packet response (%d) is larger than possible buffer size (%d)!", data_needed, session->data_capacity);
-                    return PLCTAG_ERR_TOO_LARGE;
-                }
-            }
         }
 
-        /* did we get all the data? */
-        if(!session->terminating && session->data_offset < data_needed) {
-            /* do not hog the CPU */
-            sleep_ms(1);
+        if(rc == 0) {
+            /* nothing available right now. */
+            return PLCTAG_STATUS_PENDING;
         }
-    } while(!session->terminating && session->data_offset < data_needed && timeout_time > time_ms());
-
-    if(session->terminating) {
-        pdebug(DEBUG_INFO, "Session is terminating, returning...");
-        return PLCTAG_ERR_ABORT;
-    }
 
-    if(timeout_time <= time_ms()) {
-        pdebug(DEBUG_WARN, "Timed out waiting for data to read!");
-        return PLCTAG_ERR_TIMEOUT;
-    }
+        session->data_offset += (uint32_t)rc;
+    } while(1);
 
     session->resp_seq_id = le2h64(((eip_encap *)(session->data))->encap_sender_context);
     session->data_size = data_needed;
@@ -1840,182 +4096,208 @@ int recv_eip_response(ab_session_p session, int timeout)
         rc = PLCTAG_ERR_BAD_STATUS;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
 }
 
 
 
-int perform_forward_open(ab_session_p session)
+/*
+ * session_setup_exchange
+ *
+ * Send the packet in the session buffer and read the response to it
+ * without blocking.  This is used while setting up and tearing down
+ * the session, when there are no requests in flight.  Returns
+ * PLCTAG_STATUS_PENDING with the events and time to wait for until the
+ * response is in the session buffer or the timeout passes.
+ */
+int session_setup_exchange(ab_session_p session, int timeout, int *wait_events, int *wait_ms)
 {
     int rc = PLCTAG_STATUS_OK;
-    int max_payload_size = session->max_payload_size;
+    int64_t time_left = 0;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_SPEW, "Starting.");
 
-    do {
-        /*
-         * Try with a large packet if this is a Logix-class PLC
-         * and we are doing connected messaging.
-         */
+    if(session->setup_io_state == SESSION_IO_NONE) {
+        pdebug(DEBUG_DETAIL, "Sending packet of size %d", session->data_size);
+        pdebug_dump_bytes(DEBUG_DETAIL, session->data, (int)(session->data_size));
 
-        if(session->plc_type == AB_PROTOCOL_LGX && session->use_connected_msg) {
-            max_payload_size = MAX_CIP_MSG_SIZE_EX;
+        session->data_offset = 0;
+        session->packet_count++;
+        session->setup_timeout_time = time_ms() + timeout;
+        session->setup_io_state = SESSION_IO_SENDING;
+    }
+
+    if(session->setup_io_state == SESSION_IO_SENDING) {
+        rc = send_eip_data(session);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            session->data_offset = 0;
+            session->data_size = 0;
+            session->setup_io_state = SESSION_IO_RECEIVING;
         }
+    }
 
-        rc = try_forward_open_ex(session, &max_payload_size);
-        if(rc == PLCTAG_ERR_TOO_LARGE) {
-            /* we support the Forward Open Extended command, but we need to use a smaller size. */
-            pdebug(DEBUG_DETAIL, "ForwardOpenEx is supported but packet size of %d is not, trying %d.", MAX_CIP_MSG_SIZE_EX, max_payload_size);
+    if(session->setup_io_state == SESSION_IO_RECEIVING) {
+        rc = recv_eip_data(session);
+    }
 
-            rc = try_forward_open_ex(session, &max_payload_size);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to open connection to PLC (%s)!", plc_tag_decode_error(rc));
-            } else {
-                pdebug(DEBUG_DETAIL, "ForwardOpenEx succeeded with packet size %d.", session->max_payload_size);
-            }
-        } else if(rc == PLCTAG_ERR_UNSUPPORTED) {
-            rc = try_forward_open(session);
-            if(rc == PLCTAG_ERR_TOO_LARGE) {
-                /* we support the Forward Open Extended command, but we need to use a smaller size. */
-                pdebug(DEBUG_DETAIL, "ForwardOpen is supported but packet size of %d is not, trying %d.", MAX_CIP_MSG_SIZE, session->max_payload_size);
-
-                rc = try_forward_open(session);
-                if(rc != PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_WARN, "Unable to open connection to PLC (%s)!", plc_tag_decode_error(rc));
-                } else {
-                    pdebug(DEBUG_DETAIL, "ForwardOpen succeeded with packet size %d.", session->max_payload_size);
-                }
-            }
-        } /*else {
-            pdebug(DEBUG_WARN, "Unknown error! rc=%d", rc);
-        }*/
-    } while(0);
+    if(rc == PLCTAG_STATUS_PENDING) {
+        time_left = session->setup_timeout_time - time_ms();
 
-    if(rc == PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_DETAIL, "ForwardOpen succeeded and maximum CIP packet size is %d.", session->max_payload_size);
+        if(time_left > 0) {
+            *wait_events = (session->setup_io_state == SESSION_IO_SENDING ? SOCK_EVENT_CAN_WRITE : SOCK_EVENT_CAN_READ);
+            *wait_ms = (int)time_left;
+
+            return rc;
+        }
+
+        pdebug(DEBUG_WARN, "Timed out waiting for the gateway!");
+        rc = PLCTAG_ERR_TIMEOUT;
     }
 
-    pdebug(DEBUG_INFO, "Done.");
+    session->setup_io_state = SESSION_IO_NONE;
+
+    pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
 }
 
 
-int perform_forward_close(ab_session_p session)
-{
-    int rc = PLCTAG_STATUS_OK;
-
-    pdebug(DEBUG_INFO, "Starting.");
-
-    do {
-        rc = send_forward_close_req(session);
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_DETAIL, "Sending forward close failed, %s!", plc_tag_decode_error(rc));
-            break;
-        }
 
-        rc = recv_forward_close_resp(session);
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_DETAIL, "Forward close not received, %s!", plc_tag_decode_error(rc));
-            break;
-        }
-    } while(0);
+/*
+ * start_forward_open
+ *
+ * Set up to try the Forward Open Extended command first.  Try with a
+ * large packet if this is a Logix-class PLC and we are doing connected
+ * messaging.
+ */
+void start_forward_open(ab_session_p session)
+{
+    critical_block(session->mutex) {
+        session->fo_old_max_payload_size = session->max_payload_size;
+    }
 
-    pdebug(DEBUG_INFO, "Done.");
+    session->fo_state = SESSION_FO_EX;
+    session->fo_max_payload_size = session->fo_old_max_payload_size;
 
-    return rc;
+    if(session->plc_type == AB_PROTOCOL_LGX && session->use_connected_msg) {
+        session->fo_max_payload_size = MAX_CIP_MSG_SIZE_EX;
+    }
 }
 
 
-int try_forward_open_ex(ab_session_p session, int *packet_size_guess)
+
+/*
+ * perform_forward_open
+ *
+ * Run one step of opening the connection.  Forward Open Extended is
+ * tried first.  If the PLC does not take the packet size, it is tried
+ * again with the size the PLC suggests.  If it is not supported at all,
+ * the old Forward Open is used.  Returns PLCTAG_STATUS_PENDING until
+ * the connection is open or all the tries have failed.
+ */
+int perform_forward_open(ab_session_p session, int *wait_events, int *wait_ms)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req=NULL;
-    uint16_t old_max_payload_size = 0;
+    int max_payload_size_guess = 0;
 
+    if(session->setup_io_state == SESSION_IO_NONE) {
+        pdebug(DEBUG_INFO, "Starting.");
 
-    pdebug(DEBUG_INFO, "Starting.");
+        critical_block(session->mutex) {
+            session->max_payload_size = (uint16_t)session->fo_max_payload_size;
+        }
 
-    critical_block(session->mutex) {
-        old_max_payload_size = session->max_payload_size;
-        session->max_payload_size = (uint16_t)*packet_size_guess;
+        if(session->fo_state == SESSION_FO_OLD) {
+            build_forward_open_req(session);
+        } else {
+            build_forward_open_req_ex(session);
+        }
     }
 
-    /* get a request buffer */
-    rc = session_create_request(session, 0, &req);
+    rc = session_setup_exchange(session, SESSION_DEFAULT_TIMEOUT, wait_events, wait_ms);
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
 
-    do {
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to get new request, %s!", plc_tag_decode_error(rc));
-            rc = 0;
-            break;
+    if(rc == PLCTAG_STATUS_OK) {
+        if(session->fo_state == SESSION_FO_OLD) {
+            rc = check_forward_open_resp(session, NULL);
+        } else {
+            max_payload_size_guess = session->fo_max_payload_size;
+            rc = check_forward_open_resp(session, &max_payload_size_guess);
         }
+    } else {
+        pdebug(DEBUG_WARN, "Unable to exchange ForwardOpen packets, %s!", plc_tag_decode_error(rc));
+    }
 
-        /* send the ForwardOpenEx command to the PLC */
-        if((rc = send_forward_open_req_ex(session)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to send ForwardOpenEx packet!");
-            break;
-        }
+    if(rc == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "ForwardOpen succeeded and maximum CIP packet size is %d.", session->max_payload_size);
+        pdebug(DEBUG_INFO, "Done.");
+        return rc;
+    }
 
-        /* check for the ForwardOpen response. */
-        if((rc = recv_forward_open_resp(session, packet_size_guess)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to use ForwardOpen response!");
-            break;
-        }
-    } while(0);
+    /* this try failed, put back the packet size. */
+    critical_block(session->mutex) {
+        session->max_payload_size = session->fo_old_max_payload_size;
+    }
+
+    if(session->fo_state == SESSION_FO_EX && rc == PLCTAG_ERR_TOO_LARGE) {
+        /* we support the Forward Open Extended command, but we need to use a smaller size. */
+        pdebug(DEBUG_DETAIL, "ForwardOpenEx is supported but packet size of %d is not, trying %d.", session->fo_max_payload_size, max_payload_size_guess);
 
-    if(req) {
-        req = rc_dec(req);
+        session->fo_state = SESSION_FO_EX_RETRY;
+        session->fo_max_payload_size = max_payload_size_guess;
+
+        return PLCTAG_STATUS_PENDING;
     }
 
-    if(rc != PLCTAG_STATUS_OK) {
-        critical_block(session->mutex) {
-            session->max_payload_size = old_max_payload_size;
-        }
+    if(session->fo_state == SESSION_FO_EX && rc == PLCTAG_ERR_UNSUPPORTED) {
+        pdebug(DEBUG_DETAIL, "ForwardOpenEx is not supported, trying ForwardOpen.");
+
+        session->fo_state = SESSION_FO_OLD;
+        session->fo_max_payload_size = session->fo_old_max_payload_size;
+
+        return PLCTAG_STATUS_PENDING;
     }
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_WARN, "Unable to open connection to PLC (%s)!", plc_tag_decode_error(rc));
 
     return rc;
 }
 
 
-int try_forward_open(ab_session_p session)
+
+/*
+ * perform_forward_close
+ *
+ * Close the connection.  Like the Forward Open, this does not block
+ * and returns PLCTAG_STATUS_PENDING until the response is in.
+ */
+int perform_forward_close(ab_session_p session, int *wait_events, int *wait_ms)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req=NULL;
-
-    pdebug(DEBUG_INFO, "Starting.");
-
-    /* get a request buffer */
-    rc = session_create_request(session, 0, &req);
 
-    do {
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to get new request, %s!", plc_tag_decode_error(rc));
-            rc = 0;
-            break;
-        }
+    if(session->setup_io_state == SESSION_IO_NONE) {
+        pdebug(DEBUG_INFO, "Starting.");
 
-        /* send the ForwardOpen command to the PLC */
-        if((rc = send_forward_open_req(session)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to send ForwardOpenEx packet!");
-            break;
-        }
+        build_forward_close_req(session);
+    }
 
-        /* check for the ForwardOpen response. */
-        if((rc = recv_forward_open_resp(session, NULL)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to use ForwardOpen response!");
-            break;
-        }
-    } while(0);
+    rc = session_setup_exchange(session, SESSION_FORWARD_CLOSE_TIMEOUT, wait_events, wait_ms);
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
 
-    if(req) {
-        req = rc_dec(req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Forward close not received, %s!", plc_tag_decode_error(rc));
+        return rc;
     }
 
+    rc = check_forward_close_resp(session);
+
     pdebug(DEBUG_INFO, "Done.");
 
     return rc;
@@ -2023,11 +4305,10 @@ int try_forward_open(ab_session_p session)
 
 
 
-int send_forward_open_req(ab_session_p session)
+void build_forward_open_req(ab_session_p session)
 {
     eip_forward_open_request_t *fo = NULL;
     uint8_t *data;
-    int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -2101,20 +4382,15 @@ int send_forward_open_req(ab_session_p session)
     /* set the size of the request */
     session->data_size = (uint32_t)(data - (session->data));
 
-    rc = send_eip_request(session, 0);
-
     pdebug(DEBUG_INFO, "Done");
-
-    return rc;
 }
 
 
 /* new version of Forward Open */
-int send_forward_open_req_ex(ab_session_p session)
+void build_forward_open_req_ex(ab_session_p session)
 {
     eip_forward_open_request_ex_t *fo = NULL;
     uint8_t *data;
-    int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -2173,29 +4449,19 @@ int send_forward_open_req_ex(ab_session_p session)
     /* set the size of the request */
     session->data_size = (uint32_t)(data - (session->data));
 
-    rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT);
-
     pdebug(DEBUG_INFO, "Done");
-
-    return rc;
 }
 
 
 
 
-int recv_forward_open_resp(ab_session_p session, int *max_payload_size_guess)
+int check_forward_open_resp(ab_session_p session, int *max_payload_size_guess)
 {
     eip_forward_open_response_t *fo_resp;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
 
-    rc = recv_eip_response(session, 0);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to receive Forward Open response.");
-        return rc;
-    }
-
     fo_resp = (eip_forward_open_response_t *)(session->data);
 
     do {
@@ -2259,11 +4525,10 @@ int recv_forward_open_resp(ab_session_p session, int *max_payload_size_guess)
 }
 
 
-int send_forward_close_req(ab_session_p session)
+void build_forward_close_req(ab_session_p session)
 {
     eip_forward_close_req_t *fc;
     uint8_t *data;
-    int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -2315,27 +4580,17 @@ int send_forward_close_req(ab_session_p session)
     /* set the size of the request */
     session->data_size = (uint32_t)(data - (session->data));
 
-    rc = send_eip_request(session, 100);
-
     pdebug(DEBUG_INFO, "Done");
-
-    return rc;
 }
 
 
-int recv_forward_close_resp(ab_session_p session)
+int check_forward_close_resp(ab_session_p session)
 {
     eip_forward_close_resp_t *fo_resp;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
 
-    rc = recv_eip_response(session, 150);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to receive Forward Close response, %s!", plc_tag_decode_error(rc));
-        return rc;
-    }
-
     fo_resp = (eip_forward_close_resp_t *)(session->data);
 
     do {
@@ -2371,18 +4626,26 @@ int recv_forward_close_resp(ab_session_p session)
 
 int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
 {
-    int rc = PLCTAG_STATUS_OK;
-    ab_request_p res;
-    size_t request_capacity = 0;
-    uint8_t *buffer = NULL;
+    int request_capacity = 0;
 
     critical_block(session->mutex) {
-        request_capacity = (size_t)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
+        request_capacity = (int)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
     }
 
+    return request_create(tag_id, request_capacity, req);
+}
+
+
+
+int request_create(int tag_id, int request_capacity, ab_request_p *req)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p res;
+    uint8_t *buffer = NULL;
+
     pdebug(DEBUG_DETAIL, "Starting.");
 
-    buffer = (uint8_t *)mem_alloc((int)request_capacity);
+    buffer = (uint8_t *)mem_alloc(request_capacity);
     if(!buffer) {
         pdebug(DEBUG_WARN, "Unable to allocate request buffer!");
         *req = NULL;
@@ -2397,7 +4660,7 @@ int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
     } else {
         res->data = buffer;
         res->tag_id = tag_id;
-        res->request_capacity = (int)request_capacity;
+        res->request_capacity = request_capacity;
         res->lock = LOCK_INIT;
 
         *req = res;
@@ -2426,6 +4689,17 @@ void request_destroy(void *req_arg)
 
     req->abort_request = 1;
 
+    if(req->merged) {
+        for(int i=0; i < req->num_merged; i++) {
+            if(req->merged[i]) {
+                req->merged[i] = rc_dec(req->merged[i]);
+            }
+        }
+
+        mem_free(req->merged);
+        req->merged = NULL;
+    }
+
     if(req->data) {
         mem_free(req->data);
         req->data = NULL;
@@ -36,6 +36,7 @@
 
 #include <ab/ab_common.h>
 #include <ab/defs.h>
+#include <util/hashtable.h>
 #include <util/rc.h>
 #include <util/vector.h>
 
@@ -43,11 +44,53 @@
 
 #define SESSION_DEFAULT_TIMEOUT (2000)
 
+/* how long to wait for the TCP connection to the gateway. */
+#define SESSION_CONNECT_TIMEOUT (10000)
+
+/* the PLC is not waited on for long when closing the connection. */
+#define SESSION_FORWARD_CLOSE_TIMEOUT (250)
+
 #define MAX_PACKET_SIZE_EX  (44 + 4002)
 
 #define SESSION_MIN_REQUESTS    (10)
 #define SESSION_INC_REQUESTS    (10)
 
+/* maximum number of requests bundled into one CIP multi-request packet. */
+#define SESSION_MAX_BUNDLED_REQUESTS (200)
+
+/* upper limit on the number of packets that can be outstanding at once. */
+#define SESSION_MAX_REQUESTS_IN_FLIGHT (16)
+
+/* threads in the shared session pool. */
+#define SESSION_POOL_DEFAULT_THREADS (4)
+#define SESSION_POOL_MAX_THREADS (64)
+
+
+typedef enum { SESSION_OPEN_SOCKET, SESSION_REGISTER, SESSION_CONNECT,
+               SESSION_IDLE, SESSION_DISCONNECT, SESSION_UNREGISTER,
+               SESSION_CLOSE_SOCKET, SESSION_START_RETRY, SESSION_WAIT_RETRY,
+               SESSION_WAIT_RECONNECT
+             } session_state_t;
+
+/* where the idle state is in sending or receiving a packet. */
+typedef enum { SESSION_IO_NONE, SESSION_IO_SENDING, SESSION_IO_RECEIVING } session_io_state_t;
+
+/* which Forward Open the connect state is trying. */
+typedef enum { SESSION_FO_EX, SESSION_FO_EX_RETRY, SESSION_FO_OLD } session_fo_state_t;
+
+
+/*
+ * A packet that has been sent to the PLC and is waiting for a response.
+ * The seq_id is either the EIP sender context (unconnected messages) or
+ * the CIP connection sequence number (connected messages).
+ */
+struct ab_packet_in_flight_t {
+    uint64_t seq_id;
+    int64_t time_sent;
+    int num_requests;
+    ab_request_p requests[SESSION_MAX_BUNDLED_REQUESTS];
+};
+
 
 struct ab_session_t {
 //    int status;
@@ -96,9 +139,141 @@ struct ab_session_t {
     volatile int terminating;
     mutex_p mutex;
 
+    /* state machine, run by the handler thread or the session pool. */
+    session_state_t state;
+    session_io_state_t io_state;
+    int64_t retry_time;
+
+    /* connect, register and Forward Open/Close exchanges, run without blocking. */
+    session_io_state_t setup_io_state;
+    int64_t setup_timeout_time;
+    session_fo_state_t fo_state;
+    int fo_max_payload_size;
+    uint16_t fo_old_max_payload_size;
+
     /* disconnect handling */
     int auto_disconnect_enabled;
     int auto_disconnect_timeout_ms;
+    int64_t auto_disconnect_time;
+    int auto_disconnect;
+
+    /* shared pool of handler threads, instead of one thread per session. */
+    int use_pool;
+    int on_pool;
+    lock_t pool_lock;
+    int64_t pool_next_step_time;
+
+    /* pipelining, packets sent but not yet answered. */
+    int max_requests_in_flight;
+    int num_packets_in_flight;
+    struct ab_packet_in_flight_t packets_in_flight[SESSION_MAX_REQUESTS_IN_FLIGHT];
+
+    /* reads shared by tag handles with the same name, not counted references. */
+    vector_p shared_reads;
+
+    /* type information found by earlier tags, keyed on the hash of the encoded name. */
+    hashtable_p tag_metadata;
+
+    /* file the type information is kept in between runs, if any. */
+    char *metadata_file;
+
+    /* records waiting to be added to the metadata file by the session thread. */
+    uint8_t *metadata_pending;
+    int metadata_pending_size;
+    int metadata_pending_capacity;
+
+    /* Logix symbol instance IDs found by tag listings, keyed on the hash of the lower case name. */
+    hashtable_p symbol_instances;
+
+    /* decoded Logix UDT templates, keyed on the template instance ID. */
+    hashtable_p udt_templates;
+};
+
+
+/*
+ * What the first read of a tag found out about it.  Entries with the same
+ * name hash are chained.  The name and type info are stored after the
+ * structure.
+ */
+struct ab_tag_metadata_t {
+    struct ab_tag_metadata_t *next;
+    uint8_t *encoded_name;
+    int encoded_name_size;
+    int elem_size;
+    uint8_t *type_info;
+    int type_info_size;
+};
+
+
+/*
+ * A Logix symbol found by a tag listing.  Program symbols have the program
+ * name in front, as in "program:main.tag".  Entries with the same name hash
+ * are chained.  The lower case name is stored after the structure.
+ */
+struct ab_symbol_instance_t {
+    struct ab_symbol_instance_t *next;
+    uint32_t instance_id;
+    char *name;
+    int name_len;
+};
+
+
+/*
+ * A decoded Logix UDT template (Template Object, class 0x6C).  Entries are
+ * never changed once they are in the session so the pointers stay good
+ * while the session is alive.  The members, the raw template definition
+ * and the names are stored after the structure.
+ */
+struct ab_udt_member_t {
+    const char *name;
+    uint16_t type;      /* CIP type code, 0x8000 | template ID for structures. */
+    uint16_t info;      /* array length, or bit number for BOOL members. */
+    uint32_t offset;    /* byte offset in the structure. */
+};
+
+struct ab_udt_template_t {
+    uint16_t id;
+    uint16_t handle;    /* structure handle, as in the type info of a read. */
+    uint32_t struct_size;
+    const char *name;
+    int member_count;
+    struct ab_udt_member_t *members;
+    uint8_t *raw;
+    int raw_size;
+};
+
+
+/*
+ * Tag handles on the same session with the same encoded name and element
+ * count share one of these.  Only one of them has a read request in flight
+ * at a time, the rest wait for its result.  Everything in here is protected
+ * by the session mutex.
+ */
+struct ab_shared_read_t {
+    ab_session_p session;
+
+    uint8_t *encoded_name;
+    int encoded_name_size;
+    int elem_count;
+
+    /* is a handle reading the tag right now? */
+    int in_flight;
+
+    /* bumped each time a read finishes. */
+    uint32_t generation;
+
+    /* result of the last read. */
+    int status;
+    int64_t read_time;
+    uint8_t *data;
+    int size;
+    uint8_t *type_info;
+    int type_info_size;
+
+    /* IDs of tags waiting for the read in flight. */
+    int32_t *waiters;
+    int num_waiters;
+    int waiters_capacity;
 };
 
 struct ab_request_t {
@@ -118,6 +293,19 @@ struct ab_request_t {
     int allow_packing;
     int packing_num;
 
+    /*
+     * element size of a one element read the session may merge with reads
+     * of the next elements.  Only connected Logix reads set this, and only
+     * once the element size is known from the tag attributes or an earlier
+     * read.  Unconnected reads and the first read of a tag without an
+     * element size are never merged.
+     */
+    int merge_elem_size;
+
+    /* the queued requests a merged read was made from. */
+    int num_merged;
+    ab_request_p *merged;
+
     /* time stamp for debugging output */
     int64_t time_sent;
 
@@ -140,4 +328,16 @@ extern int session_get_max_payload(ab_session_p session);
 extern int session_create_request(ab_session_p session, int tag_id, ab_request_p *request);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
 
+extern int session_get_tag_metadata(ab_session_p session, uint8_t *encoded_name, int encoded_name_size, int *elem_size, uint8_t *type_info, int *type_info_size);
+extern int session_put_tag_metadata(ab_session_p session, uint8_t *encoded_name, int encoded_name_size, int elem_size, uint8_t *type_info, int type_info_size);
+extern int session_get_symbol_instance(ab_session_p session, const char *name, int name_len, uint32_t *instance_id);
+extern int session_put_symbol_instance(ab_session_p session, const char *prefix, int prefix_len, const char *name, int name_len, uint32_t instance_id);
+extern struct ab_udt_template_t *session_get_udt_template(ab_session_p session, uint16_t template_id);
+extern struct ab_udt_template_t *session_find_udt_template(ab_session_p session, uint16_t handle);
+extern int session_put_udt_template(ab_session_p session, struct ab_udt_template_t *udt_template);
+extern int session_get_shared_read(ab_session_p session, uint8_t *encoded_name, int encoded_name_size, int elem_count, ab_shared_read_p *shared);
+extern int session_shared_read_start(ab_shared_read_p shared, int32_t tag_id, int64_t max_age_ms, uint32_t *generation);
+extern int session_shared_read_get_result(ab_shared_read_p shared, uint32_t generation, uint8_t **data, int *size, uint8_t *type_info, int *type_info_size);
+extern void session_shared_read_done(ab_shared_read_p shared, int status, uint8_t *data, int size, uint8_t *type_info, int type_info_size);
+
 #endif
@@ -60,10 +60,19 @@ typedef enum {
     AB_TYPE_STRING,
     AB_TYPE_SHORT_STRING,
     AB_TYPE_TIMER,
-    AB_TYPE_TAG_ENTRY /* not a real AB type, but a pseudo UDT. */
+    AB_TYPE_TAG_ENTRY, /* not a real AB type, but a pseudo UDT. */
+    AB_TYPE_UDT_TEMPLATE /* not a real AB type, the raw template definition. */
 } elem_type_t;
 
 
+/* one piece of a read or write that has all the pieces of a large tag in flight at once. */
+struct ab_frag_t {
+    ab_request_p req;
+    int offset;     /* next byte to read, or the first byte written. */
+    int end;        /* one past the last byte of this piece. */
+};
+
+
 struct ab_tag_t {
     /*struct plc_tag_t p_tag;*/
     TAG_BASE_STRUCT;
@@ -79,6 +88,10 @@ struct ab_tag_t {
     uint8_t encoded_name[MAX_TAG_NAME];
     int encoded_name_size;
 
+    /* the symbolic encoded name if the tag is addressed by instance ID. */
+    uint8_t *symbolic_name;
+    int symbolic_name_size;
+
 //    const char *read_group;
 
     /* storage for the encoded type. */
@@ -98,6 +111,16 @@ struct ab_tag_t {
     int tag_list;
     uint32_t next_id;
 
+    /* UDT template reads, "@udt/<template ID>". */
+    int udt_template;
+    int udt_read_definition;    /* 0 while getting the attributes, 1 while reading the definition. */
+    uint16_t udt_id;            /* the template asked for. */
+    uint16_t udt_fetch_id;      /* the template being read now, may be a nested one. */
+    uint16_t udt_handle;
+    uint16_t udt_member_count;
+    uint32_t udt_struct_size;
+    uint32_t udt_definition_size;
+
     int is_bit;
     uint8_t bit;
 
@@ -109,6 +132,27 @@ struct ab_tag_t {
 
     int allow_packing;
 
+    /* read large tags in pieces that are all in flight at once. */
+    int parallel_reads;
+    struct ab_frag_t *read_frags;
+    int num_read_frags;
+    int read_frag_max;      /* most data the PLC has sent in one partial response. */
+
+    /* write large tags in pieces that are all in flight at once. */
+    int parallel_writes;
+    struct ab_frag_t *write_frags;
+    int num_write_frags;
+
+    /* changed ranges in flight, put back in the dirty ranges if the write fails. */
+    int num_sending_ranges;
+    struct tag_range_t sending_ranges[TAG_MAX_DIRTY_RANGES];
+
+    /* reads shared with other handles to the same tag. */
+    ab_shared_read_p shared_read;
+    int shared_read_owner;
+    int shared_read_waiting;
+    uint32_t shared_read_generation;
+
     /* flags for operations */
     int read_in_progress;
     int write_in_progress;
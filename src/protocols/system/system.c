@@ -98,7 +98,9 @@ struct tag_vtable_t system_tag_vtable = {
     /* set_float64 */ NULL,
 
     /* get_float32 */ NULL,
-    /* set_float32 */ NULL
+    /* set_float32 */ NULL,
+
+    /* get_member_offset */ NULL
 };
 
 
@@ -176,6 +178,22 @@ static void system_tag_destroy(plc_tag_p ptag)
         mutex_destroy(&ptag->api_mutex);
     }
 
+    if(ptag->sync_op_mutex) {
+        mutex_destroy(&ptag->sync_op_mutex);
+    }
+
+    if(ptag->tag_cond_wait) {
+        cond_destroy(&ptag->tag_cond_wait);
+    }
+
+    if(ptag->callback_queue.idle_cond) {
+        cond_destroy(&ptag->callback_queue.idle_cond);
+    }
+
+    if(ptag->data_snapshot) {
+        mem_free(ptag->data_snapshot);
+    }
+
     //mem_free(tag);
 
     return;
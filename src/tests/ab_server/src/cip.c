@@ -34,6 +34,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cip.h"
 #include "eip.h"
 #include "plc.h"
@@ -54,7 +55,7 @@ const uint8_t CIP_WRITE_FRAG[] = { 0x53 };
 const uint8_t CIP_PCCC_EXECUTE[] = { 0x4B, 0x02, 0x20, 0x02, 0x24, 0x01 };
 const uint8_t CIP_FORWARD_CLOSE[] = { 0x4E, 0x02, 0x20, 0x06, 0x24, 0x01 };
 const uint8_t CIP_FORWARD_OPEN[] = { 0x54, 0x02, 0x20, 0x06, 0x24, 0x01 };
-const uint8_t CIP_LIST_TAGS[] = { 0x55, 0x02, 0x20, 0x02, 0x24, 0x01 };
+const uint8_t CIP_LIST_TAGS[] = { 0x55 };
 const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 
 /* path to match. */
@@ -64,6 +65,8 @@ const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 #define CIP_DONE               ((uint8_t)0x80)
 
 #define CIP_SYMBOLIC_SEGMENT_MARKER ((uint8_t)0x91)
+#define CIP_CLASS_SEGMENT_MARKER ((uint8_t)0x20)
+#define CIP_SYMBOL_CLASS ((uint8_t)0x6B)
 
 /* CIP Errors */
 
@@ -84,6 +87,7 @@ static slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_list_tags_request(slice_s input, slice_s output, plc_s *plc);
 
 static bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *start_read_offset);
 static slice_s make_cip_error(slice_s output, uint8_t cip_cmd, uint8_t cip_err, bool extend, uint16_t extended_error);
@@ -109,6 +113,8 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
         return handle_forward_open(input, output, plc);
     } else if(slice_match_bytes(input, CIP_FORWARD_CLOSE, sizeof(CIP_FORWARD_CLOSE))) {
         return handle_forward_close(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_LIST_TAGS, sizeof(CIP_LIST_TAGS))) {
+        return handle_list_tags_request(input, output, plc);
     } else {
             return make_cip_error(output, (uint8_t)(slice_get_uint8(input, 0) | (uint8_t)CIP_DONE), (uint8_t)CIP_ERR_UNSUPPORTED, false, (uint16_t)0);
     }
@@ -561,125 +567,249 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
 
 
 /*
- * we should see:
- *  0x91 <name len> <name bytes> (<numeric segment>){0-3}
+ * Only controller tag listings are supported:
+ *  0x55 0x03 0x20 0x6B 0x25 0x00 <start instance> <attribute list>
  *
- * find the tag name, then check the numeric segments, if any, against the
- * tag dimensions.
+ * Each tag is returned with its symbol instance ID, type, element size,
+ * dimensions and name.  Instance IDs are the position of the tag in the
+ * list, starting at 1.
  */
 
-bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *start_read_offset)
+#define CIP_LIST_TAGS_MIN_SIZE (8)
+#define CIP_LIST_TAGS_ENTRY_SIZE (22) /* MAGIC - instance ID, type, element size, dimensions and name length. */
+
+slice_s handle_list_tags_request(slice_s input, slice_s output, plc_s *plc)
 {
+    uint8_t list_cmd = slice_get_uint8(input, 0);
+    uint32_t start_id = 0;
+    uint32_t instance_id = 1;
     size_t offset = 0;
-    uint8_t symbolic_marker = slice_get_uint8(input, offset); offset++;
-    uint8_t name_len = 0;
-    slice_s tag_name;
-    size_t dimensions[3] = { 0, 0, 0};
-    size_t dimension_index = 0;
+    bool need_frag = false;
+    tag_def_s *tag = NULL;
 
-    if(symbolic_marker != CIP_SYMBOLIC_SEGMENT_MARKER)  {
-        info("Expected symbolic segment but found %x!", symbolic_marker);
-        return false;
+    if(slice_len(input) < CIP_LIST_TAGS_MIN_SIZE) {
+        info("Insufficient data in the CIP list tags request!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
     }
 
-    /* get and check the length of the symbolic name part. */
-    name_len = slice_get_uint8(input, offset); offset++;
-    if(name_len >= slice_len(input)) {
-        info("Insufficient space in symbolic segment for name.   Needed %d bytes but only had %d bytes!", name_len, slice_len(input)-1);
-        return false;
+    if(slice_get_uint8(input, 1) != 3 || slice_get_uint8(input, 2) != CIP_CLASS_SEGMENT_MARKER || slice_get_uint8(input, 3) != CIP_SYMBOL_CLASS || slice_get_uint8(input, 4) != 0x25) {
+        info("Only controller tag listings are supported!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
     }
 
-    /* bump the offset.   Must be 16-bit aligned, so pad if needed. */
-    offset += (size_t)(name_len + ((name_len & 0x01) ? 1 : 0));
+    start_id = (uint32_t)slice_get_uint16_le(input, 6);
+
+    /* leave space for the response header. */
+    offset = 4;
 
-    /* try to find the tag. */
-    tag_name = slice_from_slice(input, 2, name_len);
-    *tag = plc->tags;
+    for(tag = plc->tags; tag; tag = tag->next_tag, instance_id++) {
+        size_t name_len = strlen(tag->name);
+
+        if(instance_id < start_id) {
+            continue;
+        }
 
-    while(*tag) {
-        if(slice_match_string(tag_name, (*tag)->name)) {
-            info("Found tag %s", (*tag)->name);
+        if(offset + CIP_LIST_TAGS_ENTRY_SIZE + name_len > slice_len(output)) {
+            need_frag = true;
             break;
         }
 
-        (*tag) = (*tag)->next_tag;
+        slice_set_uint32_le(output, offset, instance_id); offset += 4;
+        slice_set_uint16_le(output, offset, (uint16_t)(tag->tag_type | (tag->num_dimensions << 13))); offset += 2;
+        slice_set_uint16_le(output, offset, (uint16_t)tag->elem_size); offset += 2;
+
+        for(size_t i=0; i < 3; i++) {
+            slice_set_uint32_le(output, offset, (uint32_t)(i < tag->num_dimensions ? tag->dimensions[i] : 0)); offset += 4;
+        }
+
+        slice_set_uint16_le(output, offset, (uint16_t)name_len); offset += 2;
+
+        for(size_t i=0; i < name_len; i++) {
+            slice_set_uint8(output, offset + i, (uint8_t)tag->name[i]);
+        }
+
+        offset += name_len;
     }
 
-    if(*tag) {
-        slice_s numeric_segments = slice_from_slice(input, offset, slice_len(input));
+    slice_set_uint8(output, 0, list_cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* padding/reserved. */
+    slice_set_uint8(output, 2, (need_frag ? CIP_ERR_FRAG : CIP_OK));
+    slice_set_uint8(output, 3, 0); /* no extra error fields. */
 
-        dimension_index = 0;
+    return slice_from_slice(output, 0, offset);
+}
 
-        info("Numeric segment(s):");
-        slice_dump(numeric_segments);
 
-        while(slice_len(numeric_segments) > 0) {
-            uint8_t segment_type = slice_get_uint8(numeric_segments, 0);
 
-            if(dimension_index >= 3) {
-                info("More numeric segments than expected!   Remaining request:");
-                slice_dump(numeric_segments);
-                return false;
-            }
 
-            switch(segment_type) {
-                case 0x28: /* single byte value. */
-                    dimensions[dimension_index] = (size_t)slice_get_uint8(numeric_segments, 1);
-                    dimension_index++;
-                    numeric_segments = slice_from_slice(numeric_segments, 2, slice_len(numeric_segments));
-                    break;
-
-                case 0x29: /* two byte value */
-                    dimensions[dimension_index] = (size_t)slice_get_uint16_le(numeric_segments, 2);
-                    dimension_index++;
-                    numeric_segments = slice_from_slice(numeric_segments, 4, slice_len(numeric_segments));
-                    break;
-
-                case 0x2A: /* four byte value */
-                    dimensions[dimension_index] = (size_t)slice_get_uint32_le(numeric_segments, 2);
-                    dimension_index++;
-                    numeric_segments = slice_from_slice(numeric_segments, 6, slice_len(numeric_segments));
-                    break;
-
-                default:
-                    info("Unexpected numeric segment marker %x!", segment_type);
-                    return false;
-                    break;
-            }
+/*
+ * we should see:
+ *  0x91 <name len> <name bytes> (<numeric segment>){0-3}
+ * or:
+ *  0x20 0x6B <instance segment> (<numeric segment>){0-3}
+ *
+ * find the tag by name or by symbol instance, then check the numeric
+ * segments, if any, against the tag dimensions.
+ */
+
+bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *start_read_offset)
+{
+    size_t offset = 0;
+    uint8_t segment_marker = slice_get_uint8(input, offset); offset++;
+    uint8_t name_len = 0;
+    slice_s tag_name;
+    slice_s numeric_segments;
+    size_t dimensions[3] = { 0, 0, 0};
+    size_t dimension_index = 0;
+
+    if(segment_marker == CIP_CLASS_SEGMENT_MARKER) {
+        uint32_t instance_id = 0;
+        uint32_t tag_index = 1;
+
+        if(slice_get_uint8(input, offset) != CIP_SYMBOL_CLASS) {
+            info("Expected the symbol class but found %x!", slice_get_uint8(input, offset));
+            return false;
         }
 
-        /* calculate the element offset. */
-        if(dimension_index > 0) {
-            size_t element_offset = 0;
+        offset++;
+
+        switch(slice_get_uint8(input, offset)) {
+            case 0x24: /* 8-bit instance */
+                instance_id = (uint32_t)slice_get_uint8(input, offset + 1);
+                offset += 2;
+                break;
+
+            case 0x25: /* 16-bit instance, padded */
+                instance_id = (uint32_t)slice_get_uint16_le(input, offset + 2);
+                offset += 4;
+                break;
 
-            if(dimension_index != (*tag)->num_dimensions) {
-                info("Required %d numeric segments, but only found %d!", (*tag)->num_dimensions, dimension_index);
+            case 0x26: /* 32-bit instance, padded */
+                instance_id = slice_get_uint32_le(input, offset + 2);
+                offset += 6;
+                break;
+
+            default:
+                info("Unexpected instance segment marker %x!", slice_get_uint8(input, offset));
                 return false;
-            }
+                break;
+        }
 
-            /* check in bounds. */
-            for(size_t i=0; i < dimension_index; i++) {
-                if(dimensions[i] >= (*tag)->dimensions[i]) {
-                    info("Dimension %d is out of bounds, must be 0 <= %d < %d", (int)i, dimensions[i], (*tag)->dimensions[i]);
-                    return false;
-                }
+        /* instance IDs are the position of the tag in the list, starting at 1. */
+        *tag = plc->tags;
+
+        while(*tag && tag_index < instance_id) {
+            (*tag) = (*tag)->next_tag;
+            tag_index++;
+        }
+
+        if(!*tag || instance_id == 0) {
+            info("Symbol instance %u not found!", (unsigned int)instance_id);
+            return false;
+        }
+
+        info("Found tag %s for symbol instance %u", (*tag)->name, (unsigned int)instance_id);
+    } else if(segment_marker == CIP_SYMBOLIC_SEGMENT_MARKER) {
+        /* get and check the length of the symbolic name part. */
+        name_len = slice_get_uint8(input, offset); offset++;
+        if(name_len >= slice_len(input)) {
+            info("Insufficient space in symbolic segment for name.   Needed %d bytes but only had %d bytes!", name_len, slice_len(input)-1);
+            return false;
+        }
+
+        /* bump the offset.   Must be 16-bit aligned, so pad if needed. */
+        offset += (size_t)(name_len + ((name_len & 0x01) ? 1 : 0));
+
+        /* try to find the tag. */
+        tag_name = slice_from_slice(input, 2, name_len);
+        *tag = plc->tags;
+
+        while(*tag) {
+            if(slice_match_string(tag_name, (*tag)->name)) {
+                info("Found tag %s", (*tag)->name);
+                break;
             }
 
-            /* calculate the offset. */
-            element_offset = (size_t)(dimensions[0] * ((*tag)->dimensions[1] * (*tag)->dimensions[2]) +
-                                      dimensions[1] *  (*tag)->dimensions[2] +
-                                      dimensions[2]);
+            (*tag) = (*tag)->next_tag;
+        }
 
-            *start_read_offset = (size_t)((*tag)->elem_size * element_offset);
-        } else {
-            *start_read_offset = 0;
+        if(!*tag) {
+            info("Tag %.*s not found!", slice_len(tag_name), (const char *)(tag_name.data));
+            return false;
         }
     } else {
-        info("Tag %.*s not found!", slice_len(tag_name), (const char *)(tag_name.data));
+        info("Expected symbolic or class segment but found %x!", segment_marker);
         return false;
     }
 
+    numeric_segments = slice_from_slice(input, offset, slice_len(input));
+
+    dimension_index = 0;
 
+    info("Numeric segment(s):");
+    slice_dump(numeric_segments);
+
+    while(slice_len(numeric_segments) > 0) {
+        uint8_t segment_type = slice_get_uint8(numeric_segments, 0);
+
+        if(dimension_index >= 3) {
+            info("More numeric segments than expected!   Remaining request:");
+            slice_dump(numeric_segments);
+            return false;
+        }
+
+        switch(segment_type) {
+            case 0x28: /* single byte value. */
+                dimensions[dimension_index] = (size_t)slice_get_uint8(numeric_segments, 1);
+                dimension_index++;
+                numeric_segments = slice_from_slice(numeric_segments, 2, slice_len(numeric_segments));
+                break;
+
+            case 0x29: /* two byte value */
+                dimensions[dimension_index] = (size_t)slice_get_uint16_le(numeric_segments, 2);
+                dimension_index++;
+                numeric_segments = slice_from_slice(numeric_segments, 4, slice_len(numeric_segments));
+                break;
+
+            case 0x2A: /* four byte value */
+                dimensions[dimension_index] = (size_t)slice_get_uint32_le(numeric_segments, 2);
+                dimension_index++;
+                numeric_segments = slice_from_slice(numeric_segments, 6, slice_len(numeric_segments));
+                break;
+
+            default:
+                info("Unexpected numeric segment marker %x!", segment_type);
+                return false;
+                break;
+        }
+    }
+
+    /* calculate the element offset. */
+    if(dimension_index > 0) {
+        size_t element_offset = 0;
+
+        if(dimension_index != (*tag)->num_dimensions) {
+            info("Required %d numeric segments, but only found %d!", (*tag)->num_dimensions, dimension_index);
+            return false;
+        }
+
+        /* check in bounds. */
+        for(size_t i=0; i < dimension_index; i++) {
+            if(dimensions[i] >= (*tag)->dimensions[i]) {
+                info("Dimension %d is out of bounds, must be 0 <= %d < %d", (int)i, dimensions[i], (*tag)->dimensions[i]);
+                return false;
+            }
+        }
+
+        /* calculate the offset. */
+        element_offset = (size_t)(dimensions[0] * ((*tag)->dimensions[1] * (*tag)->dimensions[2]) +
+                                  dimensions[1] *  (*tag)->dimensions[2] +
+                                  dimensions[2]);
+
+        *start_read_offset = (size_t)((*tag)->elem_size * element_offset);
+    } else {
+        *start_read_offset = 0;
+    }
 
     return true;
 }
@@ -67,8 +67,7 @@
  */
 
 struct refcount_t {
-    lock_t lock;
-    int count;
+    volatile int32_t count;
     const char *function_name;
     int line_num;
     //cleanup_p cleaners;
@@ -119,7 +118,6 @@ void *rc_alloc_impl(const char *func, int line_num, int data_size, rc_cleanup_fu
     }
 
     rc->count = 1;  /* start with a reference count. */
-    rc->lock = LOCK_INIT;
 
     rc->cleanup_func = cleaner_func;
 
@@ -170,17 +168,21 @@ void *rc_inc_impl(const char *func, int line_num, void *data)
     /* get the refcount structure. */
     rc = ((refcount_p)data) - 1;
 
-    /* spin until we have ownership */
-    spin_block(&rc->lock) {
-        if(rc->count > 0) {
-            rc->count++;
-            count = rc->count;
-            result = data;
-        } else {
-            count = rc->count;
+    /* only take a reference if the count has not already gone to zero. */
+    do {
+        count = atomic_int32_get(&rc->count);
+
+        if(count <= 0) {
             result = NULL;
+            break;
         }
-    }
+
+        if(atomic_int32_cas(&rc->count, count, count + 1)) {
+            count++;
+            result = data;
+            break;
+        }
+    } while(1);
 
     if(!result) {
         pdebug(DEBUG_SPEW,"Invalid ref count (%d) from call at %s line %d!  Unable to take strong reference.", count, func, line_num);
@@ -221,16 +223,20 @@ void *rc_dec_impl(const char *func, int line_num, void *data)
     /* get the refcount structure. */
     rc = ((refcount_p)data) - 1;
 
-    /* do this sorta atomically */
-    spin_block(&rc->lock) {
-        if(rc->count > 0) {
-            rc->count--;
-            count = rc->count;
-        } else {
-            count = rc->count;
+    /* never take the count below zero. */
+    do {
+        count = atomic_int32_get(&rc->count);
+
+        if(count <= 0) {
             invalid = 1;
+            break;
         }
-    }
+
+        if(atomic_int32_cas(&rc->count, count, count - 1)) {
+            count--;
+            break;
+        }
+    } while(1);
 
     if(invalid) {
         pdebug(DEBUG_WARN,"Reference has invalid count %d!", count);